@@ -4,6 +4,8 @@
 #define IMAGEFILE <Classify2D/Classify2D.iml>
 #include <Draw/iml_source.h>
 
+static const int alloc_warmup_steps = 100;
+
 Classify2D::Classify2D() {
 	Title("Classify2D");
 	Icon(Classify2DImg::icon());
@@ -64,6 +66,8 @@ void Classify2D::ViewLayer(int i) {
 }
 
 void Classify2D::Reload() {
+	// the new net allocates again during its warm-up
+	SetStrictAllocation(false);
 	String net_str = net_edit.GetData();
 	session.MakeLayers(net_str);
 	session.StartTraining();
@@ -165,6 +169,15 @@ void Classify2D::Refresher() {
 		#ifndef flagMT
 		session.TrainIteration();
 		#endif
+		
+		// With the CONVNET_ALLOC_COUNT configuration, a training step panics at any heap
+		// allocation after the warm-up, and the title shows the allocations of the steps.
+		if (IsAllocCounting()) {
+			const AllocStat& stat = session.GetStepAllocStat();
+			if (!IsStrictAllocation() && stat.calls >= alloc_warmup_steps)
+				SetStrictAllocation();
+			Title("Classify2D - training steps: " + stat.ToString());
+		}
 		pctrl.Refresh();
 		lctrl.Refresh();
 	}
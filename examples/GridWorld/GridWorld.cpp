@@ -4,6 +4,8 @@
 #define IMAGEFILE <GridWorld/GridWorld.iml>
 #include <Draw/iml_source.h>
 
+static const int alloc_warmup_steps = 100;
+
 GridWorld::GridWorld() {
 	Title("GridWorld: dynamic programming");
 	Icon(GridWorldImg::icon());
@@ -43,6 +45,16 @@ GridWorld::~GridWorld() {
 void GridWorld::Refresher() {
 	gworld.Refresh();
 	
+	// With the CONVNET_ALLOC_COUNT configuration, the agent panics at any heap allocation
+	// in Act and Learn after the warm-up, and the title shows their allocations.
+	if (IsAllocCounting()) {
+		const AllocStat& learn = agent.GetLearnAllocStat();
+		if (!IsStrictAllocation() && learn.calls >= alloc_warmup_steps)
+			SetStrictAllocation();
+		Title("GridWorld: dynamic programming - act: " + agent.GetActAllocStat().ToString() +
+			", learn: " + learn.ToString());
+	}
+	
 	PostCallback(THISBACK(Refresher));
 }
 
@@ -2,6 +2,8 @@
 #include "pretrained.brc"
 #include <plugin/bz2/bz2.h>
 
+static const int alloc_warmup_steps = 100;
+
 PuckWorldAgent::PuckWorldAgent() {
 	nflot = 1000;
 }
@@ -167,6 +169,7 @@ PuckWorld::PuckWorld() {
 	Icon(PuckWorldImg::icon());
 	Sizeable().MaximizeBox().MinimizeBox();
 	
+	alloc_warmup_end = -1;
 	agent.pworld = this;
 	
 	
@@ -240,12 +243,29 @@ void PuckWorld::Refresher() {
 	pworld.Refresh();
 	RefreshStatus();
 	
+	// With the CONVNET_ALLOC_COUNT configuration, the agent panics at any heap allocation
+	// in Act and Learn after the warm-up, and the title shows their allocations. The
+	// replay memory grows until it is full, so the warm-up begins only then.
+	if (IsAllocCounting()) {
+		const AllocStat& learn = agent.GetLearnAllocStat();
+		if (alloc_warmup_end < 0 && agent.GetExperienceCount() >= agent.GetExperienceSize())
+			alloc_warmup_end = learn.calls + alloc_warmup_steps;
+		if (!IsStrictAllocation() && alloc_warmup_end >= 0 && learn.calls >= alloc_warmup_end)
+			SetStrictAllocation();
+		Title("PuckWorld: Deep Q Learning - act: " + agent.GetActAllocStat().ToString() +
+			", learn: " + learn.ToString());
+	}
+	
 	PostCallback(THISBACK(Refresher));
 }
 
 void PuckWorld::Reset(bool init_reward, bool start) {
 	agent.Stop();
 	
+	// the changed agent allocates again during its warm-up
+	SetStrictAllocation(false);
+	alloc_warmup_end = -1;
+	
 	if (init_reward) {
 		int states = 8; // x,y,vx,vy, puck dx,dy
 		int action_count = 5; // left, right, up, down, nothing
@@ -304,6 +324,8 @@ void PuckWorld::LoadPretrained() {
 	String json = BZ2Decompress(pretrained_mem);
 	
 	agent.Stop();
+	SetStrictAllocation(false);
+	alloc_warmup_end = -1;
 	agent.LoadJSON(json);
 	agent.Start();
 }
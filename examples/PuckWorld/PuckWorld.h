@@ -84,6 +84,7 @@ protected:
 	DocEdit agent_edit;
 	
 	String t;
+	int64 alloc_warmup_end; // the learning steps until the strict allocation mode
 	
 	
 public:
@@ -6,6 +6,8 @@
 #define IMAGEFILE <ReinforcedLearning/ReinforcedLearning.iml>
 #include <Draw/iml_source.h>
 
+static const int alloc_warmup_steps = 100;
+
 
 GUI_APP_MAIN {
 	ReinforcedLearning().Run();
@@ -21,6 +23,7 @@ ReinforcedLearning::ReinforcedLearning() {
 	ticking_stopped = true;
 	
 	skipdraw = false;
+	alloc_warmup_end = -1;
 	
 	t = "[\n"
 		"\t{\"type\":\"input\", \"input_width\":1, \"input_height\":1, \"input_depth\":59},\n"
@@ -177,6 +180,9 @@ void ReinforcedLearning::Reload() {
 	Brain& brain = world.agents[0].brain;
 	
 	ticking_lock.Enter();
+	// the new net allocates again during its warm-up
+	SetStrictAllocation(false);
+	alloc_warmup_end = -1;
 	brain.Reset();
 	bool success = brain.MakeLayers(net_str);
 	ticking_lock.Leave();
@@ -204,6 +210,20 @@ void ReinforcedLearning::Refresher() {
 		reward_graph.RefreshData();
 		RefreshStatus();
 	}
+	
+	// With the CONVNET_ALLOC_COUNT configuration, the brains panic at any heap allocation
+	// in Forward and Backward after the warm-up, and the title shows the allocations of
+	// the first one. The warm-up begins with the learning.
+	if (IsAllocCounting()) {
+		Brain& b = world.agents[0].brain;
+		const AllocStat& learn = b.GetLearnAllocStat();
+		if (alloc_warmup_end < 0 && b.IsStartTrainingTreshold())
+			alloc_warmup_end = learn.calls + alloc_warmup_steps;
+		if (!IsStrictAllocation() && alloc_warmup_end >= 0 && learn.calls >= alloc_warmup_end)
+			SetStrictAllocation();
+		Title("Deep Q Learning Reinforcement - forward: " + b.GetActAllocStat().ToString() +
+			", backward: " + learn.ToString());
+	}
 	PostCallback(THISBACK(Refresher));
 }
 
@@ -219,6 +239,8 @@ void ReinforcedLearning::LoadPreTrained() {
 	RefreshTrainingStatus();
 	
 	// Load json
+	SetStrictAllocation(false);
+	alloc_warmup_end = -1;
 	world.agents[0].brain.LoadJSON(json);
 	ticking_lock.Leave();
 	
@@ -247,6 +269,8 @@ void ReinforcedLearning::OpenFile() {
 		return;
 	}
 	ticking_lock.Enter();
+	SetStrictAllocation(false);
+	alloc_warmup_end = -1;
 	bool res = world.agents[0].brain.LoadJSON(json);
 	if (!res) {
 		ticking_running = false;
@@ -147,6 +147,7 @@ class ReinforcedLearning : public DockWindow {
 	int current_interval_id;
 	int simspeed;
 	int average_size;
+	int64 alloc_warmup_end; // the learning steps until the strict allocation mode
 	bool skipdraw;
 	bool ticking_running, ticking_stopped;
 	SpinLock ticking_lock;
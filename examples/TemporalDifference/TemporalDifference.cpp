@@ -1,5 +1,7 @@
 #include "TemporalDifference.h"
 
+static const int alloc_warmup_steps = 100;
+
 /*
 // agent parameter spec to play with (this gets eval()'d on Agent reset)
 var spec = {}
@@ -89,6 +91,16 @@ void TemporalDifference::DockInit() {
 void TemporalDifference::Refresher() {
 	gworld.Refresh();
 	
+	// With the CONVNET_ALLOC_COUNT configuration, the agent panics at any heap allocation
+	// in Act and Learn after the warm-up, and the title shows their allocations.
+	if (IsAllocCounting()) {
+		const AllocStat& learn = agent.GetLearnAllocStat();
+		if (!IsStrictAllocation() && learn.calls >= alloc_warmup_steps)
+			SetStrictAllocation();
+		Title("GridWorld: temporal difference - act: " + agent.GetActAllocStat().ToString() +
+			", learn: " + learn.ToString());
+	}
+	
 	PostCallback(THISBACK(Refresher));
 }
 
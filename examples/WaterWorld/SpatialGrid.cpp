@@ -0,0 +1,161 @@
+#include "WaterWorld.h"
+
+void SpatialGrid::Init(int width, int height, double cell_size) {
+	cell = cell_size;
+	cols = max(1, (int)ceil(width / cell));
+	rows = max(1, (int)ceil(height / cell));
+	item_cells.Clear();
+	wall_cells.Clear();
+	item_cells.SetCount(cols * rows);
+	wall_cells.SetCount(cols * rows);
+	item_range.Clear();
+	item_mark.Clear();
+	wall_mark.Clear();
+	stamp = 0;
+}
+
+Rect SpatialGrid::GetRange(Pointf p, double rad) const {
+	// the cells are clamped to the grid, so the things at the border are in the border cells
+	return Rect(
+		minmax((int)floor((p.x - rad) / cell), 0, cols - 1),
+		minmax((int)floor((p.y - rad) / cell), 0, rows - 1),
+		minmax((int)floor((p.x + rad) / cell), 0, cols - 1),
+		minmax((int)floor((p.y + rad) / cell), 0, rows - 1));
+}
+
+void SpatialGrid::AddToRange(int item, const Rect& r) {
+	for(int y = r.top; y <= r.bottom; y++)
+		for(int x = r.left; x <= r.right; x++)
+			item_cells[y * cols + x].Add(item);
+}
+
+void SpatialGrid::RemoveFromRange(int item, const Rect& r) {
+	for(int y = r.top; y <= r.bottom; y++) {
+		for(int x = r.left; x <= r.right; x++) {
+			Vector<int>& c = item_cells[y * cols + x];
+			for(int i = 0; i < c.GetCount(); i++) {
+				if (c[i] == item) {
+					c[i] = c.Top();
+					c.Drop();
+					break;
+				}
+			}
+		}
+	}
+}
+
+void SpatialGrid::SetWalls(const Vector<Wall>& walls) {
+	for(int i = 0; i < wall_cells.GetCount(); i++)
+		wall_cells[i].SetCount(0);
+	// walls are few and long, so they are listed in all cells of their bounding box
+	for(int i = 0; i < walls.GetCount(); i++) {
+		const Wall& w = walls[i];
+		Rect r = GetRange(w.p1, 0);
+		r.Union(GetRange(w.p2, 0));
+		for(int y = r.top; y <= r.bottom; y++)
+			for(int x = r.left; x <= r.right; x++)
+				wall_cells[y * cols + x].Add(i);
+	}
+	wall_mark.SetCount(walls.GetCount(), 0);
+}
+
+void SpatialGrid::SetItems(const Vector<Item>& items) {
+	for(int i = 0; i < item_cells.GetCount(); i++)
+		item_cells[i].SetCount(0);
+	item_range.SetCount(0);
+	for(int i = 0; i < items.GetCount(); i++)
+		AddItem(i, items[i]);
+}
+
+void SpatialGrid::AddItem(int i, const Item& it) {
+	ASSERT(i == item_range.GetCount());
+	Rect r = GetRange(it.p, it.rad);
+	item_range.Add(r);
+	item_mark.SetCount(item_range.GetCount(), 0);
+	AddToRange(i, r);
+}
+
+void SpatialGrid::MoveItem(int i, const Item& it) {
+	Rect r = GetRange(it.p, it.rad);
+	if (r == item_range[i])
+		return;
+	RemoveFromRange(i, item_range[i]);
+	AddToRange(i, r);
+	item_range[i] = r;
+}
+
+void SpatialGrid::GetRayCells(Pointf a, Pointf b, Vector<int>& cells) const {
+	// walk the cells along the segment (Amanatides & Woo)
+	cells.SetCount(0);
+	int x = (int)floor(a.x / cell);
+	int y = (int)floor(a.y / cell);
+	double dx = b.x - a.x;
+	double dy = b.y - a.y;
+	int step_x = dx > 0 ? 1 : -1;
+	int step_y = dy > 0 ? 1 : -1;
+	double t_max_x = dx != 0 ? ((x + (dx > 0)) * cell - a.x) / dx : DBL_MAX;
+	double t_max_y = dy != 0 ? ((y + (dy > 0)) * cell - a.y) / dy : DBL_MAX;
+	double t_delta_x = dx != 0 ? cell / fabs(dx) : DBL_MAX;
+	double t_delta_y = dy != 0 ? cell / fabs(dy) : DBL_MAX;
+
+	// the cells outside the grid are clamped like in GetRange, so the parts of the
+	// border items and walls, which are outside, are found too
+	for(;;) {
+		cells.Add(minmax(y, 0, rows - 1) * cols + minmax(x, 0, cols - 1));
+		if (t_max_x < t_max_y) {
+			if (t_max_x > 1.0)
+				break;
+			x += step_x;
+			t_max_x += t_delta_x;
+		}
+		else {
+			if (t_max_y > 1.0)
+				break;
+			y += step_y;
+			t_max_y += t_delta_y;
+		}
+	}
+}
+
+void SpatialGrid::QueryRay(Pointf a, Pointf b, Vector<int>& walls, Vector<int>& items) {
+	GetRayCells(a, b, tmp_cells);
+	walls.SetCount(0);
+	items.SetCount(0);
+	stamp++;
+	for(int i = 0; i < tmp_cells.GetCount(); i++) {
+		const Vector<int>& wc = wall_cells[tmp_cells[i]];
+		for(int j = 0; j < wc.GetCount(); j++) {
+			int w = wc[j];
+			if (wall_mark[w] != stamp) {
+				wall_mark[w] = stamp;
+				walls.Add(w);
+			}
+		}
+		const Vector<int>& ic = item_cells[tmp_cells[i]];
+		for(int j = 0; j < ic.GetCount(); j++) {
+			int it = ic[j];
+			if (item_mark[it] != stamp) {
+				item_mark[it] = stamp;
+				items.Add(it);
+			}
+		}
+	}
+}
+
+void SpatialGrid::QueryCircle(Pointf p, double rad, Vector<int>& items) {
+	Rect r = GetRange(p, rad);
+	items.SetCount(0);
+	stamp++;
+	for(int y = r.top; y <= r.bottom; y++) {
+		for(int x = r.left; x <= r.right; x++) {
+			const Vector<int>& ic = item_cells[y * cols + x];
+			for(int j = 0; j < ic.GetCount(); j++) {
+				int it = ic[j];
+				if (item_mark[it] != stamp) {
+					item_mark[it] = stamp;
+					items.Add(it);
+				}
+			}
+		}
+	}
+}
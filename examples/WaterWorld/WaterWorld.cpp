@@ -2,6 +2,8 @@
 #include "pretrained.brc"
 #include <plugin/bz2/bz2.h>
 
+static const int alloc_warmup_steps = 100;
+
 WaterWorld::WaterWorld() {
 	Title("WaterWorld: Deep Q Learning");
 	Icon(WaterWorldImg::icon());
@@ -9,6 +11,7 @@ WaterWorld::WaterWorld() {
 	
 	world.agents[0].world = this;
 	
+	alloc_warmup_end = -1;
 	ticking_running = false;
 	ticking_stopped = true;
 	simspeed = 2;
@@ -103,6 +106,20 @@ void WaterWorld::Refresher() {
 	RefreshStatus();
 	network_view.Refresh();
 	
+	// With the CONVNET_ALLOC_COUNT configuration, the agent panics at any heap allocation
+	// in Act and Learn after the warm-up, and the title shows their allocations. The
+	// replay memory grows until it is full, so the warm-up begins only then.
+	if (IsAllocCounting()) {
+		WaterWorldAgent& agent = world.agents[0];
+		const AllocStat& learn = agent.GetLearnAllocStat();
+		if (alloc_warmup_end < 0 && agent.GetExperienceCount() >= agent.GetExperienceSize())
+			alloc_warmup_end = learn.calls + alloc_warmup_steps;
+		if (!IsStrictAllocation() && alloc_warmup_end >= 0 && learn.calls >= alloc_warmup_end)
+			SetStrictAllocation();
+		Title("WaterWorld: Deep Q Learning - act: " + agent.GetActAllocStat().ToString() +
+			", learn: " + learn.ToString());
+	}
+	
 	PostCallback(THISBACK(Refresher));
 }
 
@@ -118,6 +135,10 @@ void WaterWorld::Reset(bool init_reward, bool start) {
 	
 	agent.do_training = true;
 	
+	// the changed agent allocates again during its warm-up
+	SetStrictAllocation(false);
+	alloc_warmup_end = -1;
+	
 	if (init_reward) {
 		int states = 152; // count of eyes
 		int action_count = 4;
@@ -136,6 +157,8 @@ void WaterWorld::Reload() {
 	WaterWorldAgent& agent = world.agents[0];
 	
 	ticking_lock.Enter();
+	SetStrictAllocation(false);
+	alloc_warmup_end = -1;
 	agent.LoadInitJSON(param_str);
 	ticking_lock.Leave();
 }
@@ -160,6 +183,8 @@ void WaterWorld::LoadPretrained() {
 	
 	agent.do_training = false;
 	ticking_lock.Enter();
+	SetStrictAllocation(false);
+	alloc_warmup_end = -1;
 	agent.LoadJSON(json);
 	ticking_lock.Leave();
 }
@@ -129,14 +129,49 @@ public:
 
 
 
+// Uniform grid over the world for finding the walls and items near a ray or a circle
+// without testing all of them. Items are listed in every cell, which their circle
+// overlaps, and moving an item updates only the cells it leaves or enters. The indices
+// are the indices in World::items, so the grid is rebuilt after items are removed.
+class SpatialGrid {
+	Vector<Vector<int> > item_cells, wall_cells;
+	Vector<Rect> item_range;
+	Vector<int> item_mark, wall_mark;
+	Vector<int> tmp_cells;
+	double cell;
+	int cols, rows, stamp;
+	
+	Rect GetRange(Pointf p, double rad) const;
+	void AddToRange(int item, const Rect& r);
+	void RemoveFromRange(int item, const Rect& r);
+	void GetRayCells(Pointf a, Pointf b, Vector<int>& cells) const;
+	
+public:
+	SpatialGrid() : cell(1), cols(0), rows(0), stamp(0) {}
+	
+	void Init(int width, int height, double cell_size);
+	void SetWalls(const Vector<Wall>& walls);
+	void SetItems(const Vector<Item>& items);
+	void AddItem(int i, const Item& it);
+	void MoveItem(int i, const Item& it);
+	
+	// The candidates, which may intersect the segment a-b or the circle (p, rad)
+	void QueryRay(Pointf a, Pointf b, Vector<int>& walls, Vector<int>& items);
+	void QueryCircle(Pointf p, double rad, Vector<int>& items);
+	
+};
+
 struct World : public Ctrl {
 	Array<WaterWorldAgent> agents;
 	Vector<Item> items;
 	Vector<Wall> walls;
+	SpatialGrid grid;
+	Vector<int> near_walls, near_items;
 	int W, H;
 	int clock;
 	
 	World();
+	void AddItem(int x, int y, int type);
 	InterceptResult StuffCollide(Pointf p1, Pointf p2, bool check_walls, bool check_items);
 	void Tick();
 	virtual void Paint(Draw& d);
@@ -166,6 +201,7 @@ protected:
 	DocEdit agent_edit;
 	String t;
 	int simspeed;
+	int64 alloc_warmup_end; // the learning steps until the strict allocation mode
 	bool ticking_running, ticking_stopped;
 	
 	SpinLock ticking_lock;
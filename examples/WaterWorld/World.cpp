@@ -5,13 +5,17 @@ World::World() {
 	H = 500;
 	clock = 0;
 	AddBox(walls, 0, 0, W, H);
+	
+	// the cells are a bit smaller than the range of the eyes
+	grid.Init(W, H, 50);
+	grid.SetWalls(walls);
 
 	// set up food and poison
 	for(int k=0; k < 50; k++) {
 		double x = RandomRange(20, W - 20);
 		double y = RandomRange(20, H - 20);
 		int t = RandomRangeInt(1, 3); // food or poison (1 and 2)
-		items.Add().Init(x, y, t);
+		AddItem(x, y, t);
 	}
 	
 	// Add agent
@@ -19,13 +23,22 @@ World::World() {
 	
 }
 
+void World::AddItem(int x, int y, int type) {
+	Item& it = items.Add();
+	it.Init(x, y, type);
+	grid.AddItem(items.GetCount() - 1, it);
+}
+
 InterceptResult World::StuffCollide(Pointf p1, Pointf p2, bool check_walls, bool check_items) {
 	InterceptResult minres(false);
 	
+	// only the walls and items in the cells along the line are tested
+	grid.QueryRay(p1, p2, near_walls, near_items);
+	
 	// collide with walls
 	if (check_walls) {
-		for(int i = 0, n = walls.GetCount(); i < n; i++) {
-			Wall& wall = walls[i];
+		for(int i = 0, n = near_walls.GetCount(); i < n; i++) {
+			Wall& wall = walls[near_walls[i]];
 			InterceptResult res = IsLineIntersect(p1, p2, wall.p1, wall.p2);
 			if (res) {
 				res.type = 0; // 0 is wall
@@ -43,8 +56,8 @@ InterceptResult World::StuffCollide(Pointf p1, Pointf p2, bool check_walls, bool
 	
 	// collide with items
 	if(check_items) {
-		for(int i = 0, n = items.GetCount(); i < n; i++) {
-			Item& it = items[i];
+		for(int i = 0, n = near_items.GetCount(); i < n; i++) {
+			Item& it = items[near_items[i]];
 			InterceptResult res = IsLinePointIntersect(p1, p2, it.p, it.rad);
 			if(res) {
 				res.type = it.type; // store type of item
@@ -144,13 +157,15 @@ void World::Tick() {
 	// tick all items
 	bool update_items = false;
 	
-	for (int i = 0, n = items.GetCount(); i < n; i++) {
-		Item& it = items[i];
-		it.age += 1;
-		
-		// see if some agent gets lunch
-		for (int j = 0, m = agents.GetCount(); j < m; j++) {
-			WaterWorldAgent& a = agents[j];
+	// see if some agent gets lunch. The agents are checked in order, so an item goes
+	// to the first agent, which touches it. Only the items near the agent are tested.
+	for (int j = 0, m = agents.GetCount(); j < m; j++) {
+		WaterWorldAgent& a = agents[j];
+		grid.QueryCircle(a.p, a.rad, near_items);
+		for (int k = 0; k < near_items.GetCount(); k++) {
+			Item& it = items[near_items[k]];
+			if (it.cleanup_)
+				continue; // item was consumed already
 			double d = Distance(a.p, it.p);
 			if (d < it.rad + a.rad) {
 				
@@ -161,10 +176,13 @@ void World::Tick() {
 					a.digestion_signal += -1.0; // ewww poison
 				it.cleanup_ = true;
 				update_items = true;
-				break; // break out of loop, item was consumed
-			
 			}
 		}
+	}
+	
+	for (int i = 0, n = items.GetCount(); i < n; i++) {
+		Item& it = items[i];
+		it.age += 1;
 		
 		// move the items
 		it.p.x += it.v.x;
@@ -173,6 +191,7 @@ void World::Tick() {
 		if (it.p.x > W-1) { it.p.x = W-1; it.v.x *= -1; }
 		if (it.p.y < 1) { it.p.y = 1; it.v.y *= -1; }
 		if (it.p.y > H-1) { it.p.y = H-1; it.v.y *= -1; }
+		grid.MoveItem(i, it);
 		
 		if (it.age > 5000 && (clock % 100) == 0 && Randomf() < 0.1) {
 			it.cleanup_ = true; // replace this one, has been around too long
@@ -186,12 +205,13 @@ void World::Tick() {
 				i--;
 			}
 		}
+		grid.SetItems(items); // the indices have changed
 	}
 	if (items.GetCount() < 50 && (clock % 10) == 0 && Randomf() < 0.25) {
 		double newitx = RandomRange(20, W - 20);
 		double newity = RandomRange(20, H - 20);
 		int newitt = RandomRangeInt(1, 3); // food or poison (1 and 2)
-		items.Add().Init(newitx, newity, newitt);
+		AddItem(newitx, newity, newitt);
 	}
 	
 	// agents are given the opportunity to learn based on feedback of their action on environment
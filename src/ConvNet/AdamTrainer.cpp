@@ -15,55 +15,8 @@ AdamTrainer::AdamTrainer(Net& net) : TrainerBase(net) {
 
 void AdamTrainer::TrainImplem() {
 	
-	iter_count++;
-	
-	if ((iter_count % batch_size) == 0) {
-		Vector<ParametersAndGradients>& parametersAndGradients = net->GetParametersAndGradients();
-		
-		// initialize lists for accumulators. Will only be done once on first iteration
-		if (gsum.GetCount() == 0) {
-			for(int i = 0; i < parametersAndGradients.GetCount(); i++) {
-				ParametersAndGradients& t = parametersAndGradients[i];
-				gsum.Add().SetCount(t.volume->GetLength(), 0.0);
-				xsum.Add().SetCount(t.volume->GetLength(), 0.0);
-			}
-		}
-		
-		// perform an update for all sets of weights
-		for (int i = 0; i < parametersAndGradients.GetCount(); i++) {
-			ParametersAndGradients& parametersAndGradient = parametersAndGradients[i];
-			
-			// param, gradient, other options in future (custom learning rate etc)
-			Volume& vol = *parametersAndGradient.volume;
-			
-			// learning rate for some parameters.
-			double l2_decay_mul = IF_NULL_1(parametersAndGradient.l2_decay_mul);
-			double l1_decay_mul = IF_NULL_1(parametersAndGradient.l1_decay_mul);
-			double l2_decay = this->l2_decay * l2_decay_mul;
-			double l1_decay = this->l1_decay * l1_decay_mul;
-			
-			int plen = vol.GetLength();
-			for (int j = 0; j < plen; j++) {
-				l2_decay_loss += l2_decay * vol.Get(j) * vol.Get(j) / 2; // accumulate weight decay loss
-				l1_decay_loss += l1_decay * fabs(vol.Get(j));
-				double l1_grad = l1_decay * (vol.Get(j) > 0 ? 1 : -1);
-				double l2_grad = l2_decay * vol.Get(j);
-				
-				double gij = (l2_grad + l1_grad + vol.GetGradient(j)) / batch_size; // raw batch gradient
-				
-				Vector<double>& gsumi = gsum[i];
-				Vector<double>& xsumi = xsum[i];
-				
-				gsumi[j] = gsumi[j] * Beta1 + (1 - Beta1) * gij; // update biased first moment estimate
-				xsumi[j] = xsumi[j] * Beta2 + (1 - Beta2) * gij * gij; // update biased second moment estimate
-				double bias_corr1 = gsumi[j] * (1 - pow(Beta1, iter_count)); // correct bias first moment estimate
-				double bias_corr2 = xsumi[j] * (1 - pow(Beta2, iter_count)); // correct bias second moment estimate
-				double dx = -1.0 * learning_rate * bias_corr1 / (sqrt(bias_corr2) + eps);
-				vol.Set(j, vol.Get(j) + dx);
-				
-				vol.SetGradient(j, 0.0); // zero out gradient so that we can begin accumulating anew
-			}
-		}
+	if (IsUpdateStep()) {
+		UpdateParameters(UPDATE_ADAM, &gsum, &xsum);
 	}
 	
 	// in future, TODO: have to completely redo the way loss is done around the network as currently
@@ -14,17 +14,16 @@ namespace ConvNet {
 void RandMat(int n, int d, double mu, double std, Mat& m) {
 	m.Init(d, n, 0);
 	
-	std::default_random_engine generator;
-	std::normal_distribution<double> distribution(mu, std);
-	generator.seed(Random(INT_MAX));
-	
-	for (int i = 0; i < m.GetLength(); i++)
-		m.Set(i, distribution(generator));
+	Vector<Real> tmp;
+	tmp.SetCount(m.GetLength());
+	GetRng().FillGaussian(tmp.Begin(), tmp.GetCount(), mu, std);
+	for (int i = 0; i < tmp.GetCount(); i++)
+		m.Set(i, tmp[i]);
 }
 
 int SampleWeighted(Vector<double>& p) {
 	ASSERT(!p.IsEmpty());
-	double r = Randomf();
+	double r = GetRng().Getf();
 	double c = 0.0;
 	for (int i = 0; i < p.GetCount(); i++) {
 		c += p[i];
@@ -335,11 +334,13 @@ void DPAgent::Reset() {
 }
 
 int DPAgent::Act(int x, int y) {
+	AllocScope alloc(act_allocs);
+	
 	// behave according to the learned policy
 	int state = GetPos(x,y);
-	Vector<int> poss;
+	Vector<int>& poss = tmp_poss;
 	AllowedActions(x, y, poss);
-	Vector<double> ps;
+	Vector<double>& ps = tmp_values;
 	ps.SetCount(poss.GetCount());
 	for (int i = 0; i < poss.GetCount(); i++) {
 		int a = poss[i];
@@ -351,6 +352,8 @@ int DPAgent::Act(int x, int y) {
 }
 
 void DPAgent::Learn() {
+	AllocScope alloc(learn_allocs);
+	
 	// perform a single round of value iteration
 	EvaluatePolicy(); // writes policy value
 	UpdatePolicy(); // writes policy distribution
@@ -361,7 +364,7 @@ void DPAgent::EvaluatePolicy() {
 	// perform a synchronous update of the value function
 	value.SetCount(length);
 	
-	Vector<int> poss;
+	Vector<int>& poss = tmp_poss;
 	int state = 0;
 	
 	for (int y = 0; y < height; y++) {
@@ -388,9 +391,9 @@ void DPAgent::EvaluatePolicy() {
 
 void DPAgent::UpdatePolicy() {
 	
-	Vector<int> poss;
-	Vector<double> vs;
-	Vector<int> maxpos;
+	Vector<int>& poss = tmp_poss;
+	Vector<double>& vs = tmp_values;
+	Vector<int>& maxpos = tmp_maxpos;
 	int state = 0;
 	
 	// update policy to be greedy w.r.t. learned Value function
@@ -530,8 +533,11 @@ void TDAgent::Reset(){
 	
 	
 	
-	// model/planning vars
+	// model/planning vars. Every state action is seen at most once, so Learn doesn't
+	// grow these after the reset.
 	sa_seen.SetCount(0);
+	sa_seen.Reserve(ns * na);
+	tmp_spq.Reserve(ns * na);
 	
 	Vector<int> poss;
 	
@@ -565,15 +571,16 @@ void TDAgent::ResetEpisode() {
 }
 
 int TDAgent::Act(int x, int y) {
+	AllocScope alloc(act_allocs);
 	
 	// act according to epsilon greedy policy
-	Vector<int> poss;
+	Vector<int>& poss = tmp_poss;
 	AllowedActions(x, y, poss);
 	ASSERT(!poss.IsEmpty());
 	
 	int state = GetPos(x,y);
 	
-	Vector<double> probs;
+	Vector<double>& probs = tmp_values;
 	
 	probs.SetCount(poss.GetCount());
 	for (int i = 0; i < poss.GetCount(); i++) {
@@ -582,8 +589,8 @@ int TDAgent::Act(int x, int y) {
 	
 	// epsilon greedy policy
 	int action;
-	if (Randomf() < epsilon) {
-		action = poss[Random(poss.GetCount())]; // random available action
+	if (GetRng().Getf() < epsilon) {
+		action = poss[GetRng().Get(poss.GetCount())]; // random available action
 		explored = true;
 	} else {
 		action = poss[SampleWeighted(probs)];
@@ -614,6 +621,7 @@ double TDAgent::GetValue(int x, int y) const {
 }
 
 void TDAgent::Learn() {
+	AllocScope alloc(learn_allocs);
 	int x, y, d;
 	GetXY(current_state, x, y);
 	
@@ -668,7 +676,8 @@ void TDAgent::Plan() {
 	};
 	
 	// order the states based on current priority queue information
-	Vector<Val> spq;
+	Vector<Val>& spq = tmp_spq;
+	spq.SetCount(0);
 	for (int i = 0; i < sa_seen.GetCount(); i++) {
 		ActionState& sa = sa_seen[i];
 		double sap = pq[sa.a][sa.b];
@@ -695,11 +704,11 @@ void TDAgent::Plan() {
 		if (update == UPDATE_SARSA) {
 			
 			// generate random action?...
-			Vector<int> poss;
+			Vector<int>& poss = tmp_poss;
 			int x,y,d;
 			GetXY(state1, x, y);
 			AllowedActions(x, y, poss);
-			action1 = poss[Random(poss.GetCount())];
+			action1 = poss[GetRng().Get(poss.GetCount())];
 		}
 		LearnFromTuple(state0, action0, reward0, state1, action1, 0); // note lambda = 0 - shouldnt use eligibility trace here
 	}
@@ -711,7 +720,7 @@ void TDAgent::LearnFromTuple(int state0, int action0, double reward0, int state1
 	GetXY(state0, s0x, s0y);
 	GetXY(state1, s1x, s1y);
 	
-	Vector<int> poss;
+	Vector<int>& poss = tmp_poss;
 	
 	// calculate the target for Q(s,a)
 	double target;
@@ -743,8 +752,9 @@ void TDAgent::LearnFromTuple(int state0, int action0, double reward0, int state1
 		}
 		double edecay = lambda * gamma;
 		
-		Vector<double> state_update;
-		state_update.SetCount(length);
+		Vector<double>& state_update = tmp_state_update;
+		state_update.SetCount(0);
+		state_update.SetCount(length, 0.0);
 		
 		
 		int state = 0;
@@ -822,7 +832,7 @@ void TDAgent::UpdatePriority(int s, int a, double u) {
 
 void TDAgent::UpdatePolicy(int x, int y) {
 	
-	Vector<int> poss;
+	Vector<int>& poss = tmp_poss;
 	AllowedActions(x, y, poss);
 	ASSERT(!poss.IsEmpty());
 	
@@ -830,7 +840,7 @@ void TDAgent::UpdatePolicy(int x, int y) {
 	// first find the maxy Q values
 	int nmax;
 	double qmax;
-	Vector<double> qs;
+	Vector<double>& qs = tmp_values;
 	
 	int s = GetPos(x,y);
 	qs.SetCount(poss.GetCount());
@@ -895,6 +905,13 @@ DQNAgent::DQNAgent() {
 	learning_steps_per_iteration = 10;
 	tderror_clamp = 1.0;
 	
+	// prioritized experience replay (off by default)
+	prioritized_replay = false;
+	priority_alpha = 0.6; // how much the td error affects the sampling
+	priority_beta = 0.4; // importance-sampling correction, 1 = full
+	priority_beta_steps = 100000; // the correction anneals to full during these iterations
+	priority_eps = 0.01; // keeps the priorities above zero
+	
 	num_hidden_units = 100;
 	
 	// Original:
@@ -951,6 +968,11 @@ void DQNAgent::LoadInit(const ValueMap& map) {
 	LOADVARDEF(learning_steps_per_iteration, learning_steps_per_iteration, 10);
 	LOADVARDEF(tderror_clamp, tderror_clamp, 1.0);
 	LOADVARDEF(num_hidden_units, num_hidden_units, 100);
+	LOADVARDEF(prioritized_replay, prioritized_replay, false);
+	LOADVARDEF(priority_alpha, priority_alpha, 0.6);
+	LOADVARDEF(priority_beta, priority_beta, 0.4);
+	LOADVARDEF(priority_beta_steps, priority_beta_steps, 100000);
+	LOADVARDEF(priority_eps, priority_eps, 0.01);
 }
 
 void DQNAgent::StoreInit(ValueMap& map) {
@@ -962,6 +984,11 @@ void DQNAgent::StoreInit(ValueMap& map) {
 	STOREVAR_(learning_steps_per_iteration);
 	STOREVAR_(tderror_clamp);
 	STOREVAR_(num_hidden_units);
+	STOREVAR_(prioritized_replay);
+	STOREVAR_(priority_alpha);
+	STOREVAR_(priority_beta);
+	STOREVAR_(priority_beta_steps);
+	STOREVAR_(priority_eps);
 }
 
 void DQNAgent::Load(const ValueMap& map) {
@@ -1016,14 +1043,15 @@ int DQNAgent::Act(int x, int y) {
 }
 
 int DQNAgent::Act(const Vector<double>& slist) {
+	AllocScope alloc(act_allocs);
 	
 	// convert to a Mat column vector
 	state.Init(width, height, slist);
 	
 	// epsilon greedy policy
 	int action;
-	if (Randomf() < epsilon) {
-		action = Random(na);
+	if (GetRng().Getf() < epsilon) {
+		action = GetRng().Get(na);
 	} else {
 		// greedy wrt Q function
 		//Mat& amat = ForwardQ(net, state);
@@ -1045,6 +1073,7 @@ void DQNAgent::Learn() {
 }
 
 void DQNAgent::Learn(double reward1) {
+	AllocScope alloc(learn_allocs);
 	
 	// perform an update on Q function
 	if (has_reward && alpha > 0 && state0.GetLength() > 0) {
@@ -1058,15 +1087,51 @@ void DQNAgent::Learn(double reward1) {
 				exp.Add();
 			ASSERT(state1.GetLength() > 0);
 			exp[expi].Set(state0, action0, reward0, state1, action1);
+			if (prioritized_replay) {
+				if (priorities.GetCount() != experience_size) {
+					priorities.Init(experience_size);
+					for(int i = 0; i < exp.GetCount() && i < experience_size; i++)
+						priorities.Set(i, 1.0);
+				}
+				priorities.Set(expi, priorities.GetMaxPriority()); // new ones are sampled at least once
+			}
 			expi += 1;
 			if (expi >= experience_size) { expi = 0; } // roll over when we run out
 		}
 		t += 1;
 		
-		if (!exp.IsEmpty()) {
+		if (!exp.IsEmpty() && prioritized_replay && priorities.GetTotal() > 0) {
+			// The learning steps of the iteration are one batch, sampled proportionally to
+			// the priority. Like in Brain::LearnBatch, the importance-sampling weights are
+			// normalized to the largest weight of the batch, and their exponent anneals
+			// from priority_beta to 1.
+			double total = priorities.GetTotal();
+			double n = exp.GetCount();
+			double progress = min(1.0, (double)t / max(1, priority_beta_steps));
+			double beta = priority_beta + (1.0 - priority_beta) * progress;
+			int count = learning_steps_per_iteration;
+			batch_ids.SetCount(count);
+			batch_priorities.SetCount(count);
+			double min_priority = total;
+			for (int k = 0; k < count; k++) {
+				int ri = priorities.Find(GetRng().Getf() * total);
+				batch_ids[k] = ri;
+				batch_priorities[k] = priorities.Get(ri);
+				min_priority = min(min_priority, batch_priorities[k]);
+			}
+			double max_weight = pow(n * min_priority / total, -beta);
+			for (int k = 0; k < count; k++) {
+				int ri = batch_ids[k];
+				double weight = pow(n * batch_priorities[k] / total, -beta) / max_weight;
+				DQExperience& e = exp[ri];
+				double td = LearnFromTuple(e.state0, e.action0, e.reward0, e.state1, e.action1, weight);
+				priorities.Set(ri, pow(fabs(td) + priority_eps, priority_alpha));
+			}
+		}
+		else if (!exp.IsEmpty()) {
 			// sample some additional experience from replay memory and learn from it
 			for (int k = 0; k < learning_steps_per_iteration; k++) {
-				int ri = Random(exp.GetCount()); // TODO: priority sweeps?
+				int ri = GetRng().Get(exp.GetCount());
 				DQExperience& e = exp[ri];
 				LearnFromTuple(e.state0, e.action0, e.reward0, e.state1, e.action1);
 			}
@@ -1076,7 +1141,7 @@ void DQNAgent::Learn(double reward1) {
 	has_reward = true;
 }
 
-double DQNAgent::LearnFromTuple(Mat& s0, int a0, double reward0, Mat& s1, int a1) {
+double DQNAgent::LearnFromTuple(Mat& s0, int a0, double reward0, Mat& s1, int a1, double weight) {
 	ASSERT(s0.GetLength() > 0);
 	ASSERT(s1.GetLength() > 0);
 	// want: Q(s,a) = r + gamma * max_a' Q(s',a')
@@ -1096,7 +1161,7 @@ double DQNAgent::LearnFromTuple(Mat& s0, int a0, double reward0, Mat& s1, int a1
 		else
 			tderror = -clamp;
 	}
-	pred.SetGradient(a0, tderror);
+	pred.SetGradient(a0, weight * tderror); // weight is the importance-sampling weight
 	G.Backward(); // compute gradients on net params
 	
 	// update net
@@ -1231,8 +1296,8 @@ int SDQNAgent::Act(const Vector<double>& slist) {
 	se.state.Init(width, height, slist);
 	
 	// epsilon greedy policy
-	if (Randomf() < epsilon) {
-		se.action = Random(na);
+	if (GetRng().Getf() < epsilon) {
+		se.action = GetRng().Get(na);
 	} else {
 		// greedy wrt Q function
 		Mat& amat = G.Forward(se.state);
@@ -1276,7 +1341,7 @@ void SDQNAgent::Learn(int seq_id, double reward) {
 		
 		// sample some additional experience from replay memory and learn from it
 		for (int i = 0; i < learning_steps_per_iteration; i++) {
-			int ri = Random(exp.GetCount()); // TODO: priority sweeps?
+			int ri = GetRng().Get(exp.GetCount()); // TODO: priority sweeps?
 			SDQExperience& e = exp[ri];
 			for(int j = 1; j < e.exp.GetCount(); j++) {
 				SDQExperienceItem& e0 = e.exp[j-1];
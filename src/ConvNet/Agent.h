@@ -22,6 +22,9 @@ protected:
 	int iter_sleep;
 	bool running, stopped;
 	
+	// The allocations of Act and Learn (see AllocScope)
+	AllocStat act_allocs, learn_allocs;
+	
 public:
 	typedef Agent CLASSNAME;
 	Agent();
@@ -57,7 +60,7 @@ public:
 	int GetPos(int x, int y) const;
 	int GetStartState() { return start_state; }
 	int GetStopState() { return stop_state; }
-	int GetRandomState() { return Random(length); }
+	int GetRandomState() { return GetRng().Get(length); }
 	int GetWidth() const {return width;}
 	int GetHeight() const {return height;}
 	int GetNextStateDistribution(int x, int y, int a);
@@ -72,6 +75,9 @@ public:
 	void SetReward(int x, int y, double reward);
 	void SetReward(int s, double reward) {this->reward[s] = reward;}
 	void SetDisabled(int x, int y, bool disable=true);
+	
+	const AllocStat& GetActAllocStat() const {return act_allocs;}
+	const AllocStat& GetLearnAllocStat() const {return learn_allocs;}
 };
 
 
@@ -90,6 +96,10 @@ protected:
 	
 	double gamma; // future reward discount factor
 	
+	// Temp vars
+	Vector<int> tmp_poss, tmp_maxpos;
+	Vector<double> tmp_values;
+	
 public:
 	DPAgent();
 	
@@ -144,6 +154,11 @@ class TDAgent : public Agent {
 	bool replacing_traces;
 	bool explored;
 	
+	// Temp vars. A function, which uses them, doesn't call another one using the same.
+	Vector<int> tmp_poss;
+	Vector<double> tmp_values, tmp_state_update;
+	Vector<Val> tmp_spq;
+	
 public:
 	
 	TDAgent();
@@ -214,8 +229,14 @@ class DQNAgent : public Agent {
 	DQNet net;
 	Graph G;
 	Vector<DQExperience> exp; // experience
+	SumTree priorities; // of exp, when prioritized_replay is set
+	Vector<int> batch_ids;
+	Vector<double> batch_priorities;
 	double gamma, epsilon, alpha, tderror_clamp;
 	double tderror;
+	double priority_alpha, priority_beta, priority_eps;
+	int priority_beta_steps;
+	bool prioritized_replay;
 	int experience_add_every, experience_size;
 	int learning_steps_per_iteration;
 	int num_hidden_units;
@@ -248,26 +269,38 @@ public:
 	double GetEpsilon() const {return epsilon;}
 	Graph& GetGraph() {return G;}
 	int GetExperienceCount() const {return exp.GetCount();}
-	void ClearExperience() {exp.Clear();}
+	int GetExperienceSize() const {return experience_size;}
+	void ClearExperience() {exp.Clear(); priorities.Init(experience_size); expi = 0;}
 	
 	void SetEpsilon(double e) {epsilon = e;}
+	void SetPrioritizedReplay(bool b=true) {prioritized_replay = b;}
 	
 	int Act(const Vector<double>& slist);
 	void Learn(double reward1);
-	double LearnFromTuple(Mat& s0, int a0, double reward0, Mat& s1, int a1);
+	double LearnFromTuple(Mat& s0, int a0, double reward0, Mat& s1, int a1, double weight=1.0);
 	
 	void Serialize(Stream& s) {
+		// The version is in the map, because the streams before the versions begin with
+		// it too. Version 1 adds the priorities at the end.
+		int version = 1;
 		if (s.IsLoading()) {
 			ValueMap map;
 			s % map;
 			Load(map);
+			int i = map.Find("serialize_version");
+			version = i >= 0 ? (int)map.GetValue(i) : 0;
 		}
 		else if (s.IsStoring()) {
 			ValueMap map;
 			Store(map);
+			map.GetAdd("serialize_version") = version;
 			s % map;
 		}
 		s % exp % gamma % epsilon % alpha % tderror_clamp % tderror % expi % t;
+		if (version >= 1)
+			s % priorities;
+		else if (s.IsLoading())
+			priorities.Init(0); // rebuilt on the next Learn
 	}
 };
 
@@ -0,0 +1,109 @@
+#include "Allocation.h"
+
+// Without USEMALLOC the U++ heap takes only large blocks from malloc, so counting the
+// calls of malloc would report almost nothing. IsAllocCounting tells, if the counts are real.
+#if CONVNET_ALLOC_COUNT && defined(flagUSEMALLOC) && defined(__GLIBC__)
+#define ALLOC_HOOK 1
+#include <errno.h>
+#else
+#define ALLOC_HOOK 0
+#endif
+
+namespace ConvNet {
+
+static std::atomic<bool> strict_allocation(false);
+
+// plain thread locals without constructors, because malloc can be called before and after
+// everything else of the thread
+static thread_local int64 thread_alloc_count;
+static thread_local bool thread_strict;
+
+static inline void CountAlloc() {
+	thread_alloc_count++;
+	if (thread_strict) {
+		thread_strict = false; // Panic allocates too
+		Panic("Heap allocation in a strict allocation scope");
+	}
+}
+
+bool IsAllocCounting() {
+	return ALLOC_HOOK;
+}
+
+int64 GetThreadAllocCount() {
+	return thread_alloc_count;
+}
+
+void SetStrictAllocation(bool b) {
+	strict_allocation = b;
+}
+
+bool IsStrictAllocation() {
+	return strict_allocation;
+}
+
+String AllocStat::ToString() const {
+	return Format("calls %d, allocations %d (%.2f per call, max %d, last %d)",
+		calls, allocs, GetAverage(), max_allocs, last_allocs);
+}
+
+void AllocScope::Begin() {
+	begin = thread_alloc_count;
+	prev_strict = thread_strict;
+	thread_strict = strict_allocation;
+}
+
+void AllocScope::End() {
+	thread_strict = prev_strict;
+	int64 n = thread_alloc_count - begin;
+	stat.calls++;
+	stat.allocs += n;
+	stat.max_allocs = max(stat.max_allocs, n);
+	stat.last_allocs = n;
+}
+
+}
+
+#if ALLOC_HOOK
+
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+
+void* malloc(size_t size) {
+	ConvNet::CountAlloc();
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+	ConvNet::CountAlloc();
+	return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+	ConvNet::CountAlloc();
+	return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) {
+	ConvNet::CountAlloc();
+	*ptr = __libc_memalign(alignment, size);
+	return *ptr ? 0 : ENOMEM;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+	ConvNet::CountAlloc();
+	return __libc_memalign(alignment, size);
+}
+
+void* memalign(size_t alignment, size_t size) {
+	ConvNet::CountAlloc();
+	return __libc_memalign(alignment, size);
+}
+
+}
+
+#endif
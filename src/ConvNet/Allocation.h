@@ -0,0 +1,61 @@
+#ifndef _ConvNet_Allocation_h_
+#define _ConvNet_Allocation_h_
+
+#include <Core/Core.h>
+
+// The allocations are counted only with the CONVNET_ALLOC_COUNT flag. The counter
+// replaces malloc, so it needs also the USEMALLOC flag, which makes U++ allocate with
+// malloc instead of its own heap, and glibc. Otherwise IsAllocCounting is false and the
+// counts stay zero.
+#ifdef flagCONVNET_ALLOC_COUNT
+#define CONVNET_ALLOC_COUNT 1
+#else
+#define CONVNET_ALLOC_COUNT 0
+#endif
+
+namespace ConvNet {
+using namespace Upp;
+
+bool IsAllocCounting();
+
+// The heap allocations of the current thread since it started
+int64 GetThreadAllocCount();
+
+// In the strict mode, an allocation inside an AllocScope panics at the allocation, so
+// the debugger shows where it came from. Set it after the warm-up, when all buffers
+// have their final size.
+void SetStrictAllocation(bool b=true);
+bool IsStrictAllocation();
+
+// The allocations of the calls of one hot path, e.g. the training steps
+struct AllocStat {
+	int64 calls, allocs, max_allocs, last_allocs;
+	
+	AllocStat() {Clear();}
+	void Clear() {calls = 0; allocs = 0; max_allocs = 0; last_allocs = 0;}
+	double GetAverage() const {return calls ? (double)allocs / calls : 0;}
+	String ToString() const;
+};
+
+// Counts the allocations of the current thread during the lifetime of the scope to stat.
+// Only the calling thread is counted, e.g. not the prefetch threads of Session. Close
+// ends the counting early, e.g. before the callbacks of the user, which may allocate.
+class AllocScope {
+	AllocStat& stat;
+	int64 begin;
+	bool prev_strict;
+	bool open;
+	
+	void Begin();
+	void End();
+	
+public:
+	AllocScope(AllocStat& stat) : stat(stat), open(true) {if (CONVNET_ALLOC_COUNT) Begin();}
+	~AllocScope() {Close();}
+	
+	void Close() {if (CONVNET_ALLOC_COUNT && open) End(); open = false;}
+};
+
+}
+
+#endif
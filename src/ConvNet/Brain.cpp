@@ -2,40 +2,46 @@
 
 namespace ConvNet {
 	
-inline void HeaplessCopy(Vector<double>& dest, const Vector<double>& src) {
-	int count = src.GetCount();
-	dest.SetCount(count);
-	for(int i = 0; i < count; i++)
-		dest[i] = src[i];
+ReplayMemory::ReplayMemory() {
+	state_size = 0;
+	capacity = 0;
+	count = 0;
+	head = 0;
 }
 
+void ReplayMemory::Init(int state_size, int capacity) {
+	ASSERT(state_size > 0 && capacity > 0);
+	this->state_size = state_size;
+	this->capacity = capacity;
+	states0.SetCount(state_size * capacity);
+	states1.SetCount(state_size * capacity);
+	actions.SetCount(capacity);
+	rewards.SetCount(capacity);
+	Clear();
+}
 
+int ReplayMemory::Add(const Vector<double>& state0, int action0, double reward0, const Vector<double>& state1) {
+	ASSERT(state0.GetCount() == state_size && state1.GetCount() == state_size);
+	int i = head;
+	Real* s0 = states0.Begin() + i * state_size;
+	Real* s1 = states1.Begin() + i * state_size;
+	for(int j = 0; j < state_size; j++) {
+		s0[j] = (Real)state0[j];
+		s1[j] = (Real)state1[j];
+	}
+	actions[i] = action0;
+	rewards[i] = reward0;
+	priorities.Set(i, priorities.GetMaxPriority());
+	head = (head + 1) % capacity;
+	if (count < capacity)
+		count++;
+	return i;
+}
 
 
 
 
 
-Experience::Experience() {
-	action0 = -1;
-	reward0 = 0;
-}
-
-Experience& Experience::operator=(const Experience& src) {
-	HeaplessCopy(this->state0, src.state0);
-	this->action0 = src.action0;
-	this->reward0 = src.reward0;
-	HeaplessCopy(this->state1, src.state1);
-	return *this;
-}
-
-Experience& Experience::Set(const Vector<double>& state0, int action0, double reward0, const Vector<double>& state1) {
-	HeaplessCopy(this->state0, state0);
-	this->action0 = action0;
-	this->reward0 = reward0;
-	HeaplessCopy(this->state1, state1);
-	return *this;
-}
-
 
 
 
@@ -51,13 +57,20 @@ Experience& Experience::Set(const Vector<double>& state0, int action0, double re
 
 
 
+Brain::PolicySnapshot::~PolicySnapshot() {
+	for(int i = 0; i < owned_layers.GetCount(); i++)
+		delete owned_layers[i];
+}
 
-Brain::Brain() {
+Brain::Brain() : published(-1), learner_stop(false), learner_steps(0) {
 	num_states = 0;
 	num_actions = 0;
+	snapshot_interval = 10;
+	learner_running = false;
 }
 
 void Brain::Init(int num_states, int num_actions, Vector<double>* random_action_distribution) {
+	StopLearner();
 	this->random_action_distribution.Clear();
 	state_window.Clear();
 	action_window.Clear();
@@ -92,6 +105,12 @@ void Brain::Init(int num_states, int num_actions, Vector<double>* random_action_
 	// what epsilon to use at test time? (i.e. when learning is disabled)
 	epsilon_test_time = 0.01;
 	
+	// sample surprising transitions more often? (prioritized experience replay)
+	prioritized_replay = false;
+	priority_alpha = 0.6;
+	priority_beta = 0.4;
+	priority_eps = 0.01;
+	
 	// advanced feature. Sometimes a random action should be biased towards some values
 	// for example in flappy bird, we may want to choose to not flap more often
 	if (random_action_distribution) {
@@ -178,10 +197,10 @@ int Brain::GetRandomAction() {
 	// do more sophisticated things. For example some actions could be more
 	// or less likely at "rest"/default state.
 	if(random_action_distribution.IsEmpty()) {
-		return Random(num_actions);
+		return GetRng().Get(num_actions);
 	} else {
 		// okay, lets do some fancier sampling:
-		double p = Randomf();
+		double p = GetRng().Getf();
 		double cumprob = 0.0;
 		for (int k=0; k < num_actions; k++) {
 			cumprob += random_action_distribution[k];
@@ -193,12 +212,7 @@ int Brain::GetRandomAction() {
 	return 0;
 }
 
-ActionValue Brain::GetPolicy(const Vector<double>& weights) {
-	// compute the value of doing any action in this state
-	// and return the argmax action and its value
-	ASSERTEXC(weights.GetCount() == net_inputs);
-	Volume svol(weights);
-	Volume& action_values = net.Forward(svol);
+static ActionValue GetMaxAction(const Volume& action_values, int num_actions) {
 	int maxk = 0;
 	double maxval = action_values.Get(0);
 	for(int k=1; k < num_actions; k++) {
@@ -214,6 +228,39 @@ ActionValue Brain::GetPolicy(const Vector<double>& weights) {
 	return av;
 }
 
+ActionValue Brain::GetPolicy(const Vector<double>& weights) {
+	// compute the value of doing any action in this state
+	// and return the argmax action and its value
+	ASSERTEXC(weights.GetCount() == net_inputs);
+	if (policy_input.GetLength() != net_inputs)
+		policy_input.Init(1, 1, net_inputs, 0.0);
+	for(int i = 0; i < net_inputs; i++)
+		policy_input.Set(i, weights[i]);
+	
+	if (!learner_running)
+		return GetMaxAction(net.Forward(policy_input), num_actions);
+	
+	int i = EnterSnapshot();
+	ActionValue av = GetMaxAction(snapshots[i].net->Predict(policy_input, policy_ws), num_actions);
+	LeaveSnapshot(i);
+	return av;
+}
+
+ActionValue Brain::GetPolicy(const Vector<double>& weights, PredictWorkspace& ws) {
+	ASSERTEXC(weights.GetCount() == net_inputs);
+	if (ws.input.GetLength() != net_inputs)
+		ws.input.Init(1, 1, net_inputs, 0.0);
+	for(int i = 0; i < net_inputs; i++)
+		ws.input.Set(i, weights[i]);
+	if (!learner_running)
+		return GetMaxAction(net.Predict(ws.input, ws), num_actions);
+	
+	int i = EnterSnapshot();
+	ActionValue av = GetMaxAction(snapshots[i].net->Predict(ws.input, ws), num_actions);
+	LeaveSnapshot(i);
+	return av;
+}
+
 void Brain::GetNetInput(const Vector<double>& xt, Vector<double>& w) {
 	// return s = (x,a,x,a,x,a,xt) state vector.
 	// It's a concatenation of last window_size (x,a) pairs and current state x
@@ -236,11 +283,26 @@ void Brain::GetNetInput(const Vector<double>& xt, Vector<double>& w) {
 	}
 }
 
+// The vectors are copied without allocating, when dst has already the memory
+static void CopyValues(Vector<double>& dst, const Vector<double>& src) {
+	dst.SetCount(src.GetCount());
+	for(int i = 0; i < src.GetCount(); i++)
+		dst[i] = src[i];
+}
+
+// Shifts the window and copies v over the oldest vector, which becomes the newest
+static void PushWindow(Vector<Vector<double> >& window, const Vector<double>& v) {
+	for(int i = 1; i < window.GetCount(); i++)
+		Swap(window[i - 1], window[i]);
+	CopyValues(window.Top(), v);
+}
+
 int Brain::Forward(const Vector<double>& input_array) {
+	AllocScope alloc(act_allocs);
 	
 	// compute forward (behavior) pass given the input neuron signals from body
 	forward_passes += 1;
-	last_input_array <<= input_array; // back this up
+	CopyValues(last_input_array, input_array); // back this up
 	
 	// create network input
 	int action;
@@ -257,7 +319,7 @@ int Brain::Forward(const Vector<double>& input_array) {
 		} else {
 			epsilon = epsilon_test_time; // use test-time value
 		}
-		double rf = Randomf();
+		double rf = GetRng().Getf();
 		if (rf < epsilon) {
 			// choose a random action with epsilon probability
 			action = GetRandomAction();
@@ -273,10 +335,8 @@ int Brain::Forward(const Vector<double>& input_array) {
 	}
 	
 	// remember the state and action we took for backward pass
-	net_window.Remove(0);
-	net_window.Add(net_input);
-	state_window.Remove(0);
-	state_window.Add(input_array);
+	PushWindow(net_window, net_input);
+	PushWindow(state_window, input_array);
 	action_window.Remove(0);
 	action_window.Add(action);
 	
@@ -284,6 +344,7 @@ int Brain::Forward(const Vector<double>& input_array) {
 }
 
 void Brain::Backward(double reward) {
+	AllocScope alloc(learn_allocs);
 	latest_reward = reward;
 	average_reward_window.Add(reward);
 	reward_window.Remove(0);
@@ -292,7 +353,12 @@ void Brain::Backward(double reward) {
 	if (!learning)
 		return;
 	
-	Enter();
+	// with the learner thread, only the experience is stored here
+	bool actor = learner_running;
+	if (!actor)
+		Enter();
+	
+	replay_lock.Enter();
 	
 	// various book-keeping
 	age += 1;
@@ -300,35 +366,205 @@ void Brain::Backward(double reward) {
 	// it is time t+1 and we have to store (s_t, a_t, r_t, s_{t+1}) as new experience
 	// (given that an appropriate number of state measurements already exist, of course)
 	if (forward_passes > temporal_window + 1) {
-		//Experience e;
-		Experience& e = (experience.GetCount() < experience_size) ? experience.Add() : experience[Random(experience_size)];
+		// the memory is (re)allocated here, because experience_size can be changed after Init
+		if (experience.GetCapacity() != experience_size || experience.GetStateSize() != net_inputs)
+			experience.Init(net_inputs, experience_size);
 		int n = window_size;
-		HeaplessCopy(e.state0, net_window[n-2]);
-		e.action0 = action_window[n-2];
-		e.reward0 = reward_window[n-2];
-		HeaplessCopy(e.state1, net_window[n-1]);
+		experience.Add(net_window[n-2], action_window[n-2], reward_window[n-2], net_window[n-1]);
 	}
 	
+	replay_lock.Leave();
+	
+	if (actor)
+		return;
+	
 	// learn based on experience, once we have some samples to go on
 	// this is where the magic happens...
-	if (experience.GetCount() > start_learn_threshold) {
-		double avcost = 0.0;
-		for(int k = 0; k < owned_trainer->batch_size; k++) {
-			int re = Random(experience.GetCount());
-			Experience& e = experience[re];
-			ASSERTEXC(e.state0.GetCount() == net_inputs);
-			Volume x(e.state0);
-			ActionValue maxact = GetPolicy(e.state1);
-			double r = e.reward0 + gamma * maxact.value;
-			owned_trainer->Train(x, e.action0, r);
-			double loss = owned_trainer->GetLoss();
-			avcost += loss;
+	if (experience.GetCount() > start_learn_threshold)
+		LearnBatch();
+	
+	Leave();
+}
+
+void Brain::LearnBatch() {
+	// sample a minibatch of transitions and train it in one pass. The Q-values of all
+	// next states are computed with one batched forward pass first.
+	int count = max(1, owned_trainer->batch_size);
+	batch_x.Init(1, 1, net_inputs, count);
+	batch_next.Init(1, 1, net_inputs, count);
+	batch_actions.SetCount(count);
+	batch_targets.SetCount(count);
+	batch_ids.SetCount(count);
+	batch_priorities.SetCount(count);
+	
+	// the actor adds experience meanwhile in the actor/learner mode
+	replay_lock.Enter();
+	const SumTree& tree = experience.GetPriorities();
+	double total = tree.GetTotal();
+	double segment = total / count;
+	double n = experience.GetCount();
+	int step = age;
+	for(int k = 0; k < count; k++) {
+		// prioritized samples are stratified: one from every equal part of the total priority
+		int re = prioritized_replay ?
+			tree.Find((k + GetRng().Getf()) * segment) :
+			GetRng().Get(experience.GetCount());
+		batch_ids[k] = re;
+		batch_priorities[k] = tree.Get(re);
+		memcpy(batch_x.Begin(k), experience.GetState0(re), net_inputs * sizeof(Real));
+		memcpy(batch_next.Begin(k), experience.GetState1(re), net_inputs * sizeof(Real));
+		batch_actions[k] = experience.GetAction(re);
+		batch_targets[k] = experience.GetReward(re);
+	}
+	replay_lock.Leave();
+	
+	VolumeBatch& action_values = net.ForwardBatch(batch_next);
+	for(int k = 0; k < count; k++) {
+		const Real* v = action_values.Begin(k);
+		double maxval = v[0];
+		for(int j = 1; j < num_actions; j++)
+			maxval = max(maxval, (double)v[j]);
+		batch_targets[k] += gamma * maxval;
+	}
+	
+	if (prioritized_replay) {
+		// The importance-sampling weight w scales the gradient (Q(s,a) - target) of the
+		// regression layer. It is done by moving the target to Q(s,a) - w * td_error.
+		double progress = min(1.0, (double)step / max(1, learning_steps_total));
+		double beta = priority_beta + (1.0 - priority_beta) * progress;
+		double min_priority = total;
+		for(int k = 0; k < count; k++)
+			min_priority = min(min_priority, batch_priorities[k]);
+		double max_weight = pow(n * min_priority / total, -beta);
+		
+		VolumeBatch& q = net.ForwardBatch(batch_x);
+		for(int k = 0; k < count; k++) {
+			double pred = q.Get(k, batch_actions[k]);
+			double td = pred - batch_targets[k];
+			double weight = pow(n * batch_priorities[k] / total, -beta) / max_weight;
+			batch_targets[k] = pred - weight * td;
+			batch_priorities[k] = pow(fabs(td) + priority_eps, priority_alpha);
 		}
-		avcost = avcost / owned_trainer->batch_size;
-		average_loss_window.Add(avcost);
+		replay_lock.Enter();
+		for(int k = 0; k < count; k++)
+			experience.SetPriority(batch_ids[k], batch_priorities[k]);
+		replay_lock.Leave();
 	}
 	
-	Leave();
+	owned_trainer->TrainBatch(batch_x, batch_actions, batch_targets);
+	
+	// the loss window is read by the actors
+	replay_lock.Enter();
+	average_loss_window.Add(owned_trainer->GetLoss());
+	replay_lock.Leave();
+}
+
+double Brain::GetAverageLoss() const {
+	replay_lock.Enter();
+	double loss = average_loss_window.GetAverage();
+	replay_lock.Leave();
+	return loss;
+}
+
+double Brain::GetAverageLossWindowSize() const {
+	replay_lock.Enter();
+	int count = average_loss_window.GetCount();
+	replay_lock.Leave();
+	return count;
+}
+
+void Brain::StartLearner(int snapshot_interval) {
+	if (learner_running)
+		return;
+	this->snapshot_interval = max(1, snapshot_interval);
+	
+	// three snapshots are enough: one published, one being written, and one still
+	// read by an actor, which took it before the last publish
+	net.StoreParameters(snapshot_params);
+	snapshots.Clear();
+	for(int i = 0; i < 3; i++) {
+		PolicySnapshot& s = snapshots.Add();
+		s.net.Create();
+		CopyLayers(*s.net, s.owned_layers);
+		s.net->SetFusion(net.IsFusion());
+		s.net->LoadParameters(snapshot_params);
+	}
+	published = 0;
+	learner_steps = 0;
+	learner_stop = false;
+	learner_running = true;
+	learner.Run(THISBACK(LearnerLoop));
+}
+
+void Brain::StopLearner() {
+	if (!learner_running)
+		return;
+	learner_stop = true;
+	learner.Wait();
+	learner_running = false;
+	published = -1;
+	snapshots.Clear();
+}
+
+void Brain::LearnerLoop() {
+	while (!learner_stop) {
+		replay_lock.Enter();
+		bool ready = experience.GetCount() > start_learn_threshold;
+		replay_lock.Leave();
+		if (!ready) {
+			Sleep(1);
+			continue;
+		}
+		
+		Enter();
+		LearnBatch();
+		if (++learner_steps % snapshot_interval == 0)
+			PublishSnapshot();
+		Leave();
+	}
+}
+
+void Brain::PublishSnapshot() {
+	// A snapshot is written only when no actor reads it, and an actor checks after
+	// registering as a reader, that the snapshot is still the published one. If all
+	// snapshots are in use, the publish waits for the next interval.
+	int current = published;
+	for(int i = 0; i < snapshots.GetCount(); i++) {
+		PolicySnapshot& s = snapshots[i];
+		if (i == current || s.readers != 0)
+			continue;
+		net.StoreParameters(snapshot_params);
+		s.net->LoadParameters(snapshot_params);
+		published = i;
+		return;
+	}
+}
+
+int Brain::EnterSnapshot() {
+	for(;;) {
+		int i = published;
+		snapshots[i].readers++;
+		if (published == i)
+			return i;
+		snapshots[i].readers--;
+	}
+}
+
+void Brain::Serialize(Stream& s) {
+	// the learner thread uses the net and the replay memory, so it is stopped meanwhile
+	bool restart = learner_running;
+	StopLearner();
+	
+	s % random_action_distribution % temporal_window % net_inputs % num_states % num_actions %
+		window_size % state_window % action_window % reward_window % net_window %
+		experience % learning % age % forward_passes % epsilon % latest_reward % last_input_array %
+		average_reward_window % average_loss_window % net_input % action1ofk %
+		experience_size % start_learn_threshold % gamma % learning_steps_total % learning_steps_burnin %
+		epsilon_min % epsilon_test_time % prioritized_replay % priority_alpha % priority_beta %
+		priority_eps;
+	
+	if (restart)
+		StartLearner(snapshot_interval);
 }
 
 String Brain::ToString() const {
@@ -337,7 +573,7 @@ String Brain::ToString() const {
 	t << "experience replay size: " << experience.GetCount() << "\n";
 	t << "exploration epsilon: " << epsilon << "\n";
 	t << "age: " << age << "\n";
-	t << "average Q-learning loss: " << average_loss_window.GetAverage() << "\n";
+	t << "average Q-learning loss: " << GetAverageLoss() << "\n";
 	t << "smooth-ish reward: " << average_reward_window.GetAverage();
 	return t;
 }
@@ -5,21 +5,36 @@
 
 namespace ConvNet {
 
-class Experience : Moveable<Experience> {
-	
+// Replay memory of Brain. The transitions (s0, a0, r0, s1) are stored as structure of
+// arrays in one ring buffer, so that a minibatch can be gathered without allocations.
+// When the memory is full, the oldest transition is overwritten. The priorities for the
+// prioritized replay are kept in a sum-tree, and new transitions get the largest priority.
+class ReplayMemory {
+	Vector<Real> states0, states1;
+	Vector<int> actions;
+	Vector<double> rewards;
+	SumTree priorities;
+	int state_size, capacity, count, head;
 	
 public:
-	Experience();
-	Experience(const Experience& src) {*this = src;}
-	Experience& operator=(const Experience& src);
-	Experience& Set(const Vector<double>& state0, int action0, double reward0, const Vector<double>& state1);
-	void Serialize(Stream& s) {s % state0 % action0 % reward0 % state1;}
-	
-	Vector<double> state0;
-    int action0;
-    double reward0;
-    Vector<double> state1;
-    
+	ReplayMemory();
+	
+	void Init(int state_size, int capacity);
+	void Clear() {count = 0; head = 0; priorities.Init(capacity);}
+	int Add(const Vector<double>& state0, int action0, double reward0, const Vector<double>& state1);
+	void Serialize(Stream& s) {s % states0 % states1 % actions % rewards % priorities % state_size % capacity % count % head;}
+	
+	const Real* GetState0(int i) const {return states0.Begin() + i * state_size;}
+	const Real* GetState1(int i) const {return states1.Begin() + i * state_size;}
+	int GetAction(int i) const {return actions[i];}
+	double GetReward(int i) const {return rewards[i];}
+	const SumTree& GetPriorities() const {return priorities;}
+	void SetPriority(int i, double priority) {priorities.Set(i, priority);}
+	int GetStateSize() const {return state_size;}
+	int GetCapacity() const {return capacity;}
+	int GetCount() const {return count;}
+	bool IsEmpty() const {return count == 0;}
+	
 };
 
 struct ActionValue : Moveable<ActionValue> {
@@ -28,6 +43,18 @@ struct ActionValue : Moveable<ActionValue> {
 };
 
 class Brain : public Session {
+	
+	// An immutable copy of the weights for the actors in the actor/learner mode. The
+	// learner writes only snapshots, which are neither published nor being read.
+	struct PolicySnapshot {
+		One<Net> net;
+		Vector<LayerBasePtr> owned_layers;
+		std::atomic<int> readers;
+		
+		PolicySnapshot() : readers(0) {}
+		~PolicySnapshot();
+	};
+	
 	Vector<double> random_action_distribution;
 	
 	int temporal_window;
@@ -41,36 +68,55 @@ class Brain : public Session {
 	Vector<Vector<double> > net_window;
 	
 	
-	Vector<Experience> experience;
+	ReplayMemory experience;
 	bool learning;
 	int age, forward_passes;
 	double epsilon, latest_reward;
 	Vector<double> last_input_array;
 	Window average_reward_window, average_loss_window;
+	AllocStat act_allocs, learn_allocs;
 	
 	// Temp vars
 	Vector<double> net_input;
 	Vector<double> action1ofk;
+	VolumeBatch batch_x, batch_next;
+	Vector<int> batch_actions;
+	Vector<double> batch_targets, batch_priorities;
+	Vector<int> batch_ids;
+	Volume policy_input;
+	PredictWorkspace policy_ws;
+	
+	// Actor/learner mode
+	Array<PolicySnapshot> snapshots;
+	Vector<Real> snapshot_params;
+	std::atomic<int> published;
+	std::atomic<bool> learner_stop;
+	std::atomic<int64> learner_steps;
+	Thread learner;
+	mutable SpinLock replay_lock; // the replay memory and the loss window
+	int snapshot_interval;
+	bool learner_running;
+	
+	void LearnBatch();
+	void LearnerLoop();
+	void PublishSnapshot();
+	int EnterSnapshot();
+	void LeaveSnapshot(int i) {snapshots[i].readers--;}
 	
 public:
 	typedef Brain CLASSNAME;
 	Brain();
+	~Brain() {StopLearner();}
 	
 	void Init(int num_states, int num_actions, Vector<double>* random_action_distribution=NULL);
 	void Reset() {Init(num_states, num_actions);}
-	void Serialize(Stream& s) {
-		s % random_action_distribution % temporal_window % net_inputs % num_states % num_actions %
-			window_size % state_window % action_window % reward_window % net_window %
-			experience % learning % age % forward_passes % epsilon % latest_reward % last_input_array %
-			average_reward_window % average_loss_window % net_input % action1ofk %
-			experience_size % start_learn_threshold % gamma % learning_steps_total % learning_steps_burnin %
-			epsilon_min % epsilon_test_time;
-	}
+	void Serialize(Stream& s);
 	
 	virtual const Vector<double>& GetLastInput() const {return last_input_array;}
 	
 	int GetRandomAction();
 	ActionValue GetPolicy(const Vector<double>& weights);
+	ActionValue GetPolicy(const Vector<double>& weights, PredictWorkspace& ws);
 	void GetNetInput(const Vector<double>& xt, Vector<double>& w);
 	int Forward(const Vector<double>& input_array);
 	void Backward(double reward);
@@ -79,18 +125,30 @@ public:
 	double GetLatestReward() const {return latest_reward;}
 	double GetAverageReward() const {return average_reward_window.GetAverage();}
 	double GetAverageRewardWindowSize() const {return average_reward_window.GetCount();}
-	double GetAverageLoss() const {return average_loss_window.GetAverage();}
-	double GetAverageLossWindowSize() const {return average_loss_window.GetCount();}
+	double GetAverageLoss() const;
+	double GetAverageLossWindowSize() const;
 	int GetExperienceCount() const {return experience.GetCount();}
 	double GetEpsilon() const {return epsilon;}
 	int GetAge() const {return age;}
+	const AllocStat& GetActAllocStat() const {return act_allocs;}
+	const AllocStat& GetLearnAllocStat() const {return learn_allocs;}
 	bool IsStartTrainingTreshold() const {return experience.GetCount() > start_learn_threshold;}
-	virtual double GetLossAverage() const {return average_loss_window.GetAverage();}
+	virtual double GetLossAverage() const {return GetAverageLoss();}
 	virtual double GetRewardAverage() const {return average_reward_window.GetAverage();}
 	
 	void SetLearning(bool b) {learning = b;}
 	void SetStartTrainingTreshold(int i) {start_learn_threshold = i;}
 	
+	// Actor/learner mode: a learner thread trains from the replay memory continuously,
+	// and publishes a snapshot of the weights after every snapshot_interval minibatches.
+	// Forward and GetPolicy read the latest snapshot without locking, and Backward only
+	// stores the experience, so the caller isn't stalled by the learning. GetPolicy with
+	// an own workspace can be called from many threads at the same time.
+	void StartLearner(int snapshot_interval=10);
+	void StopLearner();
+	bool IsLearnerRunning() const {return learner_running;}
+	int64 GetLearnerSteps() const {return learner_steps;}
+	
 	int experience_size;
 	double start_learn_threshold;
 	double gamma;
@@ -98,6 +156,15 @@ public:
 	int learning_steps_burnin;
 	double epsilon_min;
 	double epsilon_test_time;
+	
+	// Prioritized experience replay: transitions are sampled with the probability
+	// (|td error| + priority_eps)^priority_alpha, and the updates are scaled with
+	// importance-sampling weights, whose exponent anneals from priority_beta to 1
+	// during learning_steps_total.
+	bool prioritized_replay;
+	double priority_alpha;
+	double priority_beta;
+	double priority_eps;
 
 	String ToString() const;
 	
@@ -13,6 +13,9 @@ ConvLayer::ConvLayer(int width, int height, int filter_count) {
 	this->width = width;
 	this->height = height;
 	
+	engine = CONV_IM2COL;
+	fused_pool = NULL;
+	col_input = NULL;
 }
 
 void ConvLayer::Init(int input_width, int input_height, int input_depth) {
@@ -38,18 +41,43 @@ void ConvLayer::UpdateOutputSize() {
 	filters.SetCount(0);
 	
 	for (int i = 0; i < output_depth; i++) {
-		filters.Add().Init(width, height, input_depth);
+		if (shape_only)
+			filters.Add().InitShape(width, height, input_depth);
+		else
+			filters.Add().Init(width, height, input_depth);
 	}
 	
-	biases.Init(1, 1, output_depth, bias);
+	if (shape_only)
+		biases.InitShape(1, 1, output_depth);
+	else
+		biases.Init(1, 1, output_depth, bias);
 }
 
 Volume& ConvLayer::Forward(Volume& input, bool is_training) {
 	// optimized code by @mdda that achieves 2x speedup over previous version
 	
 	input_activation = &input;
+	
+	if (fused_pool && engine == CONV_IM2COL) {
+		PoolLayer& pool = *fused_pool;
+		const Volume& in = input;
+		pool.output_activation.Init(pool.output_width, pool.output_height, pool.output_depth, 0.0);
+		PackFilters();
+		ForwardPooled(in.Begin(), in.GetWidth(), in.GetHeight(), in.GetDepth(),
+			pool.output_activation.Begin(), pool.switchx.Begin(), pool.switchy.Begin());
+		return pool.output_activation;
+	}
+	
 	output_activation.Init(output_width, output_height, output_depth, 0.0);
 	
+	if (engine == CONV_IM2COL) {
+		const Volume& in = input;
+		PackFilters();
+		ForwardIm2Col(in.Begin(), in.GetWidth(), in.GetHeight(), in.GetDepth(), output_activation.Begin());
+		ApplyActivation(fused_activation, output_activation.Begin(), output_activation.GetLength());
+		return output_activation;
+	}
+	
 	int volume_width = input.GetWidth();
 	int volume_height = input.GetHeight();
 	int xy_stride = GetStride();
@@ -85,12 +113,75 @@ Volume& ConvLayer::Forward(Volume& input, bool is_training) {
 		}
 	}
 	
+	ApplyActivation(fused_activation, output_activation.Begin(), output_activation.GetLength());
+	if (fused_pool)
+		return fused_pool->Forward(output_activation, is_training);
 	return output_activation;
 }
 
+void ConvLayer::Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const {
+	// always the im2col engine, with the column matrix and the packed filters in tmp
+	output.Init(output_width, output_height, output_depth, 0.0);
+	
+	int k = width * height * input.GetDepth();
+	int positions = output_width * output_height;
+	ASSERT(k == filters[0].GetLength());
+	
+	bool contiguous = HasContiguousFilters();
+	tmp.SetCount(positions * k + (contiguous ? 0 : output_depth * k));
+	Real* col = tmp.Begin();
+	const Real* w = filters[0].Begin();
+	if (!contiguous) {
+		Real* packed = col + positions * k;
+		for (int f = 0; f < output_depth; f++)
+			memcpy(packed + f * k, filters[f].Begin(), k * sizeof(Real));
+		w = packed;
+	}
+	
+	Im2Col(input.Begin(), input.GetWidth(), input.GetHeight(), input.GetDepth(),
+		width, height, stride, pad, output_width, output_height, col);
+	
+	Real* out = output.Begin();
+	const Real* b = biases.Begin();
+	for (int i = 0; i < positions; i++)
+		for (int f = 0; f < output_depth; f++)
+			out[i * output_depth + f] = b[f];
+	Gemm(false, true, positions, output_depth, k,
+		1.0, col, k, w, k,
+		1.0, out, output_depth);
+	ApplyActivation(fused_activation, out, positions * output_depth);
+}
+
 void ConvLayer::Backward() {
 	Volume& input = *input_activation;
-	input.ZeroGradients(); // zero out gradient wrt bottom data, we're about to fill it
+	Real* din = NULL;
+	if (!skip_input_gradient) {
+		input.ZeroGradients(); // zero out gradient wrt bottom data, we're about to fill it
+		din = input.GradientBegin();
+	}
+	
+	if (fused_pool && engine == CONV_IM2COL) {
+		const Volume& in = input;
+		const Volume& out = fused_pool->output_activation;
+		BeginFilterGradients();
+		BackwardPooled(in.Begin(), in.GetWidth(), in.GetHeight(), in.GetDepth(), din,
+			out.Begin(), out.GradientBegin(), fused_pool->switchx.Begin(), fused_pool->switchy.Begin());
+		EndFilterGradients();
+		return;
+	}
+	
+	if (fused_pool)
+		fused_pool->Backward();
+	ActivationGradient(fused_activation, output_activation.Begin(), output_activation.GradientBegin(), output_activation.GetLength());
+	
+	if (engine == CONV_IM2COL) {
+		const Volume& in = input;
+		BeginFilterGradients();
+		BackwardIm2Col(in.Begin(), in.GetWidth(), in.GetHeight(), in.GetDepth(),
+			din, output_activation.GradientBegin());
+		EndFilterGradients();
+		return;
+	}
 	
 	int volume_width = input.GetWidth();
 	int volume_height = input.GetHeight();
@@ -118,19 +209,368 @@ void ConvLayer::Backward() {
 						double ox = x + fx;
 						if (oy >= 0 && oy < volume_height && ox >= 0 && ox < volume_width) {
 							for (int fd = 0; fd < filter.GetDepth(); fd++) {
-								filter.AddGradient(fx, fy, fd, input.Get(ox, oy, fd) * chain_gradient_);
-								input.AddGradient( ox, oy, fd, filter.Get(fx, fy, fd) * chain_gradient_);
+								if (!frozen)
+									filter.AddGradient(fx, fy, fd, input.Get(ox, oy, fd) * chain_gradient_);
+								if (din)
+									input.AddGradient( ox, oy, fd, filter.Get(fx, fy, fd) * chain_gradient_);
 							}
 						}
 					}
 				}
 				
-				biases.AddGradient(depth, chain_gradient_);
+				if (!frozen)
+					biases.AddGradient(depth, chain_gradient_);
+			}
+		}
+	}
+}
+
+VolumeBatch& ConvLayer::ForwardBatch(VolumeBatch& input, bool is_training) {
+	input_batch = &input;
+	int count = input.GetCount();
+	
+	int volume_width = input.GetWidth();
+	int volume_height = input.GetHeight();
+	int volume_depth = input.GetDepth();
+	int xy_stride = GetStride();
+	
+	if (fused_pool && engine == CONV_IM2COL) {
+		PoolLayer& pool = *fused_pool;
+		VolumeBatch& out = pool.output_batch;
+		out.Init(pool.output_width, pool.output_height, pool.output_depth, count, 0.0);
+		int length = out.GetLength();
+		pool.switchx_batch.SetCount(length * count);
+		pool.switchy_batch.SetCount(length * count);
+		PackFilters();
+		for (int b = 0; b < count; b++)
+			ForwardPooled(input.Begin(b), volume_width, volume_height, volume_depth, out.Begin(b),
+				pool.switchx_batch.Begin() + b * length, pool.switchy_batch.Begin() + b * length);
+		return out;
+	}
+	
+	output_batch.Init(output_width, output_height, output_depth, count, 0.0);
+	
+	if (engine == CONV_IM2COL) {
+		PackFilters();
+		for (int b = 0; b < count; b++)
+			ForwardIm2Col(input.Begin(b), volume_width, volume_height, volume_depth, output_batch.Begin(b));
+		ApplyActivation(fused_activation, output_batch.Begin(), output_batch.GetLength() * count);
+		return output_batch;
+	}
+	
+	for (int depth = 0; depth < output_depth; depth++) {
+		const Real* f = filters[depth].Begin();
+		double bias = biases.Get(depth);
+		
+		// the filter stays in the cache while it is applied to all samples
+		for (int b = 0; b < count; b++) {
+			const Real* in = input.Begin(b);
+			Real* out = output_batch.Begin(b);
+			
+			int y = -GetPad();
+			for (int ay = 0; ay < output_height; y += xy_stride, ay++) {
+				int x = -GetPad();
+				for (int ax = 0; ax < output_width; x += xy_stride, ax++) {
+					
+					// convolve centered at this particular location
+					double a = 0.0;
+					for (int fy = 0; fy < height; fy++) {
+						int oy = y + fy;
+						if (oy < 0 || oy >= volume_height)
+							continue;
+						for (int fx = 0; fx < width; fx++) {
+							int ox = x + fx;
+							if (ox < 0 || ox >= volume_width)
+								continue;
+							const Real* fp = f + (width * fy + fx) * volume_depth;
+							const Real* ip = in + (volume_width * oy + ox) * volume_depth;
+							for (int fd = 0; fd < volume_depth; fd++)
+								a += fp[fd] * ip[fd];
+						}
+					}
+					
+					out[(output_width * ay + ax) * output_depth + depth] = a + bias;
+				}
+			}
+		}
+	}
+	
+	ApplyActivation(fused_activation, output_batch.Begin(), output_batch.GetLength() * count);
+	if (fused_pool)
+		return fused_pool->ForwardBatch(output_batch, is_training);
+	return output_batch;
+}
+
+void ConvLayer::BackwardBatch() {
+	VolumeBatch& input = *input_batch;
+	int count = input.GetCount();
+	bool input_gradient = !skip_input_gradient;
+	if (input_gradient)
+		input.ZeroGradients(); // zero out gradient wrt bottom data, we're about to fill it
+	
+	int volume_width = input.GetWidth();
+	int volume_height = input.GetHeight();
+	int volume_depth = input.GetDepth();
+	int xy_stride = GetStride();
+	
+	if (fused_pool && engine == CONV_IM2COL) {
+		const PoolLayer& pool = *fused_pool;
+		const VolumeBatch& out = pool.output_batch;
+		int length = out.GetLength();
+		BeginFilterGradients();
+		for (int b = 0; b < count; b++)
+			BackwardPooled(input.Begin(b), volume_width, volume_height, volume_depth,
+				input_gradient ? input.GradientBegin(b) : NULL,
+				out.Begin(b), out.GradientBegin(b),
+				pool.switchx_batch.Begin() + b * length, pool.switchy_batch.Begin() + b * length);
+		EndFilterGradients();
+		return;
+	}
+	
+	if (fused_pool)
+		fused_pool->BackwardBatch();
+	ActivationGradient(fused_activation, output_batch.Begin(), output_batch.GradientBegin(), output_batch.GetLength() * count);
+	
+	if (engine == CONV_IM2COL) {
+		// the column matrix of the last sample is usually still there from ForwardBatch, so start from it
+		BeginFilterGradients();
+		for (int b = count - 1; b >= 0; b--)
+			BackwardIm2Col(input.Begin(b), volume_width, volume_height, volume_depth,
+				input_gradient ? input.GradientBegin(b) : NULL, output_batch.GradientBegin(b));
+		EndFilterGradients();
+		return;
+	}
+	
+	for (int depth = 0; depth < output_depth; depth++) {
+		Volume& filter = filters[depth];
+		const Real* f = filter.Begin();
+		Real* df = filter.GradientBegin();
+		double bias_gradient = 0.0;
+		
+		for (int b = 0; b < count; b++) {
+			const Real* in = input.Begin(b);
+			Real* din = input.GradientBegin(b);
+			const Real* dout = output_batch.GradientBegin(b);
+			
+			int y = -GetPad();
+			for (int ay = 0; ay < output_height; y += xy_stride, ay++) {
+				int x = -GetPad();
+				for (int ax = 0; ax < output_width; x += xy_stride, ax++) {
+					
+					// gradient from above, from chain rule
+					double chain_gradient_ = dout[(output_width * ay + ax) * output_depth + depth];
+					
+					for (int fy = 0; fy < height; fy++) {
+						int oy = y + fy;
+						if (oy < 0 || oy >= volume_height)
+							continue;
+						for (int fx = 0; fx < width; fx++) {
+							int ox = x + fx;
+							if (ox < 0 || ox >= volume_width)
+								continue;
+							int fi = (width * fy + fx) * volume_depth;
+							int ii = (volume_width * oy + ox) * volume_depth;
+							if (!frozen)
+								for (int fd = 0; fd < volume_depth; fd++)
+									df[fi + fd] += in[ii + fd] * chain_gradient_;
+							if (input_gradient)
+								for (int fd = 0; fd < volume_depth; fd++)
+									din[ii + fd] += f[fi + fd] * chain_gradient_;
+						}
+					}
+					
+					bias_gradient += chain_gradient_;
+				}
+			}
+		}
+		if (!frozen)
+			biases.AddGradient(depth, bias_gradient);
+	}
+}
+
+bool ConvLayer::HasContiguousFilters() const {
+	// true when the net has packed the filters into its parameter arena
+	int k = filters[0].GetLength();
+	const Real* w = filters[0].Begin();
+	const Real* dw = filters[0].GradientBegin();
+	for (int f = 1; f < output_depth; f++)
+		if (filters[f].Begin() != w + f * k || filters[f].GradientBegin() != dw + f * k)
+			return false;
+	return true;
+}
+
+void ConvLayer::PackFilters() {
+	// filters as the rows of a filter_count x (width * height * depth) matrix
+	const Vector<Volume>& filters = this->filters;
+	if (HasContiguousFilters()) {
+		filter_w = filters[0].Begin();
+		return;
+	}
+	int k = filters[0].GetLength();
+	filter_matrix.SetCount(output_depth * k);
+	for (int f = 0; f < output_depth; f++)
+		memcpy(filter_matrix.Begin() + f * k, filters[f].Begin(), k * sizeof(Real));
+	filter_w = filter_matrix.Begin();
+}
+
+void ConvLayer::BeginFilterGradients() {
+	// accumulate directly to the filters when possible
+	if (frozen)
+		return;
+	if (HasContiguousFilters()) {
+		filter_dw = filters[0].GradientBegin();
+		return;
+	}
+	filter_gradient_matrix.SetCount(0);
+	filter_gradient_matrix.SetCount(output_depth * filters[0].GetLength(), 0.0);
+	filter_dw = filter_gradient_matrix.Begin();
+}
+
+void ConvLayer::EndFilterGradients() {
+	if (frozen || filter_dw != filter_gradient_matrix.Begin())
+		return;
+	int k = filters[0].GetLength();
+	for (int f = 0; f < output_depth; f++) {
+		Real* df = filters[f].GradientBegin();
+		const Real* src = filter_gradient_matrix.Begin() + f * k;
+		for (int i = 0; i < k; i++)
+			df[i] += src[i];
+	}
+}
+
+void ConvLayer::ForwardIm2Col(const Real* in, int in_w, int in_h, int in_d, Real* out) {
+	int k = width * height * in_d;
+	int positions = output_width * output_height;
+	ASSERT(k == filters[0].GetLength());
+	
+	col.SetCount(positions * k);
+	Im2Col(in, in_w, in_h, in_d, width, height, stride, pad, output_width, output_height, col.Begin());
+	col_input = in;
+	
+	// start from the biases and add the product of the columns and the filters
+	for (int i = 0; i < positions; i++) {
+		Real* o = out + i * output_depth;
+		for (int f = 0; f < output_depth; f++)
+			o[f] = biases.Get(f);
+	}
+	Gemm(false, true, positions, output_depth, k,
+		1.0, col.Begin(), k, filter_w, k,
+		1.0, out, output_depth);
+}
+
+void ConvLayer::BackwardIm2Col(const Real* in, int in_w, int in_h, int in_d, Real* din, const Real* dout) {
+	int k = width * height * in_d;
+	int positions = output_width * output_height;
+	
+	if (!frozen) {
+		// the columns are reused only when the last Forward built them from this input
+		if (col_input != in) {
+			col.SetCount(positions * k);
+			Im2Col(in, in_w, in_h, in_d, width, height, stride, pad, output_width, output_height, col.Begin());
+			col_input = in;
+		}
+		
+		// gradient wrt biases
+		for (int f = 0; f < output_depth; f++) {
+			double sum = 0.0;
+			for (int i = 0; i < positions; i++)
+				sum += dout[i * output_depth + f];
+			biases.AddGradient(f, sum);
+		}
+		
+		// gradient wrt filters: dout^T * col, accumulated over calls
+		Gemm(true, false, output_depth, k, positions,
+			1.0, dout, output_depth, col.Begin(), k,
+			1.0, filter_dw, k);
+	}
+	
+	// gradient wrt input: dout * filters gives the columns, which are added back to the volume.
+	// din is NULL, when nobody reads it.
+	if (!din)
+		return;
+	col_gradient.SetCount(positions * k);
+	Gemm(false, false, positions, k, output_depth,
+		1.0, dout, output_depth, filter_w, k,
+		0.0, col_gradient.Begin(), k);
+	Col2Im(col_gradient.Begin(), in_w, in_h, in_d, width, height, stride, pad, output_width, output_height, din);
+}
+
+void ConvLayer::ForwardPooled(const Real* in, int in_w, int in_h, int in_d, Real* out, int* sx, int* sy) {
+	// The pool windows don't overlap, so one row of the pool needs only a band of
+	// pool height rows of the convolution, which is computed to the tile.
+	const PoolLayer& pool = *fused_pool;
+	int pool_w = pool.output_width;
+	int pool_h = pool.output_height;
+	int k = width * height * in_d;
+	int positions = output_width * pool.height;
+	ASSERT(k == filters[0].GetLength());
+	ASSERT(pool.stride == pool.width && pool.stride == pool.height && !pool.pad);
+	
+	col.SetCount(positions * k);
+	col_input = NULL; // only a band of rows
+	tile.SetCount(positions * output_depth);
+	for (int py = 0; py < pool_h; py++) {
+		int y0 = py * pool.height;
+		Im2ColRows(in, in_w, in_h, in_d, width, height, stride, pad, output_width, y0, pool.height, col.Begin());
+		Real* t = tile.Begin();
+		for (int i = 0; i < positions; i++)
+			for (int f = 0; f < output_depth; f++)
+				t[i * output_depth + f] = biases.Get(f);
+		Gemm(false, true, positions, output_depth, k,
+			1.0, col.Begin(), k, filter_w, k,
+			1.0, t, output_depth);
+		ApplyActivation(fused_activation, t, positions * output_depth);
+		
+		// same scan order and switch order as in PoolLayer::Forward
+		for (int px = 0; px < pool_w; px++) {
+			int x0 = px * pool.width;
+			Real* o = out + (pool_w * py + px) * output_depth;
+			for (int depth = 0; depth < output_depth; depth++) {
+				double a = -DBL_MAX;
+				int winx = -1, winy = -1;
+				for (int fx = 0; fx < pool.width; fx++) {
+					for (int fy = 0; fy < pool.height; fy++) {
+						double v = t[(output_width * fy + x0 + fx) * output_depth + depth];
+						if (v > a) {
+							a = v;
+							winx = x0 + fx;
+							winy = y0 + fy;
+						}
+					}
+				}
+				int n = (depth * pool_w + px) * pool_h + py;
+				sx[n] = winx;
+				sy[n] = winy;
+				o[depth] = (Real)a;
 			}
 		}
 	}
 }
 
+void ConvLayer::BackwardPooled(const Real* in, int in_w, int in_h, int in_d, Real* din,
+	const Real* out, const Real* dout, const int* sx, const int* sy) {
+	// the pooled gradients go to the winners, and the others stay zero
+	const PoolLayer& pool = *fused_pool;
+	int pool_w = pool.output_width;
+	int pool_h = pool.output_height;
+	int length = pool_w * pool_h * output_depth;
+	
+	tile.SetCount(length);
+	memcpy(tile.Begin(), dout, length * sizeof(Real));
+	ActivationGradient(fused_activation, out, tile.Begin(), length);
+	
+	tile_gradient.SetCount(0);
+	tile_gradient.SetCount(output_width * output_height * output_depth, 0.0);
+	Real* d = tile_gradient.Begin();
+	int n = 0;
+	for (int depth = 0; depth < output_depth; depth++)
+		for (int px = 0; px < pool_w; px++)
+			for (int py = 0; py < pool_h; py++, n++)
+				d[(output_width * sy[n] + sx[n]) * output_depth + depth] += tile[(pool_w * py + px) * output_depth + depth];
+	
+	BackwardIm2Col(in, in_w, in_h, in_d, din, d);
+}
+
 Vector<ParametersAndGradients>& ConvLayer::GetParametersAndGradients() {
 	
 	response.SetCount(output_depth + 1);
@@ -154,7 +594,7 @@ Vector<ParametersAndGradients>& ConvLayer::GetParametersAndGradients() {
 #define LOADVAR(field, json) this->field = map.GetValue(map.Find(#json));
 #define LOADVARDEF(field, json, def) {Value tmp = map.GetValue(map.Find(#json)); if (tmp.IsNull()) this->field = def; else this->field = tmp;}
 
-void ConvLayer::Store(ValueMap& map) const {
+void ConvLayer::StoreLayer(ValueMap& map, bool values) const {
 	STOREVAR(out_depth, output_depth);
 	STOREVAR(out_sx, output_width);
 	STOREVAR(out_sy, output_height);
@@ -169,15 +609,15 @@ void ConvLayer::Store(ValueMap& map) const {
 	STOREVAR(input_depth, input_depth);
 	
 	Value filters;
-	for (int i = 0; i < filters.GetCount(); i++) {
+	for (int i = 0; i < this->filters.GetCount(); i++) {
 		ValueMap map;
-		this->filters[i].Store(map);
+		this->filters[i].Store(map, values);
 		filters.Add(map);
 	}
 	map.GetAdd("filters") = filters;
 	
 	ValueMap biases;
-	this->biases.Store(biases);
+	this->biases.Store(biases, values);
 	map.GetAdd("biases") = biases;
 }
 
@@ -218,4 +658,109 @@ String ConvLayer::ToString() const {
 		width, height, input_depth, bias_pref, filter_count, l1_decay_mul, l2_decay_mul, stride, pad);
 }
 
+static bool CheckNear(const Real* a, const Real* b, int n, const char* what, String& error) {
+	const double tol = sizeof(Real) == sizeof(float) ? 1e-3 : 1e-8;
+	for (int i = 0; i < n; i++) {
+		if (fabs((double)a[i] - b[i]) > tol * max(1.0, fabs((double)b[i]))) {
+			error = Format("%s differs at %d: %g, reference %g", what, i, (double)a[i], (double)b[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool CheckConvEngine(int in_w, int in_h, int in_d, int fw, int fh, int filter_count,
+	int stride, int pad, int activation, bool pooled, String& error) {
+	const int count = 3;
+	
+	// the same random filters and biases for both engines
+	ConvLayer conv(fw, fh, filter_count), ref(fw, fh, filter_count);
+	conv.stride = ref.stride = stride;
+	conv.pad = ref.pad = pad;
+	conv.Init(in_w, in_h, in_d);
+	ref.Init(in_w, in_h, in_d);
+	for (int f = 0; f < filter_count; f++)
+		ref.filters[f] = conv.filters[f];
+	GetRng().FillGaussian(conv.biases.Begin(), filter_count, 0, 1);
+	ref.biases = conv.biases;
+	ref.SetEngine(CONV_REFERENCE);
+	conv.fused_activation = ref.fused_activation = activation;
+	
+	PoolLayer conv_pool(2, 2), ref_pool(2, 2);
+	if (pooled) {
+		conv_pool.Init(conv.output_width, conv.output_height, conv.output_depth);
+		ref_pool.Init(conv.output_width, conv.output_height, conv.output_depth);
+		conv.fused_pool = &conv_pool;
+		ref.fused_pool = &ref_pool;
+	}
+	
+	Volume in(in_w, in_h, in_d);
+	VolumeBatch batch;
+	batch.Init(in_w, in_h, in_d, count);
+	GetRng().FillGaussian(batch.Begin(), batch.GetLength() * count, 0, 1);
+	
+	Volume& out = conv.Forward(in, true);
+	Volume& ref_out = ref.Forward(in, true);
+	if (!CheckNear(out.Begin(), ref_out.Begin(), out.GetLength(), "Forward output", error))
+		return false;
+	
+	// the batch runs before the backward of the single sample, so the columns of
+	// the im2col engine are not from this input anymore
+	VolumeBatch& out_batch = conv.ForwardBatch(batch, true);
+	VolumeBatch& ref_out_batch = ref.ForwardBatch(batch, true);
+	if (!CheckNear(out_batch.Begin(), ref_out_batch.Begin(), out_batch.GetLength() * count, "ForwardBatch output", error))
+		return false;
+	
+	GetRng().FillGaussian(out.GradientBegin(), out.GetLength(), 0, 1);
+	memcpy(ref_out.GradientBegin(), out.GradientBegin(), out.GetLength() * sizeof(Real));
+	GetRng().FillGaussian(out_batch.GradientBegin(), out_batch.GetLength() * count, 0, 1);
+	memcpy(ref_out_batch.GradientBegin(), out_batch.GradientBegin(), out_batch.GetLength() * count * sizeof(Real));
+	
+	// the layers share the input, so its gradient is kept before the reference overwrites it
+	Vector<Real> din;
+	conv.Backward();
+	din.SetCount(in.GetLength());
+	memcpy(din.Begin(), in.GradientBegin(), in.GetLength() * sizeof(Real));
+	ref.Backward();
+	if (!CheckNear(din.Begin(), in.GradientBegin(), in.GetLength(), "Backward input gradient", error))
+		return false;
+	
+	conv.BackwardBatch();
+	din.SetCount(batch.GetLength() * count);
+	memcpy(din.Begin(), batch.GradientBegin(), din.GetCount() * sizeof(Real));
+	ref.BackwardBatch();
+	if (!CheckNear(din.Begin(), batch.GradientBegin(), din.GetCount(), "BackwardBatch input gradient", error))
+		return false;
+	
+	// the filter gradients are accumulated over both passes
+	for (int f = 0; f < filter_count; f++)
+		if (!CheckNear(conv.filters[f].GradientBegin(), ref.filters[f].GradientBegin(), conv.filters[f].GetLength(), "Filter gradient", error))
+			return false;
+	return CheckNear(conv.biases.GradientBegin(), ref.biases.GradientBegin(), filter_count, "Bias gradient", error);
+}
+
+bool CheckConvEngines(String& error) {
+	static const int configs[][8] = {
+		// input w, h, d, filter w, h, count, stride, pad
+		{7, 7, 3, 3, 3, 4, 1, 0},
+		{8, 8, 3, 3, 3, 5, 1, 1},
+		{9, 7, 2, 3, 3, 4, 2, 1},
+		{10, 10, 3, 5, 5, 3, 2, 2},
+		{6, 5, 1, 1, 1, 2, 1, 0},
+	};
+	for (int i = 0; i < __countof(configs); i++) {
+		const int* c = configs[i];
+		for (int act = ACT_NONE; act <= ACT_SIGMOID; act++) {
+			for (int pooled = 0; pooled < 2; pooled++) {
+				if (!CheckConvEngine(c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7], act, pooled, error)) {
+					error = Format("Conv %dx%dx%d, filter %dx%dx%d, stride %d, pad %d, activation %d%s: ",
+						c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7], act, pooled ? ", pooled" : "") + error;
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
 }
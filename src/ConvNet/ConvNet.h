@@ -56,8 +56,19 @@
 	before destructor. These classes are intended to be used from a single thread, so temp class
 	variables shouldn't be a problem.
 	
-	Multi- or many-thread usage won't be supported in the main repository of ConvNetC++, because
-	of the readibility problems.
+	The CONVNET_ALLOC_COUNT flag (with USEMALLOC, on glibc) counts the allocations of the
+	training steps, predictions and agent steps (see AllocStat of Session, TrainerBase,
+	PredictWorkspace, Brain and Agent). After the warm-up, SetStrictAllocation makes every
+	allocation in them panic, which shows in the debugger where the allocation came from.
+	
+	Nets and layers are still used from a single thread. The only exception is the batch
+	training of Session with SetThreadCount: every minibatch is split between replicas of the
+	net, which read the same weights but have their own activations and gradients. The
+	gradients are summed to the net of the session before the update of the trainer.
+	
+	To find the slow layers, build with the CONVNET_PROFILE flag and call Net::SetProfiling.
+	The NetProfile of the net has the cycles, flops and bytes of every layer, and it can
+	write a trace for chrome://tracing.
 	
 	
 	TODO
@@ -67,10 +78,12 @@
 */
 
 #include "Utilities.h"
+#include "Kernels.h"
 #include "Net.h"
 #include "Layers.h"
 #include "Training.h"
 #include "Session.h"
+#include "QuantizedNet.h"
 #include "Brain.h"
 #include "MetaSession.h"
 #include "MagicNet.h"
@@ -0,0 +1,241 @@
+#include "ConvNet.h"
+
+namespace ConvNet {
+
+static const char shard_magic[4] = {'C', 'N', 'N', 'D'};
+
+enum {
+	SHARD_VERSION = 1,
+	SHARD_HEADER_SIZE = 28
+};
+
+ShardedFileSource::ShardedFileSource() {
+	width = 0;
+	height = 0;
+	depth = 0;
+	class_count = 0;
+}
+
+bool ShardedFileSource::AddShard(const String& path, bool test) {
+	Shard& s = shards[test].Add();
+	int64 size = s.file.Open(path) ? s.file.GetFileSize() : 0;
+	if (size < SHARD_HEADER_SIZE || !s.file.Map(0, (size_t)size)) {
+		shards[test].Drop();
+		return false;
+	}
+	
+	const byte* p = s.file.Begin();
+	int version = Peek32le(p + 4);
+	int w = Peek32le(p + 12);
+	int h = Peek32le(p + 16);
+	int d = Peek32le(p + 20);
+	dword scale = Peek32le(p + 24);
+	float f;
+	memcpy(&f, &scale, 4);
+	s.elem_size = Peek32le(p + 8);
+	s.scale = f;
+	
+	bool first = shards[0].GetCount() + shards[1].GetCount() == 1;
+	if (memcmp(p, shard_magic, 4) || version != SHARD_VERSION ||
+		(s.elem_size != 1 && s.elem_size != 4) || w <= 0 || h <= 0 || d <= 0 ||
+		(!first && (w != width || h != height || d != depth))) {
+		LOG("ERROR: INVALID SHARD " + path);
+		shards[test].Drop();
+		return false;
+	}
+	width = w;
+	height = h;
+	depth = d;
+	
+	int64 record_size = 4 + (int64)GetLength() * s.elem_size;
+	if ((size - SHARD_HEADER_SIZE) % record_size) {
+		LOG("ERROR: TRUNCATED SHARD " + path);
+		shards[test].Drop();
+		return false;
+	}
+	
+	// labels are kept in the memory, because the session reads them often
+	Vector<int>& l = labels[test];
+	s.begin = l.GetCount();
+	s.count = (int)((size - SHARD_HEADER_SIZE) / record_size);
+	p += SHARD_HEADER_SIZE;
+	for(int i = 0; i < s.count; i++, p += record_size) {
+		int label = Peek32le(p);
+		l.Add(label);
+		class_count = max(class_count, label + 1);
+	}
+	
+	return true;
+}
+
+const ShardedFileSource::Shard* ShardedFileSource::FindShard(bool test, int i) const {
+	const Array<Shard>& list = shards[test];
+	int a = 0, b = list.GetCount();
+	while (a < b) {
+		int mid = (a + b) / 2;
+		if (list[mid].begin + list[mid].count <= i)
+			a = mid + 1;
+		else
+			b = mid;
+	}
+	if (a < list.GetCount() && i >= list[a].begin)
+		return &list[a];
+	return NULL;
+}
+
+bool ShardedFileSource::Read(bool test, int i, int count, Real* dst) {
+	int length = GetLength();
+	while (count > 0) {
+		const Shard* s = FindShard(test, i);
+		if (!s)
+			return false;
+		
+		int n = min(count, s->begin + s->count - i);
+		int64 record_size = 4 + (int64)length * s->elem_size;
+		const byte* p = s->file.Begin() + SHARD_HEADER_SIZE + (i - s->begin) * record_size;
+		for(int j = 0; j < n; j++, p += record_size) {
+			const byte* v = p + 4;
+			if (s->elem_size == 1) {
+				for(int k = 0; k < length; k++)
+					*dst++ = (Real)(v[k] * s->scale);
+			}
+			else {
+				for(int k = 0; k < length; k++) {
+					dword d = Peek32le(v + k * 4);
+					float f;
+					memcpy(&f, &d, 4);
+					*dst++ = (Real)f;
+				}
+			}
+		}
+		i += n;
+		count -= n;
+	}
+	return true;
+}
+
+
+
+
+ShardWriter::ShardWriter() {
+	length = 0;
+	elem_size = 4;
+	scale = 1.0;
+}
+
+bool ShardWriter::Open(const String& path, int width, int height, int depth, int elem_size, double scale) {
+	ASSERT(elem_size == 1 || elem_size == 4);
+	if (!out.Open(path))
+		return false;
+	
+	length = width * height * depth;
+	this->elem_size = elem_size;
+	this->scale = scale;
+	
+	float f = (float)scale;
+	dword d;
+	memcpy(&d, &f, 4);
+	out.Put(shard_magic, 4);
+	out.Put32le(SHARD_VERSION);
+	out.Put32le(elem_size);
+	out.Put32le(width);
+	out.Put32le(height);
+	out.Put32le(depth);
+	out.Put32le(d);
+	return true;
+}
+
+void ShardWriter::Add(int label, const VolumeDataBase& sample) {
+	ASSERT(sample.GetCount() == length);
+	out.Put32le(label);
+	for(int i = 0; i < length; i++) {
+		if (elem_size == 1) {
+			out.Put(minmax((int)(sample.Get(i) / scale + 0.5), 0, 255));
+		}
+		else {
+			float f = (float)sample.Get(i);
+			dword d;
+			memcpy(&d, &f, 4);
+			out.Put32le(d);
+		}
+	}
+}
+
+bool ShardWriter::Close() {
+	bool ok = !out.IsError();
+	out.Close();
+	return ok;
+}
+
+
+
+
+SampleCache::SampleCache() {
+	src = NULL;
+	tick = 0;
+	block_size = 256;
+	block_count = 64;
+}
+
+void SampleCache::SetSource(DataSource* src) {
+	Clear();
+	this->src = src;
+}
+
+void SampleCache::SetSize(int block_size, int block_count) {
+	ASSERT(block_size > 0 && block_count > 0);
+	Clear();
+	this->block_size = block_size;
+	this->block_count = block_count;
+}
+
+void SampleCache::Clear() {
+	Mutex::Lock __(lock);
+	blocks.Clear();
+	tick = 0;
+}
+
+double SampleCache::Get(bool test, int i, int col) {
+	Mutex::Lock __(lock);
+	return Fetch(test, i).Get(col);
+}
+
+void SampleCache::Read(bool test, int i, VolumeDataBase& dst) {
+	Mutex::Lock __(lock);
+	dst.Assign(Fetch(test, i));
+}
+
+VolumeDataBase& SampleCache::Fetch(bool test, int i) {
+	ASSERT(src);
+	int begin = i / block_size * block_size;
+	Block* b = NULL;
+	Block* oldest = NULL;
+	for(int j = 0; j < blocks.GetCount() && !b; j++) {
+		Block& block = blocks[j];
+		if (block.begin == begin && block.test == test)
+			b = &block;
+		else if (!oldest || block.used < oldest->used)
+			oldest = &block;
+	}
+	
+	if (!b) {
+		b = blocks.GetCount() < block_count ? &blocks.Add() : oldest;
+		int length = src->GetLength();
+		int count = min(block_size, (test ? src->GetTestCount() : src->GetCount()) - begin);
+		b->values.SetCount(count * length);
+		b->samples.SetCount(count);
+		b->begin = begin;
+		b->test = test;
+		if (!src->Read(test, begin, count, b->values.Begin())) {
+			b->begin = -1;
+			throw Exception("Reading samples from the data source failed");
+		}
+		for(int j = 0; j < count; j++)
+			b->samples[j].SetView(b->values.Begin() + j * length, length);
+	}
+	
+	b->used = ++tick;
+	return b->samples[i - begin];
+}
+
+}
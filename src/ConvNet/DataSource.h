@@ -0,0 +1,123 @@
+#ifndef _ConvNet_DataSource_h_
+#define _ConvNet_DataSource_h_
+
+#include "Utilities.h"
+
+namespace ConvNet {
+
+// Samples which are read on demand, e.g. from files larger than the memory.
+// Read can be called from many threads at the same time.
+class DataSource {
+	
+public:
+	virtual ~DataSource() {}
+	
+	virtual int GetCount() const = 0;
+	virtual int GetTestCount() const = 0;
+	virtual int GetWidth() const = 0;
+	virtual int GetHeight() const = 0;
+	virtual int GetDepth() const = 0;
+	virtual int GetClassCount() const = 0;
+	virtual int GetLabel(int i) const = 0;
+	virtual int GetTestLabel(int i) const = 0;
+	
+	// Reads count consecutive samples beginning from i to dst
+	virtual bool Read(bool test, int i, int count, Real* dst) = 0;
+	
+	int GetLength() const {return GetWidth() * GetHeight() * GetDepth();}
+};
+
+
+// Shard files are memory mapped, so only the used pages are in the memory. A shard is
+//   "CNND", version, element size (1 or 4), width, height, depth (32-bit), scale (float)
+//   samples: label (32-bit) and width * height * depth values (byte or float)
+// Everything is little-endian. Byte values are multiplied by the scale. A shard, which
+// ends in the middle of a sample, is rejected as truncated.
+class ShardedFileSource : public DataSource {
+	
+	struct Shard {
+		FileMapping file;
+		int begin, count, elem_size;
+		double scale;
+	};
+	
+	Array<Shard> shards[2];
+	Vector<int> labels[2];
+	int width, height, depth, class_count;
+	
+	const Shard* FindShard(bool test, int i) const;
+	
+public:
+	typedef ShardedFileSource CLASSNAME;
+	ShardedFileSource();
+	
+	// All shards must have the same sample size. Samples are numbered in the order of the shards.
+	bool AddShard(const String& path, bool test=false);
+	
+	virtual int GetCount() const {return labels[0].GetCount();}
+	virtual int GetTestCount() const {return labels[1].GetCount();}
+	virtual int GetWidth() const {return width;}
+	virtual int GetHeight() const {return height;}
+	virtual int GetDepth() const {return depth;}
+	virtual int GetClassCount() const {return class_count;}
+	virtual int GetLabel(int i) const {return labels[0][i];}
+	virtual int GetTestLabel(int i) const {return labels[1][i];}
+	virtual bool Read(bool test, int i, int count, Real* dst);
+	
+};
+
+
+// Writes one shard file for ShardedFileSource. Write the samples in random order,
+// because the training goes through them in the stored order.
+class ShardWriter {
+	FileOut out;
+	int length, elem_size;
+	double scale;
+	
+public:
+	typedef ShardWriter CLASSNAME;
+	ShardWriter();
+	
+	bool Open(const String& path, int width, int height, int depth, int elem_size=4, double scale=1.0);
+	void Add(int label, const VolumeDataBase& sample);
+	bool Close();
+	
+};
+
+
+// Least recently used blocks of a DataSource, as Reals. A block can be reused by the next
+// call, so the samples are only copied out of the cache while it is locked.
+class SampleCache {
+	
+	struct Block {
+		Vector<Real> values;
+		Array<VolumeDataBase> samples;
+		int begin;
+		bool test;
+		int64 used;
+	};
+	
+	Array<Block> blocks;
+	Mutex lock;
+	DataSource* src;
+	int64 tick;
+	int block_size, block_count;
+	
+	VolumeDataBase& Fetch(bool test, int i);
+	
+public:
+	typedef SampleCache CLASSNAME;
+	SampleCache();
+	
+	void SetSource(DataSource* src);
+	void SetSize(int block_size, int block_count);
+	void Clear();
+	
+	double Get(bool test, int i, int col);
+	void Read(bool test, int i, VolumeDataBase& dst);
+	
+};
+
+}
+
+#endif
@@ -24,21 +24,20 @@ void DropOutLayer::Init(int input_width, int input_height, int input_depth) {
 
 Volume& DropOutLayer::Forward(Volume& input, bool is_training) {
 	input_activation = &input;
-	output_activation = input;
+	if (in_place)
+		output_activation.InitView(input.GetWidth(), input.GetHeight(), input.GetDepth(), input.Begin(), input.GradientBegin());
+	else
+		output_activation = input;
 	Volume& output = output_activation;
 	
 	int length = input.GetLength();
 	
 	if (is_training) {
 		// do dropout
+		GetRng().FillMask(dropped.Begin(), length, drop_prob);
 		for (int i = 0; i < length; i++) {
-			if (Randomf() < drop_prob) {
-				output.Set(i, 0);
-				dropped[i] = true;
-			} // drop!
-			else {
-				dropped[i] = false;
-			}
+			if (dropped[i])
+				output.Set(i, 0); // drop!
 		}
 	}
 	else {
@@ -54,11 +53,30 @@ Volume& DropOutLayer::Forward(Volume& input, bool is_training) {
 	return output_activation; // dummy identity function for now
 }
 
+void DropOutLayer::Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const {
+	// the same scaling as the prediction of Forward
+	if (&output != &input)
+		output = input;
+	Real* out = output.Begin();
+	int length = input.GetLength();
+	for (int i = 0; i < length; i++)
+		out[i] *= drop_prob;
+}
+
 void DropOutLayer::Backward() {
 	Volume& input = *input_activation; // we need to set dw of this
 	Volume& output = output_activation;
 	
 	int length = input.GetLength();
+	
+	if (in_place) {
+		// the gradients are shared too
+		for (int i = 0; i < length; i++)
+			if (dropped[i])
+				output.SetGradient(i, 0);
+		return;
+	}
+	
 	input.ZeroGradients(); // zero out gradient wrt data
 	
 	for (int i = 0; i < length; i++) {
@@ -68,6 +86,41 @@ void DropOutLayer::Backward() {
 	}
 }
 
+VolumeBatch& DropOutLayer::ForwardBatch(VolumeBatch& input, bool is_training) {
+	input_batch = &input;
+	output_batch = input;
+	
+	Real* out = output_batch.Begin();
+	int length = input.GetLength() * input.GetCount();
+	
+	if (is_training) {
+		// do dropout
+		dropped_batch.SetCount(length);
+		GetRng().FillMask(dropped_batch.Begin(), length, drop_prob);
+		for (int i = 0; i < length; i++) {
+			if (dropped_batch[i])
+				out[i] = 0; // drop!
+		}
+	}
+	else {
+		// scale the activations during prediction (see Forward)
+		for (int i = 0; i < length; i++)
+			out[i] *= drop_prob;
+	}
+	
+	return output_batch;
+}
+
+void DropOutLayer::BackwardBatch() {
+	VolumeBatch& input = *input_batch;
+	const Real* dout = output_batch.GradientBegin();
+	Real* din = input.GradientBegin();
+	
+	int length = input.GetLength() * input.GetCount();
+	for (int i = 0; i < length; i++)
+		din[i] = dropped_batch[i] ? 0.0 : dout[i]; // copy over the gradient
+}
+
 #define STOREVAR(json, field) map.GetAdd(#json) = this->field;
 #define LOADVAR(field, json) this->field = map.GetValue(map.Find(#json));
 #define LOADVARDEF(field, json, def) {Value tmp = map.GetValue(map.Find(#json)); if (tmp.IsNull()) this->field = def; else this->field = tmp;}
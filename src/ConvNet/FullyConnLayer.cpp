@@ -30,10 +30,16 @@ void FullyConnLayer::Init(int input_width, int input_height, int input_depth) {
 	filters.SetCount(0);
 	
 	for (int i = 0; i < output_depth; i++) {
-		filters.Add().Init(1, 1, input_count);
+		if (shape_only)
+			filters.Add().InitShape(1, 1, input_count);
+		else
+			filters.Add().Init(1, 1, input_count);
 	}
 	
-	biases.Init(1, 1, output_depth, bias);
+	if (shape_only)
+		biases.InitShape(1, 1, output_depth);
+	else
+		biases.Init(1, 1, output_depth, bias);
 }
 
 Volume& FullyConnLayer::Forward(Volume& input, bool is_training) {
@@ -50,15 +56,33 @@ Volume& FullyConnLayer::Forward(Volume& input, bool is_training) {
 		a += biases.Get(i);
 		output_activation.Set(i, a);
 	}
+	ApplyActivation(fused_activation, output_activation.Begin(), output_depth);
 	            
 	return output_activation;
 }
 
+void FullyConnLayer::Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const {
+	output.Init(1, 1, output_depth, 0.0);
+	
+	const Real* in = input.Begin();
+	Real* out = output.Begin();
+	for (int i = 0; i < output_depth; i++) {
+		const Real* w = filters[i].Begin();
+		double a = 0.0;
+		for (int d = 0; d < input_count; d++)
+			a += in[d] * w[d];
+		out[i] = (Real)(a + biases.Get(i));
+	}
+	ApplyActivation(fused_activation, out, output_depth);
+}
+
 void FullyConnLayer::Backward() {
 	Volume& input = *input_activation;
 	ASSERT(output_activation.GetLength());
 	
-	input.ZeroGradients(); // zero out the gradient in input Vol
+	if (!skip_input_gradient)
+		input.ZeroGradients(); // zero out the gradient in input Vol
+	ActivationGradient(fused_activation, output_activation.Begin(), output_activation.GradientBegin(), output_depth);
 	
 	// compute gradient wrt weights and data
 	for (int i = 0; i < output_depth; i++)
@@ -66,11 +90,110 @@ void FullyConnLayer::Backward() {
 		Volume& tfi = filters[i];
 		double chain_gradient_ = output_activation.GetGradient(i);
 		
-		for (int d = 0; d < input_count; d++) {
-			input.SetGradient(d, input.GetGradient(d) + tfi.Get(d) * chain_gradient_); // grad wrt input data
-			tfi.SetGradient(d, tfi.GetGradient(d) + input.Get(d) * chain_gradient_); // grad wrt params
+		if (!skip_input_gradient) {
+			for (int d = 0; d < input_count; d++)
+				input.SetGradient(d, input.GetGradient(d) + tfi.Get(d) * chain_gradient_); // grad wrt input data
+		}
+		if (!frozen) {
+			for (int d = 0; d < input_count; d++)
+				tfi.SetGradient(d, tfi.GetGradient(d) + input.Get(d) * chain_gradient_); // grad wrt params
+			biases.SetGradient(i, biases.GetGradient(i) + chain_gradient_);
+		}
+	}
+}
+
+VolumeBatch& FullyConnLayer::ForwardBatch(VolumeBatch& input, bool is_training) {
+	input_batch = &input;
+	int count = input.GetCount();
+	output_batch.Init(1, 1, output_depth, count, 0.0);
+	
+	// start from the biases and add the product of the samples and the filters
+	for (int b = 0; b < count; b++) {
+		Real* o = output_batch.Begin(b);
+		for (int i = 0; i < output_depth; i++)
+			o[i] = biases.Get(i);
+	}
+	PackFilters();
+	Gemm(false, true, count, output_depth, input_count,
+		1.0, input.Begin(), input_count, filter_w, input_count,
+		1.0, output_batch.Begin(), output_depth);
+	ApplyActivation(fused_activation, output_batch.Begin(), output_depth * count);
+	
+	return output_batch;
+}
+
+void FullyConnLayer::BackwardBatch() {
+	VolumeBatch& input = *input_batch;
+	int count = input.GetCount();
+	
+	ActivationGradient(fused_activation, output_batch.Begin(), output_batch.GradientBegin(), output_depth * count);
+	const Real* dout = output_batch.GradientBegin();
+	
+	if (!frozen) {
+		// gradient wrt biases
+		for (int i = 0; i < output_depth; i++) {
+			double sum = 0.0;
+			for (int b = 0; b < count; b++)
+				sum += dout[b * output_depth + i];
+			biases.AddGradient(i, sum);
 		}
-		biases.SetGradient(i, biases.GetGradient(i) + chain_gradient_);
+		
+		// gradient wrt filters: dout^T * input, accumulated over calls
+		BeginFilterGradients();
+		Gemm(true, false, output_depth, input_count, count,
+			1.0, dout, output_depth, input.Begin(), input_count,
+			1.0, filter_dw, input_count);
+		EndFilterGradients();
+	}
+	
+	// gradient wrt input: dout * filters, with the filters packed by ForwardBatch. It
+	// replaces the old gradient in the input batch.
+	if (!skip_input_gradient)
+		Gemm(false, false, count, input_count, output_depth,
+			1.0, dout, output_depth, filter_w, input_count,
+			0.0, input.GradientBegin(), input_count);
+}
+
+bool FullyConnLayer::HasContiguousFilters() const {
+	// true when the net has packed the filters into its parameter arena
+	const Real* w = filters[0].Begin();
+	const Real* dw = filters[0].GradientBegin();
+	for (int i = 1; i < output_depth; i++)
+		if (filters[i].Begin() != w + i * input_count || filters[i].GradientBegin() != dw + i * input_count)
+			return false;
+	return true;
+}
+
+void FullyConnLayer::PackFilters() {
+	if (HasContiguousFilters()) {
+		filter_w = filters[0].Begin();
+		return;
+	}
+	filter_matrix.SetCount(output_depth * input_count);
+	for (int i = 0; i < output_depth; i++)
+		memcpy(filter_matrix.Begin() + i * input_count, filters[i].Begin(), input_count * sizeof(Real));
+	filter_w = filter_matrix.Begin();
+}
+
+void FullyConnLayer::BeginFilterGradients() {
+	// accumulate directly to the filters when possible
+	if (HasContiguousFilters()) {
+		filter_dw = filters[0].GradientBegin();
+		return;
+	}
+	filter_gradient_matrix.SetCount(0);
+	filter_gradient_matrix.SetCount(output_depth * input_count, 0.0);
+	filter_dw = filter_gradient_matrix.Begin();
+}
+
+void FullyConnLayer::EndFilterGradients() {
+	if (filter_dw != filter_gradient_matrix.Begin())
+		return;
+	for (int i = 0; i < output_depth; i++) {
+		Real* df = filters[i].GradientBegin();
+		const Real* src = filter_gradient_matrix.Begin() + i * input_count;
+		for (int d = 0; d < input_count; d++)
+			df[d] += src[d];
 	}
 }
 
@@ -96,7 +219,7 @@ Vector<ParametersAndGradients>& FullyConnLayer::GetParametersAndGradients() {
 #define LOADVAR(field, json) this->field = map.GetValue(map.Find(#json));
 #define LOADVARDEF(field, json, def) {Value tmp = map.GetValue(map.Find(#json)); if (tmp.IsNull()) this->field = def; else this->field = tmp;}
 
-void FullyConnLayer::Store(ValueMap& map) const {
+void FullyConnLayer::StoreLayer(ValueMap& map, bool values) const {
 	STOREVAR(out_depth, output_depth);
 	STOREVAR(out_sx, output_width);
 	STOREVAR(out_sy, output_height);
@@ -108,13 +231,13 @@ void FullyConnLayer::Store(ValueMap& map) const {
 	Value filters;
 	for (int i = 0; i < this->filters.GetCount(); i++) {
 		ValueMap map;
-		this->filters[i].Store(map);
+		this->filters[i].Store(map, values);
 		filters.Add(map);
 	}
 	map.GetAdd("filters") = filters;
 	
 	ValueMap biases;
-	this->biases.Store(biases);
+	this->biases.Store(biases, values);
 	map.GetAdd("biases") = biases;
 }
 
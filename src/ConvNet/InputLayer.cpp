@@ -19,10 +19,23 @@ Volume& InputLayer::Forward(Volume& input, bool is_training) {
 	return output_activation; // simply identity function for now
 }
 
+void InputLayer::Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const {
+	output = input;
+}
+
 void InputLayer::Backward() {
 	
 }
 
+VolumeBatch& InputLayer::ForwardBatch(VolumeBatch& input, bool is_training) {
+	input_batch = &input;
+	return input; // identity, the batch is not copied
+}
+
+void InputLayer::BackwardBatch() {
+	
+}
+
 Volume& InputLayer::Forward(bool is_training) {
 	return output_activation;
 }
@@ -0,0 +1,296 @@
+#include "Kernels.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+namespace ConvNet {
+
+static int DetectKernelIsa() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return KERNEL_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return KERNEL_SSE2;
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	if (avx && osxsave && max_leaf >= 7 && (_xgetbv(0) & 6) == 6) {
+		__cpuidex(info, 7, 0);
+		if (info[1] & (1 << 5))
+			return KERNEL_AVX2;
+	}
+	if (sse2)
+		return KERNEL_SSE2;
+#endif
+	return KERNEL_SCALAR;
+}
+
+static int& KernelIsa() {
+	static int isa = GetSupportedKernelIsa();
+	return isa;
+}
+
+int GetSupportedKernelIsa() {
+	static int isa = DetectKernelIsa();
+	return isa;
+}
+
+int GetKernelIsa() {
+	return KernelIsa();
+}
+
+void SetKernelIsa(int isa) {
+	KernelIsa() = max((int)KERNEL_SCALAR, min(isa, GetSupportedKernelIsa()));
+}
+
+const char* GetKernelIsaName(int isa) {
+	switch (isa) {
+		case KERNEL_AVX2: return "avx2";
+		case KERNEL_SSE2: return "sse2";
+		default: return "scalar";
+	}
+}
+
+// Block sizes of the matrix product. The packed block of A (GEMM_MC x GEMM_KC)
+// fits in the L2 cache and the packed panel of B (GEMM_KC x GEMM_NC) in the
+// L3 cache. The micro kernel computes GEMM_MR x GEMM_NR values of C in registers.
+#define GEMM_MC 64
+#define GEMM_KC 256
+#define GEMM_NC 1024
+#define GEMM_MR 4
+#define GEMM_NR 4
+
+// Packs a mc x kc block of op(A) into micro panels of GEMM_MR rows. Inside a
+// panel the values are k-major, so the micro kernel reads them sequentially.
+// Missing rows at the edge are padded with zeros.
+static void GemmPackA(bool trans, const Real* a, int lda, int i0, int k0, int mc, int kc, Real alpha, Real* dst) {
+	for (int ir = 0; ir < mc; ir += GEMM_MR) {
+		int mr = min(GEMM_MR, mc - ir);
+		Real* panel = dst + ir * kc;
+		for (int k = 0; k < kc; k++) {
+			Real* d = panel + k * GEMM_MR;
+			int r = 0;
+			if (!trans) {
+				for (; r < mr; r++)
+					d[r] = alpha * a[(i0 + ir + r) * lda + k0 + k];
+			}
+			else {
+				const Real* src = a + (k0 + k) * lda + i0 + ir;
+				for (; r < mr; r++)
+					d[r] = alpha * src[r];
+			}
+			for (; r < GEMM_MR; r++)
+				d[r] = 0.0;
+		}
+	}
+}
+
+// Packs a kc x nc panel of op(B) into micro panels of GEMM_NR columns.
+static void GemmPackB(bool trans, const Real* b, int ldb, int k0, int j0, int kc, int nc, Real* dst) {
+	for (int jr = 0; jr < nc; jr += GEMM_NR) {
+		int nr = min(GEMM_NR, nc - jr);
+		Real* panel = dst + jr * kc;
+		for (int k = 0; k < kc; k++) {
+			Real* d = panel + k * GEMM_NR;
+			int c = 0;
+			if (!trans) {
+				const Real* src = b + (k0 + k) * ldb + j0 + jr;
+				for (; c < nr; c++)
+					d[c] = src[c];
+			}
+			else {
+				for (; c < nr; c++)
+					d[c] = b[(j0 + jr + c) * ldb + k0 + k];
+			}
+			for (; c < GEMM_NR; c++)
+				d[c] = 0.0;
+		}
+	}
+}
+
+// C[0:mr, 0:nr] += Apanel * Bpanel
+static inline void GemmMicroKernel(int kc, const Real* ap, const Real* bp, Real* c, int ldc, int mr, int nr) {
+	Real acc[GEMM_MR][GEMM_NR];
+	for (int r = 0; r < GEMM_MR; r++)
+		for (int j = 0; j < GEMM_NR; j++)
+			acc[r][j] = 0.0;
+
+	for (int k = 0; k < kc; k++) {
+		const Real* a = ap + k * GEMM_MR;
+		const Real* b = bp + k * GEMM_NR;
+		for (int r = 0; r < GEMM_MR; r++)
+			for (int j = 0; j < GEMM_NR; j++)
+				acc[r][j] += a[r] * b[j];
+	}
+
+	for (int r = 0; r < mr; r++) {
+		Real* crow = c + r * ldc;
+		for (int j = 0; j < nr; j++)
+			crow[j] += acc[r][j];
+	}
+}
+
+void Gemm(bool trans_a, bool trans_b, int m, int n, int k,
+	Real alpha, const Real* a, int lda, const Real* b, int ldb,
+	Real beta, Real* c, int ldc) {
+
+	if (m <= 0 || n <= 0)
+		return;
+
+	if (beta != 1.0) {
+		for (int i = 0; i < m; i++) {
+			Real* crow = c + i * ldc;
+			if (beta == 0.0)
+				for (int j = 0; j < n; j++) crow[j] = 0.0;
+			else
+				for (int j = 0; j < n; j++) crow[j] *= beta;
+		}
+	}
+
+	if (k <= 0 || alpha == 0.0)
+		return;
+
+	// Packing buffers are kept per thread, so that only the first call allocates.
+	thread_local Vector<Real> apack, bpack;
+	apack.SetCount(GEMM_MC * GEMM_KC);
+	bpack.SetCount(GEMM_KC * (GEMM_NC + GEMM_NR));
+
+	for (int jc = 0; jc < n; jc += GEMM_NC) {
+		int nc = min(GEMM_NC, n - jc);
+
+		for (int pc = 0; pc < k; pc += GEMM_KC) {
+			int kc = min(GEMM_KC, k - pc);
+			GemmPackB(trans_b, b, ldb, pc, jc, kc, nc, bpack.Begin());
+
+			for (int ic = 0; ic < m; ic += GEMM_MC) {
+				int mc = min(GEMM_MC, m - ic);
+				GemmPackA(trans_a, a, lda, ic, pc, mc, kc, alpha, apack.Begin());
+
+				for (int jr = 0; jr < nc; jr += GEMM_NR) {
+					int nr = min(GEMM_NR, nc - jr);
+					const Real* bp = bpack.Begin() + jr * kc;
+					for (int ir = 0; ir < mc; ir += GEMM_MR) {
+						int mr = min(GEMM_MR, mc - ir);
+						GemmMicroKernel(kc, apack.Begin() + ir * kc, bp,
+							c + (ic + ir) * ldc + jc + jr, ldc, mr, nr);
+					}
+				}
+			}
+		}
+	}
+}
+
+void Im2Col(const Real* in, int in_w, int in_h, int in_d, int f_w, int f_h,
+	int stride, int pad, int out_w, int out_h, Real* col) {
+	Im2ColRows(in, in_w, in_h, in_d, f_w, f_h, stride, pad, out_w, 0, out_h, col);
+}
+
+void Im2ColRows(const Real* in, int in_w, int in_h, int in_d, int f_w, int f_h,
+	int stride, int pad, int out_w, int y0, int rows, Real* col) {
+
+	int row_len = f_w * f_h * in_d;
+	int span = f_w * in_d;
+
+	for (int ay = y0; ay < y0 + rows; ay++) {
+		int y = ay * stride - pad;
+		for (int ax = 0; ax < out_w; ax++) {
+			int x = ax * stride - pad;
+			Real* row = col + ((ay - y0) * out_w + ax) * row_len;
+
+			// the taps of one filter row are consecutive in the input too
+			int fx0 = max(0, -x);
+			int fx1 = min(f_w, in_w - x);
+
+			for (int fy = 0; fy < f_h; fy++) {
+				Real* dst = row + fy * span;
+				int oy = y + fy;
+				if (oy < 0 || oy >= in_h || fx0 >= fx1) {
+					for (int i = 0; i < span; i++)
+						dst[i] = 0.0;
+					continue;
+				}
+				for (int i = 0; i < fx0 * in_d; i++)
+					dst[i] = 0.0;
+				memcpy(dst + fx0 * in_d, in + (in_w * oy + x + fx0) * in_d, (fx1 - fx0) * in_d * sizeof(Real));
+				for (int i = fx1 * in_d; i < span; i++)
+					dst[i] = 0.0;
+			}
+		}
+	}
+}
+
+void ApplyActivation(int act, Real* v, int n) {
+	switch (act) {
+		case ACT_RELU:
+			for (int i = 0; i < n; i++)
+				if (v[i] < 0)
+					v[i] = 0;
+			break;
+		case ACT_TANH:
+			for (int i = 0; i < n; i++)
+				v[i] = (Real)tanh(v[i]);
+			break;
+		case ACT_SIGMOID:
+			for (int i = 0; i < n; i++)
+				v[i] = (Real)(1.0 / (1.0 + exp(-1.0 * v[i])));
+			break;
+	}
+}
+
+void ActivationGradient(int act, const Real* out, Real* dout, int n) {
+	switch (act) {
+		case ACT_RELU:
+			for (int i = 0; i < n; i++)
+				if (out[i] <= 0)
+					dout[i] = 0; // threshold
+			break;
+		case ACT_TANH:
+			for (int i = 0; i < n; i++)
+				dout[i] = (Real)((1.0 - out[i] * out[i]) * dout[i]);
+			break;
+		case ACT_SIGMOID:
+			for (int i = 0; i < n; i++)
+				dout[i] = (Real)(out[i] * (1.0 - out[i]) * dout[i]);
+			break;
+	}
+}
+
+void Col2Im(const Real* col, int in_w, int in_h, int in_d, int f_w, int f_h,
+	int stride, int pad, int out_w, int out_h, Real* in) {
+
+	int row_len = f_w * f_h * in_d;
+	int span = f_w * in_d;
+
+	for (int ay = 0; ay < out_h; ay++) {
+		int y = ay * stride - pad;
+		for (int ax = 0; ax < out_w; ax++) {
+			int x = ax * stride - pad;
+			const Real* row = col + (ay * out_w + ax) * row_len;
+
+			int fx0 = max(0, -x);
+			int fx1 = min(f_w, in_w - x);
+			if (fx0 >= fx1)
+				continue;
+
+			for (int fy = 0; fy < f_h; fy++) {
+				int oy = y + fy;
+				if (oy < 0 || oy >= in_h)
+					continue;
+				const Real* src = row + fy * span + fx0 * in_d;
+				Real* dst = in + (in_w * oy + x + fx0) * in_d;
+				int len = (fx1 - fx0) * in_d;
+				for (int i = 0; i < len; i++)
+					dst[i] += src[i];
+			}
+		}
+	}
+}
+
+}
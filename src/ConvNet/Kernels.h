@@ -0,0 +1,93 @@
+#ifndef _ConvNet_Kernels_h_
+#define _ConvNet_Kernels_h_
+
+#include "Utilities.h"
+
+namespace ConvNet {
+
+// Cache-blocked matrix product for row-major matrices:
+//   C = alpha * op(A) * op(B) + beta * C
+// where op(X) is X or its transpose. op(A) is m x k, op(B) is k x n and C is m x n.
+// lda, ldb and ldc are the row strides of the matrices as they are in memory.
+void Gemm(bool trans_a, bool trans_b, int m, int n, int k,
+	Real alpha, const Real* a, int lda, const Real* b, int ldb,
+	Real beta, Real* c, int ldc);
+
+// Im2Col unrolls the filter windows of a volume into rows of a matrix, so that the
+// convolution becomes a matrix product. The row of output position (ax, ay) is
+// (ay * out_w + ax) and its columns use the same ((f_w * fy) + fx) * in_d + fd
+// order as the filter volumes. Taps in the padding are zero.
+void Im2Col(const Real* in, int in_w, int in_h, int in_d, int f_w, int f_h,
+	int stride, int pad, int out_w, int out_h, Real* col);
+
+// Im2ColRows writes only the rows of the output positions y0 ... y0 + rows - 1.
+// The row of (ax, ay) is ((ay - y0) * out_w + ax).
+void Im2ColRows(const Real* in, int in_w, int in_h, int in_d, int f_w, int f_h,
+	int stride, int pad, int out_w, int y0, int rows, Real* col);
+
+// Col2Im is the adjoint of Im2Col: it adds the rows of the column matrix back to
+// the volume positions they were read from. Used for the gradient wrt input.
+void Col2Im(const Real* col, int in_w, int in_h, int in_d, int f_w, int f_h,
+	int stride, int pad, int out_w, int out_h, Real* in);
+
+
+// Activations, which the dot product layers can apply to their own output
+// (see Net::SetFusion).
+enum {ACT_NONE, ACT_RELU, ACT_TANH, ACT_SIGMOID};
+
+// Applies the activation to n values in place
+void ApplyActivation(int act, Real* v, int n);
+
+// Multiplies the gradients wrt the activated values by the derivative of the
+// activation, which is computed from the activated values.
+void ActivationGradient(int act, const Real* out, Real* dout, int n);
+
+
+// Instruction sets of the SIMD kernels. The best one supported by the CPU is
+// selected at runtime, and SetKernelIsa can force a lower one (e.g. for testing).
+enum {KERNEL_SCALAR, KERNEL_SSE2, KERNEL_AVX2};
+
+int GetKernelIsa();
+int GetSupportedKernelIsa();
+void SetKernelIsa(int isa);
+const char* GetKernelIsaName(int isa);
+
+
+// Integer kernel of the quantized inference (see QuantizedNet): the 32-bit dot
+// products of the vector a with n rows of b, each k values long, to out[0 ... n-1].
+void DotInt8(const int8* a, const int8* b, int k, int n, int* out);
+
+
+// Update rules of the trainers
+enum {
+	UPDATE_SGD,
+	UPDATE_MOMENTUM,
+	UPDATE_NESTEROV,
+	UPDATE_ADAGRAD,
+	UPDATE_WINDOWGRAD,
+	UPDATE_ADADELTA,
+	UPDATE_ADAM
+};
+
+struct UpdateArgs {
+	int rule;
+	double batch_size;
+	double l1_decay, l2_decay;
+	double learning_rate, momentum, ro, eps;
+	double beta1, beta2, bias_scale1, bias_scale2;
+	
+	// accumulated by UpdateParameters
+	double l1_decay_loss, l2_decay_loss;
+	
+	UpdateArgs() {memset(this, 0, sizeof(UpdateArgs));}
+};
+
+// Fused parameter update: in one pass over n contiguous values it accumulates
+// the decay losses, adds the L1 and L2 gradients to dw, applies the update rule
+// to w and zeroes dw. gsum and xsum are the per-parameter accumulators of the
+// rule (xsum only for Adadelta and Adam).
+void UpdateParameters(UpdateArgs& args, Real* w, Real* dw, Real* gsum, Real* xsum, int n);
+
+}
+
+#endif
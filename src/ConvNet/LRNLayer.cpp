@@ -55,6 +55,29 @@ Volume& LrnLayer::Forward(Volume& input, bool is_training) {
 	return output_activation;
 }
 
+void LrnLayer::Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const {
+	output.Init(input.GetWidth(), input.GetHeight(), input.GetDepth(), 0);
+	
+	int n2 = n / 2;
+	int depth = input.GetDepth();
+	int count = input.GetWidth() * input.GetHeight();
+	const Real* in = input.Begin();
+	Real* out = output.Begin();
+	for (int p = 0; p < count; p++) {
+		const Real* a = in + p * depth;
+		Real* o = out + p * depth;
+		for (int i = 0; i < depth; i++) {
+			// normalize in a window of size n
+			double den = 0.0;
+			for (int j = max(0, i - n2); j <= min(i + n2, depth - 1); j++)
+				den += a[j] * a[j];
+			den *= alpha / n;
+			den += k;
+			o[i] = (Real)(a[i] / pow(den, beta));
+		}
+	}
+}
+
 void LrnLayer::Backward() {
 	// evaluate gradient wrt data
 	Volume& input = *input_activation; // we need to set dw of this
@@ -92,6 +115,78 @@ void LrnLayer::Backward() {
 #define LOADVAR(field, json) this->field = map.GetValue(map.Find(#json));
 #define LOADVARDEF(field, json, def) {Value tmp = map.GetValue(map.Find(#json)); if (tmp.IsNull()) this->field = def; else this->field = tmp;}
 
+VolumeBatch& LrnLayer::ForwardBatch(VolumeBatch& input, bool is_training) {
+	input_batch = &input;
+	
+	output_batch.Init(input, 0.0);
+	S_cache_batch.Init(input, 0.0);
+	
+	int n2 = n / 2;
+	int depth = input.GetDepth();
+	int pixels = input.GetWidth() * input.GetHeight() * input.GetCount();
+	const Real* in = input.Begin();
+	Real* out = output_batch.Begin();
+	Real* S = S_cache_batch.Begin();
+	
+	// samples are consecutive in memory, so all pixels of the batch
+	// can be iterated as one long row of depth columns
+	for (int p = 0; p < pixels; p++) {
+		const Real* a = in + p * depth;
+		for (int i = 0; i < depth; i++) {
+			
+			// normalize in a window of size n
+			double den = 0.0;
+			for (int j = max(0, i - n2); j <= min(i + n2, depth - 1); j++)
+				den += a[j] * a[j];
+			den *= alpha / n;
+			den += k;
+			S[p * depth + i] = den; // will be useful for backprop
+			den = pow(den, beta);
+			out[p * depth + i] = a[i] / den;
+		}
+	}
+	
+	return output_batch;
+}
+
+void LrnLayer::BackwardBatch() {
+	// evaluate gradient wrt data
+	VolumeBatch& input = *input_batch;
+	input.ZeroGradients(); // zero out gradient wrt data
+	
+	int n2 = n / 2;
+	int depth = input.GetDepth();
+	int pixels = input.GetWidth() * input.GetHeight() * input.GetCount();
+	const Real* in = input.Begin();
+	Real* din = input.GradientBegin();
+	const Real* dout = output_batch.GradientBegin();
+	const Real* S_cache = S_cache_batch.Begin();
+	
+	for (int p = 0; p < pixels; p++) {
+		const Real* a = in + p * depth;
+		Real* da = din + p * depth;
+		for (int i = 0; i < depth; i++) {
+			double chain_grad = dout[p * depth + i];
+			double S = S_cache[p * depth + i];
+			double SB = pow(S, beta);
+			double SB2 = SB*SB;
+			
+			// normalize in a window of size n
+			int begin = max(0, i - n2);
+			int end = min(i + n2, depth - 1);
+			for (int j = begin; j <= end; j++) {
+				double aj = a[j];
+				double g = -aj * beta * pow(S, beta - 1) * alpha / n * 2 * aj;
+				if (j == i)
+					g += SB;
+				g /= SB2;
+				g *= chain_grad;
+				da[j] += g;
+			}
+		}
+	}
+}
+
 void LrnLayer::Store(ValueMap& map) const {
 	STOREVAR(out_depth, output_depth);
 	STOREVAR(out_sx, output_width);
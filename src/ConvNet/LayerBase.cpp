@@ -11,6 +11,11 @@ LayerBase::LayerBase() {
 	input_width = 0;
 	input_height = 0;
 	input_activation = NULL;
+	input_batch = NULL;
+	in_place = false;
+	frozen = false;
+	skip_input_gradient = false;
+	shape_only = false;
 }
 
 LayerBase::~LayerBase() {
@@ -25,6 +30,18 @@ Volume& LayerBase::Forward(Volume& input, bool is_training) {
 	throw NotImplementedException();
 }
 
+void LayerBase::Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const {
+	throw NotImplementedException();
+}
+
+VolumeBatch& LayerBase::ForwardBatch(VolumeBatch& input, bool is_training) {
+	throw NotImplementedException();
+}
+
+void LayerBase::BackwardBatch() {
+	throw NotImplementedException();
+}
+
 void LayerBase::Init(int input_width, int input_height, int input_depth) {
 	this->input_width = input_width;
 	this->input_height = input_height;
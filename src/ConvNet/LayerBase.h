@@ -16,6 +16,8 @@ protected:
 public:
 	Volume* input_activation;
 	Volume output_activation;
+	VolumeBatch* input_batch;
+	VolumeBatch output_batch;
 	int output_depth;
 	int output_width;
 	int output_height;
@@ -28,11 +30,42 @@ public:
 	virtual Volume& Forward(Volume& input, bool is_training = false);
 	virtual Volume& Forward(bool is_training);
 	virtual void Backward() = 0;
+	
+	// Inference without changing the layer: the result goes to output and tmp is
+	// scratch memory. Both are owned by the caller, so this can be called from many
+	// threads at the same time (see Net::Predict).
+	virtual void Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const;
+	virtual VolumeBatch& ForwardBatch(VolumeBatch& input, bool is_training = false);
+	virtual void BackwardBatch();
 	virtual void Init(int input_width, int input_height, int input_depth);
 	virtual Vector<ParametersAndGradients>& GetParametersAndGradients();
 	virtual String GetKey() const {return "base";}
 	
+	// What Backward reads besides the gradients, for the memory plan of Net. The
+	// default is the safe answer: both the input and the output values.
+	virtual bool NeedsInputValues() const {return true;}
+	virtual bool NeedsOutputValues() const {return true;}
+	
+	// Elementwise layers can compute the output over the input. The Net sets
+	// in_place, when the previous layer doesn't need its output values anymore.
+	virtual bool CanRunInPlace() const {return false;}
+	bool in_place;
+	
+	// Estimated floating point operations of one Forward, for the profile of Net
+	virtual int64 GetFlops() const {return (int64)output_width * output_height * output_depth;}
+	
+	// The parameters of a frozen layer are not trained (see Net::SetFrozen). The Net sets
+	// skip_input_gradient, when no layer before this one has parameters to train.
+	bool frozen;
+	bool skip_input_gradient;
+	
+	// Init gives the parameters only their shape, when the Net gets the weights from
+	// elsewhere, like a model file (see Session::LoadModelLayers).
+	bool shape_only;
+	
 	virtual void Store(ValueMap& map) const {}
+	// StoreSettings leaves out the values of the parameters, but not their shapes.
+	virtual void StoreSettings(ValueMap& map) const {Store(map);}
 	virtual void Load(const ValueMap& map) {}
 	virtual String ToString() const = 0;
 	
@@ -56,6 +89,11 @@ public:
 	virtual double Backward(int pos, double y) = 0;
 	virtual double Backward(const VolumeDataBase& y) = 0;
 	virtual double Backward(int cols, const Vector<int>& pos, const Vector<double>& y) = 0;
+	
+	// Minibatch versions. The returned loss is the sum over the batch.
+	virtual double BackwardBatch(const Vector<int>& pos, const Vector<double>& y) = 0;
+	virtual double BackwardBatch(const VolumeBatch& y) = 0;
+	virtual void BackwardBatch() = 0;
 	virtual String GetKey() const {return "lastlayerbase";}
 	
 };
@@ -2,6 +2,7 @@
 #define _ConvNet_Layers_h_
 
 #include "LayerBase.h"
+#include "Kernels.h"
 
 namespace ConvNet {
 
@@ -23,19 +24,57 @@ public:
 class IDotProductLayer {
 	
 public:
-	IDotProductLayer() : bias_pref(0) {}
+	IDotProductLayer() : bias_pref(0), fused_activation(ACT_NONE) {}
 	
 	double bias_pref;
+	
+	// Set by Net::SetFusion, when the activation layer after this one is skipped
+	int fused_activation;
 };
 
+class PoolLayer;
+
+// Convolution engines of ConvLayer. CONV_REFERENCE is the original direct loop,
+// which is kept as the reference for checking the correctness of the others.
+// CONV_IM2COL lowers the convolution to a matrix product (see Kernels.h).
+enum {CONV_REFERENCE, CONV_IM2COL};
+
+// Compares the im2col engine with CONV_REFERENCE on random data: the outputs and all
+// gradients of the single sample and the batch paths, with strides, padding, the fused
+// activations and the fused pool. Returns false and the first difference in error.
+bool CheckConvEngines(String& error);
+
 class ConvLayer : public LayerBase, public IDotProductLayer {
 	
+	// Temporary matrices of the im2col engine. col_input is the input, which the
+	// columns were built from, so that Backward can reuse them.
+	Vector<Real> col, col_gradient;
+	const Real* col_input;
+	Vector<Real> filter_matrix, filter_gradient_matrix;
+	const Real* filter_w;
+	Real* filter_dw;
+	int engine;
+	
+	bool HasContiguousFilters() const;
+	void PackFilters();
+	void BeginFilterGradients();
+	void EndFilterGradients();
+	void ForwardIm2Col(const Real* in, int in_w, int in_h, int in_d, Real* out);
+	void BackwardIm2Col(const Real* in, int in_w, int in_h, int in_d, Real* din, const Real* dout);
+	
+	// The fused max pool is computed from tiles of the product, so the output of the
+	// convolution isn't stored. The pooled values and switches go to the pool layer.
+	Vector<Real> tile, tile_gradient;
+	void ForwardPooled(const Real* in, int in_w, int in_h, int in_d, Real* out, int* sx, int* sy);
+	void BackwardPooled(const Real* in, int in_w, int in_h, int in_d, Real* din,
+		const Real* out, const Real* dout, const int* sx, const int* sy);
+	
 protected:
 	ConvLayer(const ConvLayer& o) {}
 	
 public:
 	ConvLayer(int width, int height, int filter_count);
-	ConvLayer(ValueMap values) {Load(values);}
+	ConvLayer(ValueMap values) : col_input(NULL), engine(CONV_IM2COL), fused_pool(NULL) {Load(values);}
 	
 	// TODO: change protected
 	int width;
@@ -48,23 +87,35 @@ public:
 	int stride;
 	int pad;
 	
+	// Set by Net::SetFusion, when the pool layer after this one is skipped
+	PoolLayer* fused_pool;
+	
 	int GetStride() const {return stride;}
 	int GetPad() const {return pad;}
+	int GetEngine() const {return engine;}
+	ConvLayer& SetEngine(int e) {engine = e; return *this;}
 	
 	virtual Volume& Forward(Volume& input, bool is_training = false);
+	virtual void Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const;
 	virtual void Backward();
+	virtual VolumeBatch& ForwardBatch(VolumeBatch& input, bool is_training = false);
+	virtual void BackwardBatch();
 	virtual void Init(int input_width, int input_height, int input_depth);
 	void UpdateOutputSize();
 	virtual Vector<ParametersAndGradients>& GetParametersAndGradients();
 	virtual String GetKey() const {return "conv";}
-	virtual void Store(ValueMap& map) const;
+	virtual int64 GetFlops() const {return 2 * (int64)output_width * output_height * output_depth * width * height * input_depth;}
+	virtual bool NeedsOutputValues() const {return fused_activation != ACT_NONE;}
+	virtual void Store(ValueMap& map) const {StoreLayer(map, true);}
+	virtual void StoreSettings(ValueMap& map) const {StoreLayer(map, false);}
+	void StoreLayer(ValueMap& map, bool values) const;
 	virtual void Load(const ValueMap& map);
 	virtual String ToString() const;
 };
 
 class DropOutLayer : public LayerBase {
 	
-	Vector<bool> dropped;
+	Vector<bool> dropped, dropped_batch;
 	
 protected:
 	DropOutLayer(const DropOutLayer& o) {}
@@ -76,9 +127,15 @@ public:
 	DropOutLayer(ValueMap values) {Load(values);}
 	
 	virtual Volume& Forward(Volume& input, bool is_training = false);
+	virtual void Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const;
 	virtual void Backward();
+	virtual VolumeBatch& ForwardBatch(VolumeBatch& input, bool is_training = false);
+	virtual void BackwardBatch();
 	virtual void Init(int input_width, int input_height, int input_depth);
 	virtual String GetKey() const {return "dropout";}
+	virtual bool NeedsInputValues() const {return false;}
+	virtual bool NeedsOutputValues() const {return false;}
+	virtual bool CanRunInPlace() const {return true;}
 	virtual void Store(ValueMap& map) const;
 	virtual void Load(const ValueMap& map);
 	virtual String ToString() const;
@@ -90,6 +147,16 @@ class FullyConnLayer : public LayerBase, public IDotProductLayer {
 	
 	int input_count;
 	
+	// The filters as the rows of one matrix for the batch products, like in ConvLayer
+	Vector<Real> filter_matrix, filter_gradient_matrix;
+	const Real* filter_w;
+	Real* filter_dw;
+	
+	bool HasContiguousFilters() const;
+	void PackFilters();
+	void BeginFilterGradients();
+	void EndFilterGradients();
+	
 protected:
 	FullyConnLayer(const FullyConnLayer& o) {Panic("Not allowed");}
 	
@@ -106,11 +173,18 @@ public:
 	int GetInputCount() const {return input_count;}
 	
 	virtual Volume& Forward(Volume& input, bool is_training = false);
+	virtual void Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const;
 	virtual void Backward();
+	virtual VolumeBatch& ForwardBatch(VolumeBatch& input, bool is_training = false);
+	virtual void BackwardBatch();
 	virtual void Init(int input_width, int input_height, int input_depth);
 	virtual Vector<ParametersAndGradients>& GetParametersAndGradients();
 	virtual String GetKey() const {return "fc";}
-	virtual void Store(ValueMap& map) const;
+	virtual int64 GetFlops() const {return 2 * (int64)input_count * neuron_count;}
+	virtual bool NeedsOutputValues() const {return fused_activation != ACT_NONE;}
+	virtual void Store(ValueMap& map) const {StoreLayer(map, true);}
+	virtual void StoreSettings(ValueMap& map) const {StoreLayer(map, false);}
+	void StoreLayer(ValueMap& map, bool values) const;
 	virtual void Load(const ValueMap& map);
 	virtual String ToString() const;
 };
@@ -125,9 +199,14 @@ public:
 	InputLayer(ValueMap values) {Load(values);}
 	
 	virtual Volume& Forward(Volume& input, bool is_training = false);
+	virtual void Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const;
 	virtual void Backward();
+	virtual VolumeBatch& ForwardBatch(VolumeBatch& input, bool is_training = false);
+	virtual void BackwardBatch();
 	virtual Volume& Forward(bool is_training);
 	virtual String GetKey() const {return "input";}
+	virtual bool NeedsInputValues() const {return false;}
+	virtual bool NeedsOutputValues() const {return false;}
 	virtual void Store(ValueMap& map) const;
 	virtual void Load(const ValueMap& map);
 	virtual String ToString() const;
@@ -141,7 +220,7 @@ public:
 // the input size should be exactly divisible by group_size
 class MaxoutLayer : public LayerBase {
 	
-	Vector<int> switches;
+	Vector<int> switches, switches_batch;
 	
 protected:
 	MaxoutLayer(const MaxoutLayer& o) {}
@@ -153,7 +232,10 @@ public:
 	int group_size;
 	
 	virtual Volume& Forward(Volume& input, bool is_training = false);
+	virtual void Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const;
 	virtual void Backward();
+	virtual VolumeBatch& ForwardBatch(VolumeBatch& input, bool is_training = false);
+	virtual void BackwardBatch();
 	virtual void Init(int input_width, int input_height, int input_depth);
 	virtual String GetKey() const {return "maxout";}
 	virtual void Store(ValueMap& map) const;
@@ -162,8 +244,12 @@ public:
 };
 
 class PoolLayer : public LayerBase {
+	friend class ConvLayer;
+	
 	Vector<int> switchx;
 	Vector<int> switchy;
+	Vector<int> switchx_batch;
+	Vector<int> switchy_batch;
 	
 protected:
 	PoolLayer(const PoolLayer& o) {}
@@ -178,10 +264,16 @@ public:
 	int pad;
 	
 	virtual Volume& Forward(Volume& input, bool is_training = false);
+	virtual void Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const;
 	virtual void Backward();
+	virtual VolumeBatch& ForwardBatch(VolumeBatch& input, bool is_training = false);
+	virtual void BackwardBatch();
 	virtual void Init(int input_width, int input_height, int input_depth);
 	void UpdateOutputSize();
 	virtual String GetKey() const {return "pool";}
+	virtual int64 GetFlops() const {return (int64)output_width * output_height * output_depth * width * height;}
+	virtual bool NeedsInputValues() const {return false;}
+	virtual bool NeedsOutputValues() const {return false;}
 	virtual void Store(ValueMap& map) const;
 	virtual void Load(const ValueMap& map);
 	virtual String ToString() const;
@@ -203,8 +295,13 @@ public:
 	virtual double Backward(int pos, double y);
 	virtual double Backward(const VolumeDataBase& y);
 	virtual double Backward(int cols, const Vector<int>& pos, const Vector<double>& y);
+	virtual double BackwardBatch(const Vector<int>& pos, const Vector<double>& y);
+	virtual double BackwardBatch(const VolumeBatch& y);
 	virtual Volume& Forward(Volume& input, bool is_training = false);
+	virtual void Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const;
 	virtual void Backward();
+	virtual VolumeBatch& ForwardBatch(VolumeBatch& input, bool is_training = false);
+	virtual void BackwardBatch();
 	virtual void Init(int input_width, int input_height, int input_depth);
 	virtual String GetKey() const {return "regression";}
 	virtual void Store(ValueMap& map) const;
@@ -226,9 +323,14 @@ public:
 	ReluLayer(ValueMap values) {Load(values);}
 	
 	virtual Volume& Forward(Volume& input, bool is_training = false);
+	virtual void Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const;
 	virtual void Backward();
+	virtual VolumeBatch& ForwardBatch(VolumeBatch& input, bool is_training = false);
+	virtual void BackwardBatch();
 	virtual void Init(int input_width, int input_height, int input_depth);
 	virtual String GetKey() const {return "relu";}
+	virtual bool NeedsInputValues() const {return false;}
+	virtual bool CanRunInPlace() const {return true;}
 	virtual void Store(ValueMap& map) const;
 	virtual void Load(const ValueMap& map);
 	virtual String ToString() const;
@@ -248,9 +350,14 @@ public:
 	SigmoidLayer(ValueMap values) {Load(values);}
 	
 	virtual Volume& Forward(Volume& input, bool is_training = false);
+	virtual void Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const;
 	virtual void Backward();
+	virtual VolumeBatch& ForwardBatch(VolumeBatch& input, bool is_training = false);
+	virtual void BackwardBatch();
 	virtual void Init(int input_width, int input_height, int input_depth);
 	virtual String GetKey() const {return "sigmoid";}
+	virtual bool NeedsInputValues() const {return false;}
+	virtual bool CanRunInPlace() const {return true;}
 	virtual void Store(ValueMap& map) const;
 	virtual void Load(const ValueMap& map);
 	virtual String ToString() const;
@@ -261,7 +368,7 @@ public:
 // it gets a stream of N incoming numbers and computes the softmax
 // function (exponentiate and normalize to sum to 1 as probabilities should)
 class SoftmaxLayer : public LastLayerBase, public IClassificationLayer {
-	Vector<double> es;
+	Vector<double> es, es_batch;
 	
 protected:
 	SoftmaxLayer(const SoftmaxLayer& o) {}
@@ -273,8 +380,13 @@ public:
 	virtual double Backward(int pos, double y);
 	virtual double Backward(const VolumeDataBase& y);
 	virtual double Backward(int cols, const Vector<int>& pos, const Vector<double>& y) {Panic("Not implemented"); return 0;}
+	virtual double BackwardBatch(const Vector<int>& pos, const Vector<double>& y);
+	virtual double BackwardBatch(const VolumeBatch& y);
 	virtual Volume& Forward(Volume& input, bool is_training = false);
+	virtual void Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const;
 	virtual void Backward();
+	virtual VolumeBatch& ForwardBatch(VolumeBatch& input, bool is_training = false);
+	virtual void BackwardBatch();
 	virtual void Init(int input_width, int input_height, int input_depth);
 	virtual String GetKey() const {return "softmax";}
 	virtual void Store(ValueMap& map) const;
@@ -295,8 +407,13 @@ public:
 	virtual double Backward(int pos, double y);
 	virtual double Backward(const VolumeDataBase& y);
 	virtual double Backward(int cols, const Vector<int>& pos, const Vector<double>& y) {Panic("Not implemented"); return 0;}
+	virtual double BackwardBatch(const Vector<int>& pos, const Vector<double>& y);
+	virtual double BackwardBatch(const VolumeBatch& y);
 	virtual Volume& Forward(Volume& input, bool is_training = false);
+	virtual void Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const;
 	virtual void Backward();
+	virtual VolumeBatch& ForwardBatch(VolumeBatch& input, bool is_training = false);
+	virtual void BackwardBatch();
 	virtual void Init(int input_width, int input_height, int input_depth);
 	virtual String GetKey() const {return "svm";}
 	virtual void Store(ValueMap& map) const;
@@ -315,9 +432,14 @@ public:
 	TanhLayer(ValueMap values) {Load(values);}
 	
 	virtual Volume& Forward(Volume& input, bool is_training = false);
+	virtual void Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const;
 	virtual void Backward();
+	virtual VolumeBatch& ForwardBatch(VolumeBatch& input, bool is_training = false);
+	virtual void BackwardBatch();
 	virtual void Init(int input_width, int input_height, int input_depth);
 	virtual String GetKey() const {return "tanh";}
+	virtual bool NeedsInputValues() const {return false;}
+	virtual bool CanRunInPlace() const {return true;}
 	virtual void Store(ValueMap& map) const;
 	virtual void Load(const ValueMap& map);
 	virtual String ToString() const;
@@ -327,6 +449,7 @@ public:
 // Local Response Normalization Layer
 class LrnLayer : public LayerBase {
 	Volume S_cache;
+	VolumeBatch S_cache_batch;
 	double k, alpha, beta;
 	int n;
 	
@@ -335,7 +458,10 @@ public:
 	LrnLayer(ValueMap values) {Load(values);}
 	
 	virtual Volume& Forward(Volume& input, bool is_training = false);
+	virtual void Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const;
 	virtual void Backward();
+	virtual VolumeBatch& ForwardBatch(VolumeBatch& input, bool is_training = false);
+	virtual void BackwardBatch();
 	virtual void Init(int input_width, int input_height, int input_depth);
 	virtual String GetKey() const {return "lrn";}
 	virtual void Store(ValueMap& map) const;
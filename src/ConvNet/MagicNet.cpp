@@ -30,6 +30,42 @@ MagicNet::MagicNet() {
 	
 	foldix = 0;
 	datapos = 0;
+	
+	thread_count = CPU_Cores();
+	
+	// budget-aware search is optional
+	successive_halving = false;
+	halving_min_epochs = 1;
+	halving_eta = 3;
+	rung = 0;
+}
+
+template <class F>
+void MagicNet::ForEachCandidate(F fn) {
+	// fn(worker, candidate) is called for every candidate. The candidates are split
+	// to equal slices, and a worker calls fn only for the candidates of its slice.
+	int n = session.GetCount();
+	int count = max(1, min(thread_count, n));
+	int part = (n + count - 1) / count;
+	workers.SetCount(count);
+	for(int i = 0; i < count; i++) {
+		Worker& w = workers[i];
+		w.begin = min(n, i * part);
+		w.count = min(n, w.begin + part) - w.begin;
+	}
+	
+	CoWork co;
+	for(int i = 0; i < count; i++) {
+		co & [=] {
+			Worker& w = workers[i];
+			for(int k = w.begin; k < w.begin + w.count; k++) {
+				Rng rng(GetRngSeed(RNG_CANDIDATE, (uint64)total_iter * n + k));
+				RngScope __(rng);
+				fn(w, k);
+			}
+		};
+	}
+	co.Finish();
 }
 
 void MagicNet::SampleFolds() {
@@ -65,18 +101,18 @@ void MagicNet::SampleCandidate(Session& cand) {
 	
 	SessionData& d = data[0];
 	
-	int input_depth = d.Get(0).GetCount();
+	int input_depth = d.GetDataLength();
 	int num_classes = d.GetClassCount();
 	
 	// sample network topology and hyperparameters
 	cand.AddInputLayer(1, 1, input_depth);
 	
 	//var nl = weightedSample([0,1,2,3], [0.2, 0.3, 0.3, 0.2]); // prefer nets with 1,2 hidden layers
-	int nl = 1 + Random(3);
+	int nl = 1 + GetRng().Get(3);
 	
 	for (int q = 0; q < nl; q++) {
-		int ni = neurons_min + Random(neurons_max - neurons_min);
-		int act = Random(3); // tanh, maxout, relu
+		int ni = neurons_min + GetRng().Get(neurons_max - neurons_min);
+		int act = GetRng().Get(3); // tanh, maxout, relu
 		
 		double bias_pref = act == 2 ? 0.1 : 0.0; // 0.1 for relu
 		
@@ -94,8 +130,8 @@ void MagicNet::SampleCandidate(Session& cand) {
 		}
 		else Panic("What activation");
 		
-		if (Randomf() < 0.5) {
-			cand.AddDropoutLayer(Randomf());
+		if (GetRng().Getf() < 0.5) {
+			cand.AddDropoutLayer(GetRng().Getf());
 		}
 	}
 	
@@ -104,11 +140,11 @@ void MagicNet::SampleCandidate(Session& cand) {
 	
 	
 	// sample training hyperparameters
-	int bs = batch_size_min + Random(batch_size_max - batch_size_min); // batch size
-	double l2 = pow(10, l2_decay_min + Randomf() + (l2_decay_max - l2_decay_min)); // l2 weight decay
-	double lr = pow(10, learning_rate_min + Randomf() * (learning_rate_max - learning_rate_min)); // learning rate
-	double mom = momentum_min + Randomf() * (momentum_max - momentum_min); // momentum. Lets just use 0.9, works okay usually ;p
-	double tp = Randomf(); // trainer type
+	int bs = batch_size_min + GetRng().Get(batch_size_max - batch_size_min); // batch size
+	double l2 = pow(10, l2_decay_min + GetRng().Getf() + (l2_decay_max - l2_decay_min)); // l2 weight decay
+	double lr = pow(10, learning_rate_min + GetRng().Getf() * (learning_rate_max - learning_rate_min)); // learning rate
+	double mom = momentum_min + GetRng().Getf() * (momentum_max - momentum_min); // momentum. Lets just use 0.9, works okay usually ;p
+	double tp = GetRng().Getf(); // trainer type
 	
 	
 	// add trainer
@@ -139,6 +175,33 @@ void MagicNet::SampleCandidates() {
 		Session& ses = session[i];
 		SampleCandidate(ses);
 	}
+	rung = 0;
+}
+
+int MagicNet::GetRungEpochs(int rung) const {
+	int64 epochs = halving_min_epochs;
+	for(int i = 0; i < rung && epochs < num_epochs; i++)
+		epochs *= halving_eta;
+	return (int)min<int64>(epochs, num_epochs);
+}
+
+void MagicNet::PruneCandidates() {
+	// rank by the accuracy on the test fold, and keep the best 1/eta. Equal accuracies
+	// keep the order of the candidates.
+	int n = session.GetCount();
+	int keep = max(1, (n + halving_eta - 1) / halving_eta);
+	Vector<int> order;
+	for(int k = 0; k < n; k++)
+		order.Add(k);
+	const Vector<double>& acc = val_acc;
+	StableSort(order, [&](int a, int b) {return acc[a] > acc[b];});
+	
+	Vector<int> removed;
+	for(int i = keep; i < n; i++)
+		removed.Add(order[i]);
+	Sort(removed);
+	session.Remove(removed);
+	rung++;
 }
 
 void MagicNet::Step() {
@@ -154,16 +217,20 @@ void MagicNet::Step() {
 	datapos++;
 	if (datapos >= fold.GetCount()) datapos = 0;
 	
-	tmp_in.Init(data.GetDataWidth(), data.GetDataHeight(), data.GetDataDepth(), 0);
-	VolumeDataBase& x = data.Get(datapos);
-	tmp_in.SetData(x);
+	data.Read(datapos, tmp_data);
 	int l = data.GetLabel(datapos);
+	int width = data.GetDataWidth(), height = data.GetDataHeight(), depth = data.GetDataDepth();
 	
-	for (int k = 0; k < session.GetCount(); k++) {
-		session[k].GetTrainer()->Train(tmp_in, l, 1.0);
-	}
+	ForEachCandidate([&](Worker& w, int k) {
+		if (k == w.begin) {
+			w.in.Init(width, height, depth, 0);
+			w.in.SetData(tmp_data);
+		}
+		session[k].GetTrainer()->Train(w.in, l, 1.0);
+	});
 	
 	if ((total_iter % 100) == 0) {
+		// the accuracies are added in the order of the candidates
 		EvaluateValueErrors(val_acc);
 		for (int k = 0; k < session.GetCount(); k++) {
 			Session& c = session[k];
@@ -172,6 +239,17 @@ void MagicNet::Step() {
 		WhenStepInterval(total_iter);
 	}
 	
+	// successive halving: prune the candidates at the end of every rung of the first fold
+	if (successive_halving && foldix == 0 && session.GetCount() > 1) {
+		int epochs = GetRungEpochs(rung);
+		if (epochs < num_epochs && iter >= epochs * fold.GetCount()) {
+			EvaluateValueErrors(val_acc);
+			for (int k = 0; k < session.GetCount(); k++)
+				session[k].accuracy_window.Add(val_acc[k]);
+			PruneCandidates();
+		}
+	}
+	
 	// process consequences: sample new folds, or candidates
 	int lastiter = num_epochs * fold.GetCount();
 	if (iter >= lastiter) {
@@ -219,26 +297,28 @@ void MagicNet::Step() {
 
 void MagicNet::EvaluateValueErrors(Vector<double>& vals) {
 	SessionData& d = data[0];
-	tmp_in.Init(d.GetDataWidth(), d.GetDataHeight(), d.GetDataDepth(), 0);
+	int width = d.GetDataWidth(), height = d.GetDataHeight(), depth = d.GetDataDepth();
 	
 	// evaluate candidates on validation data and return performance of current networks
 	// as simple list
 	vals.SetCount(session.GetCount());
 	Vector<int>& fold = test_folds[foldix]; // active fold
-	for(int k = 0; k < session.GetCount(); k++) {
+	ForEachCandidate([&](Worker& w, int k) {
+		w.in.Init(width, height, depth, 0);
 		Net& net = session[k].GetNetwork();
 		double v = 0.0;
 		for (int q = 0; q < fold.GetCount(); q++) {
-			VolumeDataBase& x = d.Get(fold[q]);
-			tmp_in.SetData(x);
+			// a streamed sample can be replaced in the cache by the other workers
+			d.Read(fold[q], w.sample);
+			w.in.SetData(w.sample);
 			int l = d.GetLabel(fold[q]);
-			net.Forward(tmp_in);
+			net.Forward(w.in);
 			int yhat = net.GetPrediction();
 			v += (yhat == l ? 1.0 : 0.0); // 0 1 loss
 		}
 		v /= fold.GetCount(); // normalize
 		vals[k] = v;
-	}
+	});
 }
 
 void MagicNet::PredictSoft(Volume& in, Volume& out) {
@@ -31,6 +31,16 @@ protected:
 	int ensemble_size;
 	int foldix, datapos;
 	
+	// Successive halving: on the first fold, the candidates are evaluated after
+	// halving_min_epochs, halving_min_epochs * halving_eta, ... epochs, and only the best
+	// 1/halving_eta of them continue. The rest of the folds are trained with the survivors.
+	bool successive_halving;
+	int halving_min_epochs, halving_eta;
+	int rung;
+	
+	int GetRungEpochs(int rung) const;
+	void PruneCandidates();
+	
 	double l2_decay_min, l2_decay_max;
 	double learning_rate_min, learning_rate_max;
 	double momentum_min, momentum_max;
@@ -44,6 +54,18 @@ protected:
 		}
 	};
 	
+	// The candidates are trained and evaluated in parallel. Every worker has a slice
+	// of the candidates, and its own input volume and copy of the sample.
+	struct Worker {
+		Volume in;
+		VolumeDataBase sample;
+		int begin, count;
+	};
+	Array<Worker> workers;
+	int thread_count;
+	
+	template <class F> void ForEachCandidate(F fn);
+	
 	// tmp
 	Vector<double> val_acc;
 	
@@ -57,6 +79,9 @@ public:
 	void SetCandidateCount(int i) {num_candidates = i;}
 	void SetEpochCount(int i) {num_epochs = i;}
 	void SetNeuronRange(int min, int max) {neurons_min = min, neurons_max = max;}
+	void SetSuccessiveHalving(bool b=true, int min_epochs=1, int eta=3) {successive_halving = b; halving_min_epochs = max(1, min_epochs); halving_eta = max(2, eta);}
+	void SetThreadCount(int i) {thread_count = i > 0 ? i : CPU_Cores();}
+	int GetThreadCount() const {return thread_count;}
 	
 	// sets folds to a sampling of num_folds folds
 	void SampleFolds();
@@ -87,6 +112,8 @@ public:
 	int GetEvaluatedCandidateCount() const {return evaluated_candidates.GetCount();}
 	
 	int GetFold() const {return foldix;}
+	int GetRung() const {return rung;}
+	bool IsSuccessiveHalving() const {return successive_halving;}
 	
 };
 
@@ -24,9 +24,11 @@ Mat::Mat(const Vector<double>& weights) {
 	height = weights.GetCount();
 	length = height;
 	
-	this->weights <<= weights;
+	this->weights.SetCount(length);
+	for(int i = 0; i < length; i++)
+		this->weights[i] = (Real)weights[i];
 	
-	weight_gradients.SetCount(length, 0.0);
+	weight_gradients.SetCount(length, 0);
 }
 
 Mat::Mat(int width, int height, const Vector<double>& weights) {
@@ -37,9 +39,11 @@ Mat::Mat(int width, int height, const Vector<double>& weights) {
 	
 	ASSERT(length == weights.GetCount());
 	
-	this->weights <<= weights;
+	this->weights.SetCount(length);
+	for(int i = 0; i < length; i++)
+		this->weights[i] = (Real)weights[i];
 	
-	weight_gradients.SetCount(length, 0.0);
+	weight_gradients.SetCount(length, 0);
 }
 
 Mat::Mat(int width, int height, Mat& vol) {
@@ -52,7 +56,7 @@ Mat::Mat(int width, int height, Mat& vol) {
 	
 	ASSERT(this->weights.GetCount() == length);
 	
-	weight_gradients.SetCount(length, 0.0);
+	weight_gradients.SetCount(length, 0);
 }
 
 Mat::~Mat() {
@@ -75,7 +79,7 @@ int Mat::GetMaxColumn() const {
 int Mat::GetSampledColumn() const {
 	// sample argmax from w, assuming w are
 	// probabilities that sum to one
-	double r = Randomf();
+	double r = GetRng().Getf();
 	double x = 0.0;
 	for(int i = 0; i < weights.GetCount(); i++) {
 		x += weights[i];
@@ -109,14 +113,10 @@ Mat& Mat::Init(int width, int height) {
 	int n = width * height;
 	
 	length = n;
-	weights.SetCount(n, 0.0);
-	weight_gradients.SetCount(n, 0.0);
+	weights.SetCount(n, 0);
+	weight_gradients.SetCount(n, 0);
 	
-	RandomGaussian& rand = GetRandomGaussian(length);
-
-	for (int i = 0; i < n; i++) {
-		weights.Set(i, rand);
-	}
+	GetRng().FillGaussian(weights.Begin(), n, 0, sqrt(1.0 / (double)n));
 	
 	return *this;
 }
@@ -137,7 +137,7 @@ Mat& Mat::Init(int width, int height, double default_value) {
 	weight_gradients.SetCount(n);
 	
 	for (int i = 0; i < n; i++) {
-		weights.Set(i, default_value);
+		weights[i] = (Real)default_value;
 		weight_gradients[i] = 0.0;
 	}
 	
@@ -159,7 +159,7 @@ Mat& Mat::Init(int width, int height, const Vector<double>& w) {
 	weight_gradients.SetCount(n);
 	
 	for (int i = 0; i < n; i++) {
-		weights[i] = w[i];
+		weights[i] = (Real)w[i];
 		weight_gradients[i] = 0.0;
 	}
 	
@@ -257,7 +257,7 @@ void Mat::AddGradient(int i, double v) {
 }
 
 void Mat::Set(int i, double v) {
-	weights.Set(i, v);
+	weights[i] = (Real)v;
 }
 
 #define STOREVAR(json, field) map.GetAdd(#json) = this->field;
@@ -299,7 +299,7 @@ void Mat::Load(const ValueMap& map) {
 	
 	for (int i = 0; i < length; i++) {
 		double value = w[i];
-		weights.Set(i, value);
+		weights[i] = (Real)value;
 	}
 	
 	int i = map.Find("dw");
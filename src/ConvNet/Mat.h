@@ -5,8 +5,8 @@
 namespace ConvNet {
 
 class Mat : Moveable<Mat> {
-	Vector<double> weight_gradients;
-	Vector<double> weights;
+	Vector<Real> weight_gradients;
+	Vector<Real> weights;
 
 protected:
 	
@@ -35,8 +35,8 @@ public:
 	
 	Mat& operator=(const Mat& src);
 	
-	const Vector<double>& GetWeights() const {return weights;}
-	const Vector<double>& GetGradients() const {return weight_gradients;}
+	const Vector<Real>& GetWeights() const {return weights;}
+	const Vector<Real>& GetGradients() const {return weight_gradients;}
 	
 	void Add(int i, double v);
 	void Add(int x, int y, double v);
@@ -71,6 +71,29 @@ Volume& MaxoutLayer::Forward(Volume& input, bool is_training) {
 	return output_activation;
 }
 
+void MaxoutLayer::Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const {
+	output.Init(output_width, output_height, output_depth, 0.0);
+	
+	// same order as in Forward, but without the switches
+	const Real* in = input.Begin();
+	Real* out = output.Begin();
+	int in_depth = input.GetDepth();
+	for (int x = 0; x < output_width; x++) {
+		for (int y = 0; y < output_height; y++) {
+			const Real* a = in + (input.GetWidth() * y + x) * in_depth;
+			Real* o = out + (output_width * y + x) * output_depth;
+			for (int i = 0; i < output_depth; i++) {
+				int ix = i * group_size;
+				Real m = a[ix];
+				for (int j = 1; j < group_size; j++)
+					if (a[ix + j] > m)
+						m = a[ix + j];
+				o[i] = m;
+			}
+		}
+	}
+}
+
 void MaxoutLayer::Backward() {
 	Volume& input = *input_activation; // we need to set dw of this
 	Volume& output = output_activation;
@@ -104,6 +127,63 @@ void MaxoutLayer::Backward() {
 #define LOADVAR(field, json) this->field = map.GetValue(map.Find(#json));
 #define LOADVARDEF(field, json, def) {Value tmp = map.GetValue(map.Find(#json)); if (tmp.IsNull()) this->field = def; else this->field = tmp;}
 
+VolumeBatch& MaxoutLayer::ForwardBatch(VolumeBatch& input, bool is_training) {
+	input_batch = &input;
+	int count = input.GetCount();
+	output_batch.Init(output_width, output_height, output_depth, count, 0.0);
+	
+	// the switches store the index of the winning input directly, so the
+	// 1D and the 3D cases are handled by the same loop
+	int in_depth = input.GetDepth();
+	int length = output_width * output_height * output_depth;
+	switches_batch.SetCount(length * count);
+	
+	for (int b = 0; b < count; b++) {
+		const Real* in = input.Begin(b);
+		Real* out = output_batch.Begin(b);
+		int* sw = switches_batch.Begin() + b * length;
+		
+		for (int xy = 0; xy < output_width * output_height; xy++) {
+			for (int i = 0; i < output_depth; i++) {
+				int ix = xy * in_depth + i * group_size;
+				double a = in[ix];
+				int ai = 0;
+				
+				for (int j = 1; j < group_size; j++) {
+					double a2 = in[ix + j];
+					if (a2 > a) {
+						a = a2;
+						ai = j;
+					}
+				}
+				
+				int o = xy * output_depth + i;
+				out[o] = a;
+				sw[o] = ix + ai;
+			}
+		}
+	}
+	
+	return output_batch;
+}
+
+void MaxoutLayer::BackwardBatch() {
+	VolumeBatch& input = *input_batch;
+	int count = input.GetCount();
+	int length = output_width * output_height * output_depth;
+	
+	input.ZeroGradients(); // zero out gradient wrt data
+	
+	// pass the gradient through the appropriate switch
+	for (int b = 0; b < count; b++) {
+		Real* din = input.GradientBegin(b);
+		const Real* dout = output_batch.GradientBegin(b);
+		const int* sw = switches_batch.Begin() + b * length;
+		for (int i = 0; i < length; i++)
+			din[sw[i]] = dout[i];
+	}
+}
+
 void MaxoutLayer::Store(ValueMap& map) const {
 	STOREVAR(out_depth, output_depth);
 	STOREVAR(out_sx, output_width);
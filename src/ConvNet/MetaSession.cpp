@@ -28,9 +28,9 @@ void MetaSession::Step() {
 	{
 		int id = total_iter % sd.GetDataCount();
 		tmp_in.Init(sd.GetDataWidth(), sd.GetDataHeight(), sd.GetDataDepth(), 0);
-		VolumeDataBase& x = sd.Get(id);
+		sd.Read(id, tmp_data);
 		int label = sd.GetLabel(id);
-		tmp_in.SetData(x);
+		tmp_in.SetData(tmp_data);
 		
 		for (int i = 0; i < session.GetCount(); i++) {
 			Session& ses = session[i];
@@ -48,9 +48,9 @@ void MetaSession::Step() {
 	{
 		int id = total_iter % sd.GetTestCount();
 		tmp_in.Init(sd.GetDataWidth(), sd.GetDataHeight(), sd.GetDataDepth(), 0);
-		VolumeDataBase& x = sd.GetTest(id);
+		sd.ReadTest(id, tmp_data);
 		int label = sd.GetTestLabel(id);
-		tmp_in.SetData(x);
+		tmp_in.SetData(tmp_data);
 		
 		for (int i = 0; i < session.GetCount(); i++) {
 			Session& ses = session[i];
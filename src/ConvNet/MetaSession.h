@@ -12,6 +12,7 @@ protected:
 	Array<SessionData> data;
 	
 	Volume tmp_in, tmp_out;
+	VolumeDataBase tmp_data;
 	int iter, total_iter;
 	
 public:
@@ -55,6 +55,249 @@ void Net::AddLayer(LayerBase& layer) {
 	}
 	
 	layers.Add(&layer);
+	repack = true;
+	generation++;
+	if (fusion)
+		UpdateFusion();
+	if (memory_plan)
+		UpdateMemoryPlan();
+	UpdateBackward();
+	if (profiling)
+		UpdateProfile();
+}
+
+void Net::AddLayerPointer(LayerBase& layer) {
+	layers.Add(&layer);
+	repack = true;
+	generation++;
+	if (fusion)
+		UpdateFusion();
+	if (memory_plan)
+		UpdateMemoryPlan();
+	UpdateBackward();
+	if (profiling)
+		UpdateProfile();
+}
+
+void Net::SetFusion(bool b) {
+	fusion = b;
+	UpdateFusion();
+	if (memory_plan)
+		UpdateMemoryPlan();
+	UpdateBackward();
+}
+
+void Net::SetFrozen(int layer, bool b) {
+	layers[layer]->frozen = b;
+	UpdateBackward();
+	CollectParameters();
+	MakeSpans();
+}
+
+void Net::UpdateBackward() {
+	// The gradients wrt the input of a layer are needed only, if a layer before it has
+	// parameters to train. A layer, which has neither to compute, is not run at all.
+	bool trainable_before = false;
+	skip_backward.SetCount(layers.GetCount());
+	for (int i = 0; i < layers.GetCount(); i++) {
+		LayerBase& layer = *layers[i];
+		bool trainable = !layer.frozen && !layer.GetParametersAndGradients().IsEmpty();
+		layer.skip_input_gradient = !trainable_before;
+		skip_backward[i] = !trainable_before && !trainable;
+		trainable_before = trainable_before || trainable;
+	}
+}
+
+static int GetActivation(const LayerBase* layer) {
+	if (dynamic_cast<const ReluLayer*>(layer))
+		return ACT_RELU;
+	if (dynamic_cast<const TanhLayer*>(layer))
+		return ACT_TANH;
+	if (dynamic_cast<const SigmoidLayer*>(layer))
+		return ACT_SIGMOID;
+	return ACT_NONE;
+}
+
+void Net::UpdateFusion() {
+	int n = layers.GetCount();
+	fused.SetCount(0);
+	fused.SetCount(n, FUSE_NONE);
+	for (int i = 0; i < n; i++) {
+		if (IDotProductLayer* dot = dynamic_cast<IDotProductLayer*>(layers[i]))
+			dot->fused_activation = ACT_NONE;
+		if (ConvLayer* conv = dynamic_cast<ConvLayer*>(layers[i]))
+			conv->fused_pool = NULL;
+	}
+	if (!fusion)
+		return;
+	
+	// the merged layer must not be the last one
+	for (int i = 1; i + 1 < n; i++) {
+		IDotProductLayer* dot = dynamic_cast<IDotProductLayer*>(layers[i]);
+		if (!dot)
+			continue;
+		int j = i + 1;
+		int act = GetActivation(layers[j]);
+		if (act != ACT_NONE && j + 1 < n) {
+			dot->fused_activation = act;
+			fused[j++] = FUSE_ACTIVATION;
+		}
+		ConvLayer* conv = dynamic_cast<ConvLayer*>(layers[i]);
+		PoolLayer* pool = dynamic_cast<PoolLayer*>(layers[j]);
+		if (conv && pool && j + 1 < n && !pool->pad &&
+			pool->stride == pool->width && pool->stride == pool->height) {
+			conv->fused_pool = pool;
+			fused[j] = FUSE_POOL;
+		}
+	}
+}
+
+void Net::SetMemoryPlan(bool b) {
+	memory_plan = b;
+	UpdateMemoryPlan();
+}
+
+void Net::ReleaseActivations() {
+	// the views must not point to the old arena
+	for (int i = 0; i < layers.GetCount(); i++) {
+		LayerBase& layer = *layers[i];
+		layer.in_place = false;
+		if (layer.output_activation.IsRelocated())
+			layer.output_activation.Clear();
+	}
+	activation_arena.Clear();
+}
+
+void Net::UpdateMemoryPlan() {
+	ReleaseActivations();
+	if (!memory_plan)
+		return;
+	
+	// The output of a conv with a fused pool is the output of the pool
+	Vector<LayerBase*> unit, output;
+	for (int i = 0; i < layers.GetCount(); i++) {
+		if (IsFused(i))
+			continue;
+		ConvLayer* conv = dynamic_cast<ConvLayer*>(layers[i]);
+		unit.Add(layers[i]);
+		output.Add(conv && conv->fused_pool ? conv->fused_pool : layers[i]);
+	}
+	
+	// Groups of units with the same output memory: an in-place layer joins the group
+	// of the previous unit. The values of a group are kept, if Backward reads them.
+	Vector<int> first, last, size;
+	Vector<bool> keep;
+	for (int k = 0; k < unit.GetCount(); k++) {
+		LayerBase& layer = *unit[k];
+		if (k > 0 && layer.CanRunInPlace() && !unit[k - 1]->NeedsOutputValues()) {
+			layer.in_place = true;
+			last.Top() = k;
+		}
+		else {
+			const LayerBase& out = *output[k];
+			first.Add(k);
+			last.Add(k);
+			size.Add(out.output_width * out.output_height * out.output_depth);
+			keep.Add(false);
+		}
+		if (layer.NeedsOutputValues())
+			keep[keep.GetCount() - 1] = true;
+	}
+	int groups = first.GetCount();
+	for (int g = 0; g < groups; g++)
+		if (g + 1 == groups || unit[first[g + 1]]->NeedsInputValues())
+			keep[g] = true;
+	
+	// The other values are needed only until the next group has read them, so they
+	// share slots, which are free after that. The gradients use two buffers in turns,
+	// because Backward of a group reads its own gradients and writes the gradients of
+	// the previous group.
+	int gradient_size = 0;
+	Vector<int> slot, slot_size, slot_end;
+	for (int g = 0; g < groups; g++) {
+		gradient_size = max(gradient_size, size[g]);
+		int s = -1;
+		if (!keep[g]) {
+			for (int j = 0; j < slot_end.GetCount() && s < 0; j++)
+				if (slot_end[j] < first[g])
+					s = j;
+			if (s < 0) {
+				s = slot_size.GetCount();
+				slot_size.Add(0);
+				slot_end.Add(0);
+			}
+			slot_size[s] = max(slot_size[s], size[g]);
+			slot_end[s] = last[g] + 1;
+		}
+		slot.Add(s);
+	}
+	
+	int total = 2 * gradient_size;
+	Vector<int> slot_offset;
+	for (int j = 0; j < slot_size.GetCount(); j++) {
+		slot_offset.Add(total);
+		total += slot_size[j];
+	}
+	int offset = total;
+	for (int g = 0; g < groups; g++)
+		if (keep[g])
+			total += size[g];
+	activation_arena.SetCount(total, 0.0);
+	
+	Real* base = activation_arena.Begin();
+	for (int g = 0; g < groups; g++) {
+		if (!size[g])
+			continue;
+		Real* w;
+		if (keep[g]) {
+			w = base + offset;
+			offset += size[g];
+		}
+		else
+			w = base + slot_offset[slot[g]];
+		LayerBase& out = *output[first[g]];
+		out.output_activation.InitView(out.output_width, out.output_height, out.output_depth,
+			w, base + (g % 2) * gradient_size);
+	}
+}
+
+int64 Net::GetActivationMemory() const {
+	// the arena and the outputs, which are not in it
+	int64 n = activation_arena.GetCount();
+	for (int i = 0; i < layers.GetCount(); i++) {
+		const Volume& v = layers[i]->output_activation;
+		if (!v.IsRelocated())
+			n += 2 * (int64)v.GetCount();
+	}
+	return n * sizeof(Real);
+}
+
+void Net::SetProfiling(bool b) {
+	profiling = b;
+	if (IsProfiling())
+		UpdateProfile();
+}
+
+void Net::UpdateProfile() {
+	int n = layers.GetCount();
+	profile.SetLayerCount(n);
+	for(int i = 0; i < n; i++) {
+		LayerBase& l = *layers[i];
+		int64 params = 0;
+		Vector<ParametersAndGradients>& pag = l.GetParametersAndGradients();
+		for(int j = 0; j < pag.GetCount(); j++)
+			params += pag[j].volume->GetLength();
+		int64 in = (int64)l.input_width * l.input_height * l.input_depth;
+		int64 out = (int64)l.output_width * l.output_height * l.output_depth;
+		int64 bytes = (in + out + params) * sizeof(Real);
+		int64 flops = l.GetFlops();
+		String name = IntStr(i) + " " + l.GetKey();
+		// backward computes the gradients of both the inputs and the parameters, and the
+		// update reads the weights, the gradients and the accumulators of the trainer
+		profile.SetLayer(i, name, NetProfile::FORWARD, flops, bytes);
+		profile.SetLayer(i, name, NetProfile::BACKWARD, 2 * flops, 2 * bytes);
+		profile.SetLayer(i, name, NetProfile::UPDATE, 4 * params, 4 * params * (int64)sizeof(Real));
+	}
 }
 
 Volume& Net::Forward(const Vector<VolumePtr>& inputs, bool is_training) {
@@ -62,14 +305,51 @@ Volume& Net::Forward(const Vector<VolumePtr>& inputs, bool is_training) {
 }
 
 Volume& Net::Forward(Volume& input, bool is_training) {
+	bool prof = IsProfiling();
+	uint64 t0 = prof ? ReadCycles() : 0;
 	Volume* activation = &layers[0]->Forward(input, is_training);
+	if (prof)
+		profile.Add(NetProfile::FORWARD, 0, t0, ReadCycles());
 	for (int i = 1; i < layers.GetCount(); i++) {
+		if (IsFused(i))
+			continue;
 		LayerBase& layer_base = *layers[i];
+		if (prof)
+			t0 = ReadCycles();
 		activation = &layer_base.Forward(*activation, is_training);
+		if (prof)
+			profile.Add(NetProfile::FORWARD, i, t0, ReadCycles());
 	}
 	return *activation;
 }
 
+const Volume& Net::Predict(const Volume& input, PredictWorkspace& ws) const {
+	AllocScope alloc(ws.allocs);
+	ws.activations.SetCount(2);
+	const Volume* activation = &input;
+	int j = 1;
+	for (int i = 0; i < layers.GetCount(); i++) {
+		// the pool is not fused here, because the layers must not be changed
+		if (IsFused(i) && fused[i] == FUSE_ACTIVATION)
+			continue;
+		// the input of the net is never overwritten, because the first layer is the InputLayer
+		if (i == 0 || !layers[i]->CanRunInPlace())
+			j = !j;
+		layers[i]->Predict(*activation, ws.activations[j], ws.tmp);
+		activation = &ws.activations[j];
+	}
+	return *activation;
+}
+
+int Net::GetPrediction(const Volume& input, PredictWorkspace& ws) const {
+	// this is a convenience function for returning the argmax
+	// prediction, assuming the last layer of the net is a softmax
+	if (!dynamic_cast<const SoftmaxLayer*>(layers.Top()))
+		throw Exception("GetPrediction function assumes softmax as last layer of the net!");
+	
+	return Predict(input, ws).GetMaxColumn();
+}
+
 double Net::GetCostLoss(Volume& input, int pos, double y) {
 	Forward(input);
 	
@@ -98,11 +378,11 @@ double Net::Backward(int pos, double y) {
 	int n = layers.GetCount();
 	LastLayerBase* last_layer = dynamic_cast<LastLayerBase*>(&*layers[n - 1]);
 	if (last_layer != NULL) {
+		uint64 t0 = IsProfiling() ? ReadCycles() : 0;
 		double loss = last_layer->Backward(pos, y); // last layer assumed to be loss layer
-		for (int i = n - 2; i >= 0; i--) {
-			// first layer assumed input
-			layers[i]->Backward();
-		}
+		if (IsProfiling())
+			profile.Add(NetProfile::BACKWARD, n - 1, t0, ReadCycles());
+		BackwardHidden();
 		return loss;
 	}
 	
@@ -113,11 +393,11 @@ double Net::Backward(const VolumeDataBase& y) {
 	int n = layers.GetCount();
 	LastLayerBase* last_layer = dynamic_cast<LastLayerBase*>(&*layers[n - 1]);
 	if (last_layer != NULL) {
+		uint64 t0 = IsProfiling() ? ReadCycles() : 0;
 		double loss = last_layer->Backward(y); // last layer assumed to be loss layer
-		for (int i = n - 2; i >= 0; i--) {
-			// first layer assumed input
-			layers[i]->Backward();
-		}
+		if (IsProfiling())
+			profile.Add(NetProfile::BACKWARD, n - 1, t0, ReadCycles());
+		BackwardHidden();
 		return loss;
 	}
 	
@@ -128,17 +408,34 @@ double Net::Backward(int cols, const Vector<int>& pos, const Vector<double>& y)
 	int n = layers.GetCount();
 	LastLayerBase* last_layer = dynamic_cast<LastLayerBase*>(&*layers[n - 1]);
 	if (last_layer != NULL) {
+		uint64 t0 = IsProfiling() ? ReadCycles() : 0;
 		double loss = last_layer->Backward(cols, pos, y); // last layer assumed to be loss layer
-		for (int i = n - 2; i >= 0; i--) {
-			// first layer assumed input
-			layers[i]->Backward();
-		}
+		if (IsProfiling())
+			profile.Add(NetProfile::BACKWARD, n - 1, t0, ReadCycles());
+		BackwardHidden();
 		return loss;
 	}
 	
 	throw Exception("Last layer doesnt implement ILastLayer interface");
 }
 
+void Net::BackwardHidden(int samples) {
+	// zero samples is the single sample path, and otherwise the minibatch path
+	bool prof = IsProfiling();
+	for (int i = layers.GetCount() - 2; i >= 0; i--) {
+		// first layer assumed input
+		if (IsBackwardSkipped(i))
+			continue;
+		uint64 t0 = prof ? ReadCycles() : 0;
+		if (samples)
+			layers[i]->BackwardBatch();
+		else
+			layers[i]->Backward();
+		if (prof)
+			profile.Add(NetProfile::BACKWARD, i, t0, ReadCycles(), max(samples, 1));
+	}
+}
+
 int Net::GetPrediction() {
 	// this is a convenience function for returning the argmax
 	// prediction, assuming the last layer of the net is a softmax
@@ -161,24 +458,271 @@ int Net::GetPrediction() {
 	return maxi; // return index of the class with highest class probability
 }
 
+VolumeBatch& Net::ForwardBatch(VolumeBatch& input, bool is_training) {
+	bool prof = IsProfiling();
+	int samples = input.GetCount();
+	uint64 t0 = prof ? ReadCycles() : 0;
+	VolumeBatch* activation = &layers[0]->ForwardBatch(input, is_training);
+	if (prof)
+		profile.Add(NetProfile::FORWARD, 0, t0, ReadCycles(), samples);
+	for (int i = 1; i < layers.GetCount(); i++) {
+		if (IsFused(i))
+			continue;
+		LayerBase& layer_base = *layers[i];
+		if (prof)
+			t0 = ReadCycles();
+		activation = &layer_base.ForwardBatch(*activation, is_training);
+		if (prof)
+			profile.Add(NetProfile::FORWARD, i, t0, ReadCycles(), samples);
+	}
+	return *activation;
+}
+
+double Net::BackwardBatch(const Vector<int>& pos, const Vector<double>& y) {
+	int n = layers.GetCount();
+	LastLayerBase* last_layer = dynamic_cast<LastLayerBase*>(&*layers[n - 1]);
+	if (last_layer != NULL) {
+		uint64 t0 = IsProfiling() ? ReadCycles() : 0;
+		double loss = last_layer->BackwardBatch(pos, y); // last layer assumed to be loss layer
+		int samples = last_layer->output_batch.GetCount();
+		if (IsProfiling())
+			profile.Add(NetProfile::BACKWARD, n - 1, t0, ReadCycles(), samples);
+		BackwardHidden(samples);
+		return loss;
+	}
+	
+	throw Exception("Last layer doesnt implement ILastLayer interface");
+}
+
+double Net::BackwardBatch(const VolumeBatch& y) {
+	int n = layers.GetCount();
+	LastLayerBase* last_layer = dynamic_cast<LastLayerBase*>(&*layers[n - 1]);
+	if (last_layer != NULL) {
+		uint64 t0 = IsProfiling() ? ReadCycles() : 0;
+		double loss = last_layer->BackwardBatch(y); // last layer assumed to be loss layer
+		int samples = last_layer->output_batch.GetCount();
+		if (IsProfiling())
+			profile.Add(NetProfile::BACKWARD, n - 1, t0, ReadCycles(), samples);
+		BackwardHidden(samples);
+		return loss;
+	}
+	
+	throw Exception("Last layer doesnt implement ILastLayer interface");
+}
+
+int Net::GetBatchPrediction(int i) {
+	// argmax of the i:th sample, assuming softmax as last layer (see GetPrediction)
+	SoftmaxLayer* softmax_layer = dynamic_cast<SoftmaxLayer*>(&*layers[layers.GetCount() - 1]);
+	if (softmax_layer == NULL) {
+		throw Exception("GetBatchPrediction function assumes softmax as last layer of the net!");
+	}
+	
+	return softmax_layer->output_batch.GetMaxColumn(i);
+}
+
 Vector<ParametersAndGradients>& Net::GetParametersAndGradients() {
-	int count = 0;
+	if (mapped)
+		DetachParameters();
+	CollectParameters();
+	return response;
+}
+
+void Net::CollectParameters() {
+	// the collected volumes are kept until the layers change (see Repack)
+	if (!repack) {
+		ASSERT(IsPacked());
+		return;
+	}
 	
-	int k = 0;
+	layer_params.SetCount(0);
+	param_layer.SetCount(0);
+	layer_param_end.SetCount(layers.GetCount());
+	int end = 0;
 	for(int i = 0; i < layers.GetCount(); i++) {
-		LayerBasePtr layer = layers[i];
-		Vector<ParametersAndGradients>& pag = layer->GetParametersAndGradients();
-		count += pag.GetCount();
-		if (count > response.GetCount()) response.SetCount(count);
+		Vector<ParametersAndGradients>& pag = layers[i]->GetParametersAndGradients();
 		for(int j = 0; j < pag.GetCount(); j++) {
-			response[k] = pag[j];
-			k++;
+			layer_params.Add(pag[j]);
+			param_layer.Add(i);
+			end += pag[j].volume->GetLength();
 		}
+		layer_param_end[i] = end;
+	}
+	
+	PackParameters();
+}
+
+const Real* Net::GetParameterBase() const {
+	if (master)
+		return master->GetParameterBase();
+	return mapped ? mapped : param_arena.Begin();
+}
+
+Real* Net::GetViewBase() {
+	// The volumes of a replica or a mapped net only read these weights. The paths that
+	// write them detach a mapped net first (see GetParametersAndGradients, ParameterBegin).
+	if (!master && !mapped)
+		return param_arena.Begin();
+	return const_cast<Real*>(GetParameterBase());
+}
+
+bool Net::IsPacked() const {
+	const Real* w = GetParameterBase();
+	const Real* dw = grad_arena.Begin();
+	int offset = 0;
+	for(int i = 0; i < layer_params.GetCount(); i++) {
+		const Volume& vol = *layer_params[i].volume;
+		if (vol.Begin() != w + offset || vol.GradientBegin() != dw + offset || !vol.IsRelocated())
+			return false;
+		offset += vol.GetLength();
 	}
+	return offset == grad_arena.GetCount();
+}
+
+void Net::PackParameters() {
+	int total = 0;
+	for(int i = 0; i < layer_params.GetCount(); i++)
+		total += layer_params[i].volume->GetLength();
 	
-	response.SetCount(count);
+	// the old arena is released only after all volumes have been moved out of it
+	Vector<Real> params, grads;
+	bool shared = master || mapped;
+	if (master)
+		ASSERT(master->grad_arena.GetCount() == total);
+	else if (mapped)
+		ASSERT(mapped_count == total);
+	else
+		params.SetCount(total);
+	grads.SetCount(total, 0);
+	Real* w = shared ? GetViewBase() : params.Begin();
+	int offset = 0;
+	for(int i = 0; i < layer_params.GetCount(); i++) {
+		Volume& vol = *layer_params[i].volume;
+		int len = vol.GetLength();
+		if (len && shared)
+			vol.InitView(vol.GetWidth(), vol.GetHeight(), vol.GetDepth(), w + offset, grads.Begin() + offset);
+		else if (len)
+			vol.Relocate(w + offset, grads.Begin() + offset);
+		offset += len;
+	}
+	Swap(param_arena, params);
+	Swap(grad_arena, grads);
+	repack = false;
 	
-	return response;
+	MakeSpans();
+}
+
+void Net::MakeSpans() {
+	// merge consecutive volumes with the same decay multipliers into one span,
+	// and leave the frozen volumes out
+	Real* w = GetViewBase();
+	response.SetCount(0);
+	spans.Clear();
+	int offset = 0;
+	for(int i = 0; i < layer_params.GetCount();) {
+		const ParametersAndGradients& first = layer_params[i];
+		bool frozen = layers[param_layer[i]]->frozen;
+		int begin = offset;
+		for(; i < layer_params.GetCount(); i++) {
+			const ParametersAndGradients& pag = layer_params[i];
+			if (pag.l1_decay_mul != first.l1_decay_mul || pag.l2_decay_mul != first.l2_decay_mul ||
+				layers[param_layer[i]]->frozen != frozen)
+				break;
+			offset += pag.volume->GetLength();
+		}
+		if (offset == begin || frozen)
+			continue;
+		ParametersAndGradients& span = response.Add();
+		span.volume = &spans.Add().InitView(1, 1, offset - begin, w + begin, grad_arena.Begin() + begin);
+		span.l1_decay_mul = first.l1_decay_mul;
+		span.l2_decay_mul = first.l2_decay_mul;
+	}
+}
+
+int Net::GetParameterCount() {
+	CollectParameters();
+	return grad_arena.GetCount();
+}
+
+void Net::StoreParameters(Vector<Real>& dst) {
+	ASSERT(!master);
+	CollectParameters();
+	dst.SetCount(grad_arena.GetCount());
+	memcpy(dst.Begin(), GetParameterBase(), grad_arena.GetCount() * sizeof(Real));
+}
+
+bool Net::LoadParameters(const Vector<Real>& src) {
+	ASSERT(!master);
+	GetParametersAndGradients();
+	if (src.GetCount() != param_arena.GetCount())
+		return false;
+	memcpy(param_arena.Begin(), src.Begin(), param_arena.GetCount() * sizeof(Real));
+	return true;
+}
+
+void Net::ShareParameters(Net& src) {
+	ASSERT(&src != this && !src.master);
+	src.GetParametersAndGradients();
+	master = &src;
+	response.Clear();
+	repack = true;
+	GetParametersAndGradients();
+}
+
+const Real* Net::ParameterData() {
+	CollectParameters();
+	return GetParameterBase();
+}
+
+Real* Net::ParameterBegin() {
+	if (master)
+		return master->ParameterBegin();
+	if (mapped)
+		DetachParameters();
+	CollectParameters();
+	return param_arena.Begin();
+}
+
+Real* Net::GradientBegin() {
+	CollectParameters();
+	return grad_arena.Begin();
+}
+
+void Net::MapParameters(const Real* mem, int count) {
+	ASSERT(!master);
+	mapped = mem;
+	mapped_count = count;
+	response.Clear();
+	repack = true;
+	CollectParameters();
+}
+
+void Net::DetachParameters() {
+	if (!mapped)
+		return;
+	// Relocate copies the weights from the mapped memory to a new arena
+	mapped = NULL;
+	mapped_count = 0;
+	response.Clear();
+	repack = true;
+	CollectParameters();
+}
+
+void Net::Clear() {
+	master = NULL;
+	mapped = NULL;
+	mapped_count = 0;
+	ReleaseActivations();
+	layers.Clear();
+	fused.Clear();
+	layer_param_end.Clear();
+	profile.SetLayerCount(0);
+	layer_params.Clear();
+	response.Clear();
+	repack = true;
+	generation++;
+	spans.Clear();
+	param_arena.Clear();
+	grad_arena.Clear();
 }
 
 String Net::ToString() const {
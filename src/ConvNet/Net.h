@@ -2,10 +2,22 @@
 #define _ConvNet_Net_h_
 
 #include "LayerBase.h"
+#include "Profile.h"
 
 namespace ConvNet
 {
 
+// The activations of one caller of Net::Predict. The workspace is reused between the
+// calls, so keep one per thread instead of creating it for every prediction. The layers
+// write to two activations in turns, and elementwise layers work in place. The input
+// is for the callers, which have the input in some other form.
+struct PredictWorkspace {
+	Array<Volume> activations;
+	Vector<Real> tmp;
+	Volume input;
+	AllocStat allocs;
+};
+
 class Net {
 	
 private:
@@ -13,16 +25,70 @@ private:
 	Vector<ParametersAndGradients> response;
 	SpinLock lock;
 	
+	// All parameters and gradients of the layers are kept in two contiguous arenas.
+	// The volumes of the layers are views to them, and the trainers get only a few
+	// spans, one for each range of equal decay multipliers.
+	Vector<Real> param_arena, grad_arena;
+	Vector<ParametersAndGradients> layer_params;
+	Array<Volume> spans;
+	bool repack; // the volumes of the layers are collected again on the next use
+	int generation; // changes with the layers, see GetGeneration
+	
+	// A replica uses the parameter arena of the master net, but has its own gradients
+	Net* master;
+	
+	// Weights read directly from the memory of a mapped model file
+	const Real* mapped;
+	int mapped_count;
+	
+	// The layers, which SetFusion has merged to the previous layer, are skipped
+	enum {FUSE_NONE, FUSE_ACTIVATION, FUSE_POOL};
+	Vector<int> fused;
+	bool fusion;
+	
+	void UpdateFusion();
+	bool IsFused(int i) const {return i < fused.GetCount() && fused[i];}
+	
+	// Shared memory of the activations of Forward and Backward (see SetMemoryPlan)
+	Vector<Real> activation_arena;
+	bool memory_plan;
+	
+	void UpdateMemoryPlan();
+	void ReleaseActivations();
+	
+	// Layers, whose Backward has nothing to compute (see SetFrozen)
+	Vector<bool> skip_backward;
+	Vector<int> param_layer;
+	
+	void UpdateBackward();
+	bool IsBackwardSkipped(int i) const {return IsFused(i) || (i < skip_backward.GetCount() && skip_backward[i]);}
+	void BackwardHidden(int samples=0);
+	
+	// The end of the parameters of every layer in the arena, and the profile (see SetProfiling)
+	Vector<int> layer_param_end;
+	NetProfile profile;
+	bool profiling;
+	
+	void UpdateProfile();
+	void MakeSpans();
+	
+	bool IsPacked() const;
+	void PackParameters();
+	void CollectParameters();
+	const Real* GetParameterBase() const;
+	Real* GetViewBase();
+	
 protected:
 	friend class Session;
-	Net(const Net& iv) {}
+	Net(const Net& iv) : repack(true), generation(0), master(NULL), mapped(NULL), mapped_count(0), fusion(false), memory_plan(false), profiling(false) {}
 		
-	void AddLayerPointer(LayerBase& layer) {layers.Add(&layer);}
+	void AddLayerPointer(LayerBase& layer);
 public:
-	Net() {}
+	Net() : repack(true), generation(0), master(NULL), mapped(NULL), mapped_count(0), fusion(false), memory_plan(false), profiling(false) {}
 	
 	const Vector<LayerBasePtr>& GetLayers() const {return layers;}
 	Volume& GetOutput() {return layers.Top()->output_activation;}
+	VolumeBatch& GetBatchOutput() {return layers.Top()->output_batch;}
 	
 	virtual void AddLayer(LayerBase& layer);
 	virtual Volume& Forward(const Vector<VolumePtr>& inputs, bool is_training = false);
@@ -33,9 +99,89 @@ public:
 	virtual double Backward(const VolumeDataBase& y);
 	virtual double Backward(int cols, const Vector<int>& pos, const Vector<double>& y);
 	virtual int GetPrediction();
+	
+	// Thread-safe inference: the net is only read, and all activations are written to
+	// the workspace of the caller, so many threads can predict at the same time without
+	// locking. The layers and the parameter arena must not be changed meanwhile.
+	const Volume& Predict(const Volume& input, PredictWorkspace& ws) const;
+	int GetPrediction(const Volume& input, PredictWorkspace& ws) const;
+	
+	// Minibatch path: one call processes all samples of the batch.
+	// The returned loss is the sum over the batch.
+	virtual VolumeBatch& ForwardBatch(VolumeBatch& input, bool is_training = false);
+	virtual double BackwardBatch(const Vector<int>& pos, const Vector<double>& y);
+	virtual double BackwardBatch(const VolumeBatch& y);
+	virtual int GetBatchPrediction(int i);
+	
 	virtual Vector<ParametersAndGradients>& GetParametersAndGradients();
 	
-	void Clear() {layers.Clear();}
+	// Fusion merges a Relu, Tanh or Sigmoid layer to the FullyConn or Conv layer
+	// before it, and a following non-overlapping max pool to the Conv layer, so that
+	// their kernels run in the same pass over the output. The merged layers are
+	// skipped, and their own outputs are not updated, except the output of the pool.
+	// The last layer is never merged, because its output is the output of the net.
+	void SetFusion(bool b=true);
+	bool IsFusion() const {return fusion;}
+	
+	// The memory plan places the activations of Forward and Backward to shared memory.
+	// The values, which Backward reads, are kept for the whole pass, but the others share
+	// a few buffers by their lifetime. Elementwise layers work in place, when the previous
+	// layer doesn't need its output values, and the gradients of the activations use two
+	// buffers in turns. So the hidden activations and their gradients are not valid after
+	// the pass, e.g. for showing them. The minibatch path is not planned.
+	void SetMemoryPlan(bool b=true);
+	bool IsMemoryPlan() const {return memory_plan;}
+	int64 GetActivationMemory() const;
+	
+	// Profiling records the cycles of Forward, Backward and the updates of the trainers for
+	// every layer, with estimates of their flops and bytes (see NetProfile). It is compiled
+	// in only with the CONVNET_PROFILE flag, and otherwise SetProfiling has no effect. The
+	// replicas of Session::SetThreadCount are not profiled.
+	void SetProfiling(bool b=true);
+	bool IsProfiling() const {return CONVNET_PROFILE && profiling;}
+	NetProfile& GetProfile() {return profile;}
+	const NetProfile& GetProfile() const {return profile;}
+	int GetLayerParameterEnd(int layer) const {return layer_param_end[layer];}
+	
+	// Frozen layers keep their parameters: they are left out of GetParametersAndGradients,
+	// and Backward doesn't compute their parameter gradients. Backward skips also the
+	// gradients wrt the inputs, which no layer with trainable parameters would read, e.g.
+	// the input gradient of the first conv layer.
+	void SetFrozen(int layer, bool b=true);
+	bool IsFrozen(int layer) const {return layers[layer]->frozen;}
+	
+	// Snapshot of all parameters in the order of the arena. LoadParameters fails, if src
+	// has a different count.
+	int GetParameterCount();
+	void StoreParameters(Vector<Real>& dst);
+	bool LoadParameters(const Vector<Real>& src);
+	
+	// Makes this net a replica of src, which must have identical layers. The weights
+	// are read from the arena of src, and the gradients go to the own arena of this net.
+	void ShareParameters(Net& src);
+	
+	// Layers re-create their parameter volumes in Init and Load. The net collects them
+	// only when layers are added, so call this after re-initializing its layers directly.
+	void Repack() {repack = true; generation++;}
+	
+	// Changes, when layers are added, removed or re-initialized. New layers can be at the
+	// addresses of deleted ones, so compare this instead of the layer pointers.
+	int GetGeneration() const {return generation;}
+	
+	// The weights in the order of the arena. ParameterBegin is for writing, so it
+	// copies a mapped model to the own arena first.
+	const Real* ParameterData();
+	Real* ParameterBegin();
+	Real* GradientBegin();
+	
+	// Uses count weights at mem directly, without copying. The memory must stay valid
+	// until Clear or DetachParameters. The trainers write to the weights, so
+	// GetParametersAndGradients copies them to the own arena first.
+	void MapParameters(const Real* mem, int count);
+	void DetachParameters();
+	bool IsMapped() const {return mapped;}
+	
+	void Clear();
 	void Enter() {lock.Enter();}
 	void Leave() {lock.Leave();}
 	
@@ -76,6 +76,33 @@ Volume& PoolLayer::Forward(Volume& input, bool is_training) {
 	return output_activation;
 }
 
+void PoolLayer::Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const {
+	output.Init(output_width, output_height, output_depth, 0.0);
+	
+	int in_w = input.GetWidth();
+	int in_h = input.GetHeight();
+	const Real* in = input.Begin();
+	Real* out = output.Begin();
+	for (int ay = 0; ay < output_height; ay++) {
+		int y = ay * stride - pad;
+		for (int ax = 0; ax < output_width; ax++) {
+			int x = ax * stride - pad;
+			Real* o = out + (output_width * ay + ax) * output_depth;
+			for (int depth = 0; depth < output_depth; depth++) {
+				double a = -DBL_MAX;
+				for (int fy = max(0, -y); fy < height && y + fy < in_h; fy++) {
+					for (int fx = max(0, -x); fx < width && x + fx < in_w; fx++) {
+						double v = in[(in_w * (y + fy) + x + fx) * output_depth + depth];
+						if (v > a)
+							a = v;
+					}
+				}
+				o[depth] = (Real)a;
+			}
+		}
+	}
+}
+
 void PoolLayer::Backward() {
 	// pooling layers have no parameters, so simply compute
 	// gradient wrt data here
@@ -97,6 +124,85 @@ void PoolLayer::Backward() {
 	}
 }
 
+VolumeBatch& PoolLayer::ForwardBatch(VolumeBatch& input, bool is_training) {
+	input_batch = &input;
+	int count = input.GetCount();
+	output_batch.Init(output_width, output_height, output_depth, count, 0.0);
+	
+	int volume_width = input.GetWidth();
+	int volume_height = input.GetHeight();
+	int volume_depth = input.GetDepth();
+	int length = output_width * output_height * output_depth;
+	switchx_batch.SetCount(length * count);
+	switchy_batch.SetCount(length * count);
+	
+	int n = 0; // a counter for switches
+	for (int b = 0; b < count; b++) {
+		const Real* in = input.Begin(b);
+		Real* out = output_batch.Begin(b);
+		
+		for (int depth = 0; depth < output_depth; depth++) {
+			int x = -pad;
+			for (int ax = 0; ax < output_width; x += stride, ax++) {
+				int y = -pad;
+				for (int ay = 0; ay < output_height; y += stride, ay++) {
+					double a = -DBL_MAX;
+					int winx = -1, winy = -1;
+					
+					for (int fx = 0; fx < width; fx++) {
+						int ox = x + fx;
+						if (ox < 0 || ox >= volume_width)
+							continue;
+						for (int fy = 0; fy < height; fy++) {
+							int oy = y + fy;
+							if (oy < 0 || oy >= volume_height)
+								continue;
+							double v = in[(volume_width * oy + ox) * volume_depth + depth];
+							if (v > a) {
+								a = v;
+								winx = ox;
+								winy = oy;
+							}
+						}
+					}
+					
+					switchx_batch[n] = winx;
+					switchy_batch[n] = winy;
+					n++;
+					out[(output_width * ay + ax) * output_depth + depth] = a;
+				}
+			}
+		}
+	}
+	
+	return output_batch;
+}
+
+void PoolLayer::BackwardBatch() {
+	VolumeBatch& input = *input_batch;
+	int count = input.GetCount();
+	input.ZeroGradients(); // zero out gradient wrt data
+	
+	int volume_width = input.GetWidth();
+	int volume_depth = input.GetDepth();
+	
+	int n = 0;
+	for (int b = 0; b < count; b++) {
+		Real* din = input.GradientBegin(b);
+		const Real* dout = output_batch.GradientBegin(b);
+		
+		for (int depth = 0; depth < output_depth; depth++) {
+			for (int ax = 0; ax < output_width; ax++) {
+				for (int ay = 0; ay < output_height; ay++) {
+					double chain_gradient_ = dout[(output_width * ay + ax) * output_depth + depth];
+					din[(volume_width * switchy_batch[n] + switchx_batch[n]) * volume_depth + depth] += chain_gradient_;
+					n++;
+				}
+			}
+		}
+	}
+}
+
 #define STOREVAR(json, field) map.GetAdd(#json) = this->field;
 #define LOADVAR(field, json) this->field = map.GetValue(map.Find(#json));
 #define LOADVARDEF(field, json, def) {Value tmp = map.GetValue(map.Find(#json)); if (tmp.IsNull()) this->field = def; else this->field = tmp;}
@@ -0,0 +1,161 @@
+#include "Profile.h"
+
+namespace ConvNet {
+
+double GetCyclesPerSecond() {
+	static double cps = [] {
+	#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+		// compare the counter to the steady clock over a short sleep
+		auto t0 = std::chrono::steady_clock::now();
+		uint64 c0 = ReadCycles();
+		Sleep(20);
+		uint64 c1 = ReadCycles();
+		double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		return (c1 - c0) / s;
+	#else
+		return (double)std::chrono::steady_clock::period::den / std::chrono::steady_clock::period::num;
+	#endif
+	}();
+	return cps;
+}
+
+void ProfileStat::Clear() {
+	count = 0;
+	cycles = 0;
+	min_cycles = UINT64_MAX;
+	max_cycles = 0;
+	flops = 0;
+	bytes = 0;
+	memset(histogram, 0, sizeof(histogram));
+}
+
+void ProfileStat::Add(uint64 c, int64 flops, int64 bytes) {
+	count++;
+	cycles += c;
+	min_cycles = min(min_cycles, c);
+	max_cycles = max(max_cycles, c);
+	this->flops += flops;
+	this->bytes += bytes;
+	int bucket = 0;
+	while (c > 1 && bucket < BUCKETS - 1) {
+		c >>= 1;
+		bucket++;
+	}
+	histogram[bucket]++;
+}
+
+void ProfileStat::Append(const ProfileStat& s) {
+	count += s.count;
+	cycles += s.cycles;
+	min_cycles = min(min_cycles, s.min_cycles);
+	max_cycles = max(max_cycles, s.max_cycles);
+	flops += s.flops;
+	bytes += s.bytes;
+	for(int i = 0; i < BUCKETS; i++)
+		histogram[i] += s.histogram[i];
+}
+
+double ProfileStat::GetPercentile(double p) const {
+	if (!count)
+		return 0;
+	// interpolate inside the bucket, which has the p:th duration
+	double target = minmax(p, 0.0, 1.0) * count;
+	int64 seen = 0;
+	for(int i = 0; i < BUCKETS; i++) {
+		if (!histogram[i])
+			continue;
+		if (seen + histogram[i] >= target) {
+			double lo = i ? (double)(1ULL << i) : 0;
+			double hi = (double)(1ULL << (i + 1));
+			double v = lo + (hi - lo) * (target - seen) / histogram[i];
+			return minmax(v, (double)min_cycles, (double)max_cycles);
+		}
+		seen += histogram[i];
+	}
+	return (double)max_cycles;
+}
+
+void NetProfile::SetLayer(int i, const String& name, int phase, int64 flops, int64 bytes) {
+	Layer& l = layers[i];
+	l.name = name;
+	l.flops[phase] = flops;
+	l.bytes[phase] = bytes;
+}
+
+void NetProfile::SetTraceCapacity(int events) {
+	trace.Clear();
+	trace.SetCount(max(0, events));
+	trace_total = 0;
+}
+
+void NetProfile::Clear() {
+	for(int i = 0; i < layers.GetCount(); i++)
+		for(int j = 0; j < PHASE_COUNT; j++)
+			layers[i].stat[j].Clear();
+	trace_total = 0;
+	origin = ReadCycles();
+}
+
+ProfileStat NetProfile::GetTotal(int phase) const {
+	ProfileStat s;
+	for(int i = 0; i < layers.GetCount(); i++)
+		s.Append(layers[i].stat[phase]);
+	return s;
+}
+
+const char* NetProfile::GetPhaseName(int phase) {
+	switch (phase) {
+		case FORWARD: return "forward";
+		case BACKWARD: return "backward";
+		case UPDATE: return "update";
+	}
+	return "";
+}
+
+String NetProfile::ToString() const {
+	double cps = GetCyclesPerSecond();
+	String s;
+	s << Format("%-12s %-8s %10s %12s %12s %12s %10s %10s\n",
+		"layer", "phase", "count", "mean us", "p50 us", "p99 us", "GFLOP/s", "GB/s");
+	for(int i = 0; i < layers.GetCount(); i++) {
+		const Layer& l = layers[i];
+		for(int j = 0; j < PHASE_COUNT; j++) {
+			const ProfileStat& st = l.stat[j];
+			if (!st.count)
+				continue;
+			s << Format("%-12s %-8s %10d %12.3f %12.3f %12.3f %10.3f %10.3f\n",
+				l.name, GetPhaseName(j), st.count,
+				st.GetMeanCycles() * 1e6 / cps,
+				st.GetPercentile(0.5) * 1e6 / cps,
+				st.GetPercentile(0.99) * 1e6 / cps,
+				st.GetFlopsPerSecond() * 1e-9,
+				st.GetBytesPerSecond() * 1e-9);
+		}
+	}
+	return s;
+}
+
+String NetProfile::StoreChromeTrace() const {
+	double us = 1e6 / GetCyclesPerSecond();
+	String s = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	int n = trace.GetCount();
+	int count = (int)min<int64>(trace_total, n);
+	// the oldest event first
+	int first = trace_total > n ? (int)(trace_total % n) : 0;
+	for(int i = 0; i < count; i++) {
+		const ProfileEvent& e = trace[(first + i) % n];
+		const Layer& l = layers[e.layer];
+		if (i)
+			s << ',';
+		s << "\n{\"name\":" << AsJSON(l.name)
+		  << ",\"cat\":\"" << GetPhaseName(e.phase) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+		  << ",\"ts\":" << FormatDouble((double)(int64)(e.begin - origin) * us, 3)
+		  << ",\"dur\":" << FormatDouble(e.cycles * us, 3)
+		  << ",\"args\":{\"layer\":" << e.layer
+		  << ",\"flops\":" << l.flops[e.phase] << ",\"bytes\":" << l.bytes[e.phase] << "}}";
+	}
+	s << "\n]}\n";
+	return s;
+}
+
+}
@@ -0,0 +1,124 @@
+#ifndef _ConvNet_Profile_h_
+#define _ConvNet_Profile_h_
+
+#include "Utilities.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+#include <chrono>
+
+// The profiling of the layers is compiled in only with the CONVNET_PROFILE flag. Without
+// it the checks are constant false, and the compiler removes the instrumentation.
+#ifdef flagCONVNET_PROFILE
+#define CONVNET_PROFILE 1
+#else
+#define CONVNET_PROFILE 0
+#endif
+
+namespace ConvNet {
+
+// Time stamp counter, or nanoseconds of the steady clock where there is no counter
+inline uint64 ReadCycles() {
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// Measured once, on the first call
+double GetCyclesPerSecond();
+
+// The durations of one thing in cycles. The histogram bucket i counts the durations
+// of [2^i, 2^(i+1)) cycles, and the percentiles are estimated from it.
+struct ProfileStat : Moveable<ProfileStat> {
+	enum {BUCKETS = 48};
+	
+	int64 count;
+	uint64 cycles, min_cycles, max_cycles;
+	int64 flops, bytes;
+	int64 histogram[BUCKETS];
+	
+	ProfileStat() {Clear();}
+	void Clear();
+	void Add(uint64 c, int64 flops, int64 bytes);
+	void Append(const ProfileStat& s);
+	
+	double GetMeanCycles() const {return count ? (double)cycles / count : 0;}
+	double GetPercentile(double p) const;
+	double GetSeconds() const {return cycles / GetCyclesPerSecond();}
+	double GetFlopsPerSecond() const {return cycles ? flops / GetSeconds() : 0;}
+	double GetBytesPerSecond() const {return cycles ? bytes / GetSeconds() : 0;}
+};
+
+struct ProfileEvent : Moveable<ProfileEvent> {
+	uint64 begin, cycles;
+	int layer, phase;
+};
+
+// The per-layer profile of a Net (see Net::SetProfiling). The forward, backward and
+// optimizer times of every layer are collected to ProfileStats. The layers, which
+// Net::SetFusion has merged, are included in the layer before them. The flops and bytes
+// are estimates of the work of the layer, set by the Net.
+//
+// The trace keeps the latest events in a ring buffer, which is allocated only in
+// SetTraceCapacity, and StoreChromeTrace writes them in the trace event format of
+// chrome://tracing and Perfetto.
+class NetProfile {
+	
+public:
+	enum {FORWARD, BACKWARD, UPDATE, PHASE_COUNT};
+	
+private:
+	struct Layer : Moveable<Layer> {
+		String name;
+		int64 flops[PHASE_COUNT], bytes[PHASE_COUNT];
+		ProfileStat stat[PHASE_COUNT];
+		
+		Layer() {memset(flops, 0, sizeof(flops)); memset(bytes, 0, sizeof(bytes));}
+	};
+	
+	Vector<Layer> layers;
+	Vector<ProfileEvent> trace;
+	int64 trace_total;
+	uint64 origin;
+	
+public:
+	NetProfile() : trace_total(0), origin(ReadCycles()) {}
+	
+	void SetLayerCount(int i) {layers.SetCount(i);}
+	void SetLayer(int i, const String& name, int phase, int64 flops, int64 bytes);
+	void SetTraceCapacity(int events);
+	void Clear();
+	
+	// samples is the count of the minibatch
+	void Add(int phase, int layer, uint64 begin, uint64 end, int samples=1) {
+		Layer& l = layers[layer];
+		uint64 c = end - begin;
+		l.stat[phase].Add(c, l.flops[phase] * samples, l.bytes[phase] * samples);
+		if (!trace.IsEmpty()) {
+			ProfileEvent& e = trace[(int)(trace_total++ % trace.GetCount())];
+			e.begin = begin;
+			e.cycles = c;
+			e.layer = layer;
+			e.phase = phase;
+		}
+	}
+	
+	int GetLayerCount() const {return layers.GetCount();}
+	const String& GetLayerName(int layer) const {return layers[layer].name;}
+	const ProfileStat& GetStat(int layer, int phase) const {return layers[layer].stat[phase];}
+	ProfileStat GetTotal(int phase) const;
+	static const char* GetPhaseName(int phase);
+	
+	String ToString() const;
+	String StoreChromeTrace() const;
+	
+};
+
+}
+
+#endif
@@ -0,0 +1,133 @@
+#include "Kernels.h"
+
+#if (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))) || \
+	(defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+#define CONVNET_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace ConvNet {
+
+static void DotInt8Scalar(const int8* a, const int8* b, int k, int n, int* out, int begin) {
+	for (int j = 0; j < n; j++) {
+		const int8* row = b + j * k;
+		int sum = out[j];
+		for (int i = begin; i < k; i++)
+			sum += a[i] * row[i];
+		out[j] = sum;
+	}
+}
+
+#ifdef CONVNET_X86_KERNELS
+
+// The products of two int8 values fit in int16, and madd adds pairs of them to int32
+// lanes, so the sums don't overflow for any practical k. Both versions return the
+// count of values they have done, and the scalar loop adds the rest.
+namespace Sse2 {
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("sse2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+
+static inline __m128i Load8(const int8* p) {
+	// sign extends 8 values to int16
+	__m128i v = _mm_loadl_epi64((const __m128i*)p);
+	return _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+}
+
+static int DotInt8(const int8* a, const int8* b, int k, int n, int* out) {
+	int end = k - k % 8;
+	for (int j = 0; j < n; j++) {
+		const int8* row = b + j * k;
+		__m128i sum = _mm_setzero_si128();
+		for (int i = 0; i < end; i += 8)
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(Load8(a + i), Load8(row + i)));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+		out[j] = _mm_cvtsi128_si32(sum);
+	}
+	return end;
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+}
+
+namespace Avx2 {
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+static inline __m256i Load16(const int8* p) {
+	return _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)p));
+}
+
+static int DotInt8(const int8* a, const int8* b, int k, int n, int* out) {
+	// four rows at a time, so that the widened values of a are reused
+	int end = k - k % 16;
+	int j = 0;
+	for (; j + 4 <= n; j += 4) {
+		const int8* r0 = b + j * k;
+		const int8* r1 = r0 + k;
+		const int8* r2 = r1 + k;
+		const int8* r3 = r2 + k;
+		__m256i s0 = _mm256_setzero_si256(), s1 = s0, s2 = s0, s3 = s0;
+		for (int i = 0; i < end; i += 16) {
+			__m256i va = Load16(a + i);
+			s0 = _mm256_add_epi32(s0, _mm256_madd_epi16(va, Load16(r0 + i)));
+			s1 = _mm256_add_epi32(s1, _mm256_madd_epi16(va, Load16(r1 + i)));
+			s2 = _mm256_add_epi32(s2, _mm256_madd_epi16(va, Load16(r2 + i)));
+			s3 = _mm256_add_epi32(s3, _mm256_madd_epi16(va, Load16(r3 + i)));
+		}
+		// horizontal sums of the four rows to the four lanes of one vector
+		__m256i s01 = _mm256_hadd_epi32(s0, s1);
+		__m256i s23 = _mm256_hadd_epi32(s2, s3);
+		__m256i s = _mm256_hadd_epi32(s01, s23);
+		__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+		_mm_storeu_si128((__m128i*)(out + j), sum);
+	}
+	for (; j < n; j++) {
+		const int8* row = b + j * k;
+		__m256i s = _mm256_setzero_si256();
+		for (int i = 0; i < end; i += 16)
+			s = _mm256_add_epi32(s, _mm256_madd_epi16(Load16(a + i), Load16(row + i)));
+		__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+		out[j] = _mm_cvtsi128_si32(sum);
+	}
+	return end;
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+}
+
+#endif
+
+void DotInt8(const int8* a, const int8* b, int k, int n, int* out) {
+	int done = 0;
+#ifdef CONVNET_X86_KERNELS
+	switch (GetKernelIsa()) {
+		case KERNEL_AVX2: done = Avx2::DotInt8(a, b, k, n, out); break;
+		case KERNEL_SSE2: done = Sse2::DotInt8(a, b, k, n, out); break;
+	}
+#endif
+	if (!done)
+		memset(out, 0, n * sizeof(int));
+	if (done < k)
+		DotInt8Scalar(a, b, k, n, out, done);
+}
+
+}
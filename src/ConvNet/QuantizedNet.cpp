@@ -0,0 +1,429 @@
+#include "ConvNet.h"
+
+namespace ConvNet {
+
+// Converts a value to int8 with the given scale (the Real value of one step)
+static inline int8 QuantizeValue(double v, double inv_scale) {
+	double q = v * inv_scale;
+	return (int8)minmax((int)(q >= 0 ? q + 0.5 : q - 0.5), -127, 127);
+}
+
+// Im2ColRows for the quantized values. Taps in the padding are zero, which is also
+// the quantized zero, because the scales are symmetric.
+static void Im2ColInt8(const int8* in, int in_w, int in_h, int in_d, int f_w, int f_h,
+	int stride, int pad, int out_w, int out_h, int8* col) {
+	
+	int row_len = f_w * f_h * in_d;
+	int span = f_w * in_d;
+	
+	for (int ay = 0; ay < out_h; ay++) {
+		int y = ay * stride - pad;
+		for (int ax = 0; ax < out_w; ax++) {
+			int x = ax * stride - pad;
+			int8* row = col + (ay * out_w + ax) * row_len;
+			int fx0 = max(0, -x);
+			int fx1 = min(f_w, in_w - x);
+			
+			for (int fy = 0; fy < f_h; fy++) {
+				int8* dst = row + fy * span;
+				int oy = y + fy;
+				if (oy < 0 || oy >= in_h || fx0 >= fx1) {
+					memset(dst, 0, span);
+					continue;
+				}
+				memset(dst, 0, fx0 * in_d);
+				memcpy(dst + fx0 * in_d, in + (in_w * oy + x + fx0) * in_d, (fx1 - fx0) * in_d);
+				memset(dst + fx1 * in_d, 0, span - fx1 * in_d);
+			}
+		}
+	}
+}
+
+static void AppendWeights(Vector<Real>& dst, const Volume& src) {
+	int n = dst.GetCount();
+	dst.SetCount(n + src.GetLength());
+	memcpy(dst.Begin() + n, src.Begin(), src.GetLength() * sizeof(Real));
+}
+
+static void CopyValues(const Volume& src, Volume& dst) {
+	if (&dst == &src)
+		return;
+	dst.Init(src.GetWidth(), src.GetHeight(), src.GetDepth(), 0.0);
+	memcpy(dst.Begin(), src.Begin(), src.GetLength() * sizeof(Real));
+}
+
+String QuantizationReport::ToString() const {
+	return Format("samples: %d, float accuracy: %2!,n, quantized accuracy: %2!,n, agreement: %2!,n, "
+		"max output difference: %2!,n, mean output difference: %2!,n, weights: %d -> %d bytes",
+		count, GetFloatAccuracy(), GetQuantizedAccuracy(), GetAgreement(), max_diff, mean_diff,
+		float_weight_bytes, quantized_weight_bytes);
+}
+
+QuantizedNet::QuantizedNet() {
+	input_width = 0;
+	input_height = 0;
+	input_depth = 0;
+}
+
+void QuantizedNet::Clear() {
+	ops.Clear();
+	input_width = 0;
+	input_height = 0;
+	input_depth = 0;
+}
+
+void QuantizedNet::Quantize(Session& ses, int calibration_count) {
+	ses.Enter();
+	try {
+		Quantize(ses.GetNetwork(), ses.GetData(), calibration_count);
+	}
+	catch (...) {
+		ses.Leave();
+		throw;
+	}
+	ses.Leave();
+}
+
+void QuantizedNet::Quantize(const Net& net, SessionData& data, int calibration_count) {
+	Clear();
+	
+	const Vector<LayerBasePtr>& layers = net.GetLayers();
+	if (layers.IsEmpty() || !dynamic_cast<const InputLayer*>(layers[0]))
+		throw ArgumentException("First layer should be an InputLayer");
+	
+	input_width = layers[0]->output_width;
+	input_height = layers[0]->output_height;
+	input_depth = layers[0]->output_depth;
+	
+	int w = input_width, h = input_height, d = input_depth;
+	for(int i = 1; i < layers.GetCount(); i++) {
+		const LayerBase* layer = layers[i];
+		int act = ACT_NONE;
+		if (dynamic_cast<const ReluLayer*>(layer))
+			act = ACT_RELU;
+		else if (dynamic_cast<const TanhLayer*>(layer))
+			act = ACT_TANH;
+		else if (dynamic_cast<const SigmoidLayer*>(layer))
+			act = ACT_SIGMOID;
+		
+		// activations are applied to the output of the previous dot product, even if
+		// the net has fused them (see Net::SetFusion)
+		if (act != ACT_NONE && ops.GetCount() && ops.Top().act == ACT_NONE &&
+			(ops.Top().type == QOP_CONV || ops.Top().type == QOP_FC)) {
+			ops.Top().act = act;
+			continue;
+		}
+		
+		Op& op = ops.Add();
+		op.act = act;
+		op.in_w = w;
+		op.in_h = h;
+		op.in_d = d;
+		op.out_w = layer->output_width;
+		op.out_h = layer->output_height;
+		op.out_d = layer->output_depth;
+		op.width = op.height = op.stride = 1;
+		op.pad = 0;
+		op.input_scale = 1.0;
+		op.scale = 1.0;
+		
+		if (act != ACT_NONE) {
+			op.type = QOP_ACTIVATION;
+		}
+		else if (const ConvLayer* conv = dynamic_cast<const ConvLayer*>(layer)) {
+			op.type = QOP_CONV;
+			op.width = conv->width;
+			op.height = conv->height;
+			op.stride = conv->stride;
+			op.pad = conv->pad;
+			for(int j = 0; j < conv->filters.GetCount(); j++)
+				AppendWeights(op.float_weights, conv->filters[j]);
+			for(int j = 0; j < op.out_d; j++)
+				op.biases.Add((Real)conv->biases.Get(j));
+		}
+		else if (const FullyConnLayer* fc = dynamic_cast<const FullyConnLayer*>(layer)) {
+			op.type = QOP_FC;
+			for(int j = 0; j < fc->filters.GetCount(); j++)
+				AppendWeights(op.float_weights, fc->filters[j]);
+			for(int j = 0; j < op.out_d; j++)
+				op.biases.Add((Real)fc->biases.Get(j));
+		}
+		else if (const PoolLayer* pool = dynamic_cast<const PoolLayer*>(layer)) {
+			op.type = QOP_POOL;
+			op.width = pool->width;
+			op.height = pool->height;
+			op.stride = pool->stride;
+			op.pad = pool->pad;
+		}
+		else if (const DropOutLayer* drop = dynamic_cast<const DropOutLayer*>(layer)) {
+			// the same scaling as DropOutLayer::Predict
+			op.type = QOP_SCALE;
+			op.scale = drop->drop_prob;
+		}
+		else if (dynamic_cast<const SoftmaxLayer*>(layer)) {
+			op.type = QOP_SOFTMAX;
+		}
+		else {
+			Clear();
+			throw ArgumentException("QuantizedNet doesn't support the layer " + layer->GetKey());
+		}
+		w = op.out_w;
+		h = op.out_h;
+		d = op.out_d;
+	}
+	
+	// the largest absolute values of the inputs of the layers in the float net
+	int count = data.GetDataCount();
+	if (!count) {
+		Clear();
+		throw ArgumentException("No samples for the calibration");
+	}
+	calibration_count = max(1, min(calibration_count, count));
+	Vector<double> ranges;
+	ranges.SetCount(ops.GetCount(), 0.0);
+	QuantizedWorkspace ws;
+	VolumeDataBase tmp;
+	for(int i = 0; i < calibration_count; i++) {
+		data.Read((int)((int64)i * count / calibration_count), tmp);
+		Volume x(input_width, input_height, input_depth, tmp);
+		Run(x, ws, false, &ranges);
+	}
+	
+	for(int i = 0; i < ops.GetCount(); i++) {
+		Op& op = ops[i];
+		if (op.type != QOP_CONV && op.type != QOP_FC)
+			continue;
+		op.input_scale = ranges[i] > 0 ? ranges[i] / 127 : 1.0;
+		
+		int k = op.float_weights.GetCount() / op.out_d;
+		op.weights.SetCount(op.float_weights.GetCount());
+		op.multipliers.SetCount(op.out_d);
+		for(int j = 0; j < op.out_d; j++) {
+			const Real* src = op.float_weights.Begin() + j * k;
+			double wmax = 0;
+			for(int l = 0; l < k; l++)
+				wmax = max(wmax, fabs((double)src[l]));
+			double wscale = wmax > 0 ? wmax / 127 : 1.0;
+			int8* dst = op.weights.Begin() + j * k;
+			for(int l = 0; l < k; l++)
+				dst[l] = QuantizeValue(src[l], 1.0 / wscale);
+			op.multipliers[j] = (Real)(op.input_scale * wscale);
+		}
+		op.float_weights.Clear();
+	}
+}
+
+const Volume& QuantizedNet::Run(const Volume& input, QuantizedWorkspace& ws, bool quantized, Vector<double>* ranges) const {
+	ASSERT(input.GetLength() == input_width * input_height * input_depth);
+	ws.activations.SetCount(2);
+	const Volume* activation = &input;
+	int j = -1;
+	for(int i = 0; i < ops.GetCount(); i++) {
+		const Op& op = ops[i];
+		
+		// the elementwise layers work in place, except over the input of the net
+		bool elementwise = op.type == QOP_ACTIVATION || op.type == QOP_SCALE;
+		if (!elementwise || j < 0)
+			j = j == 0;
+		Volume& output = ws.activations[j];
+		
+		bool dot_product = op.type == QOP_CONV || op.type == QOP_FC;
+		if (ranges && dot_product) {
+			const Real* in = activation->Begin();
+			double& range = (*ranges)[i];
+			for(int l = 0; l < activation->GetLength(); l++)
+				range = max(range, fabs((double)in[l]));
+		}
+		
+		switch (op.type) {
+		case QOP_CONV:
+		case QOP_FC:
+			RunDotProduct(op, *activation, output, ws, quantized);
+			break;
+		case QOP_POOL:
+			RunPool(op, *activation, output);
+			break;
+		case QOP_SOFTMAX:
+			RunSoftmax(op, *activation, output);
+			break;
+		case QOP_ACTIVATION:
+			CopyValues(*activation, output);
+			ApplyActivation(op.act, output.Begin(), output.GetLength());
+			break;
+		case QOP_SCALE: {
+			CopyValues(*activation, output);
+			Real* out = output.Begin();
+			for(int l = 0; l < output.GetLength(); l++)
+				out[l] *= op.scale;
+			break;
+		}
+		default:
+			NEVER();
+		}
+		activation = &output;
+	}
+	return *activation;
+}
+
+void QuantizedNet::RunDotProduct(const Op& op, const Volume& input, Volume& output, QuantizedWorkspace& ws, bool quantized) const {
+	output.Init(op.out_w, op.out_h, op.out_d, 0.0);
+	
+	bool conv = op.type == QOP_CONV;
+	int positions = op.out_w * op.out_h;
+	int k = conv ? op.width * op.height * op.in_d : op.in_w * op.in_h * op.in_d;
+	Real* out = output.Begin();
+	
+	if (!quantized) {
+		// the float path of the calibration, as in ConvLayer::Predict
+		const Real* col = input.Begin();
+		if (conv) {
+			ws.tmp.SetCount(positions * k);
+			Im2Col(input.Begin(), op.in_w, op.in_h, op.in_d, op.width, op.height,
+				op.stride, op.pad, op.out_w, op.out_h, ws.tmp.Begin());
+			col = ws.tmp.Begin();
+		}
+		for(int i = 0; i < positions; i++)
+			memcpy(out + i * op.out_d, op.biases.Begin(), op.out_d * sizeof(Real));
+		Gemm(false, true, positions, op.out_d, k,
+			1.0, col, k, op.float_weights.Begin(), k,
+			1.0, out, op.out_d);
+		ApplyActivation(op.act, out, positions * op.out_d);
+		return;
+	}
+	
+	int length = input.GetLength();
+	const Real* in = input.Begin();
+	double inv_scale = 1.0 / op.input_scale;
+	ws.input.SetCount(length);
+	for(int i = 0; i < length; i++)
+		ws.input[i] = QuantizeValue(in[i], inv_scale);
+	
+	const int8* col = ws.input.Begin();
+	if (conv) {
+		ws.col.SetCount(positions * k);
+		Im2ColInt8(ws.input.Begin(), op.in_w, op.in_h, op.in_d, op.width, op.height,
+			op.stride, op.pad, op.out_w, op.out_h, ws.col.Begin());
+		col = ws.col.Begin();
+	}
+	
+	ws.sums.SetCount(op.out_d);
+	int* sums = ws.sums.Begin();
+	const Real* mul = op.multipliers.Begin();
+	const Real* b = op.biases.Begin();
+	for(int i = 0; i < positions; i++) {
+		DotInt8(col + i * k, op.weights.Begin(), k, op.out_d, sums);
+		Real* o = out + i * op.out_d;
+		for(int f = 0; f < op.out_d; f++)
+			o[f] = sums[f] * mul[f] + b[f];
+	}
+	ApplyActivation(op.act, out, positions * op.out_d);
+}
+
+void QuantizedNet::RunPool(const Op& op, const Volume& input, Volume& output) {
+	// as in PoolLayer::Predict
+	output.Init(op.out_w, op.out_h, op.out_d, 0.0);
+	
+	const Real* in = input.Begin();
+	Real* out = output.Begin();
+	for (int ay = 0; ay < op.out_h; ay++) {
+		int y = ay * op.stride - op.pad;
+		for (int ax = 0; ax < op.out_w; ax++) {
+			int x = ax * op.stride - op.pad;
+			Real* o = out + (op.out_w * ay + ax) * op.out_d;
+			for (int depth = 0; depth < op.out_d; depth++) {
+				double a = -DBL_MAX;
+				for (int fy = max(0, -y); fy < op.height && y + fy < op.in_h; fy++) {
+					for (int fx = max(0, -x); fx < op.width && x + fx < op.in_w; fx++) {
+						double v = in[(op.in_w * (y + fy) + x + fx) * op.out_d + depth];
+						if (v > a)
+							a = v;
+					}
+				}
+				o[depth] = (Real)a;
+			}
+		}
+	}
+}
+
+void QuantizedNet::RunSoftmax(const Op& op, const Volume& input, Volume& output) {
+	output.Init(1, 1, op.out_d, 0.0);
+	const Real* in = input.Begin();
+	Real* out = output.Begin();
+	
+	double amax = in[0];
+	for (int i = 1; i < op.out_d; i++)
+		if (in[i] > amax)
+			amax = in[i];
+	
+	double esum = 0.0;
+	for (int i = 0; i < op.out_d; i++) {
+		double e = exp(in[i] - amax);
+		esum += e;
+		out[i] = (Real)e;
+	}
+	for (int i = 0; i < op.out_d; i++)
+		out[i] = (Real)(out[i] / esum);
+}
+
+const Volume& QuantizedNet::Predict(const Volume& input, QuantizedWorkspace& ws) const {
+	return Run(input, ws, true, NULL);
+}
+
+int QuantizedNet::GetPrediction(const Volume& input, QuantizedWorkspace& ws) const {
+	return Predict(input, ws).GetMaxColumn();
+}
+
+QuantizationReport QuantizedNet::Compare(const Net& net, SessionData& data, int count) const {
+	QuantizationReport r;
+	bool test = data.GetTestCount() > 0;
+	int total = test ? data.GetTestCount() : data.GetDataCount();
+	r.count = count < 0 ? total : min(count, total);
+	
+	PredictWorkspace pws;
+	QuantizedWorkspace qws;
+	VolumeDataBase tmp;
+	double diff_sum = 0;
+	for(int i = 0; i < r.count; i++) {
+		if (test)
+			data.ReadTest(i, tmp);
+		else
+			data.Read(i, tmp);
+		Volume x(input_width, input_height, input_depth, tmp);
+		int label = test ? data.GetTestLabel(i) : data.GetLabel(i);
+		
+		const Volume& a = net.Predict(x, pws);
+		const Volume& b = Predict(x, qws);
+		int pa = a.GetMaxColumn();
+		int pb = b.GetMaxColumn();
+		r.float_correct += pa == label;
+		r.quantized_correct += pb == label;
+		r.agree += pa == pb;
+		
+		double diff = 0;
+		for(int j = 0; j < a.GetLength(); j++)
+			diff = max(diff, fabs(a.Get(j) - b.Get(j)));
+		r.max_diff = max(r.max_diff, diff);
+		diff_sum += diff;
+	}
+	r.mean_diff = r.count ? diff_sum / r.count : 0;
+	
+	const Vector<LayerBasePtr>& layers = net.GetLayers();
+	for(int i = 0; i < layers.GetCount(); i++) {
+		const Vector<ParametersAndGradients>& pag = layers[i]->GetParametersAndGradients();
+		for(int j = 0; j < pag.GetCount(); j++)
+			r.float_weight_bytes += (int64)pag[j].volume->GetLength() * sizeof(Real);
+	}
+	r.quantized_weight_bytes = GetWeightMemory();
+	return r;
+}
+
+int64 QuantizedNet::GetWeightMemory() const {
+	int64 bytes = 0;
+	for(int i = 0; i < ops.GetCount(); i++) {
+		const Op& op = ops[i];
+		bytes += op.weights.GetCount() + (int64)(op.multipliers.GetCount() + op.biases.GetCount()) * sizeof(Real);
+	}
+	return bytes;
+}
+
+}
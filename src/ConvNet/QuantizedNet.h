@@ -0,0 +1,89 @@
+#ifndef _ConvNet_QuantizedNet_h_
+#define _ConvNet_QuantizedNet_h_
+
+#include "Session.h"
+
+namespace ConvNet {
+
+// The activations of one caller of QuantizedNet::Predict (see PredictWorkspace)
+struct QuantizedWorkspace {
+	Array<Volume> activations;
+	Vector<int8> input, col;
+	Vector<int> sums;
+	Vector<Real> tmp;
+};
+
+// Comparison of the quantized net with the float net, which it was made of
+struct QuantizationReport {
+	int count;
+	int float_correct, quantized_correct, agree;
+	double max_diff, mean_diff;
+	int64 float_weight_bytes, quantized_weight_bytes;
+	
+	QuantizationReport() {memset(this, 0, sizeof(QuantizationReport));}
+	
+	double GetFloatAccuracy() const {return count ? (double)float_correct / count : 0;}
+	double GetQuantizedAccuracy() const {return count ? (double)quantized_correct / count : 0;}
+	double GetAgreement() const {return count ? (double)agree / count : 0;}
+	String ToString() const;
+};
+
+// Inference-only copy of a trained net, with 8-bit weights. The weights of the conv and
+// fc layers are scaled to -127 ... 127 separately for every filter, and their inputs are
+// scaled by the largest absolute value seen in the calibration samples. The dot products
+// are computed with integers, and the outputs are converted back to Real, so the other
+// layers work as before. Supported layers: input, conv, fc, pool, relu, tanh, sigmoid,
+// dropout and softmax.
+class QuantizedNet {
+	
+	enum {QOP_CONV, QOP_FC, QOP_POOL, QOP_ACTIVATION, QOP_SCALE, QOP_SOFTMAX};
+	
+	struct Op {
+		int type, act;
+		int in_w, in_h, in_d, out_w, out_h, out_d;
+		int width, height, stride, pad;
+		double input_scale, scale;
+		
+		// one row of k weights for every output, and the factors, which convert the
+		// integer sums back to Real
+		Vector<int8> weights;
+		Vector<Real> multipliers, biases;
+		
+		// the original weights are needed only in the calibration
+		Vector<Real> float_weights;
+	};
+	
+	Array<Op> ops;
+	int input_width, input_height, input_depth;
+	
+	const Volume& Run(const Volume& input, QuantizedWorkspace& ws, bool quantized, Vector<double>* ranges) const;
+	void RunDotProduct(const Op& op, const Volume& input, Volume& output, QuantizedWorkspace& ws, bool quantized) const;
+	static void RunPool(const Op& op, const Volume& input, Volume& output);
+	static void RunSoftmax(const Op& op, const Volume& input, Volume& output);
+	
+public:
+	typedef QuantizedNet CLASSNAME;
+	QuantizedNet();
+	
+	// Converts the net and calibrates the input scales with calibration_count samples,
+	// which are taken evenly from the training data.
+	void Quantize(const Net& net, SessionData& data, int calibration_count=256);
+	void Quantize(Session& ses, int calibration_count=256);
+	
+	// Thread-safe like Net::Predict
+	const Volume& Predict(const Volume& input, QuantizedWorkspace& ws) const;
+	int GetPrediction(const Volume& input, QuantizedWorkspace& ws) const;
+	
+	// Predicts count samples of the test data (or the training data, if there is no
+	// test data) with both nets. All samples are used, when count is negative.
+	QuantizationReport Compare(const Net& net, SessionData& data, int count=-1) const;
+	
+	int64 GetWeightMemory() const;
+	bool IsEmpty() const {return ops.IsEmpty();}
+	void Clear();
+	
+};
+
+}
+
+#endif
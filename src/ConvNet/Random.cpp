@@ -0,0 +1,157 @@
+#include "Utilities.h"
+
+namespace ConvNet {
+
+static uint64 SplitMix64(uint64& x) {
+	uint64 z = (x += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+void Rng::Seed(uint64 seed) {
+	// the states are expanded with splitmix64, as recommended for xoshiro, so that
+	// similar seeds give unrelated streams
+	uint64 x = seed;
+	for (int i = 0; i < 4; i++)
+		s[i] = SplitMix64(x);
+	for (int i = 0; i < LANES; i++)
+		for (int j = 0; j < 4; j++)
+			lanes[j][i] = SplitMix64(x);
+	has_spare = false;
+	spare = 0;
+}
+
+void Rng::NextBlock(uint64* out) {
+	// xoshiro256+ in every lane. The loops have a constant count and no dependencies
+	// between the lanes, so they are vectorized.
+	for (int i = 0; i < LANES; i++)
+		out[i] = lanes[0][i] + lanes[3][i];
+	for (int i = 0; i < LANES; i++) {
+		uint64 t = lanes[1][i] << 17;
+		lanes[2][i] ^= lanes[0][i];
+		lanes[3][i] ^= lanes[1][i];
+		lanes[1][i] ^= lanes[2][i];
+		lanes[0][i] ^= lanes[3][i];
+		lanes[2][i] ^= t;
+		lanes[3][i] = Rotl(lanes[3][i], 45);
+	}
+}
+
+double Rng::GetGaussian() {
+	if (has_spare) {
+		has_spare = false;
+		return spare;
+	}
+	// Box-Muller, which gives two values at a time
+	double u1 = ((Get64() >> 11) + 1) * (1.0 / 9007199254740992.0); // (0, 1]
+	double u2 = Getf();
+	double r = sqrt(-2.0 * log(u1));
+	spare = r * sin(2 * M_PI * u2);
+	has_spare = true;
+	return r * cos(2 * M_PI * u2);
+}
+
+void Rng::FillUniform(Real* dst, int n, double low, double high) {
+	uint64 block[LANES];
+	double mul = (high - low) * (1.0 / 9007199254740992.0);
+	for (int i = 0; i < n; i += LANES) {
+		NextBlock(block);
+		int count = min((int)LANES, n - i);
+		for (int j = 0; j < count; j++)
+			dst[i + j] = (Real)(low + (block[j] >> 11) * mul);
+	}
+}
+
+void Rng::FillGaussian(Real* dst, int n, double mean, double stddev) {
+	uint64 block[LANES];
+	const double mul = 1.0 / 9007199254740992.0;
+	for (int i = 0; i < n; i += LANES) {
+		NextBlock(block);
+		// the lanes are used in pairs for Box-Muller
+		for (int j = 0; j < LANES && i + j < n; j += 2) {
+			double u1 = ((block[j] >> 11) + 1) * mul;
+			double u2 = (block[j + 1] >> 11) * mul;
+			double r = stddev * sqrt(-2.0 * log(u1));
+			dst[i + j] = (Real)(mean + r * cos(2 * M_PI * u2));
+			if (i + j + 1 < n)
+				dst[i + j + 1] = (Real)(mean + r * sin(2 * M_PI * u2));
+		}
+	}
+}
+
+void Rng::FillMask(bool* dst, int n, double p) {
+	// compared as integers, which avoids the conversions to double
+	uint64 block[LANES];
+	uint64 threshold = p >= 1.0 ? (1ULL << 53) : p <= 0.0 ? 0 : (uint64)(p * 9007199254740992.0);
+	for (int i = 0; i < n; i += LANES) {
+		NextBlock(block);
+		int count = min((int)LANES, n - i);
+		for (int j = 0; j < count; j++)
+			dst[i + j] = (block[j] >> 11) < threshold;
+	}
+}
+
+
+static std::atomic<uint64> rng_seed(0), rng_thread_index(0);
+static std::atomic<bool> rng_fixed(false);
+
+static uint64 GetMasterSeed() {
+	static uint64 random_seed = Random64(); // until SeedRng
+	return rng_fixed ? rng_seed.load() : random_seed;
+}
+
+static uint64 GetThreadSeed() {
+	uint64 x = GetMasterSeed() + 0x632BE59BD9B4E019ULL * ++rng_thread_index;
+	return SplitMix64(x);
+}
+
+uint64 GetRngSeed(int stream, uint64 index) {
+	uint64 s = stream;
+	uint64 x = GetMasterSeed() ^ SplitMix64(s);
+	x += 0x632BE59BD9B4E019ULL * index;
+	return SplitMix64(x);
+}
+
+struct ThreadRng {
+	Rng rng;
+	Rng* scope = NULL;
+	bool seeded = false;
+};
+
+static ThreadRng& GetThreadRng() {
+	thread_local ThreadRng t;
+	return t;
+}
+
+Rng& GetRng() {
+	ThreadRng& t = GetThreadRng();
+	if (t.scope)
+		return *t.scope;
+	if (!t.seeded) {
+		t.rng.Seed(GetThreadSeed());
+		t.seeded = true;
+	}
+	return t.rng;
+}
+
+void SeedRng(uint64 seed) {
+	rng_seed = seed;
+	rng_fixed = true;
+	rng_thread_index = 0;
+	ThreadRng& t = GetThreadRng();
+	t.rng.Seed(GetThreadSeed());
+	t.seeded = true;
+}
+
+RngScope::RngScope(Rng& rng) {
+	ThreadRng& t = GetThreadRng();
+	prev = t.scope;
+	t.scope = &rng;
+}
+
+RngScope::~RngScope() {
+	GetThreadRng().scope = prev;
+}
+
+}
@@ -22,6 +22,10 @@ Volume& RegressionLayer::Forward(Volume& input, bool is_training) {
 	return input; // identity function
 }
 
+void RegressionLayer::Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const {
+	output = input;
+}
+
 void RegressionLayer::Backward() {
 	throw NotImplementedException();
 }
@@ -79,6 +83,55 @@ double RegressionLayer::Backward(int cols, const Vector<int>& posv, const Vector
 }
 
 
+VolumeBatch& RegressionLayer::ForwardBatch(VolumeBatch& input, bool is_training) {
+	input_batch = &input;
+	output_batch = input;
+	return input; // identity function
+}
+
+void RegressionLayer::BackwardBatch() {
+	throw NotImplementedException();
+}
+
+double RegressionLayer::BackwardBatch(const VolumeBatch& y) {
+	VolumeBatch& input = *input_batch;
+	ASSERT(y.GetCount() == input.GetCount() && y.GetLength() == output_depth);
+	
+	const Real* in = input.Begin();
+	const Real* yw = y.Begin();
+	Real* din = input.GradientBegin();
+	double loss = 0.0;
+	
+	int length = output_depth * input.GetCount();
+	for (int i = 0; i < length; i++) {
+		double dy = in[i] - yw[i];
+		din[i] = dy;
+		loss += 0.5 * dy * dy;
+	}
+	
+	return loss;
+}
+
+double RegressionLayer::BackwardBatch(const Vector<int>& pos, const Vector<double>& y) {
+	// one regressed value per sample, like in Backward(int, double)
+	VolumeBatch& input = *input_batch;
+	int count = input.GetCount();
+	ASSERT(pos.GetCount() == count && y.GetCount() == count);
+	
+	input.ZeroGradients(); // zero out the gradient of input batch
+	double loss = 0.0;
+	
+	for (int b = 0; b < count; b++) {
+		int p = pos[b];
+		ASSERT(p >= 0 && p < output_depth);
+		double dy = input.Get(b, p) - y[b];
+		input.SetGradient(b, p, dy);
+		loss += 0.5 * dy * dy;
+	}
+	
+	return loss;
+}
+
 #define STOREVAR(json, field) map.GetAdd(#json) = this->field;
 #define LOADVAR(field, json) this->field = map.GetValue(map.Find(#json));
 #define LOADVARDEF(field, json, def) {Value tmp = map.GetValue(map.Find(#json)); if (tmp.IsNull()) this->field = def; else this->field = tmp;}
@@ -17,7 +17,10 @@ void ReluLayer::Init(int input_width, int input_height, int input_depth) {
 
 Volume& ReluLayer::Forward(Volume& input, bool is_training) {
 	input_activation = &input;
-	output_activation = input;
+	if (in_place)
+		output_activation.InitView(input.GetWidth(), input.GetHeight(), input.GetDepth(), input.Begin(), input.GradientBegin());
+	else
+		output_activation = input;
 	Volume& output = output_activation;
 	
 	for (int i = 0; i < input.GetLength(); i++) {
@@ -29,10 +32,30 @@ Volume& ReluLayer::Forward(Volume& input, bool is_training) {
 	return output_activation;
 }
 
+void ReluLayer::Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const {
+	if (&output != &input)
+		output = input;
+	Real* out = output.Begin();
+	int length = input.GetLength();
+	for (int i = 0; i < length; i++)
+		if (out[i] < 0)
+			out[i] = 0; // threshold at 0
+}
+
 void ReluLayer::Backward() {
 	Volume& input = *input_activation; // we need to set dw of this
 	int length = input.GetLength();
 	
+	if (in_place) {
+		// the gradients are shared too
+		const Real* out = output_activation.Begin();
+		Real* dout = output_activation.GradientBegin();
+		for (int i = 0; i < length; i++)
+			if (out[i] <= 0)
+				dout[i] = 0; // threshold
+		return;
+	}
+	
 	input.ZeroGradients(); // zero out gradient wrt data
 	
 	for (int i = 0; i < length; i++)
@@ -46,6 +69,31 @@ void ReluLayer::Backward() {
 	}
 }
 
+VolumeBatch& ReluLayer::ForwardBatch(VolumeBatch& input, bool is_training) {
+	input_batch = &input;
+	output_batch = input;
+	
+	Real* out = output_batch.Begin();
+	int length = input.GetLength() * input.GetCount();
+	for (int i = 0; i < length; i++) {
+		if (out[i] < 0)
+			out[i] = 0; // threshold at 0
+	}
+	
+	return output_batch;
+}
+
+void ReluLayer::BackwardBatch() {
+	VolumeBatch& input = *input_batch;
+	const Real* out = output_batch.Begin();
+	const Real* dout = output_batch.GradientBegin();
+	Real* din = input.GradientBegin();
+	
+	int length = input.GetLength() * input.GetCount();
+	for (int i = 0; i < length; i++)
+		din[i] = out[i] <= 0 ? 0.0 : dout[i]; // threshold
+}
+
 #define STOREVAR(json, field) map.GetAdd(#json) = this->field;
 #define LOADVAR(field, json) this->field = map.GetValue(map.Find(#json));
 #define LOADVARDEF(field, json, def) {Value tmp = map.GetValue(map.Find(#json)); if (tmp.IsNull()) this->field = def; else this->field = tmp;}
@@ -22,6 +22,10 @@ Volume& SvmLayer::Forward(Volume& input, bool is_training) {
 	return input;
 }
 
+void SvmLayer::Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const {
+	output = input; // nothing to do, output raw scores
+}
+
 double SvmLayer::Backward(int pos, double yd) {
 	
 	// compute and accumulate gradient wrt weights and bias of this layer
@@ -59,6 +63,52 @@ void SvmLayer::Backward() {
 	throw NotImplementedException();
 }
 
+VolumeBatch& SvmLayer::ForwardBatch(VolumeBatch& input, bool is_training) {
+	input_batch = &input;
+	output_batch = input; // nothing to do, output raw scores
+	return input;
+}
+
+double SvmLayer::BackwardBatch(const Vector<int>& pos, const Vector<double>& y) {
+	VolumeBatch& input = *input_batch;
+	int count = input.GetCount();
+	ASSERT(pos.GetCount() == count);
+	
+	input.ZeroGradients(); // zero out the gradient of input batch
+	
+	// structured loss, see Backward(int, double)
+	const double margin = 1.0;
+	double loss = 0.0;
+	for (int b = 0; b < count; b++) {
+		const Real* in = input.Begin(b);
+		Real* din = input.GradientBegin(b);
+		int p = pos[b];
+		double yscore = in[p]; // score of ground truth
+		
+		for (int i = 0; i < output_depth; i++) {
+			if (p == i)
+				continue;
+			double ydiff = -1.0 * yscore + in[i] + margin;
+			if (ydiff > 0) {
+				// violating dimension, apply loss
+				din[i] += 1;
+				din[p] -= 1;
+				loss += ydiff;
+			}
+		}
+	}
+	
+	return loss;
+}
+
+double SvmLayer::BackwardBatch(const VolumeBatch& y) {
+	throw NotImplementedException();
+}
+
+void SvmLayer::BackwardBatch() {
+	throw NotImplementedException();
+}
+
 #define STOREVAR(json, field) map.GetAdd(#json) = this->field;
 #define LOADVAR(field, json) this->field = map.GetValue(map.Find(#json));
 #define LOADVARDEF(field, json, def) {Value tmp = map.GetValue(map.Find(#json)); if (tmp.IsNull()) this->field = def; else this->field = tmp;}
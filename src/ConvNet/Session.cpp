@@ -19,6 +19,11 @@ Session::Session() {
 	iter_cb_interal = 100;
 	augmentation = 0;
 	augmentation_do_flip = false;
+	batch_training = false;
+	thread_count = 1;
+	prefetch_threads = 0;
+	prefetch_size = 64;
+	shuffle = false;
 	
 	SetWindowSize(100);
 }
@@ -63,11 +68,13 @@ void Session::Clear() {
 
 void Session::ClearOwnedLayers() {
 	lock.Enter();
+	ClearReplicas();
 	net.Clear();
 	for(int i = 0; i < owned_layers.GetCount(); i++)
 		if (owned_layers[i])
 			delete owned_layers[i];
 	owned_layers.Clear();
+	model_file.Close();
 	lock.Leave();
 }
 
@@ -130,6 +137,15 @@ void Session::TrainBegin() {
 	SessionData& d = Data();
 	x.Init(d.data_w, d.data_h, d.data_d, 0.0);
 	
+	ClearReplicas();
+	if (batch_training && thread_count > 1)
+		InitReplicas();
+	
+	// without the prefetcher x is only a view to the data, which can't be augmented,
+	// so augmentation and shuffling use the prefetcher even without threads
+	if (prefetch_threads > 0 || augmentation || shuffle)
+		prefetch.Start(d, prefetch_threads, prefetch_size, augmentation, augmentation_do_flip, shuffle);
+	
 	// reinit windows that keep track of val/train accuracies
 	loss_window.Clear();
 	reward_window.Clear();
@@ -138,118 +154,427 @@ void Session::TrainBegin() {
 	train_window.Clear();
 	accuracy_window.Clear();
 	test_window.Clear();
+	step_allocs.Clear();
 	
 }
 
 void Session::TrainIteration() {
+	try {
+		if (batch_training)
+			TrainBatchIteration();
+		else
+			TrainSampleIteration();
+		
+		iter++;
+		
+		if ((iter % iter_cb_interal) == 0)
+			WhenIterationInterval(iter);
+		
+	}
+	catch (Exc e) {
+		lock.Leave();
+		LOG("Exception: " + e);
+		TrainEnd();
+	}
+	catch (...) {
+		lock.Leave();
+		LOG("Unknown exception");
+		TrainEnd();
+	}
+}
+
+bool Session::IsTrainRegression() {
+	const Vector<LayerBasePtr>& layers = net.GetLayers();
+	return Data().is_data_result ? false : dynamic_cast<RegressionLayer*>(layers[layers.GetCount()-1]) != NULL;
+}
+
+static double GetMeanSquaredError(const Real* correct, const Real* v, int count) {
+	double mse = 0.0;
+	for (int i = 0; i < count; i++) {
+		double diff = correct[i] - v[i];
+		mse += diff * diff;
+	}
+	return mse / count;
+}
+
+void Session::GetStepLoss(StepLoss& l) const {
+	l.reward = trainer->GetReward();
+	l.loss = trainer->GetLoss();
+	l.l1_decay = trainer->GetL1DecayLoss();
+	l.l2_decay = trainer->GetL2DecayLoss();
+}
+
+void Session::AddStepLoss(const StepLoss& l) {
+	reward_window.Add(l.reward);
+	loss_window.Add(l.loss);
+	l1_loss_window.Add(l.l1_decay);
+	l2_loss_window.Add(l.l2_decay);
+}
+
+void Session::TrainSampleIteration() {
 	TrainerBase& trainer = *this->trainer;
 	SessionData& d = Data();
+	bool train_regression = IsTrainRegression();
+	StepLoss step_loss;
 	
-	const Vector<LayerBasePtr>& layers = net.GetLayers();
-	bool train_regression = d.is_data_result ? false : dynamic_cast<RegressionLayer*>(layers[layers.GetCount()-1]) != NULL;
+	for(int i = 0; i < d.GetDataCount() && is_training; i++) {
+		AllocScope alloc(step_allocs);
+		int id = NextSample(i);
+		
+		lock.Enter();
+		
+		// use x to build our estimate of validation error
+		if (test_predict && (step_num % predict_interval) == 0) {
+			TimeStop ts;
+			const Volume& v = net.Forward(x);
+			forward_time = ts.Elapsed();
+			
+			if (train_regression || d.is_data_result) {
+				const VolumeDataBase& correct = train_regression ? x.GetWeights() : d.GetResult(id);
+				accuracy_window.Add(-GetMeanSquaredError(correct.Begin(), v.Begin(), v.GetLength()));
+			}
+			else {
+				// Is correct prediction or not?
+				int cls = net.GetPrediction();
+				accuracy_window.Add(cls == d.GetLabel(id) ? 1.0 : 0.0);
+			}
+		}
+		
+		TimeStop ts;
+		if (d.is_data_result)
+			trainer.Train(x, d.GetResult(id));
+		else if (train_regression)
+			trainer.Train(x, x.GetWeights()); // value
+		else
+			trainer.Train(x, d.GetLabel(id), 1.0); // value
+		backward_time = ts.Elapsed();
+		
+		GetStepLoss(step_loss);
+		step_num++;
+		lock.Leave();
+		
+		// keep track of stats such as the average training error and loss
+		// if last layer is softmax, then add prediction value to the average
+		if (test_predict) {
+			if (train_regression || d.is_data_result) {
+				const Volume& v = net.GetOutput();
+				const VolumeDataBase& correct = train_regression ? x.GetWeights() : d.GetResult(id);
+				train_window.Add(-GetMeanSquaredError(correct.Begin(), v.Begin(), v.GetLength()));
+			}
+			else {
+				// Is correct prediction or not?
+				int cls = net.GetPrediction();
+				train_window.Add(cls == d.GetLabel(id) ? 1.0 : 0.0); // add 1 when label is correct
+			}
+		}
+		
+		AddStepLoss(step_loss);
+		alloc.Close();
+		
+		if ((step_num % step_cb_interal) == 0)
+			WhenStepInterval(step_num);
+		
+	}
+}
+
+int Session::NextSample(int i) {
+	if (prefetch.IsRunning())
+		return prefetch.Pop(x);
+	SessionData& d = Data();
+	if (d.IsStreaming()) {
+		// a streamed sample can be replaced in the cache, so x uses a copy
+		d.Read(i, sample);
+		x.SetData(sample);
+	}
+	else
+		x.SetData(d.Get(i));
+	return i;
+}
+
+void Session::TrainBatchIteration() {
+	TrainerBase& trainer = *this->trainer;
+	SessionData& d = Data();
+	bool train_regression = IsTrainRegression();
+	StepLoss step_loss;
 	
-	try {
+	// one minibatch is as large as the batch of the trainer, so every
+	// batch ends with exactly one update of the weights
+	int batch_size = max(1, trainer.GetBatchSize());
 	
-		for(int i = 0; i < d.GetDataCount() && is_training; i++) {
-			ASSERT(d.data[i]);
-			
-			x.SetData(d.Get(i));
+	for(int i = 0; i < d.GetDataCount() && is_training; i += batch_size) {
+		AllocScope alloc(step_allocs);
+		int count = min(batch_size, d.GetDataCount() - i);
+		
+		batch_labels.SetCount(count);
+		batch_values.SetCount(count);
+		for(int j = 0; j < count; j++) {
+			int id = NextSample(i + j);
 			
-			if (augmentation)
-				x.Augment(augmentation, -1, -1, augmentation_do_flip);
+			if (j == 0)
+				batch_x.Init(x.GetWidth(), x.GetHeight(), x.GetDepth(), count, 0.0);
+			batch_x.SetSample(j, x);
 			
-			lock.Enter();
+			if (d.is_data_result) {
+				const VolumeDataBase& result = d.GetResult(id);
+				if (j == 0)
+					batch_y.Init(1, 1, result.GetCount(), count, 0.0);
+				batch_y.SetSample(j, result);
+			}
+			else {
+				batch_labels[j] = d.GetLabel(id);
+				batch_values[j] = 1.0;
+			}
+		}
+		const VolumeBatch& correct = train_regression ? batch_x : batch_y;
+		
+		lock.Enter();
+		
+		// use the batch to build our estimate of validation error, when
+		// the prediction interval is reached during this batch
+		int r = step_num % predict_interval;
+		if (test_predict && (r == 0 || r + count > predict_interval)) {
+			TimeStop ts;
+			const VolumeBatch& v = net.ForwardBatch(batch_x);
+			forward_time = ts.Elapsed();
 			
-			// use x to build our estimate of validation error
-			if (test_predict && (step_num % predict_interval) == 0) {
-				TimeStop ts;
-				Volume& v = net.Forward(x);
-				forward_time = ts.Elapsed();
-				
-				if (train_regression || d.is_data_result) {
-					// Mean squared error
-					const VolumeDataBase& correct = train_regression ? x.GetWeights() : d.GetResult(i);
-					double mse = 0.0;
-					for (int i = 0; i < v.GetLength(); i++) {
-						double diff = correct.Get(i) - v.Get(i);
-						mse += diff * diff;
-					}
-					mse /= v.GetLength();
-					accuracy_window.Add(-mse);
-				}
+			for(int j = 0; j < count; j++) {
+				if (train_regression || d.is_data_result)
+					accuracy_window.Add(-GetMeanSquaredError(correct.Begin(j), v.Begin(j), v.GetLength()));
 				else {
 					// Is correct prediction or not?
-					int cls = net.GetPrediction();
-					accuracy_window.Add(cls == d.GetLabel(i) ? 1.0 : 0.0);
+					int cls = net.GetBatchPrediction(j);
+					accuracy_window.Add(cls == batch_labels[j] ? 1.0 : 0.0);
 				}
 			}
-			
-			TimeStop ts;
-			if (d.is_data_result)
-				trainer.Train(x, d.GetResult(i));
-			else if (train_regression)
-				trainer.Train(x, x.GetWeights()); // value
-			else
-				trainer.Train(x, d.GetLabel(i), 1.0); // value
-			backward_time = ts.Elapsed();
-			
-			double reward = trainer.GetReward();
-			double loss = trainer.GetLoss();
-			double loss_l1d = trainer.GetL1DecayLoss();
-			double loss_l2d = trainer.GetL2DecayLoss();
-			step_num++;
-			lock.Leave();
-			
-			// keep track of stats such as the average training error and loss
-			// if last layer is softmax, then add prediction value to the average
-			if (test_predict) {
-				if (train_regression || d.is_data_result) {
-					// Mean squared error
-					Volume& v = net.GetOutput();
-					const VolumeDataBase& correct = train_regression ? x.GetWeights() : d.GetResult(i);
-					double mse = 0.0;
-					for (int i = 0; i < v.GetLength(); i++) {
-						double diff = correct.Get(i) - v.Get(i);
-						mse += diff * diff;
-					}
-					mse /= v.GetLength();
-					train_window.Add(-mse);
-				}
+		}
+		
+		TimeStop ts;
+		if (replicas.GetCount())
+			TrainParallel(count, train_regression);
+		else if (d.is_data_result)
+			trainer.TrainBatch(batch_x, batch_y);
+		else if (train_regression)
+			trainer.TrainBatch(batch_x, batch_x); // value
+		else
+			trainer.TrainBatch(batch_x, batch_labels, batch_values); // value
+		
+		// the last batch of the epoch can be partial, and it is updated now, so
+		// that the next epoch starts with a new batch
+		if (i + count >= d.GetDataCount())
+			trainer.Flush();
+		backward_time = ts.Elapsed();
+		
+		GetStepLoss(step_loss);
+		int prev_step_num = step_num;
+		step_num += count;
+		lock.Leave();
+		
+		// keep track of stats such as the average training error and loss
+		if (test_predict) {
+			for(int j = 0; j < count; j++) {
+				int vj = j;
+				Net& vnet = GetBatchNet(vj);
+				const VolumeBatch& v = vnet.GetBatchOutput();
+				if (train_regression || d.is_data_result)
+					train_window.Add(-GetMeanSquaredError(correct.Begin(j), v.Begin(vj), v.GetLength()));
 				else {
 					// Is correct prediction or not?
-					int cls = net.GetPrediction();
-					train_window.Add(cls == d.GetLabel(i) ? 1.0 : 0.0); // add 1 when label is correct
+					int cls = vnet.GetBatchPrediction(vj);
+					train_window.Add(cls == batch_labels[j] ? 1.0 : 0.0); // add 1 when label is correct
 				}
 			}
-			
-			reward_window.Add(reward);
-			loss_window.Add(loss);
-			l1_loss_window.Add(loss_l1d);
-			l2_loss_window.Add(loss_l2d);
-			
-			
-			if ((step_num % step_cb_interal) == 0)
-				WhenStepInterval(step_num);
-			
 		}
 		
-		iter++;
+		AddStepLoss(step_loss);
+		alloc.Close();
 		
+		if (step_num / step_cb_interal != prev_step_num / step_cb_interal)
+			WhenStepInterval(step_num);
+		
+	}
+}
+
+Session::Replica::~Replica() {
+	for(int i = 0; i < owned_layers.GetCount(); i++)
+		delete owned_layers[i];
+}
+
+void Session::InitReplicas() {
+	const Vector<LayerBasePtr>& layers = net.GetLayers();
+	net.GetParametersAndGradients();
 	
-		if ((iter % iter_cb_interal) == 0)
-			WhenIterationInterval(iter);
+	replicas.SetCount(thread_count);
+	replicas[0].net = &net;
+	for(int i = 1; i < thread_count; i++) {
+		Replica& r = replicas[i];
+		r.owned_net.Create();
+		r.net = &*r.owned_net;
 		
+		// the weights are replaced by the views to the session net
+		CopyLayers(*r.net, r.owned_layers);
+		r.net->ShareParameters(net);
+		r.net->SetFusion(net.IsFusion());
+		for(int j = 0; j < layers.GetCount(); j++)
+			if (layers[j]->frozen)
+				r.net->SetFrozen(j);
 	}
-	catch (Exc e) {
-		lock.Leave();
-		LOG("Exception: " + e);
-		TrainEnd();
+}
+
+void Session::CopyLayers(Net& dst, Vector<LayerBasePtr>& owned) {
+	// only the settings are copied like in LoadJSON, and Init sets the sizes, which
+	// are not stored. The weights come from the caller (ShareParameters or
+	// LoadParameters), so they are neither stored nor randomized here.
+	const Vector<LayerBasePtr>& layers = net.GetLayers();
+	for(int j = 0; j < layers.GetCount(); j++) {
+		const LayerBase& src = *layers[j];
+		ValueMap map;
+		src.StoreSettings(map);
+		LayerBase* layer = CreateLayer(map);
+		ASSERT(layer);
+		layer->shape_only = true;
+		layer->Init(src.input_width, src.input_height, src.input_depth);
+		layer->shape_only = false;
+		owned.Add(layer);
+		dst.AddLayerPointer(*layer);
 	}
-	catch (...) {
-		lock.Leave();
-		LOG("Unknown exception");
-		TrainEnd();
+}
+
+void NetSnapshot::ClearLayers() {
+	net.Clear();
+	for(int i = 0; i < owned_layers.GetCount(); i++)
+		delete owned_layers[i];
+	owned_layers.Clear();
+}
+
+void NetSnapshot::Update(Session& ses) {
+	ses.Enter();
+	Net& src = ses.GetNetwork();
+	if (net.IsEmpty() || source != &src || generation != src.GetGeneration() || net->IsFusion() != src.IsFusion()) {
+		ClearLayers();
+		net.Create();
+		ses.CopyLayers(*net, owned_layers);
+		net->SetFusion(src.IsFusion());
+		source = &src;
+		generation = src.GetGeneration();
 	}
+	src.StoreParameters(params);
+	ses.Leave();
+	
+	// the generation covers every change of the layers, so this fails only on a bug
+	bool ok = net->LoadParameters(params);
+	ASSERT(ok);
+	if (!ok)
+		source = NULL;
+}
+
+void Session::ClearReplicas() {
+	replicas.Clear();
+}
+
+void Session::TrainReplica(int i, bool train_regression) {
+	Replica& r = replicas[i];
+	r.loss = 0;
+	if (!r.count)
+		return;
+	r.net->ForwardBatch(r.x, true);
+	if (Data().is_data_result)
+		r.loss = r.net->BackwardBatch(r.y);
+	else if (train_regression)
+		r.loss = r.net->BackwardBatch(r.x);
+	else
+		r.loss = r.net->BackwardBatch(r.labels, r.values);
+}
+
+void Session::TrainParallel(int count, bool train_regression) {
+	TrainerBase& trainer = *this->trainer;
+	SessionData& d = Data();
+	int n = replicas.GetCount();
+	
+	// split the batch into equal parts
+	int part = (count + n - 1) / n;
+	for(int i = 0; i < n; i++) {
+		Replica& r = replicas[i];
+		r.begin = min(count, i * part);
+		r.count = min(count, r.begin + part) - r.begin;
+		if (!r.count)
+			continue;
+		int len = batch_x.GetLength();
+		r.x.Init(batch_x.GetWidth(), batch_x.GetHeight(), batch_x.GetDepth(), r.count);
+		memcpy(r.x.Begin(), batch_x.Begin(r.begin), r.count * len * sizeof(Real));
+		if (d.is_data_result) {
+			len = batch_y.GetLength();
+			r.y.Init(batch_y.GetWidth(), batch_y.GetHeight(), batch_y.GetDepth(), r.count);
+			memcpy(r.y.Begin(), batch_y.Begin(r.begin), r.count * len * sizeof(Real));
+		}
+		else {
+			r.labels.SetCount(r.count);
+			r.values.SetCount(r.count);
+			for(int j = 0; j < r.count; j++) {
+				r.labels[j] = batch_labels[r.begin + j];
+				r.values[j] = batch_values[r.begin + j];
+			}
+		}
+	}
+	
+	CoWork co;
+	for(int i = 0; i < n; i++)
+		co & [=] {
+			Rng rng(GetRngSeed(RNG_REPLICA, step_num + replicas[i].begin));
+			RngScope __(rng);
+			TrainReplica(i, train_regression);
+		};
+	co.Finish();
+	
+	// Sum the gradients of the replicas into the gradients of the session net. The
+	// arena is split between the threads and every value is summed in the same
+	// order, so the result doesn't depend on the scheduling.
+	Real* dst = net.GradientBegin();
+	int total = net.GetParameterCount();
+	int chunk = (total + n - 1) / n;
+	replica_gradients.SetCount(n);
+	for(int i = 1; i < n; i++)
+		replica_gradients[i] = replicas[i].net->GradientBegin();
+	for(int i = 0; i < n; i++) {
+		co & [=] {
+			int begin = min(total, i * chunk);
+			int end = min(total, begin + chunk);
+			for(int j = 1; j < n; j++) {
+				Real* src = replica_gradients[j];
+				for(int k = begin; k < end; k++) {
+					dst[k] += src[k];
+					src[k] = 0;
+				}
+			}
+		};
+	}
+	co.Finish();
+	
+	double loss = 0;
+	for(int i = 0; i < n; i++)
+		loss += replicas[i].loss;
+	
+	if (!d.is_data_result && !train_regression) {
+		double sum = 0;
+		for(int i = 0; i < count; i++)
+			sum += batch_values[i];
+		trainer.cost_reward = sum / count;
+	}
+	trainer.cost_loss = loss / count;
+	trainer.l2_decay_loss = 0.0;
+	trainer.l1_decay_loss = 0.0;
+	
+	trainer.TrainBatchImplem(count);
+}
+
+Net& Session::GetBatchNet(int& i) {
+	for(int j = replicas.GetCount() - 1; j >= 0; j--) {
+		const Replica& r = replicas[j];
+		if (r.count && i >= r.begin) {
+			i -= r.begin;
+			return *r.net;
+		}
+	}
+	return net;
 }
 
 void Session::TrainEnd() {
@@ -257,6 +582,7 @@ void Session::TrainEnd() {
 	LOG("loss = " << loss_window.GetAverage() << ", " << iter << " cycles through data in " << ts.ToString() << "ms");
 	is_training_stopped = true;
 	is_training = false;
+	prefetch.Stop();
 }
 
 void Session::TrainOnce(Volume& x, const VolumeDataBase& y) {
@@ -534,23 +860,13 @@ bool Session::LoadJSON(const String& json) {
 		String type = layer.GetAdd("layer_type");
 		if (type.IsEmpty()) return false;
 		
-		if      (type == "fc")			LoadLayer<FullyConnLayer>(layer);
-		else if (type == "lrn")			LoadLayer<LrnLayer>(layer);
-		else if (type == "dropout")		LoadLayer<DropOutLayer>(layer);
-		else if (type == "input")		LoadLayer<InputLayer>(layer);
-		else if (type == "softmax")		LoadLayer<SoftmaxLayer>(layer);
-		else if (type == "regression")	LoadLayer<RegressionLayer>(layer);
-		else if (type == "conv")		LoadLayer<ConvLayer>(layer);
-		else if (type == "pool")		LoadLayer<PoolLayer>(layer);
-		else if (type == "relu")		LoadLayer<ReluLayer>(layer);
-		else if (type == "sigmoid")		LoadLayer<SigmoidLayer>(layer);
-		else if (type == "tanh")		LoadLayer<TanhLayer>(layer);
-		else if (type == "maxout")		LoadLayer<MaxoutLayer>(layer);
-		else if (type == "svm")			LoadLayer<SvmLayer>(layer);
-		else {
+		LayerBase* l = CreateLayer(layer);
+		if (!l) {
 			LOG("ERROR: UNRECOGNIZED LAYER TYPE: " + type);
 			return false;
 		}
+		owned_layers.Add(l);
+		net.AddLayerPointer(*l);
 	}
 	
 	Leave();
@@ -560,6 +876,25 @@ bool Session::LoadJSON(const String& json) {
 	return true;
 }
 
+LayerBase* Session::CreateLayer(const ValueMap& layer) {
+	String type = layer.GetValue(layer.Find("layer_type"));
+	
+	if      (type == "fc")			return new FullyConnLayer(layer);
+	else if (type == "lrn")			return new LrnLayer(layer);
+	else if (type == "dropout")		return new DropOutLayer(layer);
+	else if (type == "input")		return new InputLayer(layer);
+	else if (type == "softmax")		return new SoftmaxLayer(layer);
+	else if (type == "regression")	return new RegressionLayer(layer);
+	else if (type == "conv")		return new ConvLayer(layer);
+	else if (type == "pool")		return new PoolLayer(layer);
+	else if (type == "relu")		return new ReluLayer(layer);
+	else if (type == "sigmoid")		return new SigmoidLayer(layer);
+	else if (type == "tanh")		return new TanhLayer(layer);
+	else if (type == "maxout")		return new MaxoutLayer(layer);
+	else if (type == "svm")			return new SvmLayer(layer);
+	return NULL;
+}
+
 bool Session::StoreJSON(String& json) {
 	Enter();
 	
@@ -580,17 +915,272 @@ bool Session::StoreJSON(String& json) {
 	return true;
 }
 
+// Binary model file:
+//   "CNNB", version, element size, layer count (32-bit)
+//   descriptor size, parameter offset, parameter count (64-bit)
+//   descriptor: the layers as JSON, without the weights of the volumes
+//   padding until the parameter offset, which is aligned to 64 bytes
+//   all parameters in the order of Net::StoreParameters
+// Everything is little-endian.
+static const char model_magic[4] = {'C', 'N', 'N', 'B'};
+
+enum {
+	MODEL_VERSION = 1,
+	MODEL_HEADER_SIZE = 40,
+	MODEL_ALIGN = 64
+};
+
+static Value StripWeights(const Value& v) {
+	if (IsValueMap(v)) {
+		ValueMap src = v, dst;
+		for(int i = 0; i < src.GetCount(); i++) {
+			String key = src.GetKey(i);
+			if (key != "w" && key != "dw")
+				dst.Add(key, StripWeights(src.GetValue(i)));
+		}
+		return dst;
+	}
+	if (IsValueArray(v)) {
+		ValueArray dst;
+		for(int i = 0; i < v.GetCount(); i++)
+			dst.Add(StripWeights(v[i]));
+		return dst;
+	}
+	return v;
+}
+
+static void PutParameters(Stream& s, const Real* p, int64 count) {
+#ifdef CPU_BE
+	for(int64 i = 0; i < count; i++) {
+		if (sizeof(Real) == 4) {dword d; memcpy(&d, p + i, 4); s.Put32le(d);}
+		else {int64 d; memcpy(&d, p + i, 8); s.Put64le(d);}
+	}
+#else
+	const byte* b = (const byte*)p;
+	for(int64 left = count * sizeof(Real); left > 0;) {
+		int chunk = (int)min<int64>(left, 1 << 24);
+		s.Put(b, chunk);
+		b += chunk;
+		left -= chunk;
+	}
+#endif
+}
+
+static bool GetParameters(Stream& s, Real* p, int64 count, int elem_size) {
+#ifndef CPU_BE
+	if (elem_size == sizeof(Real)) {
+		byte* b = (byte*)p;
+		for(int64 left = count * sizeof(Real); left > 0;) {
+			int chunk = (int)min<int64>(left, 1 << 24);
+			if (!s.GetAll(b, chunk))
+				return false;
+			b += chunk;
+			left -= chunk;
+		}
+		return true;
+	}
+#endif
+	// other endianness or precision, so convert one value at a time
+	for(int64 i = 0; i < count; i++) {
+		if (elem_size == 4) {dword d = s.Get32le(); float f; memcpy(&f, &d, 4); p[i] = (Real)f;}
+		else {int64 d = s.Get64le(); double f; memcpy(&f, &d, 8); p[i] = (Real)f;}
+	}
+	return !s.IsError();
+}
+
 void Session::Serialize(Stream& s) {
 	if (s.IsLoading()) {
-		String json;
-		s % json;
-		LoadJSON(json);
+		// sessions stored before the binary format are JSON strings
+		int64 pos = s.GetPos();
+		char magic[4];
+		bool binary = s.GetAll(magic, 4) && !memcmp(magic, model_magic, 4);
+		s.Seek(pos);
+		if (binary)
+			LoadModel(s);
+		else {
+			String json;
+			s % json;
+			LoadJSON(json);
+		}
 	}
 	else if (s.IsStoring()) {
-		String json;
-		StoreJSON(json);
-		s % json;
+		StoreModel(s);
+	}
+}
+
+bool Session::StoreModel(Stream& s) {
+	Enter();
+	
+	const Vector<LayerBasePtr>& layers = net.GetLayers();
+	Value new_layers;
+	for(int i = 0; i < layers.GetCount(); i++) {
+		ValueMap map;
+		layers[i]->Store(map);
+		new_layers.Add(StripWeights(map));
+	}
+	
+	ValueMap js;
+	js.GetAdd("layers") = new_layers;
+	String descriptor = AsJSON(js);
+	
+	int64 param_count = net.GetParameterCount();
+	int64 param_offset = (MODEL_HEADER_SIZE + descriptor.GetCount() + MODEL_ALIGN - 1) / MODEL_ALIGN * MODEL_ALIGN;
+	
+	s.Put(model_magic, 4);
+	s.Put32le(MODEL_VERSION);
+	s.Put32le(sizeof(Real));
+	s.Put32le(layers.GetCount());
+	s.Put64le(descriptor.GetCount());
+	s.Put64le(param_offset);
+	s.Put64le(param_count);
+	s.Put(descriptor);
+	for(int64 i = MODEL_HEADER_SIZE + descriptor.GetCount(); i < param_offset; i++)
+		s.Put(0);
+	PutParameters(s, net.ParameterData(), param_count);
+	
+	Leave();
+	
+	return !s.IsError();
+}
+
+bool Session::LoadModelLayers(Stream& s, ModelHeader& h) {
+	char magic[4];
+	if (!s.GetAll(magic, 4) || memcmp(magic, model_magic, 4))
+		return false;
+	
+	h.version = s.Get32le();
+	h.elem_size = s.Get32le();
+	h.layer_count = s.Get32le();
+	h.descriptor_size = s.Get64le();
+	h.param_offset = s.Get64le();
+	h.param_count = s.Get64le();
+	if (h.version != MODEL_VERSION || (h.elem_size != 4 && h.elem_size != 8) ||
+		h.descriptor_size < 0 || h.descriptor_size > INT_MAX ||
+		h.param_offset < MODEL_HEADER_SIZE + h.descriptor_size ||
+		h.param_count < 0 || h.param_count > INT_MAX) {
+		LOG("ERROR: INVALID MODEL HEADER");
+		return false;
+	}
+	
+	Vector<char> descriptor;
+	descriptor.SetCount((int)h.descriptor_size);
+	if (!s.GetAll(descriptor.Begin(), descriptor.GetCount()))
+		return false;
+	for(int64 i = MODEL_HEADER_SIZE + h.descriptor_size; i < h.param_offset; i++)
+		s.Get();
+	
+	Value js = ParseJSON(String(descriptor.Begin(), descriptor.GetCount()));
+	Value layers = js["layers"];
+	if (layers.GetCount() != h.layer_count)
+		return false;
+	
+	// The descriptor has no weights, so the parameter volumes get only their shape here.
+	// The memory comes later from the arena or the mapped file, when the net packs them.
+	int64 param_count = 0;
+	for(int i = 0; i < layers.GetCount(); i++) {
+		ValueMap layer = layers[i];
+		
+		LayerBase* l = CreateLayer(layer);
+		if (!l) {
+			LOG("ERROR: UNRECOGNIZED LAYER TYPE: " + layer["layer_type"].ToString());
+			return false;
+		}
+		owned_layers.Add(l);
+		net.AddLayerPointer(*l);
+		
+		// the input size isn't stored, but it is the output size of the previous layer
+		if (i > 0) {
+			const LayerBase& prev = *net.GetLayers()[i - 1];
+			l->shape_only = true;
+			l->Init(prev.output_width, prev.output_height, prev.output_depth);
+			l->shape_only = false;
+		}
+		
+		Vector<ParametersAndGradients>& pag = l->GetParametersAndGradients();
+		for(int j = 0; j < pag.GetCount(); j++)
+			param_count += pag[j].volume->GetLength();
+	}
+	
+	if (param_count != h.param_count) {
+		LOG("ERROR: PARAMETER COUNT DOESN'T MATCH THE LAYERS");
+		return false;
+	}
+	
+	return !s.IsError();
+}
+
+bool Session::LoadModel(Stream& s) {
+	ClearOwnedLayers();
+	
+	Enter();
+	ModelHeader h;
+	bool ok = LoadModelLayers(s, h) && GetParameters(s, net.ParameterBegin(), h.param_count, h.elem_size);
+	Leave();
+	
+	if (!ok) {
+		ClearOwnedLayers();
+		return false;
 	}
+	
+	WhenSessionLoaded();
+	
+	return true;
+}
+
+bool Session::StoreModelFile(const String& path) {
+	FileOut out(path);
+	if (!out.IsOpen())
+		return false;
+	return StoreModel(out);
+}
+
+bool Session::LoadModelFile(const String& path) {
+	FileIn in(path);
+	if (!in.IsOpen())
+		return false;
+	return LoadModel(in);
+}
+
+bool Session::MapModelFile(const String& path) {
+	ClearOwnedLayers();
+	
+	Enter();
+	
+	bool ok = model_file.Open(path);
+	int64 size = ok ? model_file.GetFileSize() : 0;
+	ok = ok && size >= MODEL_HEADER_SIZE && model_file.Map(0, (size_t)size);
+	
+	ModelHeader h;
+	MemReadStream in(ok ? model_file.Begin() : NULL, ok ? size : 0);
+	ok = ok && LoadModelLayers(in, h) && h.param_offset + h.param_count * h.elem_size <= size;
+	
+	if (ok) {
+		const byte* params = model_file.Begin() + h.param_offset;
+		bool direct = h.elem_size == sizeof(Real) && (uintptr_t)params % sizeof(Real) == 0;
+		#ifdef CPU_BE
+		direct = false;
+		#endif
+		
+		if (direct)
+			net.MapParameters((const Real*)params, (int)h.param_count);
+		else {
+			// the weights must be converted, so the mapping isn't needed after this
+			in.Seek(h.param_offset);
+			ok = GetParameters(in, net.ParameterBegin(), h.param_count, h.elem_size);
+			model_file.Close();
+		}
+	}
+	
+	Leave();
+	
+	if (!ok) {
+		ClearOwnedLayers();
+		return false;
+	}
+	
+	WhenSessionLoaded();
+	
+	return true;
 }
 
 void Session::ClearData() {
@@ -611,9 +1201,14 @@ void Session::Reset() {
 	train_window.Clear();
 	accuracy_window.Clear();
 	
+	// the layers write the new weights to their views, which must not be in the
+	// read-only mapped model file
+	if (net.IsMapped())
+		net.DetachParameters();
 	for(int i = 0; i < net.GetLayers().GetCount(); i++) {
 		net.GetLayers()[i]->Reset();
 	}
+	net.Repack();
 	if (trainer)
 		trainer->Reset();
 }
@@ -8,6 +8,29 @@ namespace ConvNet {
 
 class Session {
 	
+	// A worker of the data-parallel training. The first one uses the net of the
+	// session and the others use replicas, which share the weights of that net,
+	// but have their own activations and gradients.
+	struct Replica {
+		Net* net;
+		One<Net> owned_net;
+		Vector<LayerBasePtr> owned_layers;
+		VolumeBatch x, y;
+		Vector<int> labels;
+		Vector<double> values;
+		double loss;
+		int begin, count;
+		
+		Replica() : net(NULL), loss(0), begin(0), count(0) {}
+		~Replica();
+	};
+	
+	// The losses of one training step, which are read under the lock and added
+	// to the windows after it
+	struct StepLoss {
+		double reward, loss, l1_decay, l2_decay;
+	};
+	
 public:
 	// Statistical variables for values during training
 	Window loss_window, reward_window, l1_loss_window, l2_loss_window, train_window, accuracy_window, test_window;
@@ -18,6 +41,7 @@ public:
 protected:
 	friend class MagicNet;
 	friend class MetaSession;
+	friend class NetSnapshot;
 	
 	typedef Exc RequiredArg;
 	
@@ -29,21 +53,57 @@ protected:
 	Net net;
 	TimeStop ts;
 	Volume x;
+	VolumeDataBase sample;
+	VolumeBatch batch_x, batch_y;
+	Vector<int> batch_labels;
+	Vector<double> batch_values;
 	Vector<double> session_last_input_array;
 	Vector<LayerBasePtr> owned_layers;
+	Array<Replica> replicas;
+	Vector<Real*> replica_gradients;
+	SamplePrefetcher prefetch;
 	int predict_interval, step_num;
 	int train_iter_limit;
 	int iter;
 	int forward_time, backward_time;
+	AllocStat step_allocs;
 	int step_cb_interal;
 	int iter_cb_interal;
 	int augmentation;
+	int thread_count;
+	int prefetch_threads, prefetch_size;
 	bool is_training, is_training_stopped;
 	bool test_predict;
 	bool augmentation_do_flip;
+	bool batch_training;
+	bool shuffle;
 	
 	const Value& ChkNotNull(const String& key, const Value& v);
 	void Train();
+	void TrainSampleIteration();
+	void TrainBatchIteration();
+	bool IsTrainRegression();
+	void GetStepLoss(StepLoss& l) const;
+	void AddStepLoss(const StepLoss& l);
+	int NextSample(int i);
+	void TrainParallel(int count, bool train_regression);
+	void TrainReplica(int i, bool train_regression);
+	void InitReplicas();
+	void ClearReplicas();
+	Net& GetBatchNet(int& i);
+	LayerBase* CreateLayer(const ValueMap& values);
+	
+	// Adds new layers with the settings and sizes of the layers of the session net to dst.
+	// The weights are not copied. The caller owns the layers, which are added to owned.
+	void CopyLayers(Net& dst, Vector<LayerBasePtr>& owned);
+	
+	struct ModelHeader {
+		int version, elem_size, layer_count;
+		int64 descriptor_size, param_offset, param_count;
+	};
+	FileMapping model_file;
+	
+	bool LoadModelLayers(Stream& s, ModelHeader& h);
 	
 public:
 	typedef Session CLASSNAME;
@@ -107,9 +167,12 @@ public:
 	double GetValidationAccuracyAverage() const {return accuracy_window.GetAverage();}
 	int GetForwardTime() const {return forward_time;}
 	int GetBackwardTime() const {return backward_time;}
+	const AllocStat& GetStepAllocStat() const {return step_allocs;}
 	int GetStepCount() const {return step_num;}
 	int GetIteration() const {return iter;}
 	bool IsTraining() const {return !is_training_stopped || is_training;}
+	bool IsBatchTraining() const {return batch_training;}
+	int GetThreadCount() const {return thread_count;}
 	
 	virtual double GetLossAverage() const {return loss_window.GetAverage();}
 	virtual double GetRewardAverage() const {return reward_window.GetAverage();}
@@ -118,10 +181,32 @@ public:
 	bool LoadJSON(const String& json);
 	bool StoreJSON(String& json);
 	void Serialize(Stream& s);
+	
+	// Binary model format: the layers without weights, and then all weights in one
+	// aligned block. MapModelFile uses the weights directly from the mapped file, until
+	// the training or Reset copies them.
+	bool StoreModel(Stream& s);
+	bool LoadModel(Stream& s);
+	bool StoreModelFile(const String& path);
+	bool LoadModelFile(const String& path);
+	bool MapModelFile(const String& path);
+	
 	void SetMaxTrainIters(int count) {train_iter_limit = count;}
 	void SetPredictInterval(int i) {predict_interval = i;}
 	void SetTestPredict(bool b) {test_predict = b;}
-	void SetAugmentation(int i=0, bool flip=false) {augmentation = 0; augmentation_do_flip = flip;}
+	void SetAugmentation(int i=0, bool flip=false) {augmentation = i; augmentation_do_flip = flip;}
+	void SetBatchTraining(bool b=true) {batch_training = b;}
+	
+	// Splits every minibatch of the batch training to this many threads. Zero uses
+	// all cores. The gradients are summed before the update, so the result is the
+	// same as with one thread, excluding the rounding.
+	void SetThreadCount(int i) {thread_count = i > 0 ? i : CPU_Cores();}
+	
+	// Reads, augments and shuffles the samples in background threads during the training,
+	// and keeps ring_size samples ready. The order of the samples is the same with any
+	// thread count. Shuffling gives every epoch a new order.
+	void SetPrefetch(int threads, int ring_size=64) {prefetch_threads = max(0, threads); prefetch_size = max(1, ring_size);}
+	void SetShuffle(bool b=true) {shuffle = b;}
 	Session& SetTrainer(TrainerBase& trainer) {this->trainer = &trainer; return *this;}
 	Session& AttachTrainer(TrainerBase* trainer) {ASSERT(!owned_trainer); this->trainer = trainer; owned_trainer = trainer; return *this;}
 	Session& SetWindowSize(int size, int min_size=1);
@@ -133,6 +218,29 @@ public:
 	
 };
 
+// A copy of the net of a session for predicting in another thread during the training,
+// e.g. for drawing. Update copies the weights under the session lock, and the copy can
+// then be used without the lock, while the training changes the original.
+class NetSnapshot {
+	One<Net> net;
+	Vector<LayerBasePtr> owned_layers;
+	const Net* source;
+	int generation;
+	Vector<Real> params;
+	
+	void ClearLayers();
+	
+public:
+	NetSnapshot() : source(NULL), generation(0) {}
+	~NetSnapshot() {ClearLayers();}
+	
+	// The layers are copied again only when the layers of the session have changed
+	// (see Net::GetGeneration)
+	void Update(Session& ses);
+	const Net& GetNet() const {return *net;}
+	bool IsEmpty() const {return net.IsEmpty();}
+};
+
 }
 
 #endif
@@ -7,6 +7,7 @@ SessionData::SessionData() {
 	data_h = 0;
 	data_d = 0;
 	is_data_result = false;
+	source = NULL;
 	
 }
 
@@ -30,13 +31,54 @@ void SessionData::ClearData() {
 	labels.Clear();
 	test_labels.Clear();
 	classes.Clear();
+	cache.SetSource(NULL);
+	if (source) {
+		delete source;
+		source = NULL;
+	}
+}
+
+void SessionData::AttachSource(DataSource* src) {
+	ClearData();
+	
+	source = src;
+	cache.SetSource(src);
+	
+	data_w = src->GetWidth();
+	data_h = src->GetHeight();
+	data_d = src->GetDepth();
+	data_len = data_w * data_h * data_d;
+	is_data_result = false;
+	
+	labels.SetCount(src->GetCount());
+	for(int i = 0; i < labels.GetCount(); i++)
+		labels[i] = src->GetLabel(i);
+	test_labels.SetCount(src->GetTestCount());
+	for(int i = 0; i < test_labels.GetCount(); i++)
+		test_labels[i] = src->GetTestLabel(i);
+	
+	// the value ranges would require reading everything
+	mins.Clear();
+	mins.SetCount(data_len, 0);
+	maxs.Clear();
+	maxs.SetCount(data_len, 1);
+	
+	classes.SetCount(src->GetClassCount());
+}
+
+void SessionData::SetCacheSize(int cache_size) {
+	cache.SetSize(256, max(1, cache_size / 256));
 }
 
 double SessionData::GetData(int i, int col) const {
+	if (source)
+		return cache.Get(false, i, col);
 	return data[i]->Get(col);
 }
 
 double SessionData::GetTestData(int i, int col) const {
+	if (source)
+		return cache.Get(true, i, col);
 	return test_data[i]->Get(col);
 }
 
@@ -61,8 +103,8 @@ void SessionData::EndData() {
 	// Randomize data
 	int count = data.GetCount() / 2;
 	for(int i = 0; i < count; i++) {
-		int a = Random(data.GetCount());
-		int b = Random(data.GetCount());
+		int a = GetRng().Get(data.GetCount());
+		int b = GetRng().Get(data.GetCount());
 		Swap(data[a],	data[b]);
 		if (!is_data_result)
 			Swap(labels[a],	labels[b]);
@@ -73,7 +115,7 @@ void SessionData::EndData() {
 }
 
 void SessionData::GetUniformClassData(int per_class, Vector<VolumeDataBase*>& volumes, Vector<int>& labels) {
-	ASSERT(per_class >= 0);
+	ASSERT(per_class >= 0 && !source);
 	Vector<int> counts;
 	counts.SetCount(classes.GetCount(), 0);
 	int remaining = per_class * classes.GetCount();
@@ -93,4 +135,143 @@ void SessionData::GetUniformClassData(int per_class, Vector<VolumeDataBase*>& vo
 	
 }
 
+
+
+
+
+SamplePrefetcher::SamplePrefetcher() {
+	data = NULL;
+	produce_seq = 0;
+	consume_seq = 0;
+	augmentation = 0;
+	augmentation_do_flip = false;
+	shuffle = false;
+	running = false;
+}
+
+void SamplePrefetcher::Start(SessionData& d, int threads, int ring_size, int augmentation, bool flip, bool shuffle) {
+	Stop();
+	ASSERT(ring_size > 0);
+	if (!d.GetDataCount())
+		return;
+	
+	data = &d;
+	this->augmentation = augmentation;
+	augmentation_do_flip = flip;
+	this->shuffle = shuffle;
+	produce_seq = 0;
+	consume_seq = 0;
+	error.Clear();
+	
+	order.SetCount(d.GetDataCount());
+	for(int i = 0; i < order.GetCount(); i++)
+		order[i] = i;
+	
+	ring.SetCount(ring_size);
+	for(int i = 0; i < ring.GetCount(); i++)
+		ring[i].ready = false;
+	
+	running = true;
+	for(int i = 0; i < threads; i++)
+		workers.Add().Run(THISBACK(Work));
+}
+
+void SamplePrefetcher::Stop() {
+	lock.Enter();
+	running = false;
+	free_cond.Broadcast();
+	lock.Leave();
+	
+	for(int i = 0; i < workers.GetCount(); i++)
+		workers[i].Wait();
+	workers.Clear();
+	ring.Clear();
+}
+
+int64 SamplePrefetcher::Claim() {
+	// the slot of the sample is free when the sample one round earlier has been popped
+	if (produce_seq - consume_seq >= ring.GetCount())
+		return -1;
+	
+	int64 seq = produce_seq++;
+	int pos = (int)(seq % order.GetCount());
+	if (shuffle && pos == 0) {
+		// every epoch has its own generator, so the order doesn't depend on the thread,
+		// which claims the first sample
+		Rng rng(GetRngSeed(RNG_SHUFFLE, seq / order.GetCount()));
+		for(int i = order.GetCount() - 1; i > 0; i--)
+			Swap(order[i], order[rng.Get(i + 1)]);
+	}
+	ring[(int)(seq % ring.GetCount())].id = order[pos];
+	return seq;
+}
+
+void SamplePrefetcher::Fill(int64 seq) {
+	Slot& s = ring[(int)(seq % ring.GetCount())];
+	try {
+		s.x.Init(data->GetDataWidth(), data->GetDataHeight(), data->GetDataDepth(), 0.0);
+		data->Read(s.id, s.tmp);
+		memcpy(s.x.Begin(), s.tmp.Begin(), s.tmp.GetCount() * sizeof(Real));
+		if (augmentation) {
+			Rng rng(GetRngSeed(RNG_AUGMENT, seq));
+			RngScope __(rng);
+			s.x.Augment(augmentation, -1, -1, augmentation_do_flip);
+		}
+	}
+	catch (Exc e) {
+		Mutex::Lock __(lock);
+		error = e;
+	}
+	
+	Mutex::Lock __(lock);
+	s.ready = true;
+	ready_cond.Broadcast();
+}
+
+void SamplePrefetcher::Work() {
+	lock.Enter();
+	while (running) {
+		int64 seq = Claim();
+		if (seq < 0) {
+			free_cond.Wait(lock);
+			continue;
+		}
+		lock.Leave();
+		Fill(seq);
+		lock.Enter();
+	}
+	lock.Leave();
+}
+
+int SamplePrefetcher::Pop(Volume& x) {
+	ASSERT(running);
+	if (workers.IsEmpty()) {
+		lock.Enter();
+		int64 seq = Claim();
+		lock.Leave();
+		ASSERT(seq >= 0);
+		Fill(seq);
+	}
+	
+	Slot& s = ring[(int)(consume_seq % ring.GetCount())];
+	lock.Enter();
+	while (!s.ready)
+		ready_cond.Wait(lock);
+	if (!error.IsEmpty()) {
+		lock.Leave();
+		throw Exception(error);
+	}
+	lock.Leave();
+	
+	x.SwapData(s.x);
+	int id = s.id;
+	
+	lock.Enter();
+	s.ready = false;
+	consume_seq++;
+	free_cond.Signal();
+	lock.Leave();
+	return id;
+}
+
 }
@@ -2,6 +2,7 @@
 #define _ConvNet_SessionData_h_
 
 #include "Net.h"
+#include "DataSource.h"
 
 namespace ConvNet {
 
@@ -18,6 +19,10 @@ protected:
 	int data_w, data_h, data_d, data_len;
 	bool is_data_result;
 	
+	// Streamed samples, which are read through the cache instead of the data vectors
+	DataSource* source;
+	mutable SampleCache cache;
+	
 public:
 	typedef SessionData CLASSNAME;
 	SessionData();
@@ -29,8 +34,18 @@ public:
 	void EndData();
 	void ClearData();
 	
-	VolumeDataBase& Get(int i) {return *data[i];}
-	VolumeDataBase& GetTest(int i) {return *test_data[i];}
+	// Reads the samples from the source on demand, so the data can be larger than the
+	// memory. The source is deleted in ClearData. The cache keeps cache_size recently used
+	// samples, which can be replaced at any time, so the streamed samples are only
+	// available as copies through Read and ReadTest. They can be used from many threads.
+	void AttachSource(DataSource* src);
+	void SetCacheSize(int cache_size);
+	bool IsStreaming() const {return source;}
+	
+	VolumeDataBase& Get(int i) {ASSERT(!source); return *data[i];}
+	VolumeDataBase& GetTest(int i) {ASSERT(!source); return *test_data[i];}
+	void Read(int i, VolumeDataBase& dst) {if (source) cache.Read(false, i, dst); else dst.Assign(*data[i]);}
+	void ReadTest(int i, VolumeDataBase& dst) {if (source) cache.Read(true, i, dst); else dst.Assign(*test_data[i]);}
 	VolumeDataBase& GetResult(int i) {return *result_data[i];}
 	String GetClass(int i) const {return classes[i];}
 	double GetData(int i, int col) const;
@@ -39,8 +54,8 @@ public:
 	double GetMin(int col) const {return mins[col];}
 	int GetLabel(int i) const {return labels[i];}
 	int GetTestLabel(int i) const {return test_labels[i];}
-	int GetDataCount() const {return data.GetCount();}
-	int GetTestCount() const {return test_data.GetCount();}
+	int GetDataCount() const {return source ? source->GetCount() : data.GetCount();}
+	int GetTestCount() const {return source ? source->GetTestCount() : test_data.GetCount();}
 	int GetDataLength() const {return data_w * data_h * data_d;}
 	int GetDataWidth() const {return data_w;}
 	int GetDataHeight() const {return data_h;}
@@ -122,6 +137,49 @@ public:
 	
 };
 
+
+// Prepares the training samples in worker threads ahead of the trainer: reads them from
+// the session data, augments and optionally shuffles them. The samples go through a ring
+// of ready volumes in a fixed order, so the thread count doesn't change the sample order.
+// Without threads, Pop prepares the sample itself.
+class SamplePrefetcher {
+	
+	struct Slot {
+		Volume x;
+		VolumeDataBase tmp;
+		int id;
+		bool ready;
+	};
+	
+	SessionData* data;
+	Array<Slot> ring;
+	Vector<int> order;
+	Array<Thread> workers;
+	Mutex lock;
+	ConditionVariable ready_cond, free_cond;
+	String error;
+	int64 produce_seq, consume_seq;
+	int augmentation;
+	bool augmentation_do_flip, shuffle, running;
+	
+	int64 Claim();
+	void Fill(int64 seq);
+	void Work();
+	
+public:
+	typedef SamplePrefetcher CLASSNAME;
+	SamplePrefetcher();
+	~SamplePrefetcher() {Stop();}
+	
+	void Start(SessionData& d, int threads, int ring_size, int augmentation, bool flip, bool shuffle);
+	void Stop();
+	bool IsRunning() const {return running;}
+	
+	// Swaps the next sample to x and returns its index in the data
+	int Pop(Volume& x);
+	
+};
+
 }
 
 #endif
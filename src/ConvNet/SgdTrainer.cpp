@@ -12,57 +12,11 @@ SgdTrainer::SgdTrainer(Net& net) : TrainerBase(net) {
 }
 
 void SgdTrainer::TrainImplem() {
-	iter_count++;
-	if ((iter_count % batch_size) == 0) {
-		Vector<ParametersAndGradients>& parametersAndGradients = net->GetParametersAndGradients();
-		
-		// initialize lists for accumulators. Will only be done once on first iteration
-		if (gsum.GetCount() == 0 && momentum > 0.0) {
-			for(int i = 0; i < parametersAndGradients.GetCount(); i++) {
-				ParametersAndGradients& t = parametersAndGradients[i];
-				gsum.Add().SetCount(t.volume->GetLength(), 0.0);
-			}
-		}
-		
-		// perform an update for all sets of weights
-		for (int i = 0; i < parametersAndGradients.GetCount(); i++) {
-			ParametersAndGradients& parametersAndGradient = parametersAndGradients[i];
-			
-			// param, gradient, other options in future (custom learning rate etc)
-			Volume& vol = *parametersAndGradient.volume;
-			
-			
-			// learning rate for some parameters.
-			double l2_decay_mul = IF_NULL_1(parametersAndGradient.l2_decay_mul);
-			double l1_decay_mul = IF_NULL_1(parametersAndGradient.l1_decay_mul);
-			double l2_decay = this->l2_decay * l2_decay_mul;
-			double l1_decay = this->l1_decay * l1_decay_mul;
-			
-			int plen = vol.GetLength();
-			
-			for (int j = 0; j < plen; j++) {
-				l2_decay_loss += l2_decay * vol.Get(j) * vol.Get(j) / 2; // accumulate weight decay loss
-				l1_decay_loss += l1_decay * fabs(vol.Get(j));
-				double l1_grad = l1_decay * (vol.Get(j) > 0 ? 1 : -1);
-				double l2_grad = l2_decay * vol.Get(j);
-				
-				double gij = (l2_grad + l1_grad + vol.GetGradient(j)) / batch_size; // raw batch gradient
-				
-				if (momentum > 0.0) {
-					// momentum update
-					Vector<double>& gsumi = gsum[i];
-					double dx = momentum * gsumi[j] - learning_rate * gij; // step
-					gsumi[j] = dx; // back this up for next iteration of momentum
-					vol.Set(j, vol.Get(j) + dx); // apply corrected gradient
-				}
-				else {
-					// vanilla sgd
-					vol.Set(j, vol.Get(j) - learning_rate * gij);
-				}
-				
-				vol.SetGradient(j , 0.0); // zero out gradient so that we can begin accumulating anew
-			}
-		}
+	if (IsUpdateStep()) {
+		if (momentum > 0.0)
+			UpdateParameters(UPDATE_MOMENTUM, &gsum, NULL);
+		else
+			UpdateParameters(UPDATE_SGD, NULL, NULL);
 	}
 	
 	// in future, TODO: have to completely redo the way loss is done around the network as currently
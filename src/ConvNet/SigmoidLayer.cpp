@@ -17,7 +17,10 @@ void SigmoidLayer::Init(int input_width, int input_height, int input_depth) {
 
 Volume& SigmoidLayer::Forward(Volume& input, bool is_training) {
 	input_activation = &input;
-	output_activation.Init(input.GetWidth(), input.GetHeight(), input.GetDepth(), 0.0);
+	if (in_place)
+		output_activation.InitView(input.GetWidth(), input.GetHeight(), input.GetDepth(), input.Begin(), input.GradientBegin());
+	else
+		output_activation.Init(input.GetWidth(), input.GetHeight(), input.GetDepth(), 0.0);
 	
 	int length = input.GetLength();
 	
@@ -28,10 +31,31 @@ Volume& SigmoidLayer::Forward(Volume& input, bool is_training) {
 	return output_activation;
 }
 
+void SigmoidLayer::Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const {
+	if (&output != &input)
+		output.Init(input.GetWidth(), input.GetHeight(), input.GetDepth(), 0.0);
+	const Real* in = input.Begin();
+	Real* out = output.Begin();
+	int length = input.GetLength();
+	for (int i = 0; i < length; i++)
+		out[i] = (Real)(1.0 / (1.0 + exp(-1.0 * in[i])));
+}
+
 void SigmoidLayer::Backward() {
 	Volume& input = *input_activation; // we need to set dw of this
 	Volume& output = output_activation;
 	
+	if (in_place) {
+		// the gradients are shared too
+		const Real* out = output.Begin();
+		Real* dout = output.GradientBegin();
+		for (int i = 0; i < input.GetLength(); i++) {
+			double v2wi = out[i];
+			dout[i] = v2wi * (1.0 - v2wi) * dout[i];
+		}
+		return;
+	}
+	
 	input.ZeroGradients(); // zero out gradient wrt data
 	
 	for (int i = 0; i < input.GetLength(); i++) {
@@ -40,6 +64,32 @@ void SigmoidLayer::Backward() {
 	}
 }
 
+VolumeBatch& SigmoidLayer::ForwardBatch(VolumeBatch& input, bool is_training) {
+	input_batch = &input;
+	output_batch.Init(input, 0.0);
+	
+	const Real* in = input.Begin();
+	Real* out = output_batch.Begin();
+	int length = input.GetLength() * input.GetCount();
+	for (int i = 0; i < length; i++)
+		out[i] = 1.0 / (1.0 + exp(-1.0 * in[i]));
+	
+	return output_batch;
+}
+
+void SigmoidLayer::BackwardBatch() {
+	VolumeBatch& input = *input_batch;
+	const Real* out = output_batch.Begin();
+	const Real* dout = output_batch.GradientBegin();
+	Real* din = input.GradientBegin();
+	
+	int length = input.GetLength() * input.GetCount();
+	for (int i = 0; i < length; i++) {
+		double v2wi = out[i];
+		din[i] = v2wi * (1.0 - v2wi) * dout[i];
+	}
+}
+
 #define STOREVAR(json, field) map.GetAdd(#json) = this->field;
 #define LOADVAR(field, json) this->field = map.GetValue(map.Find(#json));
 #define LOADVARDEF(field, json, def) {Value tmp = map.GetValue(map.Find(#json)); if (tmp.IsNull()) this->field = def; else this->field = tmp;}
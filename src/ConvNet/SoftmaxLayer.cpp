@@ -52,6 +52,28 @@ Volume& SoftmaxLayer::Forward(Volume& input, bool is_training) {
 	return output_activation;
 }
 
+void SoftmaxLayer::Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const {
+	output.Init(1, 1, output_depth, 0.0);
+	const Real* in = input.Begin();
+	Real* out = output.Begin();
+	
+	// compute max activation
+	double amax = in[0];
+	for (int i = 1; i < output_depth; i++)
+		if (in[i] > amax)
+			amax = in[i];
+	
+	// compute exponentials and normalize to sum to one
+	double esum = 0.0;
+	for (int i = 0; i < output_depth; i++) {
+		double e = exp(in[i] - amax);
+		esum += e;
+		out[i] = (Real)e;
+	}
+	for (int i = 0; i < output_depth; i++)
+		out[i] = (Real)(out[i] / esum);
+}
+
 double SoftmaxLayer::Backward(int pos, double y) {
 	
 	// compute and accumulate gradient wrt weights and bias of this layer
@@ -76,6 +98,72 @@ void SoftmaxLayer::Backward() {
 	throw NotImplementedException();
 }
 
+VolumeBatch& SoftmaxLayer::ForwardBatch(VolumeBatch& input, bool is_training) {
+	input_batch = &input;
+	int count = input.GetCount();
+	output_batch.Init(1, 1, output_depth, count, 0.0);
+	es_batch.SetCount(output_depth * count);
+	
+	for (int b = 0; b < count; b++) {
+		const Real* in = input.Begin(b);
+		Real* out = output_batch.Begin(b);
+		double* es = es_batch.Begin() + b * output_depth;
+		
+		// compute max activation
+		double amax = in[0];
+		for (int i = 1; i < output_depth; i++)
+			if (in[i] > amax)
+				amax = in[i];
+		
+		// compute exponentials (carefully to not blow up)
+		double esum = 0.0;
+		for (int i = 0; i < output_depth; i++) {
+			double e = exp(in[i] - amax);
+			esum += e;
+			es[i] = e;
+		}
+		
+		// normalize and output to sum to one
+		for (int i = 0; i < output_depth; i++) {
+			es[i] /= esum;
+			out[i] = es[i];
+		}
+	}
+	
+	return output_batch;
+}
+
+double SoftmaxLayer::BackwardBatch(const Vector<int>& pos, const Vector<double>& y) {
+	VolumeBatch& input = *input_batch;
+	int count = input.GetCount();
+	ASSERT(pos.GetCount() == count);
+	double loss = 0.0;
+	
+	for (int b = 0; b < count; b++) {
+		Real* din = input.GradientBegin(b);
+		const double* es = es_batch.Begin() + b * output_depth;
+		int p = pos[b];
+		
+		for (int i = 0; i < output_depth; i++) {
+			double indicator = i == p ? 1.0 : 0.0;
+			din[i] = -1.0 * (indicator - es[i]);
+		}
+		
+		// loss is the class negative log likelihood
+		loss += -1.0 * log(es[p]);
+	}
+	
+	return loss;
+}
+
+double SoftmaxLayer::BackwardBatch(const VolumeBatch& y) {
+	throw NotImplementedException();
+}
+
+void SoftmaxLayer::BackwardBatch() {
+	throw NotImplementedException();
+}
+
 #define STOREVAR(json, field) map.GetAdd(#json) = this->field;
 #define LOADVAR(field, json) this->field = map.GetValue(map.Find(#json));
 #define LOADVARDEF(field, json, def) {Value tmp = map.GetValue(map.Find(#json)); if (tmp.IsNull()) this->field = def; else this->field = tmp;}
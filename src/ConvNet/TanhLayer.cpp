@@ -17,7 +17,10 @@ void TanhLayer::Init(int input_width, int input_height, int input_depth) {
 
 Volume& TanhLayer::Forward(Volume& input, bool is_training) {
 	input_activation = &input;
-	output_activation.Init(input.GetWidth(), input.GetHeight(), input.GetDepth(), 0.0);
+	if (in_place)
+		output_activation.InitView(input.GetWidth(), input.GetHeight(), input.GetDepth(), input.Begin(), input.GradientBegin());
+	else
+		output_activation.Init(input.GetWidth(), input.GetHeight(), input.GetDepth(), 0.0);
 	int length = input.GetLength();
 	
 	for (int i = 0; i < length; i++) {
@@ -26,11 +29,32 @@ Volume& TanhLayer::Forward(Volume& input, bool is_training) {
 	return output_activation;
 }
 
+void TanhLayer::Predict(const Volume& input, Volume& output, Vector<Real>& tmp) const {
+	if (&output != &input)
+		output.Init(input.GetWidth(), input.GetHeight(), input.GetDepth(), 0.0);
+	const Real* in = input.Begin();
+	Real* out = output.Begin();
+	int length = input.GetLength();
+	for (int i = 0; i < length; i++)
+		out[i] = (Real)tanh(in[i]);
+}
+
 void TanhLayer::Backward() {
 	Volume& input = *input_activation; // we need to set dw of this
 	Volume& output = output_activation;
 	int length = input.GetLength();
 	
+	if (in_place) {
+		// the gradients are shared too
+		const Real* out = output.Begin();
+		Real* dout = output.GradientBegin();
+		for (int i = 0; i < length; i++) {
+			double v2wi = out[i];
+			dout[i] = (1.0 - v2wi * v2wi) * dout[i];
+		}
+		return;
+	}
+	
 	input.ZeroGradients(); // zero out gradient wrt data
 	
 	for (int i = 0; i < length; i++)
@@ -40,6 +64,32 @@ void TanhLayer::Backward() {
 	}
 }
 
+VolumeBatch& TanhLayer::ForwardBatch(VolumeBatch& input, bool is_training) {
+	input_batch = &input;
+	output_batch.Init(input, 0.0);
+	
+	const Real* in = input.Begin();
+	Real* out = output_batch.Begin();
+	int length = input.GetLength() * input.GetCount();
+	for (int i = 0; i < length; i++)
+		out[i] = tanh(in[i]);
+	
+	return output_batch;
+}
+
+void TanhLayer::BackwardBatch() {
+	VolumeBatch& input = *input_batch;
+	const Real* out = output_batch.Begin();
+	const Real* dout = output_batch.GradientBegin();
+	Real* din = input.GradientBegin();
+	
+	int length = input.GetLength() * input.GetCount();
+	for (int i = 0; i < length; i++) {
+		double v2wi = out[i];
+		din[i] = (1.0 - v2wi * v2wi) * dout[i];
+	}
+}
+
 #define STOREVAR(json, field) map.GetAdd(#json) = this->field;
 #define LOADVAR(field, json) this->field = map.GetValue(map.Find(#json));
 #define LOADVARDEF(field, json, def) {Value tmp = map.GetValue(map.Find(#json)); if (tmp.IsNull()) this->field = def; else this->field = tmp;}
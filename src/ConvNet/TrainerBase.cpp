@@ -8,6 +8,10 @@ TrainerBase::TrainerBase(Net& net) {
 	this->net = &net;
 	batch_size = 1;
 	iter_count = 0;
+	pending_samples = 0;
+	step_samples = 1;
+	update_samples = 0;
+	flush = false;
 	cost_loss = 0;
 	cost_reward = 0;
 	
@@ -24,6 +28,7 @@ TrainerBase::TrainerBase(Net& net) {
 }
 
 void TrainerBase::Train(Volume& x, int pos, double y) {
+	AllocScope alloc(train_allocs);
 	vec.SetCount(1);
 	vec[0] = &x;
 	Forward(vec);
@@ -34,6 +39,7 @@ void TrainerBase::Train(Volume& x, int pos, double y) {
 }
 
 void TrainerBase::Train(Volume& x, const VolumeDataBase& y) {
+	AllocScope alloc(train_allocs);
 	vec.SetCount(1);
 	vec[0] = &x;
 	Forward(vec);
@@ -44,6 +50,7 @@ void TrainerBase::Train(Volume& x, const VolumeDataBase& y) {
 }
 
 void TrainerBase::Train(const VolumeDataBase& y, const Vector<VolumePtr>& x) {
+	AllocScope alloc(train_allocs);
 	Forward(x);
 	
 	Backward(y);
@@ -52,6 +59,7 @@ void TrainerBase::Train(const VolumeDataBase& y, const Vector<VolumePtr>& x) {
 }
 
 void TrainerBase::Train(Volume& x, int cols, const Vector<int>& pos, const Vector<double>& y) {
+	AllocScope alloc(train_allocs);
 	vec.SetCount(1);
 	vec[0] = &x;
 	Forward(vec);
@@ -61,6 +69,150 @@ void TrainerBase::Train(Volume& x, int cols, const Vector<int>& pos, const Vecto
 	TrainImplem();
 }
 
+void TrainerBase::TrainBatch(VolumeBatch& x, const Vector<int>& pos, const Vector<double>& y) {
+	AllocScope alloc(train_allocs);
+	int count = x.GetCount();
+	net->ForwardBatch(x, true);
+	
+	double sum = 0;
+	for(int i = 0; i < y.GetCount(); i++)
+		sum += y[i];
+	cost_reward = sum / count;
+	cost_loss = net->BackwardBatch(pos, y) / count;
+	l2_decay_loss = 0.0;
+	l1_decay_loss = 0.0;
+	
+	TrainBatchImplem(count);
+}
+
+void TrainerBase::TrainBatch(VolumeBatch& x, const VolumeBatch& y) {
+	AllocScope alloc(train_allocs);
+	int count = x.GetCount();
+	net->ForwardBatch(x, true);
+	
+	cost_loss = net->BackwardBatch(y) / count;
+	l2_decay_loss = 0.0;
+	l1_decay_loss = 0.0;
+	
+	TrainBatchImplem(count);
+}
+
+void TrainerBase::TrainBatchImplem(int sample_count) {
+	// The gradients of sample_count samples are already accumulated, so
+	// they are counted as one step of TrainImplem.
+	step_samples = sample_count;
+	TrainImplem();
+	step_samples = 1;
+}
+
+void TrainerBase::Flush() {
+	if (!pending_samples)
+		return;
+	
+	// no new samples, only the update of the pending ones
+	step_samples = 0;
+	flush = true;
+	TrainImplem();
+	flush = false;
+	step_samples = 1;
+}
+
+bool TrainerBase::IsUpdateStep() {
+	iter_count += step_samples;
+	pending_samples += step_samples;
+	if (pending_samples < batch_size && !flush)
+		return false;
+	
+	// the gradient is averaged over the real count, which is less than
+	// batch_size only when flushing
+	update_samples = pending_samples;
+	pending_samples = 0;
+	return true;
+}
+
+static bool IsSameLayout(const Vector<Vector<Real> >& sum, const Vector<ParametersAndGradients>& pag) {
+	if (sum.GetCount() != pag.GetCount())
+		return false;
+	for(int i = 0; i < pag.GetCount(); i++)
+		if (sum[i].GetCount() != pag[i].volume->GetLength())
+			return false;
+	return true;
+}
+
+void TrainerBase::UpdateParameters(int rule, Vector<Vector<Real> >* gsum, Vector<Vector<Real> >* xsum) {
+	Vector<ParametersAndGradients>& parametersAndGradients = net->GetParametersAndGradients();
+	
+	// initialize lists for accumulators. Done on the first iteration, and again when
+	// the spans of the net change, e.g. after freezing a layer
+	if (gsum && !IsSameLayout(*gsum, parametersAndGradients)) {
+		gsum->Clear();
+		for(int i = 0; i < parametersAndGradients.GetCount(); i++)
+			gsum->Add().SetCount(parametersAndGradients[i].volume->GetLength(), 0.0);
+	}
+	if (xsum && !IsSameLayout(*xsum, parametersAndGradients)) {
+		xsum->Clear();
+		for(int i = 0; i < parametersAndGradients.GetCount(); i++)
+			xsum->Add().SetCount(parametersAndGradients[i].volume->GetLength(), 0.0);
+	}
+	
+	UpdateArgs args;
+	args.rule = rule;
+	args.batch_size = update_samples;
+	args.learning_rate = learning_rate;
+	args.momentum = momentum;
+	args.ro = ro;
+	args.eps = eps;
+	args.beta1 = Beta1;
+	args.beta2 = Beta2;
+	args.bias_scale1 = 1 - pow(Beta1, iter_count);
+	args.bias_scale2 = 1 - pow(Beta2, iter_count);
+	args.l1_decay_loss = l1_decay_loss;
+	args.l2_decay_loss = l2_decay_loss;
+	
+	// the profile needs the time of every layer, so the spans are split at the layer
+	// boundaries. The update is elementwise, so the result is the same.
+	bool prof = net->IsProfiling();
+	const Real* grad_base = prof ? net->GradientBegin() : NULL;
+	
+	// perform an update for all sets of weights
+	for (int i = 0; i < parametersAndGradients.GetCount(); i++) {
+		ParametersAndGradients& parametersAndGradient = parametersAndGradients[i];
+		Volume& vol = *parametersAndGradient.volume;
+		
+		// learning rate for some parameters.
+		args.l1_decay = l1_decay * IF_NULL_1(parametersAndGradient.l1_decay_mul);
+		args.l2_decay = l2_decay * IF_NULL_1(parametersAndGradient.l2_decay_mul);
+		
+		Real* w = vol.Begin();
+		Real* dw = vol.GradientBegin();
+		Real* g = gsum ? (*gsum)[i].Begin() : NULL;
+		Real* x = xsum ? (*xsum)[i].Begin() : NULL;
+		if (!prof) {
+			ConvNet::UpdateParameters(args, w, dw, g, x, vol.GetLength());
+			continue;
+		}
+		
+		int offset = (int)(dw - grad_base);
+		int end = offset + vol.GetLength();
+		for (int layer = 0; offset < end; layer++) {
+			int len = min(end, net->GetLayerParameterEnd(layer)) - offset;
+			if (len <= 0)
+				continue;
+			uint64 t0 = ReadCycles();
+			ConvNet::UpdateParameters(args, w, dw, g, x, len);
+			net->GetProfile().Add(NetProfile::UPDATE, layer, t0, ReadCycles());
+			w += len;
+			dw += len;
+			if (g) g += len;
+			if (x) x += len;
+			offset += len;
+		}
+	}
+	
+	l1_decay_loss = args.l1_decay_loss;
+	l2_decay_loss = args.l2_decay_loss;
+}
+
 void TrainerBase::Backward(int pos, double y) {
 	cost_reward = y;
 	cost_loss = net->Backward(pos, y);
@@ -85,6 +237,7 @@ void TrainerBase::Forward(const Vector<VolumePtr>& x) {
 
 void TrainerBase::Reset() {
 	iter_count = 0;
+	pending_samples = 0;
 }
 
 }
@@ -2,6 +2,7 @@
 #define _ConvNet_Training_h_
 
 #include "Net.h"
+#include "Kernels.h"
 
 namespace ConvNet {
 
@@ -15,6 +16,10 @@ protected:
 	
 	Net* net;
 	int iter_count;
+	int pending_samples;  // accumulated since the last update
+	int step_samples;     // counted by the next TrainImplem
+	int update_samples;   // averaged by the current update
+	bool flush;
 	Vector<VolumePtr> vec;
 	
 	// Previously public vars
@@ -32,10 +37,21 @@ protected:
 	double eps;
 	double ro;
 	
+	// The allocations of the Train and TrainBatch calls (see AllocScope)
+	AllocStat train_allocs;
+	
 	TrainerBase(Net& net);
 	TrainerBase(const TrainerBase& o) {}
 	TrainerBase() {}
 	
+	// Runs the fused update kernel (see Kernels.h) over all parameters of the net.
+	// The accumulators are allocated on the first call.
+	void UpdateParameters(int rule, Vector<Vector<Real> >* gsum, Vector<Vector<Real> >* xsum);
+	
+	// Counts the samples of a TrainImplem call. Returns true when the accumulated
+	// gradients are to be applied: batch_size samples are seen or Flush was called.
+	bool IsUpdateStep();
+	
 public:
 	virtual ~TrainerBase() {}
 	
@@ -52,6 +68,7 @@ public:
 	double GetL2Decay() const {return l2_decay;}
 	double GetL1DecayLoss() const {return l1_decay_loss;}
 	double GetL2DecayLoss() const {return l2_decay_loss;}
+	const AllocStat& GetAllocStat() const {return train_allocs;}
 	virtual double GetLoss() {return cost_loss;}
 	virtual double GetReward() {return cost_reward;}
 	
@@ -78,6 +95,17 @@ public:
 	void Train(Volume& x, int cols, const Vector<int>& pos, const Vector<double>& y);
 	void Forward(const Vector<VolumePtr>& x);
 	
+	// Minibatch training. The gradients of all samples are accumulated
+	// in one pass and the update is done when batch_size samples have
+	// been seen, like with the single sample Train.
+	void TrainBatch(VolumeBatch& x, const Vector<int>& pos, const Vector<double>& y);
+	void TrainBatch(VolumeBatch& x, const VolumeBatch& y);
+	void TrainBatchImplem(int sample_count);
+	
+	// Applies the gradients of a partial batch, e.g. the last one of an epoch,
+	// averaged over its real sample count. The next batch starts from zero.
+	void Flush();
+	
 	virtual void TrainImplem() = 0;
 	virtual void Backward(int pos, double y);
 	virtual void Backward(const VolumeDataBase& y);
@@ -89,8 +117,8 @@ public:
 typedef TrainerBase* TrainerBasePtr;
 
 class AdadeltaTrainer : public TrainerBase {
-	Vector<Vector<double> > gsum;
-	Vector<Vector<double> > xsum;
+	Vector<Vector<Real> > gsum;
+	Vector<Vector<Real> > xsum;
 	
 protected:
 	AdadeltaTrainer(const AdadeltaTrainer& o) {}
@@ -112,7 +140,7 @@ protected:
 
 
 class AdagradTrainer : public TrainerBase {
-	Vector<Vector<double> > gsum;
+	Vector<Vector<Real> > gsum;
 	
 protected:
 	AdagradTrainer(const AdagradTrainer& o) {}
@@ -134,8 +162,8 @@ protected:
 
 
 class AdamTrainer : public TrainerBase {
-	Vector<Vector<double> > gsum;
-	Vector<Vector<double> > xsum;
+	Vector<Vector<Real> > gsum;
+	Vector<Vector<Real> > xsum;
 	
 protected:
 	AdamTrainer(const AdamTrainer& o) {}
@@ -158,7 +186,7 @@ protected:
 
 
 class NetsterovTrainer : public TrainerBase {
-	Vector<Vector<double> > gsum;
+	Vector<Vector<Real> > gsum;
 	
 protected:
 	NetsterovTrainer(const NetsterovTrainer& o) {}
@@ -182,7 +210,7 @@ protected:
 
 // Stochastic gradient descent
 class SgdTrainer : public TrainerBase {
-	Vector<Vector<double> > gsum;
+	Vector<Vector<Real> > gsum;
 	
 protected:
 	SgdTrainer(const SgdTrainer& o) {}
@@ -207,7 +235,7 @@ protected:
 
 
 class WindowgradTrainer : public TrainerBase {
-	Vector<Vector<double> > gsum;
+	Vector<Vector<Real> > gsum;
 	
 protected:
 	WindowgradTrainer(const WindowgradTrainer& o) {}
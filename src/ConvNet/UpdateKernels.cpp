@@ -0,0 +1,226 @@
+#include "Kernels.h"
+
+#if (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))) || \
+	(defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+#define CONVNET_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace ConvNet {
+
+// The plain version of the update, used when there is no SIMD support and for the
+// remaining values after the vectorized loop.
+static void UpdateScalar(UpdateArgs& a, Real* w, Real* dw, Real* gsum, Real* xsum, int begin, int end) {
+	double l1_decay = a.l1_decay;
+	double l2_decay = a.l2_decay;
+	double learning_rate = a.learning_rate;
+	double momentum = a.momentum;
+	double ro = a.ro;
+	double eps = a.eps;
+	
+	for (int j = begin; j < end; j++) {
+		double wj = w[j];
+		a.l2_decay_loss += l2_decay * wj * wj / 2; // accumulate weight decay loss
+		a.l1_decay_loss += l1_decay * fabs(wj);
+		double l1_grad = l1_decay * (wj > 0 ? 1 : -1);
+		double l2_grad = l2_decay * wj;
+		
+		double gij = (l2_grad + l1_grad + dw[j]) / a.batch_size; // raw batch gradient
+		double dx;
+		
+		switch (a.rule) {
+		case UPDATE_SGD:
+			dx = -learning_rate * gij;
+			break;
+		case UPDATE_MOMENTUM:
+			dx = momentum * gsum[j] - learning_rate * gij;
+			gsum[j] = dx;
+			break;
+		case UPDATE_NESTEROV:
+			dx = gsum[j];
+			gsum[j] = gsum[j] * momentum + learning_rate * gij;
+			dx = momentum * dx - (1.0 + momentum) * gsum[j];
+			break;
+		case UPDATE_ADAGRAD:
+			gsum[j] = gsum[j] + gij * gij;
+			dx = -1.0 * learning_rate / sqrt(gsum[j] + eps) * gij;
+			break;
+		case UPDATE_WINDOWGRAD:
+			// this is adagrad but with a moving window weighted average
+			// so the gradient is not accumulated over the entire history of the run.
+			// it's also referred to as Idea #1 in Zeiler paper on Adadelta.
+			gsum[j] = ro * gsum[j] + (1 - ro) * gij * gij;
+			dx = -1.0 * learning_rate / sqrt(gsum[j] + eps) * gij;
+			break;
+		case UPDATE_ADADELTA:
+			gsum[j] = ro * gsum[j] + (1 - ro) * gij * gij;
+			dx = -1.0 * sqrt((xsum[j] + eps) / (gsum[j] + eps)) * gij;
+			xsum[j] = ro * xsum[j] + (1 - ro) * dx * dx; // xsum lags behind gsum by 1
+			break;
+		case UPDATE_ADAM: {
+			gsum[j] = gsum[j] * a.beta1 + (1 - a.beta1) * gij; // update biased first moment estimate
+			xsum[j] = xsum[j] * a.beta2 + (1 - a.beta2) * gij * gij; // update biased second moment estimate
+			double bias_corr1 = gsum[j] * a.bias_scale1; // correct bias first moment estimate
+			double bias_corr2 = xsum[j] * a.bias_scale2; // correct bias second moment estimate
+			dx = -1.0 * learning_rate * bias_corr1 / (sqrt(bias_corr2) + eps);
+			break;
+		}
+		default:
+			NEVER();
+			dx = 0;
+		}
+		
+		w[j] = wj + dx;
+		dw[j] = 0.0; // zero out gradient so that we can begin accumulating anew
+	}
+}
+
+#ifdef CONVNET_X86_KERNELS
+
+// The SIMD versions are compiled for their instruction set with target pragmas, so
+// the rest of the package doesn't need any special compiler flags.
+namespace Sse2 {
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("sse2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+
+#ifdef flagCONVNET_FLOAT
+typedef __m128 V;
+enum {LANES = 4};
+
+static inline V Set1(double d) {return _mm_set1_ps((float)d);}
+static inline V Load(const float* p) {return _mm_loadu_ps(p);}
+static inline void Store(float* p, V v) {_mm_storeu_ps(p, v);}
+static inline V Add(V a, V b) {return _mm_add_ps(a, b);}
+static inline V Sub(V a, V b) {return _mm_sub_ps(a, b);}
+static inline V Mul(V a, V b) {return _mm_mul_ps(a, b);}
+static inline V Div(V a, V b) {return _mm_div_ps(a, b);}
+static inline V Sqrt(V a) {return _mm_sqrt_ps(a);}
+static inline V Abs(V a) {return _mm_andnot_ps(_mm_set1_ps(-0.0f), a);}
+static inline V Sign(V a, V one, V minus_one) {
+	V mask = _mm_cmpgt_ps(a, _mm_setzero_ps());
+	return _mm_or_ps(_mm_and_ps(mask, one), _mm_andnot_ps(mask, minus_one));
+}
+static inline double HorizontalSum(V a) {
+	float d[4];
+	_mm_storeu_ps(d, a);
+	return (double)d[0] + d[1] + d[2] + d[3];
+}
+
+#else
+typedef __m128d V;
+enum {LANES = 2};
+
+static inline V Set1(double d) {return _mm_set1_pd(d);}
+static inline V Load(const double* p) {return _mm_loadu_pd(p);}
+static inline void Store(double* p, V v) {_mm_storeu_pd(p, v);}
+static inline V Add(V a, V b) {return _mm_add_pd(a, b);}
+static inline V Sub(V a, V b) {return _mm_sub_pd(a, b);}
+static inline V Mul(V a, V b) {return _mm_mul_pd(a, b);}
+static inline V Div(V a, V b) {return _mm_div_pd(a, b);}
+static inline V Sqrt(V a) {return _mm_sqrt_pd(a);}
+static inline V Abs(V a) {return _mm_andnot_pd(_mm_set1_pd(-0.0), a);}
+static inline V Sign(V a, V one, V minus_one) {
+	V mask = _mm_cmpgt_pd(a, _mm_setzero_pd());
+	return _mm_or_pd(_mm_and_pd(mask, one), _mm_andnot_pd(mask, minus_one));
+}
+static inline double HorizontalSum(V a) {
+	double d[2];
+	_mm_storeu_pd(d, a);
+	return d[0] + d[1];
+}
+
+#endif
+
+#include "UpdateKernels.inl"
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+}
+
+namespace Avx2 {
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+#ifdef flagCONVNET_FLOAT
+typedef __m256 V;
+enum {LANES = 8};
+
+static inline V Set1(double d) {return _mm256_set1_ps((float)d);}
+static inline V Load(const float* p) {return _mm256_loadu_ps(p);}
+static inline void Store(float* p, V v) {_mm256_storeu_ps(p, v);}
+static inline V Add(V a, V b) {return _mm256_add_ps(a, b);}
+static inline V Sub(V a, V b) {return _mm256_sub_ps(a, b);}
+static inline V Mul(V a, V b) {return _mm256_mul_ps(a, b);}
+static inline V Div(V a, V b) {return _mm256_div_ps(a, b);}
+static inline V Sqrt(V a) {return _mm256_sqrt_ps(a);}
+static inline V Abs(V a) {return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);}
+static inline V Sign(V a, V one, V minus_one) {
+	return _mm256_blendv_ps(minus_one, one, _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_GT_OQ));
+}
+static inline double HorizontalSum(V a) {
+	float d[8];
+	_mm256_storeu_ps(d, a);
+	double sum = 0;
+	for (int i = 0; i < 8; i++)
+		sum += d[i];
+	return sum;
+}
+
+#else
+typedef __m256d V;
+enum {LANES = 4};
+
+static inline V Set1(double d) {return _mm256_set1_pd(d);}
+static inline V Load(const double* p) {return _mm256_loadu_pd(p);}
+static inline void Store(double* p, V v) {_mm256_storeu_pd(p, v);}
+static inline V Add(V a, V b) {return _mm256_add_pd(a, b);}
+static inline V Sub(V a, V b) {return _mm256_sub_pd(a, b);}
+static inline V Mul(V a, V b) {return _mm256_mul_pd(a, b);}
+static inline V Div(V a, V b) {return _mm256_div_pd(a, b);}
+static inline V Sqrt(V a) {return _mm256_sqrt_pd(a);}
+static inline V Abs(V a) {return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a);}
+static inline V Sign(V a, V one, V minus_one) {
+	return _mm256_blendv_pd(minus_one, one, _mm256_cmp_pd(a, _mm256_setzero_pd(), _CMP_GT_OQ));
+}
+static inline double HorizontalSum(V a) {
+	double d[4];
+	_mm256_storeu_pd(d, a);
+	return d[0] + d[1] + d[2] + d[3];
+}
+
+#endif
+
+#include "UpdateKernels.inl"
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+}
+
+#endif
+
+void UpdateParameters(UpdateArgs& args, Real* w, Real* dw, Real* gsum, Real* xsum, int n) {
+	int done = 0;
+#ifdef CONVNET_X86_KERNELS
+	switch (GetKernelIsa()) {
+		case KERNEL_AVX2: done = Avx2::UpdateSpan(args, w, dw, gsum, xsum, n); break;
+		case KERNEL_SSE2: done = Sse2::UpdateSpan(args, w, dw, gsum, xsum, n); break;
+	}
+#endif
+	UpdateScalar(args, w, dw, gsum, xsum, done, n);
+}
+
+}
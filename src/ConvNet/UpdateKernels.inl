@@ -0,0 +1,137 @@
+// Vectorized body of UpdateParameters. UpdateKernels.cpp includes this once for
+// each instruction set, after defining the vector type V, its lane count LANES
+// and the operations used below.
+
+static inline V DecayGradient(V wj, V dwj, V l1, V l2, V bs, V one, V minus_one, V half, V& l1_loss, V& l2_loss) {
+	l2_loss = Add(l2_loss, Mul(Mul(Mul(l2, wj), wj), half)); // accumulate weight decay loss
+	l1_loss = Add(l1_loss, Mul(l1, Abs(wj)));
+	V l1_grad = Mul(l1, Sign(wj, one, minus_one));
+	V l2_grad = Mul(l2, wj);
+	return Div(Add(Add(l2_grad, l1_grad), dwj), bs); // raw batch gradient
+}
+
+static int UpdateSpan(UpdateArgs& a, Real* w, Real* dw, Real* gsum, Real* xsum, int n) {
+	V l1 = Set1(a.l1_decay);
+	V l2 = Set1(a.l2_decay);
+	V bs = Set1(a.batch_size);
+	V one = Set1(1.0);
+	V minus_one = Set1(-1.0);
+	V half = Set1(0.5);
+	V zero = Set1(0.0);
+	V lr = Set1(a.learning_rate);
+	V neg_lr = Set1(-1.0 * a.learning_rate);
+	V mom = Set1(a.momentum);
+	V eps = Set1(a.eps);
+	V ro = Set1(a.ro);
+	V one_ro = Set1(1 - a.ro);
+	V l1_loss = zero, l2_loss = zero;
+	
+	int end = n - n % LANES;
+	int j = 0;
+	
+	switch (a.rule) {
+	
+	case UPDATE_SGD:
+		for (; j < end; j += LANES) {
+			V wj = Load(w + j);
+			V g = DecayGradient(wj, Load(dw + j), l1, l2, bs, one, minus_one, half, l1_loss, l2_loss);
+			Store(w + j, Sub(wj, Mul(lr, g)));
+			Store(dw + j, zero);
+		}
+		break;
+	
+	case UPDATE_MOMENTUM:
+		for (; j < end; j += LANES) {
+			V wj = Load(w + j);
+			V g = DecayGradient(wj, Load(dw + j), l1, l2, bs, one, minus_one, half, l1_loss, l2_loss);
+			V dx = Sub(Mul(mom, Load(gsum + j)), Mul(lr, g));
+			Store(gsum + j, dx);
+			Store(w + j, Add(wj, dx));
+			Store(dw + j, zero);
+		}
+		break;
+	
+	case UPDATE_NESTEROV: {
+		V one_mom = Set1(1.0 + a.momentum);
+		for (; j < end; j += LANES) {
+			V wj = Load(w + j);
+			V g = DecayGradient(wj, Load(dw + j), l1, l2, bs, one, minus_one, half, l1_loss, l2_loss);
+			V dx = Load(gsum + j);
+			V gs = Add(Mul(dx, mom), Mul(lr, g));
+			Store(gsum + j, gs);
+			dx = Sub(Mul(mom, dx), Mul(one_mom, gs));
+			Store(w + j, Add(wj, dx));
+			Store(dw + j, zero);
+		}
+		break;
+	}
+	
+	case UPDATE_ADAGRAD:
+		for (; j < end; j += LANES) {
+			V wj = Load(w + j);
+			V g = DecayGradient(wj, Load(dw + j), l1, l2, bs, one, minus_one, half, l1_loss, l2_loss);
+			V gs = Add(Load(gsum + j), Mul(g, g));
+			Store(gsum + j, gs);
+			V dx = Mul(Div(neg_lr, Sqrt(Add(gs, eps))), g);
+			Store(w + j, Add(wj, dx));
+			Store(dw + j, zero);
+		}
+		break;
+	
+	case UPDATE_WINDOWGRAD:
+		for (; j < end; j += LANES) {
+			V wj = Load(w + j);
+			V g = DecayGradient(wj, Load(dw + j), l1, l2, bs, one, minus_one, half, l1_loss, l2_loss);
+			V gs = Add(Mul(ro, Load(gsum + j)), Mul(Mul(one_ro, g), g));
+			Store(gsum + j, gs);
+			V dx = Mul(Div(neg_lr, Sqrt(Add(gs, eps))), g);
+			Store(w + j, Add(wj, dx));
+			Store(dw + j, zero);
+		}
+		break;
+	
+	case UPDATE_ADADELTA:
+		for (; j < end; j += LANES) {
+			V wj = Load(w + j);
+			V g = DecayGradient(wj, Load(dw + j), l1, l2, bs, one, minus_one, half, l1_loss, l2_loss);
+			V gs = Add(Mul(ro, Load(gsum + j)), Mul(Mul(one_ro, g), g));
+			Store(gsum + j, gs);
+			V xs = Load(xsum + j);
+			V dx = Mul(Mul(minus_one, Sqrt(Div(Add(xs, eps), Add(gs, eps)))), g);
+			Store(xsum + j, Add(Mul(ro, xs), Mul(Mul(one_ro, dx), dx)));
+			Store(w + j, Add(wj, dx));
+			Store(dw + j, zero);
+		}
+		break;
+	
+	case UPDATE_ADAM: {
+		V beta1 = Set1(a.beta1);
+		V beta2 = Set1(a.beta2);
+		V one_beta1 = Set1(1 - a.beta1);
+		V one_beta2 = Set1(1 - a.beta2);
+		V bias_scale1 = Set1(a.bias_scale1);
+		V bias_scale2 = Set1(a.bias_scale2);
+		for (; j < end; j += LANES) {
+			V wj = Load(w + j);
+			V g = DecayGradient(wj, Load(dw + j), l1, l2, bs, one, minus_one, half, l1_loss, l2_loss);
+			V gs = Add(Mul(Load(gsum + j), beta1), Mul(one_beta1, g));
+			V xs = Add(Mul(Load(xsum + j), beta2), Mul(Mul(one_beta2, g), g));
+			Store(gsum + j, gs);
+			Store(xsum + j, xs);
+			V bias_corr1 = Mul(gs, bias_scale1);
+			V bias_corr2 = Mul(xs, bias_scale2);
+			V dx = Div(Mul(neg_lr, bias_corr1), Add(Sqrt(bias_corr2), eps));
+			Store(w + j, Add(wj, dx));
+			Store(dw + j, zero);
+		}
+		break;
+	}
+	
+	default:
+		return 0;
+	}
+	
+	a.l1_decay_loss += HorizontalSum(l1_loss);
+	a.l2_decay_loss += HorizontalSum(l2_loss);
+	return j;
+}
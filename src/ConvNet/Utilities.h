@@ -1,28 +1,56 @@
 #ifndef _ConvNet_Utilities_h_
 #define _ConvNet_Utilities_h_
 
-#include <random>
 #include <Core/Core.h>
+#include "Allocation.h"
 
 
 namespace ConvNet {
 using namespace Upp;
 
 
+// Element type of all volumes, parameters and gradients. Build with the CONVNET_FLOAT
+// flag to run everything in single precision, which halves the memory traffic and
+// doubles the SIMD width. The interface still takes and returns doubles, and stored
+// models are interchangeable between the two modes.
+#ifdef flagCONVNET_FLOAT
+typedef float Real;
+#else
+typedef double Real;
+#endif
+
 
+// VolumeDataBase is an array of Reals. Usually it owns its memory, but it can
+// also be a view to memory owned by someone else, like the parameter arena of Net.
+// Resizing a view copies the values to owned memory first.
 struct VolumeDataBase {
-	Vector<double> weights;
-	
-	VolumeDataBase() {}
-	VolumeDataBase(int count, double value=0) {weights.SetCount(count, value);}
-	VolumeDataBase(const Vector<double>& data) {weights <<= data;}
-	inline double operator[](int i) const {return weights[i];}
-	inline double Get(int i) const {return weights[i];}
-	inline double Get(int x, int y, int z, int w, int d) const {return weights[((w * y) + x) * d + z];}
-	inline int GetCount() const {return weights.GetCount();}
-	inline void Set(int i, double d) {weights[i] = d;}
-	inline void SetCount(int i) {ASSERT(i >= weights.GetCount()); weights.SetCount(i);}
-	inline void SetCount(int i, double d) {ASSERT(i >= weights.GetCount()); weights.SetCount(i, d);}
+	Vector<Real> weights;
+	Real* data;
+	int count;
+	
+	VolumeDataBase() : data(NULL), count(0) {}
+	VolumeDataBase(int count, double value=0) {weights.SetCount(count, (Real)value); Sync();}
+	VolumeDataBase(const Vector<double>& data);
+	inline double operator[](int i) const {ASSERT(i >= 0 && i < count); return data[i];}
+	inline double Get(int i) const {ASSERT(i >= 0 && i < count); return data[i];}
+	inline double Get(int x, int y, int z, int w, int d) const {return Get(((w * y) + x) * d + z);}
+	inline int GetCount() const {return count;}
+	inline void Set(int i, double d) {ASSERT(i >= 0 && i < count); data[i] = (Real)d;}
+	inline Real& operator[](int i) {ASSERT(i >= 0 && i < count); return data[i];}
+	inline Real* Begin() {return data;}
+	inline const Real* Begin() const {return data;}
+	inline bool IsView() const {return count > 0 && data != weights.Begin();}
+	
+	void SetCount(int i);
+	void SetCount(int i, double d);
+	void SetView(Real* data, int count);
+	void Detach();
+	void Clear() {weights.Clear(); Sync();}
+	void Assign(const VolumeDataBase& src);
+	void Swap(VolumeDataBase& b);
+	
+private:
+	void Sync() {data = weights.Begin(); count = weights.GetCount();}
 };
 
 
@@ -35,7 +63,7 @@ struct VolumeDataBase {
 // all weights, and also stores all gradients w.r.t.
 // the data.
 class Volume : Moveable<Volume> {
-	Vector<double> weight_gradients;
+	VolumeDataBase weight_gradients;
 	VolumeDataBase* weights;
 	bool owned_weights;
 
@@ -61,13 +89,24 @@ public:
 	Volume& Init(int width, int height, int depth); // Volume will be filled with random numbers
 	Volume& Init(int width, int height, int depth, const Vector<double>& weights);
 	Volume& Init(int width, int height, int depth, double default_value);
+	Volume& InitView(int width, int height, int depth, Real* w, Real* dw);
+	
+	// Sets only the size, without memory for the values. Net gives the volume its
+	// memory when it packs the parameters (see Relocate).
+	Volume& InitShape(int width, int height, int depth);
 	
 	~Volume();
 	
 	Volume& operator=(const Volume& src);
 	
 	const VolumeDataBase& GetWeights() const {return *weights;}
-	const Vector<double>& GetGradients() const {return weight_gradients;}
+	const VolumeDataBase& GetGradients() const {return weight_gradients;}
+	
+	// Raw access for the inner loops of the layers
+	Real* Begin() {ASSERT(owned_weights); return weights->Begin();}
+	const Real* Begin() const {return weights->Begin();}
+	Real* GradientBegin() {return weight_gradients.Begin();}
+	const Real* GradientBegin() const {return weight_gradients.Begin();}
 	
 	void Add(int i, double v);
 	void Add(int x, int y, int d, double v);
@@ -87,12 +126,19 @@ public:
 	double GetGradient(int i) const;
 	void SetGradient(int i, double v);
 	void ZeroGradients();
-	void Store(ValueMap& map) const;
+	void Store(ValueMap& map, bool values = true) const;
 	void Load(const ValueMap& map);
 	void Serialize(Stream& s);
 	void Augment(int crop, int dx=-1, int dy=-1, bool fliplr=false);
 	void SetData(VolumeDataBase& data);
 	void SwapData(Volume& vol);
+	void Clear();
+	
+	// Moves the values and the gradients to external memory, which must hold
+	// GetLength() values. The volume keeps using that memory until it is resized.
+	// A volume with only the shape gets zeros.
+	void Relocate(Real* w, Real* dw);
+	bool IsRelocated() const {return weights->IsView();}
 	
 	int GetPos(int x, int y, int d) const;
 	int GetWidth()  const {return width;}
@@ -108,6 +154,55 @@ public:
   
 typedef Volume* VolumePtr;
 
+
+// VolumeBatch holds a minibatch of equally sized volumes in one
+// contiguous block, sample after sample. Layers process the whole
+// batch in one call, which keeps the weights in the cache and
+// avoids the per-sample virtual calls of the Volume path.
+class VolumeBatch : Moveable<VolumeBatch> {
+	Vector<Real> weights;
+	Vector<Real> weight_gradients;
+	int width;
+	int height;
+	int depth;
+	int length;
+	int count;
+	
+public:
+	
+	VolumeBatch();
+	VolumeBatch(const VolumeBatch& o) {*this = o;}
+	VolumeBatch& Init(int width, int height, int depth, int count, double default_value=0.0);
+	VolumeBatch& Init(const VolumeBatch& b, double default_value=0.0) {return Init(b.width, b.height, b.depth, b.count, default_value);}
+	
+	VolumeBatch& operator=(const VolumeBatch& src);
+	
+	void SetSample(int i, const VolumeDataBase& data);
+	void SetSample(int i, const Volume& vol);
+	void GetSample(int i, Volume& vol) const;
+	void ZeroGradients();
+	
+	double Get(int i, int j) const {return weights[i * length + j];}
+	void Set(int i, int j, double v) {weights[i * length + j] = (Real)v;}
+	double GetGradient(int i, int j) const {return weight_gradients[i * length + j];}
+	void SetGradient(int i, int j, double v) {weight_gradients[i * length + j] = (Real)v;}
+	void AddGradient(int i, int j, double v) {weight_gradients[i * length + j] += (Real)v;}
+	
+	// Pointers to the beginning of the i:th sample
+	Real* Begin(int i=0) {return weights.Begin() + i * length;}
+	const Real* Begin(int i=0) const {return weights.Begin() + i * length;}
+	Real* GradientBegin(int i=0) {return weight_gradients.Begin() + i * length;}
+	const Real* GradientBegin(int i=0) const {return weight_gradients.Begin() + i * length;}
+	
+	int GetMaxColumn(int i) const;
+	int GetWidth()  const {return width;}
+	int GetHeight() const {return height;}
+	int GetDepth()  const {return depth;}
+	int GetLength() const {return length;}
+	int GetCount()  const {return count;}
+	
+};
+
 class ParametersAndGradients : Moveable<ParametersAndGradients> {
 	
 public:
@@ -128,43 +223,81 @@ public:
 	double* l1_decay_mul;
 };
 
-class RandomGaussian {
-	std::default_random_engine generator;
-	std::normal_distribution<double> distribution;
+// Random number generator of the library: xoshiro256** for single values, and four
+// interleaved xoshiro256+ streams for the bulk functions, which the compiler can keep in
+// SIMD registers. Every thread has its own generator (see GetRng), so nothing is locked.
+class Rng {
+	enum {LANES = 4};
+	
+	uint64 s[4];
+	uint64 lanes[4][LANES];
+	double spare;
+	bool has_spare;
+	
+	void NextBlock(uint64* out);
 	
 public:
-
-	// weight normalization is done to equalize the output
-	// variance of every neuron, otherwise neurons with a lot
-	// of incoming connections have outputs of larger variance
-	RandomGaussian(int length) : distribution(0, sqrt(1.0 / (double)(length))) {
-		generator.seed(Random(1000000000));
+	Rng(uint64 seed = 0) {Seed(seed);}
+	
+	void Seed(uint64 seed);
+	
+	uint64 Get64() {
+		uint64 r = Rotl(s[1] * 5, 7) * 9;
+		uint64 t = s[1] << 17;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = Rotl(s[3], 45);
+		return r;
 	}
-	double Get() {return distribution(generator);}
-	operator double() {return distribution(generator);}
+	dword Get() {return (dword)(Get64() >> 32);}
+	int Get(int n) {return (int)(((Get64() >> 32) * (uint64)n) >> 32);} // 0 ... n-1
+	double Getf() {return (Get64() >> 11) * (1.0 / 9007199254740992.0);} // [0, 1)
+	double GetGaussian();
+	
+	// Bulk generation to n values: uniform values in [low, high), normal values and a
+	// mask, which is true with the probability p.
+	void FillUniform(Real* dst, int n, double low = 0, double high = 1);
+	void FillGaussian(Real* dst, int n, double mean, double stddev);
+	void FillMask(bool* dst, int n, double p);
+	
+	static uint64 Rotl(uint64 x, int k) {return (x << k) | (x >> (64 - k));}
 	
 };
 
-template <class T> // Workaround for GCC bug - specialization needed...
-T& SingleRandomGaussianLock() {
-	static T o;
-	return o;
-}
+// The generator of the calling thread. The threads are seeded from a common sequence in
+// the order, in which they use their generators the first time, so the runs are
+// reproducible after SeedRng, when that order is (e.g. with a single thread). The
+// threads of the library use an RngScope for their tasks instead.
+Rng& GetRng();
 
-inline RandomGaussian& GetRandomGaussian(int length) {
-	SpinLock& lock = SingleRandomGaussianLock<SpinLock>(); // workaround
-	ArrayMap<int, RandomGaussian>& rands = Single<ArrayMap<int, RandomGaussian> >();
-	lock.Enter();
-	int i = rands.Find(length);
-	RandomGaussian* r;
-	if (i == -1) {
-		r = &rands.Add(length, new RandomGaussian(length));
-	} else {
-		r = &rands[i];
-	}
-	lock.Leave();
-	return *r;
-}
+// Restarts the seed sequence from seed and reseeds the generator of the calling thread.
+// Threads, which have used their generators already, keep their current state.
+void SeedRng(uint64 seed);
+
+// A seed, which depends only on the seed of SeedRng, the stream and the index. Work,
+// which can run in any thread, uses an own Rng seeded with this to be reproducible.
+uint64 GetRngSeed(int stream, uint64 index);
+
+enum {
+	RNG_SHUFFLE,   // index is the epoch (see SamplePrefetcher)
+	RNG_AUGMENT,   // index is the sequence number of the prefetched sample
+	RNG_REPLICA,   // index is the first sample of the replica (see Session::TrainParallel)
+	RNG_CANDIDATE, // index is the iteration and the candidate (see MagicNet)
+};
+
+// Makes GetRng return rng in the calling thread until the end of the scope. The tasks
+// of a thread pool use this, so that the layers (e.g. DropOutLayer) get the same numbers
+// whichever thread runs the task.
+class RngScope {
+	Rng* prev;
+	
+public:
+	RngScope(Rng& rng);
+	~RngScope();
+};
 
 struct MaxMin : Moveable<MaxMin> {
 	int maxi, mini;
@@ -200,6 +333,8 @@ public:
 	void Serialize(Stream& s) {s % v % sum % size % minsize;}
 	
 	void Add(double x) {
+		if (v.IsEmpty())
+			v.Reserve(size + 1); // the values are added before the oldest is removed
 		v.Add(x);
 		sum += x;
 		if (v.GetCount() > size) {
@@ -260,6 +395,58 @@ public:
 
 };
 
+// Sum-tree for proportional sampling, e.g. of prioritized replay memory. The leaves hold
+// the priorities and every inner node the sum of its children, so that both updating a
+// priority and finding the item at a cumulative sum take O(log n).
+class SumTree {
+	Vector<double> tree;
+	int leaves, count;
+	double max_priority;
+
+public:
+	SumTree() {leaves = 0; count = 0; max_priority = 1.0;}
+
+	void Init(int capacity) {
+		leaves = 1;
+		while (leaves < capacity)
+			leaves <<= 1;
+		count = capacity;
+		tree.SetCount(0);
+		tree.SetCount(2 * leaves, 0.0);
+		max_priority = 1.0;
+	}
+
+	void Serialize(Stream& s) {s % tree % leaves % count % max_priority;}
+
+	void Set(int i, double priority) {
+		ASSERT(i >= 0 && i < count && priority >= 0);
+		max_priority = max(max_priority, priority);
+		int k = leaves + i;
+		double diff = priority - tree[k];
+		for (; k > 0; k >>= 1)
+			tree[k] += diff;
+	}
+
+	// Returns the item, where the cumulative sum of the priorities reaches value
+	int Find(double value) const {
+		int k = 1;
+		while (k < leaves) {
+			k <<= 1;
+			if (value >= tree[k] && tree[k + 1] > 0) {
+				value -= tree[k];
+				k++;
+			}
+		}
+		return min(k - leaves, count - 1);
+	}
+
+	double Get(int i) const {return tree[leaves + i];}
+	double GetTotal() const {return leaves ? tree[1] : 0.0;}
+	double GetMaxPriority() const {return max_priority;}
+	int GetCount() const {return count;}
+
+};
+
 
 void RandomPermutation(int n, Vector<int>& array);
 
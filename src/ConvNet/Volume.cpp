@@ -2,6 +2,55 @@
 
 namespace ConvNet {
 
+VolumeDataBase::VolumeDataBase(const Vector<double>& data) {
+	weights.SetCount(data.GetCount());
+	for(int i = 0; i < data.GetCount(); i++)
+		weights[i] = (Real)data[i];
+	Sync();
+}
+
+void VolumeDataBase::SetCount(int i) {
+	if (i == count)
+		return;
+	Detach();
+	weights.SetCount(i);
+	Sync();
+}
+
+void VolumeDataBase::SetCount(int i, double d) {
+	if (i == count)
+		return;
+	Detach();
+	weights.SetCount(i, (Real)d);
+	Sync();
+}
+
+void VolumeDataBase::SetView(Real* data, int count) {
+	weights.Clear();
+	this->data = data;
+	this->count = count;
+}
+
+void VolumeDataBase::Detach() {
+	if (!IsView())
+		return;
+	weights.SetCount(count);
+	memcpy(weights.Begin(), data, count * sizeof(Real));
+	Sync();
+}
+
+void VolumeDataBase::Assign(const VolumeDataBase& src) {
+	SetCount(src.count);
+	if (count)
+		memcpy(data, src.data, count * sizeof(Real));
+}
+
+void VolumeDataBase::Swap(VolumeDataBase& b) {
+	Upp::Swap(weights, b.weights);
+	Upp::Swap(data, b.data);
+	Upp::Swap(count, b.count);
+}
+
 Volume::Volume() {
 	width = 0;
 	height = 0;
@@ -116,7 +165,7 @@ int Volume::GetMaxColumn() const {
 int Volume::GetSampledColumn() const {
 	// sample argmax from w, assuming w are
 	// probabilities that sum to one
-	double r = Randomf();
+	double r = GetRng().Getf();
 	double x = 0.0;
 	for(int i = 0; i < weights->GetCount(); i++) {
 		x += weights->Get(i);
@@ -143,19 +192,17 @@ Volume& Volume::operator=(const Volume& src) {
 	if (owned_weights) {
 		ASSERT(weights);
 		ASSERT(src.weights);
-		weights->weights <<= src.weights->weights;
+		weights->Assign(*src.weights);
 	} else {
 		if (src.owned_weights) {
 			owned_weights = true;
-			this->weights = new VolumeDataBase(src.weights->GetCount());
-			weights->weights <<= src.weights->weights;
+			this->weights = new VolumeDataBase();
+			weights->Assign(*src.weights);
 		} else{
 			weights = src.weights;
 		}
 	}
-	weight_gradients.SetCount(src.weight_gradients.GetCount());
-	for(int i = 0; i < weight_gradients.GetCount(); i++)
-		weight_gradients[i] = src.weight_gradients[i];
+	weight_gradients.Assign(src.weight_gradients);
 	return *this;
 }
 
@@ -177,11 +224,10 @@ Volume& Volume::Init(int width, int height, int depth) {
 	weights->SetCount(n, 0.0);
 	weight_gradients.SetCount(n, 0.0);
 	
-	RandomGaussian& rand = GetRandomGaussian(length);
-
-	for (int i = 0; i < n; i++) {
-		weights->Set(i, rand);
-	}
+	// weight normalization is done to equalize the output
+	// variance of every neuron, otherwise neurons with a lot
+	// of incoming connections have outputs of larger variance
+	GetRng().FillGaussian(weights->Begin(), n, 0, sqrt(1.0 / (double)n));
 	
 	return *this;
 }
@@ -241,6 +287,41 @@ Volume& Volume::Init(int width, int height, int depth, const Vector<double>& w)
 	return *this;
 }
 
+Volume& Volume::InitView(int width, int height, int depth, Real* w, Real* dw) {
+	ASSERT(width > 0 && height > 0 && depth > 0);
+	if (!owned_weights) {
+		owned_weights = true;
+		weights = new VolumeDataBase();
+	}
+	
+	this->width = width;
+	this->height = height;
+	this->depth = depth;
+	length = width * height * depth;
+	
+	weights->SetView(w, length);
+	weight_gradients.SetView(dw, length);
+	
+	return *this;
+}
+
+Volume& Volume::InitShape(int width, int height, int depth) {
+	if (!owned_weights) {
+		owned_weights = true;
+		weights = new VolumeDataBase();
+	}
+	
+	this->width = width;
+	this->height = height;
+	this->depth = depth;
+	length = width * height * depth;
+	
+	weights->Clear();
+	weight_gradients.Clear();
+	
+	return *this;
+}
+
 int Volume::GetPos(int x, int y, int d) const {
 	ASSERT(x >= 0 && y >= 0 && d >= 0 && x < width && y < height && d < depth);
 	return ((width * y) + x) * depth + d;
@@ -349,11 +430,15 @@ void Volume::Set(int i, double v) {
 #define LOADVARDEF(field, json, def) {Value tmp = map.GetValue(map.Find(#json)); if (tmp.IsNull()) this->field = def; else this->field = tmp;}
 #define LOADVARDEF_(field, def) {Value tmp = map.GetValue(map.Find(#field)); if (tmp.IsNull()) this->field = def; else this->field = tmp;}
 
-void Volume::Store(ValueMap& map) const {
+void Volume::Store(ValueMap& map, bool values) const {
 	STOREVAR(sx, width);
 	STOREVAR(sy, height);
 	STOREVAR(depth, depth);
 	
+	// without the values, Load gives only the shape
+	if (!values)
+		return;
+	
 	Value w;
 	for(int i = 0; i < weights->GetCount(); i++) {
 		double value = weights->Get(i);
@@ -378,14 +463,21 @@ void Volume::Load(const ValueMap& map) {
 	
 	length = width * height * depth;
 	
+	// Binary model files store the weights separately, so their descriptors have
+	// only the shape. The memory comes from the Net (see Session::LoadModelLayers).
+	int j = map.Find("w");
+	if (j == -1) {
+		InitShape(width, height, depth);
+		return;
+	}
+	
 	weights->SetCount(0);
 	weights->SetCount(length, 0);
 	weight_gradients.SetCount(0);
 	weight_gradients.SetCount(length, 0);
 	
-	// copy over the elements.
-	Value w = map.GetValue(map.Find("w"));
-	
+	// copy over the elements
+	Value w = map.GetValue(j);
 	for (int i = 0; i < length; i++) {
 		double value = w[i];
 		weights->Set(i, value);
@@ -405,42 +497,77 @@ void Volume::Augment(int crop, int dx, int dy, bool fliplr) {
 	ASSERT(owned_weights);
 	
 	// note assumes square outputs of size crop x crop
-	if (dx == -1) dx = Random(width - crop);
-	if (dy == -1) dy = Random(height - crop);
+	if (dx == -1) dx = GetRng().Get(width - crop);
+	if (dy == -1) dy = GetRng().Get(height - crop);
 	
-	// randomly sample a crop in the input volume
+	// randomly sample a crop in the input volume. The crop is copied through a buffer
+	// of the thread, so that the volume keeps its memory and nothing is allocated.
 	if (crop != width || dx != 0 || dy != 0) {
-		Volume W;
-		W.Init(crop, crop, depth, 0.0);
+		thread_local Vector<Real> tmp;
+		tmp.SetCount(crop * crop * depth);
 		for (int x = 0; x < crop; x++) {
 			for (int y = 0; y < crop; y++) {
-				if (x+dx < 0 || x+dx >= width || y+dy < 0 || y+dy >= height)
-					continue; // oob
+				bool oob = x+dx < 0 || x+dx >= width || y+dy < 0 || y+dy >= height;
+				Real* dst = tmp.Begin() + ((crop * y) + x) * depth;
 				for (int d = 0; d < depth; d++) {
-					W.Set(x, y, d, Get(x+dx, y+dy, d)); // copy data over
+					dst[d] = oob ? 0 : (Real)Get(x+dx, y+dy, d); // copy data over
 				}
 			}
 		}
-		SwapData(W);
+		Init(crop, crop, depth, 0.0);
+		memcpy(Begin(), tmp.Begin(), tmp.GetCount() * sizeof(Real));
 	}
 	
 	if (fliplr) {
-		// flip volume horziontally
-		Volume vol;
-		vol.Init(width, height, depth, 0.0);
-		for (int x = 0; x < width; x++) {
+		// flip volume horziontally, in place
+		for (int x = 0; x < width / 2; x++) {
 			for (int y = 0; y < height; y++) {
 				for (int d = 0; d < depth; d++) {
-					vol.Set(x, y, d, Get(width - x - 1, y, d)); // copy data over
+					double a = Get(x, y, d);
+					Set(x, y, d, Get(width - x - 1, y, d));
+					Set(width - x - 1, y, d, a);
 				}
 			}
 		}
-		SwapData(vol);
 	}
 }
 
+void Volume::Relocate(Real* w, Real* dw) {
+	ASSERT(owned_weights);
+	if (!weights->GetCount() && !weight_gradients.GetCount()) {
+		memset(w, 0, length * sizeof(Real));
+		memset(dw, 0, length * sizeof(Real));
+		weights->SetView(w, length);
+		weight_gradients.SetView(dw, length);
+		return;
+	}
+	ASSERT(weights->GetCount() == length && weight_gradients.GetCount() == length);
+	if (weights->Begin() != w) {
+		memmove(w, weights->Begin(), length * sizeof(Real));
+		weights->SetView(w, length);
+	}
+	if (weight_gradients.Begin() != dw) {
+		memmove(dw, weight_gradients.Begin(), length * sizeof(Real));
+		weight_gradients.SetView(dw, length);
+	}
+}
+
+void Volume::Clear() {
+	// also drops the views
+	if (!owned_weights) {
+		owned_weights = true;
+		weights = new VolumeDataBase();
+	}
+	weights->Clear();
+	weight_gradients.Clear();
+	width = 0;
+	height = 0;
+	depth = 0;
+	length = 0;
+}
+
 void Volume::SwapData(Volume& vol) {
-	Swap(vol.weight_gradients, weight_gradients);
+	vol.weight_gradients.Swap(weight_gradients);
 	Swap(vol.weights, weights);
 	Swap(vol.owned_weights, owned_weights);
 	Swap(vol.width, width);
@@ -454,6 +581,90 @@ void Volume::SwapData(Volume& vol) {
 
 
 
+VolumeBatch::VolumeBatch() {
+	width = 0;
+	height = 0;
+	depth = 0;
+	length = 0;
+	count = 0;
+}
+
+VolumeBatch& VolumeBatch::Init(int width, int height, int depth, int count, double default_value) {
+	ASSERT(width > 0 && height > 0 && depth > 0 && count > 0);
+	this->width = width;
+	this->height = height;
+	this->depth = depth;
+	this->count = count;
+	
+	length = width * height * depth;
+	
+	int n = length * count;
+	weights.SetCount(n);
+	weight_gradients.SetCount(n);
+	
+	for (int i = 0; i < n; i++) {
+		weights[i] = (Real)default_value;
+		weight_gradients[i] = 0.0;
+	}
+	
+	return *this;
+}
+
+VolumeBatch& VolumeBatch::operator=(const VolumeBatch& src) {
+	width = src.width;
+	height = src.height;
+	depth = src.depth;
+	length = src.length;
+	count = src.count;
+	
+	int n = length * count;
+	weights.SetCount(n);
+	weight_gradients.SetCount(n);
+	for(int i = 0; i < n; i++) {
+		weights[i] = src.weights[i];
+		weight_gradients[i] = src.weight_gradients[i];
+	}
+	return *this;
+}
+
+void VolumeBatch::SetSample(int i, const VolumeDataBase& data) {
+	ASSERT(i >= 0 && i < count && data.GetCount() == length);
+	Real* dst = Begin(i);
+	for(int j = 0; j < length; j++)
+		dst[j] = data.Get(j);
+}
+
+void VolumeBatch::SetSample(int i, const Volume& vol) {
+	ASSERT(i >= 0 && i < count && vol.GetLength() == length);
+	Real* dst = Begin(i);
+	for(int j = 0; j < length; j++)
+		dst[j] = vol.Get(j);
+}
+
+void VolumeBatch::GetSample(int i, Volume& vol) const {
+	ASSERT(i >= 0 && i < count);
+	vol.Init(width, height, depth, 0.0);
+	const Real* src = Begin(i);
+	for(int j = 0; j < length; j++)
+		vol.Set(j, src[j]);
+}
+
+void VolumeBatch::ZeroGradients() {
+	for(int i = 0; i < weight_gradients.GetCount(); i++)
+		weight_gradients[i] = 0.0;
+}
+
+int VolumeBatch::GetMaxColumn(int i) const {
+	const Real* w = Begin(i);
+	int pos = 0;
+	for(int j = 1; j < length; j++)
+		if (w[j] > w[pos])
+			pos = j;
+	return pos;
+}
+
+
+
 
 
 void RandomPermutation(int n, Vector<int>& array) {
@@ -466,7 +677,7 @@ void RandomPermutation(int n, Vector<int>& array) {
 		array[q] = q;
 	
 	while (i--) {
-		j = floor(Randomf() * (i+1));
+		j = GetRng().Get(i + 1);
 		int temp = array[i];
 		array[i] = array[j];
 		array[j] = temp;
@@ -0,0 +1,231 @@
+#include "ConvNetBench.h"
+#include <chrono>
+
+namespace ConvNet {
+
+// the settings of the trainers, which are the same in all benchmarks
+static const double bench_learning_rate = 0.01;
+static const int bench_batch_size = 8;
+static const double bench_l2_decay = 0.001;
+
+const Vector<String>& GetBenchmarkTrainers() {
+	static Vector<String> v = Split("sgd,sgd_momentum,adagrad,windowgrad,adadelta,nesterov", ',');
+	return v;
+}
+
+TrainerBase* CreateBenchmarkTrainer(const String& name, Net& net) {
+	TrainerBase* t;
+	if (name == "sgd") {
+		t = new SgdTrainer(net);
+		t->SetLearningRate(10 * bench_learning_rate);
+		t->SetMomentum(0.0);
+	}
+	else if (name == "sgd_momentum") {
+		t = new SgdTrainer(net);
+		t->SetLearningRate(bench_learning_rate);
+		t->SetMomentum(0.9);
+	}
+	else if (name == "adagrad") {
+		t = new AdagradTrainer(net);
+		t->SetLearningRate(bench_learning_rate);
+		t->SetEps(1e-6);
+	}
+	else if (name == "windowgrad") {
+		t = new WindowgradTrainer(net);
+		t->SetLearningRate(bench_learning_rate);
+		t->SetEps(1e-6);
+		t->SetRo(0.95);
+	}
+	else if (name == "adadelta") {
+		t = new AdadeltaTrainer(net);
+		t->SetLearningRate(1.0);
+		t->SetEps(1e-6);
+		t->SetRo(0.95);
+	}
+	else if (name == "nesterov") {
+		t = new NetsterovTrainer(net);
+		t->SetLearningRate(bench_learning_rate);
+		t->SetMomentum(0.9);
+	}
+	else
+		return NULL;
+	t->SetBatchSize(bench_batch_size);
+	t->SetL2Decay(bench_l2_decay);
+	return t;
+}
+
+// TimeStop has millisecond resolution, which is too coarse for single samples
+static double Seconds() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TrainerBench::TrainerBench() {
+	trainers <<= GetBenchmarkTrainers();
+	steps = 10000;
+	interval = 100;
+	threads = 1;
+	seed = 1;
+}
+
+void TrainerBench::RunTrainer(int i, const String& net_json, SessionData& d, BenchmarkResult& r) {
+	// the same seed for the same trainer with any thread count
+	GetRng().Seed(seed + i + 1);
+	
+	Worker& w = workers[i];
+	Net& net = w.ses.GetNetwork();
+	w.ses.MakeLayers(net_json);
+	w.ses.AttachTrainer(CreateBenchmarkTrainer(trainers[i], net));
+	TrainerBase& trainer = *w.ses.GetTrainer();
+	
+	r.name = trainers[i];
+	w.vec.SetCount(1);
+	w.vec[0] = &w.in;
+	
+	double loss = 0, train_acc = 0, test_acc = 0;
+	int count = 0;
+	double begin = Seconds();
+	for(int step = 1; step <= steps; step++) {
+		{
+			int id = step % d.GetDataCount();
+			w.in.Init(d.GetDataWidth(), d.GetDataHeight(), d.GetDataDepth(), 0);
+			w.in.SetData(d.Get(id));
+			int label = d.GetLabel(id);
+			
+			double t0 = Seconds();
+			trainer.Forward(w.vec);
+			double t1 = Seconds();
+			trainer.Backward(label, 1.0);
+			double t2 = Seconds();
+			trainer.TrainImplem();
+			double t3 = Seconds();
+			r.forward += t1 - t0;
+			r.backward += t2 - t1;
+			r.update += t3 - t2;
+			
+			loss += trainer.GetLoss();
+			train_acc += net.GetPrediction() == label ? 1.0 : 0.0;
+		}
+		
+		if (d.GetTestCount()) {
+			int id = step % d.GetTestCount();
+			w.in.Init(d.GetDataWidth(), d.GetDataHeight(), d.GetDataDepth(), 0);
+			w.in.SetData(d.GetTest(id));
+			
+			double t0 = Seconds();
+			net.Forward(w.in);
+			r.test += Seconds() - t0;
+			test_acc += net.GetPrediction() == d.GetTestLabel(id) ? 1.0 : 0.0;
+		}
+		
+		count++;
+		if (count == interval || step == steps) {
+			BenchmarkPoint& p = r.curve.Add();
+			p.step = step;
+			p.seconds = Seconds() - begin;
+			p.loss = loss / count;
+			p.train_accuracy = train_acc / count;
+			p.test_accuracy = d.GetTestCount() ? test_acc / count : 0;
+			loss = train_acc = test_acc = 0;
+			count = 0;
+		}
+	}
+	r.samples = steps;
+	r.seconds = Seconds() - begin;
+}
+
+bool TrainerBench::Run(const String& net_json, SessionData& d, Array<BenchmarkResult>& results, String& error) {
+	results.Clear();
+	if (d.GetDataCount() == 0 || d.IsStreaming()) {
+		error = "The benchmark needs the whole dataset in memory";
+		return false;
+	}
+	for(int i = 0; i < trainers.GetCount(); i++) {
+		if (FindIndex(GetBenchmarkTrainers(), trainers[i]) < 0) {
+			error = "Unknown trainer " + trainers[i];
+			return false;
+		}
+	}
+	{
+		Session ses;
+		if (!ses.MakeLayers(net_json)) {
+			error = "Invalid network json";
+			return false;
+		}
+		if (ses.GetTrainer()) {
+			error = "The network json must not have a trainer";
+			return false;
+		}
+	}
+	
+	int n = trainers.GetCount();
+	workers.Clear();
+	workers.SetCount(n);
+	results.SetCount(n);
+	
+	if (threads <= 1) {
+		for(int i = 0; i < n; i++)
+			RunTrainer(i, net_json, d, results[i]);
+	}
+	else {
+		// the workers take the next trainer until all have been run
+		std::atomic<int> next(0);
+		CoWork co;
+		for(int t = 0; t < min(threads, n); t++) {
+			co & [&] {
+				for (int i = next++; i < n; i = next++)
+					RunTrainer(i, net_json, d, results[i]);
+			};
+		}
+		co.Finish();
+	}
+	workers.Clear();
+	return true;
+}
+
+String StoreBenchmarkJSON(const Array<BenchmarkResult>& results, const ValueMap& info) {
+	ValueArray trainers;
+	for(int i = 0; i < results.GetCount(); i++) {
+		const BenchmarkResult& r = results[i];
+		ValueMap t;
+		t.Add("name", r.name);
+		t.Add("samples", r.samples);
+		t.Add("seconds", r.seconds);
+		t.Add("samples_per_second", r.GetSamplesPerSecond());
+		t.Add("forward_seconds", r.forward);
+		t.Add("backward_seconds", r.backward);
+		t.Add("update_seconds", r.update);
+		t.Add("test_seconds", r.test);
+		ValueArray curve;
+		for(int j = 0; j < r.curve.GetCount(); j++) {
+			const BenchmarkPoint& p = r.curve[j];
+			ValueMap m;
+			m.Add("step", p.step);
+			m.Add("seconds", p.seconds);
+			m.Add("loss", p.loss);
+			m.Add("train_accuracy", p.train_accuracy);
+			m.Add("test_accuracy", p.test_accuracy);
+			curve.Add(m);
+		}
+		t.Add("curve", curve);
+		trainers.Add(t);
+	}
+	ValueMap root = info;
+	root.Add("trainers", trainers);
+	return AsJSON(root, true);
+}
+
+String StoreBenchmarkCSV(const Array<BenchmarkResult>& results) {
+	String out = "trainer,step,seconds,loss,train_accuracy,test_accuracy\n";
+	for(int i = 0; i < results.GetCount(); i++) {
+		const BenchmarkResult& r = results[i];
+		for(int j = 0; j < r.curve.GetCount(); j++) {
+			const BenchmarkPoint& p = r.curve[j];
+			out << r.name << ',' << p.step << ',' << FormatDouble(p.seconds, 6) << ','
+				<< FormatDouble(p.loss, 6) << ',' << FormatDouble(p.train_accuracy, 6) << ','
+				<< FormatDouble(p.test_accuracy, 6) << '\n';
+		}
+	}
+	return out;
+}
+
+}
@@ -0,0 +1,70 @@
+#ifndef _ConvNetBench_ConvNetBench_h_
+#define _ConvNetBench_ConvNetBench_h_
+
+#include <ConvNet/ConvNet.h>
+
+namespace ConvNet {
+
+// Loads the dataset of the spec to d without a GUI. The spec is one of
+//   mnist:dir    the four MNIST idx files, with or without the .bin extension
+//   cifar10:dir  data_batch_1.bin ... data_batch_5.bin and test_batch.bin
+//   csv:file     numeric columns and the class label in the last column. A header row is
+//                skipped, and every tenth row is a test sample.
+bool LoadBenchmarkData(SessionData& d, const String& spec, String& error);
+
+// The trainers of the TrainerBenchmark example, by name: sgd, sgd_momentum, adagrad,
+// windowgrad, adadelta and nesterov. Returns NULL for an unknown name.
+TrainerBase* CreateBenchmarkTrainer(const String& name, Net& net);
+const Vector<String>& GetBenchmarkTrainers();
+
+struct BenchmarkPoint : Moveable<BenchmarkPoint> {
+	int step;
+	double seconds, loss, train_accuracy, test_accuracy;
+};
+
+struct BenchmarkResult {
+	String name;
+	int64 samples;
+	double seconds;
+	double forward, backward, update, test; // seconds in each phase
+	Vector<BenchmarkPoint> curve;
+	
+	BenchmarkResult() : samples(0), seconds(0), forward(0), backward(0), update(0), test(0) {}
+	double GetSamplesPerSecond() const {return seconds > 0 ? samples / seconds : 0;}
+};
+
+// Trains one session for every trainer for a fixed number of steps, like MetaSession::Step
+// does: one training sample and one test sample per step, in the order of the data. The
+// phases are timed separately, and the averages of the loss and accuracies are recorded
+// every interval steps. With more than one thread, the trainers run in parallel, and
+// every thread has its own generator seeded from seed, so the runs are reproducible.
+class TrainerBench {
+	
+	struct Worker {
+		Session ses;
+		Volume in;
+		Vector<VolumePtr> vec;
+	};
+	
+	Array<Worker> workers;
+	
+	void RunTrainer(int i, const String& net_json, SessionData& d, BenchmarkResult& r);
+	
+public:
+	typedef TrainerBench CLASSNAME;
+	TrainerBench();
+	
+	Vector<String> trainers;
+	int steps, interval, threads;
+	uint64 seed;
+	
+	bool Run(const String& net_json, SessionData& d, Array<BenchmarkResult>& results, String& error);
+	
+};
+
+String StoreBenchmarkJSON(const Array<BenchmarkResult>& results, const ValueMap& info);
+String StoreBenchmarkCSV(const Array<BenchmarkResult>& results);
+
+}
+
+#endif
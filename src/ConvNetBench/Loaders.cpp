@@ -0,0 +1,199 @@
+#include "ConvNetBench.h"
+
+namespace ConvNet {
+
+static String FindDataFile(const String& dir, const String& name) {
+	String path = AppendFileName(dir, name);
+	if (FileExists(path))
+		return path;
+	if (FileExists(path + ".bin"))
+		return path + ".bin";
+	return Null;
+}
+
+static bool ReadBigEndian32(Stream& in, int& v) {
+	byte b[4];
+	if (in.Get(b, 4) != 4)
+		return false;
+	v = (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+	return true;
+}
+
+static bool LoadMNIST(SessionData& d, const String& dir, String& error) {
+	d.BeginData(10, 60000, 28, 28, 1, 10000);
+	for(int i = 0; i < 10; i++)
+		d.SetClass(i, IntStr(i));
+	
+	const char* files[] = {"train-images.idx3-ubyte", "train-labels.idx1-ubyte", "t10k-images.idx3-ubyte", "t10k-labels.idx1-ubyte"};
+	for(int i = 0; i < 4; i++) {
+		bool main = i < 2;
+		bool labels = i % 2;
+		String path = FindDataFile(dir, files[i]);
+		FileIn in(path);
+		if (path.IsEmpty() || !in) {
+			error = "MNIST file " + String(files[i]) + " was not found in " + dir;
+			return false;
+		}
+		
+		int magic, items, rows = 1, cols = 1;
+		if (!ReadBigEndian32(in, magic) || !ReadBigEndian32(in, items) ||
+			magic != (labels ? 0x00000801 : 0x00000803) || items != (main ? 60000 : 10000) ||
+			(!labels && (!ReadBigEndian32(in, rows) || !ReadBigEndian32(in, cols) || rows != 28 || cols != 28))) {
+			error = "Invalid MNIST file " + path;
+			return false;
+		}
+		
+		int len = rows * cols;
+		Buffer<byte> buf(len);
+		for(int j = 0; j < items; j++) {
+			if (in.Get(buf, len) != len) {
+				error = "Unexpected end of " + path;
+				return false;
+			}
+			if (labels) {
+				if (main)
+					d.SetLabel(j, buf[0]);
+				else
+					d.SetTestLabel(j, buf[0]);
+			}
+			else {
+				VolumeDataBase& out = main ? d.Get(j) : d.GetTest(j);
+				for(int p = 0; p < len; p++)
+					out.Set(p, buf[p] / 255.0);
+			}
+		}
+	}
+	
+	d.EndData();
+	return true;
+}
+
+static bool LoadCIFAR10(SessionData& d, const String& dir, String& error) {
+	d.BeginData(10, 50000, 32, 32, 3, 10000);
+	const char* classes[] = {"airplane", "automobile", "bird", "cat", "deer", "dog", "frog", "horse", "ship", "truck"};
+	for(int i = 0; i < 10; i++)
+		d.SetClass(i, classes[i]);
+	
+	// the rows are the label and the red, green and blue planes of 32x32 pixels
+	int len = 32 * 32 * 3;
+	Buffer<byte> buf(1 + len);
+	for(int i = 0; i < 6; i++) {
+		bool main = i < 5;
+		String name = main ? "data_batch_" + IntStr(i + 1) + ".bin" : "test_batch.bin";
+		String path = AppendFileName(dir, name);
+		FileIn in(path);
+		if (!in) {
+			error = "CIFAR-10 file " + name + " was not found in " + dir;
+			return false;
+		}
+		
+		int base = main ? i * 10000 : 0;
+		for(int j = 0; j < 10000; j++) {
+			if (in.Get(buf, 1 + len) != 1 + len || buf[0] >= 10) {
+				error = "Invalid CIFAR-10 file " + path;
+				return false;
+			}
+			if (main)
+				d.SetLabel(base + j, buf[0]);
+			else
+				d.SetTestLabel(base + j, buf[0]);
+			
+			VolumeDataBase& out = main ? d.Get(base + j) : d.GetTest(base + j);
+			const byte* pixel = ~buf + 1;
+			for (int clr = 0; clr < 3; clr++)
+				for (int y = 0; y < 32; y++)
+					for (int x = 0; x < 32; x++)
+						out.Set((32 * y + x) * 3 + clr, *pixel++ / 255.0);
+		}
+	}
+	
+	d.EndData();
+	return true;
+}
+
+static bool LoadCSV(SessionData& d, const String& file, String& error) {
+	FileIn in(file);
+	if (!in) {
+		error = "Opening " + file + " failed";
+		return false;
+	}
+	
+	Vector<Vector<double> > rows;
+	int cols = -1, classes = 0, line_num = 0;
+	while (!in.IsEof()) {
+		String line = TrimBoth(in.GetLine());
+		line_num++;
+		if (line.IsEmpty())
+			continue;
+		Vector<String> v = Split(line, ',', false);
+		if (rows.IsEmpty() && cols < 0 && IsNull(ScanDouble(TrimBoth(v[0])))) {
+			cols = v.GetCount(); // header
+			continue;
+		}
+		if (cols < 0)
+			cols = v.GetCount();
+		if (v.GetCount() != cols || cols < 2) {
+			error = Format("Invalid column count on line %d of %s", line_num, file);
+			return false;
+		}
+		Vector<double>& row = rows.Add();
+		for(int i = 0; i < cols; i++) {
+			double value = ScanDouble(TrimBoth(v[i]));
+			if (IsNull(value)) {
+				error = Format("Invalid number on line %d of %s", line_num, file);
+				return false;
+			}
+			row.Add(value);
+		}
+		int label = (int)row.Top();
+		if (label < 0 || label != row.Top()) {
+			error = Format("Invalid class label on line %d of %s", line_num, file);
+			return false;
+		}
+		classes = max(classes, label + 1);
+	}
+	if (rows.IsEmpty()) {
+		error = "No data in " + file;
+		return false;
+	}
+	
+	int test_count = rows.GetCount() / 10;
+	int columns = cols - 1;
+	d.BeginData(classes, rows.GetCount() - test_count, columns, test_count);
+	for(int i = 0; i < classes; i++)
+		d.SetClass(i, IntStr(i));
+	int train = 0, test = 0;
+	for(int i = 0; i < rows.GetCount(); i++) {
+		const Vector<double>& row = rows[i];
+		bool is_test = i % 10 == 9 && test < test_count;
+		for(int j = 0; j < columns; j++) {
+			if (is_test)
+				d.SetTestData(test, j, row[j]);
+			else
+				d.SetData(train, j, row[j]);
+		}
+		if (is_test)
+			d.SetTestLabel(test++, (int)row.Top());
+		else
+			d.SetLabel(train++, (int)row.Top());
+	}
+	
+	d.EndData();
+	return true;
+}
+
+bool LoadBenchmarkData(SessionData& d, const String& spec, String& error) {
+	int i = spec.Find(':');
+	String type = ToLower(spec.Left(max(0, i)));
+	String path = spec.Mid(i + 1);
+	if (type == "mnist")
+		return LoadMNIST(d, path, error);
+	if (type == "cifar10")
+		return LoadCIFAR10(d, path, error);
+	if (type == "csv")
+		return LoadCSV(d, path, error);
+	error = "Unknown dataset " + spec + ", expected mnist:dir, cifar10:dir or csv:file";
+	return false;
+}
+
+}
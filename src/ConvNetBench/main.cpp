@@ -0,0 +1,102 @@
+#include "ConvNetBench.h"
+
+using namespace ConvNet;
+
+// ConvNetBench [-steps n] [-interval n] [-threads n] [-seed n] [-trainers a,b] [-json out] [-csv out] net.json dataset
+// The net.json has the layers without a trainer, like in the TrainerBenchmark example.
+// The dataset is mnist:dir, cifar10:dir or csv:file (see LoadBenchmarkData).
+// ConvNetBench -check compares the convolution engines instead (see CheckConvEngines).
+CONSOLE_APP_MAIN {
+	const Vector<String>& cmd = CommandLine();
+	TrainerBench bench;
+	String net_file, dataset, json_out, csv_out;
+	bool check = false;
+	for(int i = 0; i < cmd.GetCount(); i++) {
+		bool has_arg = i + 1 < cmd.GetCount();
+		if (cmd[i] == "-check")
+			check = true;
+		else if (cmd[i] == "-steps" && has_arg)
+			bench.steps = max(1, StrInt(cmd[++i]));
+		else if (cmd[i] == "-interval" && has_arg)
+			bench.interval = max(1, StrInt(cmd[++i]));
+		else if (cmd[i] == "-threads" && has_arg)
+			bench.threads = max(1, StrInt(cmd[++i]));
+		else if (cmd[i] == "-seed" && has_arg)
+			bench.seed = (uint64)ScanInt64(cmd[++i]);
+		else if (cmd[i] == "-trainers" && has_arg)
+			bench.trainers = Split(cmd[++i], ',');
+		else if (cmd[i] == "-json" && has_arg)
+			json_out = cmd[++i];
+		else if (cmd[i] == "-csv" && has_arg)
+			csv_out = cmd[++i];
+		else if (net_file.IsEmpty())
+			net_file = cmd[i];
+		else
+			dataset = cmd[i];
+	}
+	if (check) {
+		SeedRng(bench.seed);
+		String error;
+		if (!CheckConvEngines(error)) {
+			Cerr() << error << "\n";
+			SetExitCode(1);
+			return;
+		}
+		Cout() << "Convolution engines match\n";
+		return;
+	}
+	if (net_file.IsEmpty() || dataset.IsEmpty()) {
+		Cerr() << "Usage: ConvNetBench [-steps n] [-interval n] [-threads n] [-seed n] [-trainers a,b] [-json out] [-csv out] net.json dataset\n"
+		          "       ConvNetBench -check\n";
+		SetExitCode(1);
+		return;
+	}
+	
+	String net_json = LoadFile(net_file);
+	if (net_json.IsEmpty()) {
+		Cerr() << "Loading " << net_file << " failed\n";
+		SetExitCode(1);
+		return;
+	}
+	
+	// the shuffle of EndData uses the generator of this thread
+	SeedRng(bench.seed);
+	SessionData d;
+	String error;
+	if (!LoadBenchmarkData(d, dataset, error)) {
+		Cerr() << error << "\n";
+		SetExitCode(1);
+		return;
+	}
+	
+	Array<BenchmarkResult> results;
+	if (!bench.Run(net_json, d, results, error)) {
+		Cerr() << error << "\n";
+		SetExitCode(1);
+		return;
+	}
+	
+	for(int i = 0; i < results.GetCount(); i++) {
+		const BenchmarkResult& r = results[i];
+		const BenchmarkPoint* last = r.curve.IsEmpty() ? NULL : &r.curve.Top();
+		Cout() << Format("%-14s %10.1f samples/s  loss %.4f  train %.3f  test %.3f\n",
+			r.name, r.GetSamplesPerSecond(),
+			last ? last->loss : 0.0, last ? last->train_accuracy : 0.0, last ? last->test_accuracy : 0.0);
+	}
+	
+	ValueMap info;
+	info.Add("net", net_file);
+	info.Add("dataset", dataset);
+	info.Add("steps", bench.steps);
+	info.Add("interval", bench.interval);
+	info.Add("threads", bench.threads);
+	info.Add("seed", (int64)bench.seed);
+	if (!json_out.IsEmpty() && !SaveFile(json_out, StoreBenchmarkJSON(results, info))) {
+		Cerr() << "Writing " << json_out << " failed\n";
+		SetExitCode(1);
+	}
+	if (!csv_out.IsEmpty() && !SaveFile(csv_out, StoreBenchmarkCSV(results))) {
+		Cerr() << "Writing " << csv_out << " failed\n";
+		SetExitCode(1);
+	}
+}
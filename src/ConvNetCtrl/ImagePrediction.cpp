@@ -45,10 +45,11 @@ void ImagePrediction::RefreshData() {
 	// grab a random test image
 	int tests = 50;
 	imgs.SetCount(tests);
+	VolumeDataBase vol;
 	for (int num = 0; num < tests; num++) {
 		
-		int i = Random(d.GetDataCount());
-		VolumeDataBase& vol = d.Get(i);
+		int i = GetRng().Get(d.GetDataCount());
+		d.Read(i, vol);
 		int label = d.GetLabel(i);
 		
 		Image& img = imgs[num];
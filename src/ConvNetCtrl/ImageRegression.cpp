@@ -50,11 +50,13 @@ void ImageRegression::RefreshData() {
 	Session& ses = *this->ses;
 	SessionData& d = ses.Data();
 	
-	Net& net = ses.GetNetwork();
-	
 	int pixel_count = d.GetDataCount();
 	if (!pixel_count) return;
 	
+	// the training continues meanwhile, so predict from a copy of the weights
+	snapshot.Update(ses);
+	const Net& net = snapshot.GetNet();
+	
 	tmp.SetCount(pixel_count*3);
 	
 	int width = img_a.GetWidth();
@@ -62,8 +64,6 @@ void ImageRegression::RefreshData() {
 	int depth = d.GetResult(0).GetCount();
 	Volume in(1, 1, depth, 0);
 	
-	ses.Enter();
-	
 	int i = 0;
 	for (int y = 0; y < height; y++) {
 		
@@ -73,7 +73,7 @@ void ImageRegression::RefreshData() {
 			
 			in.Set(0, (double)x / height - 0.5);
 			
-			Volume& out = net.Forward(in);
+			const Volume& out = net.Predict(in, ws);
 			
 			if (depth == 3) {
 				tmp[i++] = out.Get(0);
@@ -85,8 +85,6 @@ void ImageRegression::RefreshData() {
 		}
 	}
 	
-	ses.Leave();
-	
 	ImageBuffer l_ib(width, height);
 	RGBA* l_it = l_ib.Begin();
 	
@@ -13,6 +13,8 @@ class ImageRegression : public Ctrl {
 	Image img_a, img_b;
 	SpinLock lock;
 	Vector<double> tmp;
+	NetSnapshot snapshot;
+	PredictWorkspace ws;
 	TimeStop ts;
 	
 public:
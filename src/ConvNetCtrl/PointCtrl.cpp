@@ -38,14 +38,14 @@ void PointCtrl::Paint(Draw& draw) {
 	ImageDraw id(sz);
 	id.DrawRect(sz, White());
 	
-	ses.Enter();
-	Net& net = ses.GetNetwork();
-	
 	InputLayer* input = ses.GetInput();
-	if (!input) {
-		ses.Leave();
+	if (!input)
 		return;
-	}
+	
+	// the training continues meanwhile, so predict from a copy of the weights
+	snapshot.Update(ses);
+	const Net& net = snapshot.GetNet();
+	
 	int data_count = d.GetDataCount();
 	double offset = max(max(-d.GetMin(0), -d.GetMin(1)), max(d.GetMax(0), d.GetMax(1)));
 	offset *= 1.1;
@@ -74,7 +74,7 @@ void PointCtrl::Paint(Draw& draw) {
 			netx.Set(0,0,0, x);
 			netx.Set(0,0,1, y);
 			
-			Volume& a = net.Forward(netx, false);
+			const Volume& a = net.Predict(netx, ws);
 			
 			double aw0 = a.Get(0,0,0);
 			double aw1 = a.Get(0,0,1);
@@ -110,8 +110,6 @@ void PointCtrl::Paint(Draw& draw) {
 		id.DrawEllipse(x_off + scr_x - radius_2, y_off + scr_y - radius_2, radius, radius, label ? clr_a2 : clr_b2, 1, Black());
 	}
 	
-	ses.Leave();
-	
 	draw.DrawImage(0, 0, id);
 }
 
@@ -10,6 +10,8 @@ using namespace ConvNet;
 
 class PointCtrl : public Ctrl {
 	Session* ses;
+	NetSnapshot snapshot;
+	PredictWorkspace ws;
 	int vis_len, offset;
 	
 public:
@@ -0,0 +1,20 @@
+#ifndef _ConvNetGen_ConvNetGen_h_
+#define _ConvNetGen_ConvNetGen_h_
+
+#include <ConvNet/ConvNet.h>
+
+namespace ConvNet {
+
+// Writes a self-contained C++ header for the inference of the net. The shapes of the
+// layers are template parameters of the kernels, and the weights are constexpr arrays,
+// so the generated code doesn't allocate, dispatch or parse anything at runtime. The
+// header needs only <math.h>, and many models can be included in the same program,
+// because every model has its own namespace.
+//
+// Supported layers: input, conv, fc, pool, relu, tanh, sigmoid, maxout, dropout,
+// softmax, regression and svm. Throws ArgumentException for the others.
+String GenerateHeader(const Net& net, const String& name, bool double_precision=false);
+
+}
+
+#endif
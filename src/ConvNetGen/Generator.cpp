@@ -0,0 +1,311 @@
+#include "ConvNetGen.h"
+
+namespace ConvNet {
+
+// The kernels of the generated headers. They are the same for every model, so they are
+// guarded by a macro of their own. The loops have constant bounds, which the compiler
+// unrolls and vectorizes for the shapes of the model.
+static const char* kernels =
+	"#ifndef CONVNET_GEN_KERNELS\n"
+	"#define CONVNET_GEN_KERNELS\n"
+	"\n"
+	"namespace ConvNetGen {\n"
+	"\n"
+	"enum {ACT_NONE, ACT_RELU, ACT_TANH, ACT_SIGMOID};\n"
+	"\n"
+	"template <class T, int ACT>\n"
+	"inline T Activate(T v) {\n"
+	"\tif (ACT == ACT_RELU) return v > 0 ? v : 0;\n"
+	"\tif (ACT == ACT_TANH) return (T)tanh(v);\n"
+	"\tif (ACT == ACT_SIGMOID) return (T)(1.0 / (1.0 + exp(-v)));\n"
+	"\treturn v;\n"
+	"}\n"
+	"\n"
+	"// Volumes are W x H x D, and the values of one position are consecutive.\n"
+	"// Every filter has FW * FH * D weights in the same order.\n"
+	"template <class T, int W, int H, int D, int FW, int FH, int N, int STRIDE, int PAD, int OW, int OH, int ACT>\n"
+	"inline void Conv(const T* in, const T* w, const T* b, T* out) {\n"
+	"\tfor (int ay = 0; ay < OH; ay++) {\n"
+	"\t\tfor (int ax = 0; ax < OW; ax++) {\n"
+	"\t\t\tconst int x0 = ax * STRIDE - PAD, y0 = ay * STRIDE - PAD;\n"
+	"\t\t\tT* o = out + (ay * OW + ax) * N;\n"
+	"\t\t\tfor (int f = 0; f < N; f++) {\n"
+	"\t\t\t\tconst T* wf = w + f * FW * FH * D;\n"
+	"\t\t\t\tT a = b[f];\n"
+	"\t\t\t\tfor (int fy = 0; fy < FH; fy++) {\n"
+	"\t\t\t\t\tconst int y = y0 + fy;\n"
+	"\t\t\t\t\tif (y < 0 || y >= H) continue;\n"
+	"\t\t\t\t\tfor (int fx = 0; fx < FW; fx++) {\n"
+	"\t\t\t\t\t\tconst int x = x0 + fx;\n"
+	"\t\t\t\t\t\tif (x < 0 || x >= W) continue;\n"
+	"\t\t\t\t\t\tconst T* v = in + (y * W + x) * D;\n"
+	"\t\t\t\t\t\tconst T* wv = wf + (fy * FW + fx) * D;\n"
+	"\t\t\t\t\t\tfor (int d = 0; d < D; d++)\n"
+	"\t\t\t\t\t\t\ta += v[d] * wv[d];\n"
+	"\t\t\t\t\t}\n"
+	"\t\t\t\t}\n"
+	"\t\t\t\to[f] = Activate<T, ACT>(a);\n"
+	"\t\t\t}\n"
+	"\t\t}\n"
+	"\t}\n"
+	"}\n"
+	"\n"
+	"template <class T, int K, int N, int ACT>\n"
+	"inline void FullyConn(const T* in, const T* w, const T* b, T* out) {\n"
+	"\tfor (int i = 0; i < N; i++) {\n"
+	"\t\tconst T* wi = w + i * K;\n"
+	"\t\tT a = b[i];\n"
+	"\t\tfor (int k = 0; k < K; k++)\n"
+	"\t\t\ta += in[k] * wi[k];\n"
+	"\t\tout[i] = Activate<T, ACT>(a);\n"
+	"\t}\n"
+	"}\n"
+	"\n"
+	"template <class T, int W, int H, int D, int FW, int FH, int STRIDE, int PAD, int OW, int OH>\n"
+	"inline void MaxPool(const T* in, T* out) {\n"
+	"\tfor (int ay = 0; ay < OH; ay++) {\n"
+	"\t\tfor (int ax = 0; ax < OW; ax++) {\n"
+	"\t\t\tconst int x0 = ax * STRIDE - PAD, y0 = ay * STRIDE - PAD;\n"
+	"\t\t\tT* o = out + (ay * OW + ax) * D;\n"
+	"\t\t\tfor (int d = 0; d < D; d++) {\n"
+	"\t\t\t\tT a = -1e30f;\n"
+	"\t\t\t\tfor (int fy = y0 < 0 ? -y0 : 0; fy < FH && y0 + fy < H; fy++)\n"
+	"\t\t\t\t\tfor (int fx = x0 < 0 ? -x0 : 0; fx < FW && x0 + fx < W; fx++) {\n"
+	"\t\t\t\t\t\tconst T v = in[((y0 + fy) * W + x0 + fx) * D + d];\n"
+	"\t\t\t\t\t\tif (v > a) a = v;\n"
+	"\t\t\t\t\t}\n"
+	"\t\t\t\to[d] = a;\n"
+	"\t\t\t}\n"
+	"\t\t}\n"
+	"\t}\n"
+	"}\n"
+	"\n"
+	"template <class T, int W, int H, int D, int OD, int G>\n"
+	"inline void Maxout(const T* in, T* out) {\n"
+	"\tfor (int p = 0; p < W * H; p++) {\n"
+	"\t\tconst T* a = in + p * D;\n"
+	"\t\tT* o = out + p * OD;\n"
+	"\t\tfor (int i = 0; i < OD; i++) {\n"
+	"\t\t\tT m = a[i * G];\n"
+	"\t\t\tfor (int j = 1; j < G; j++)\n"
+	"\t\t\t\tif (a[i * G + j] > m) m = a[i * G + j];\n"
+	"\t\t\to[i] = m;\n"
+	"\t\t}\n"
+	"\t}\n"
+	"}\n"
+	"\n"
+	"template <class T, int N, int ACT>\n"
+	"inline void Activation(const T* in, T* out) {\n"
+	"\tfor (int i = 0; i < N; i++)\n"
+	"\t\tout[i] = Activate<T, ACT>(in[i]);\n"
+	"}\n"
+	"\n"
+	"template <class T, int N>\n"
+	"inline void Scale(const T* in, T* out, T s) {\n"
+	"\tfor (int i = 0; i < N; i++)\n"
+	"\t\tout[i] = in[i] * s;\n"
+	"}\n"
+	"\n"
+	"template <class T, int N>\n"
+	"inline void Softmax(const T* in, T* out) {\n"
+	"\tT amax = in[0];\n"
+	"\tfor (int i = 1; i < N; i++)\n"
+	"\t\tif (in[i] > amax) amax = in[i];\n"
+	"\tT esum = 0;\n"
+	"\tfor (int i = 0; i < N; i++) {\n"
+	"\t\tout[i] = (T)exp(in[i] - amax);\n"
+	"\t\tesum += out[i];\n"
+	"\t}\n"
+	"\tfor (int i = 0; i < N; i++)\n"
+	"\t\tout[i] /= esum;\n"
+	"}\n"
+	"\n"
+	"}\n"
+	"\n"
+	"#endif\n";
+
+static String FormatReal(double v, bool double_precision) {
+	if (!IsFin(v))
+		throw ArgumentException("The weights of the net are not finite");
+	String s = Format(double_precision ? "%.17g" : "%.9g", v);
+	if (s.Find('.') < 0 && s.Find('e') < 0)
+		s.Cat(".0");
+	if (!double_precision)
+		s.Cat('f');
+	return s;
+}
+
+static void GenerateArray(String& out, const String& id, const Vector<Real>& values, bool double_precision) {
+	out << "alignas(32) constexpr Real " << id << "[" << values.GetCount() << "] = {";
+	for(int i = 0; i < values.GetCount(); i++) {
+		if (i % 8 == 0)
+			out << "\n\t";
+		out << FormatReal(values[i], double_precision) << ",";
+	}
+	out << "\n};\n\n";
+}
+
+static void AddVolume(Vector<Real>& dst, const Volume& src) {
+	for(int i = 0; i < src.GetLength(); i++)
+		dst.Add((Real)src.Get(i));
+}
+
+static const char* GetActivationId(int act) {
+	switch (act) {
+		case ACT_RELU: return "ConvNetGen::ACT_RELU";
+		case ACT_TANH: return "ConvNetGen::ACT_TANH";
+		case ACT_SIGMOID: return "ConvNetGen::ACT_SIGMOID";
+		default: return "ConvNetGen::ACT_NONE";
+	}
+}
+
+String GenerateHeader(const Net& net, const String& name, bool double_precision) {
+	bool valid = !name.IsEmpty() && (IsAlpha(name[0]) || name[0] == '_');
+	for(int i = 0; i < name.GetCount(); i++)
+		valid = valid && (IsAlNum(name[i]) || name[i] == '_');
+	if (!valid)
+		throw ArgumentException("The name of the model should be a C++ identifier");
+	
+	const Vector<LayerBasePtr>& layers = net.GetLayers();
+	if (layers.IsEmpty() || !dynamic_cast<const InputLayer*>(layers[0]))
+		throw ArgumentException("First layer should be an InputLayer");
+	
+	// One call of a kernel for every layer, except the activations, which are merged to
+	// the conv or fc layer before them. The calls write to the two buffers of the
+	// workspace in turns, but the elementwise layers work in place.
+	String weights, calls;
+	int w = layers[0]->output_width, h = layers[0]->output_height, d = layers[0]->output_depth;
+	int max_length = 1;
+	int buffer = -1;
+	bool pending = false; // the call of a conv or fc layer waits for its activation
+	String pending_call;
+	
+	for(int i = 1; i < layers.GetCount(); i++) {
+		const LayerBase* layer = layers[i];
+		String in = buffer < 0 ? String("input") : Format("ws.buffer[%d]", buffer);
+		int length = layer->output_width * layer->output_height * layer->output_depth;
+		
+		int act = ACT_NONE;
+		if (dynamic_cast<const ReluLayer*>(layer))
+			act = ACT_RELU;
+		else if (dynamic_cast<const TanhLayer*>(layer))
+			act = ACT_TANH;
+		else if (dynamic_cast<const SigmoidLayer*>(layer))
+			act = ACT_SIGMOID;
+		
+		if (act != ACT_NONE && pending) {
+			pending_call.Replace("ConvNetGen::ACT_NONE", GetActivationId(act));
+			calls << pending_call;
+			pending = false;
+			continue;
+		}
+		if (pending) {
+			calls << pending_call;
+			pending = false;
+		}
+		
+		bool elementwise = act != ACT_NONE || dynamic_cast<const DropOutLayer*>(layer);
+		int next = elementwise && buffer >= 0 ? buffer : buffer == 0;
+		String out = Format("ws.buffer[%d]", next);
+		String id = Format("layer%d", i);
+		
+		if (act != ACT_NONE) {
+			calls << Format("\tConvNetGen::Activation<Real, %d, %s>(%s, %s);\n",
+				length, GetActivationId(act), in, out);
+		}
+		else if (const ConvLayer* conv = dynamic_cast<const ConvLayer*>(layer)) {
+			Vector<Real> f, b;
+			for(int j = 0; j < conv->filters.GetCount(); j++)
+				AddVolume(f, conv->filters[j]);
+			AddVolume(b, conv->biases);
+			GenerateArray(weights, id + "_filters", f, double_precision);
+			GenerateArray(weights, id + "_biases", b, double_precision);
+			pending = true;
+			pending_call = Format("\tConvNetGen::Conv<Real, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %s>(%s, %s_filters, %s_biases, %s);\n",
+				w, h, d, conv->width, conv->height, layer->output_depth, conv->stride, conv->pad,
+				layer->output_width, layer->output_height, GetActivationId(ACT_NONE), in, id, id, out);
+		}
+		else if (const FullyConnLayer* fc = dynamic_cast<const FullyConnLayer*>(layer)) {
+			Vector<Real> f, b;
+			for(int j = 0; j < fc->filters.GetCount(); j++)
+				AddVolume(f, fc->filters[j]);
+			AddVolume(b, fc->biases);
+			GenerateArray(weights, id + "_filters", f, double_precision);
+			GenerateArray(weights, id + "_biases", b, double_precision);
+			pending = true;
+			pending_call = Format("\tConvNetGen::FullyConn<Real, %d, %d, %s>(%s, %s_filters, %s_biases, %s);\n",
+				w * h * d, layer->output_depth, GetActivationId(ACT_NONE), in, id, id, out);
+		}
+		else if (const PoolLayer* pool = dynamic_cast<const PoolLayer*>(layer)) {
+			calls << Format("\tConvNetGen::MaxPool<Real, %d, %d, %d, %d, %d, %d, %d, %d, %d>(%s, %s);\n",
+				w, h, d, pool->width, pool->height, pool->stride, pool->pad,
+				layer->output_width, layer->output_height, in, out);
+		}
+		else if (const MaxoutLayer* maxout = dynamic_cast<const MaxoutLayer*>(layer)) {
+			calls << Format("\tConvNetGen::Maxout<Real, %d, %d, %d, %d, %d>(%s, %s);\n",
+				w, h, d, layer->output_depth, maxout->group_size, in, out);
+		}
+		else if (const DropOutLayer* drop = dynamic_cast<const DropOutLayer*>(layer)) {
+			// the same scaling as DropOutLayer::Predict
+			calls << Format("\tConvNetGen::Scale<Real, %d>(%s, %s, %s);\n",
+				length, in, out, FormatReal(drop->drop_prob, double_precision));
+		}
+		else if (dynamic_cast<const SoftmaxLayer*>(layer)) {
+			calls << Format("\tConvNetGen::Softmax<Real, %d>(%s, %s);\n", length, in, out);
+		}
+		else if (dynamic_cast<const RegressionLayer*>(layer) || dynamic_cast<const SvmLayer*>(layer)) {
+			// the output is the input
+			continue;
+		}
+		else {
+			throw ArgumentException("ConvNetGen doesn't support the layer " + layer->GetKey());
+		}
+		
+		buffer = next;
+		max_length = max(max_length, length);
+		w = layer->output_width;
+		h = layer->output_height;
+		d = layer->output_depth;
+	}
+	if (pending)
+		calls << pending_call;
+	
+	String guard = "_" + name + "_h_";
+	String s;
+	s << "// Generated by ConvNetGen. Do not edit.\n"
+	  << "#ifndef " << guard << "\n"
+	  << "#define " << guard << "\n\n"
+	  << "#include <math.h>\n\n"
+	  << kernels << "\n"
+	  << "namespace " << name << " {\n\n"
+	  << "typedef " << (double_precision ? "double" : "float") << " Real;\n\n"
+	  << "enum {\n"
+	  << "\tinput_width = " << layers[0]->output_width << ",\n"
+	  << "\tinput_height = " << layers[0]->output_height << ",\n"
+	  << "\tinput_depth = " << layers[0]->output_depth << ",\n"
+	  << "\toutput_count = " << w * h * d << ",\n"
+	  << "\tbuffer_length = " << max_length << "\n"
+	  << "};\n\n"
+	  << weights
+	  << "// The activations of one caller of Predict\n"
+	  << "struct Workspace {\n"
+	  << "\talignas(32) Real buffer[2][buffer_length];\n"
+	  << "};\n\n"
+	  << "// Returns the output_count values of the last layer, which are in the workspace\n"
+	  << "inline const Real* Predict(const Real* input, Workspace& ws) {\n"
+	  << calls
+	  << "\treturn " << (buffer < 0 ? String("input") : Format("ws.buffer[%d]", buffer)) << ";\n"
+	  << "}\n\n"
+	  << "inline int GetPrediction(const Real* input, Workspace& ws) {\n"
+	  << "\tconst Real* out = Predict(input, ws);\n"
+	  << "\tint best = 0;\n"
+	  << "\tfor (int i = 1; i < output_count; i++)\n"
+	  << "\t\tif (out[i] > out[best]) best = i;\n"
+	  << "\treturn best;\n"
+	  << "}\n\n"
+	  << "}\n\n"
+	  << "#endif\n";
+	return s;
+}
+
+}
@@ -0,0 +1,54 @@
+#include "ConvNetGen.h"
+
+using namespace ConvNet;
+
+// ConvNetGen [-double] [-name id] model output.h
+// The model is the JSON of Session::StoreJSON, or the binary file of Session::StoreModelFile.
+CONSOLE_APP_MAIN {
+	const Vector<String>& cmd = CommandLine();
+	String model, output, name;
+	bool double_precision = false;
+	for(int i = 0; i < cmd.GetCount(); i++) {
+		if (cmd[i] == "-double")
+			double_precision = true;
+		else if (cmd[i] == "-name" && i + 1 < cmd.GetCount())
+			name = cmd[++i];
+		else if (model.IsEmpty())
+			model = cmd[i];
+		else
+			output = cmd[i];
+	}
+	if (model.IsEmpty() || output.IsEmpty()) {
+		Cerr() << "Usage: ConvNetGen [-double] [-name id] model output.h\n";
+		SetExitCode(1);
+		return;
+	}
+	if (name.IsEmpty()) {
+		// the title of the output file, as an identifier
+		name = GetFileTitle(output);
+		for(int i = 0; i < name.GetCount(); i++)
+			if (!IsAlNum(name[i]))
+				name.Set(i, '_');
+		if (name.IsEmpty() || IsDigit(name[0]))
+			name = "_" + name;
+	}
+	
+	Session ses;
+	bool loaded = ToLower(GetFileExt(model)) == ".json" ? ses.LoadJSON(LoadFile(model)) : ses.LoadModelFile(model);
+	if (!loaded) {
+		Cerr() << "Loading the model " << model << " failed\n";
+		SetExitCode(1);
+		return;
+	}
+	
+	try {
+		if (!SaveFile(output, GenerateHeader(ses.GetNetwork(), name, double_precision))) {
+			Cerr() << "Writing " << output << " failed\n";
+			SetExitCode(1);
+		}
+	}
+	catch (Exc e) {
+		Cerr() << e << "\n";
+		SetExitCode(1);
+	}
+}